@@ -0,0 +1,101 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <stdlib.h>
+#include "beid_p11.h"
+#include "p11.h"
+#include "util.h"
+#include "arena.h"
+
+//the header is padded so the data that follows it is aligned
+#define BLOCK_HEADER_SIZE (((sizeof(P11_ARENA_BLOCK) + P11_ARENA_ALIGN - 1) / P11_ARENA_ALIGN) * P11_ARENA_ALIGN)
+#define BLOCK_DATA(pBlock) ((unsigned char *) (pBlock) + BLOCK_HEADER_SIZE)
+
+//the space p11_arena_alloc() takes for len bytes
+static CK_ULONG p11_arena_size(CK_ULONG len)
+{
+	CK_ULONG size = ((len + P11_ARENA_ALIGN - 1) / P11_ARENA_ALIGN) * P11_ARENA_ALIGN;
+
+	return size == 0 ? P11_ARENA_ALIGN : size;
+}
+
+void *p11_arena_alloc(P11_ARENA *pArena, CK_ULONG len)
+{
+	P11_ARENA_BLOCK *pBlock = pArena->pBlocks;
+	CK_ULONG size = p11_arena_size(len);
+	void *p;
+
+	if ((pBlock == NULL) || (pBlock->size - pBlock->used < size))
+	{
+		if (size > P11_ARENA_BLOCK_SIZE / 4)
+		{
+			//big values (certificates, the photo) get a block of their own,
+			//so the current block can still be filled up
+			pBlock = (P11_ARENA_BLOCK *) malloc(BLOCK_HEADER_SIZE + size);
+			if (pBlock == NULL)
+				return NULL;
+			pBlock->size = size;
+			pBlock->used = size;
+			if (pArena->pBlocks == NULL)
+			{
+				pBlock->pNext = NULL;
+				pArena->pBlocks = pBlock;
+			}
+			else
+			{
+				pBlock->pNext = pArena->pBlocks->pNext;
+				pArena->pBlocks->pNext = pBlock;
+			}
+			return BLOCK_DATA(pBlock);
+		}
+		pBlock = (P11_ARENA_BLOCK *) malloc(BLOCK_HEADER_SIZE + P11_ARENA_BLOCK_SIZE);
+		if (pBlock == NULL)
+			return NULL;
+		pBlock->size = P11_ARENA_BLOCK_SIZE;
+		pBlock->used = 0;
+		pBlock->pNext = pArena->pBlocks;
+		pArena->pBlocks = pBlock;
+	}
+
+	p = BLOCK_DATA(pBlock) + pBlock->used;
+	pBlock->used += size;
+	return p;
+}
+
+int p11_arena_fits(CK_ULONG oldlen, CK_ULONG len)
+{
+	return len <= p11_arena_size(oldlen);
+}
+
+void p11_arena_release(P11_ARENA *pArena)
+{
+	P11_ARENA_BLOCK *pBlock = pArena->pBlocks;
+	P11_ARENA_BLOCK *pNext;
+
+	while (pBlock != NULL)
+	{
+		pNext = pBlock->pNext;
+		//the attributes hold the identity data of the card holder
+		memwash((char *) BLOCK_DATA(pBlock), (unsigned int) pBlock->used);
+		free(pBlock);
+		pBlock = pNext;
+	}
+	pArena->pBlocks = NULL;
+}
@@ -0,0 +1,56 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#ifndef __arena_h__
+#define __arena_h__
+
+/*
+ * Attribute storage for the objects of a slot.
+ *
+ * The attribute arrays and values of all objects of a slot are carved out
+ * of a few large blocks instead of being allocated one by one. Nothing is
+ * given back until the token goes away; then the whole arena is wiped and
+ * freed in one go by p11_arena_release(). A value that is overwritten
+ * (e.g. when an object is read from the card) is written over the old one
+ * if it fits there, and only gets new space if it is larger.
+ */
+
+#include "p11.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define P11_ARENA_BLOCK_SIZE 16384
+#define P11_ARENA_ALIGN      16
+
+	/* Returns len bytes from the arena, or NULL if out of memory */
+	void *p11_arena_alloc(P11_ARENA * pArena, CK_ULONG len);
+	/* Returns 1 if len bytes fit where p11_arena_alloc() returned space for oldlen */
+	int p11_arena_fits(CK_ULONG oldlen, CK_ULONG len);
+	/* Wipes and frees everything that was allocated from the arena */
+	void p11_arena_release(P11_ARENA * pArena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -93,4 +93,21 @@
 #define CKM_SHA512_RSA_PKCS            0x00000042
 */
 
+/************************/
+
+/* PKCS#11 v3.0 mechanisms missing from the v2.40 headers */
+
+/************************/
+
+#ifndef CKM_SHA3_256
+#define CKM_SHA3_256                   0x000002B0UL
+#define CKM_SHA3_384                   0x000002C0UL
+#define CKM_SHA3_512                   0x000002D0UL
+#endif
+#ifndef CKM_ECDSA_SHA3_256
+#define CKM_ECDSA_SHA3_256             0x00001048UL
+#define CKM_ECDSA_SHA3_384             0x00001049UL
+#define CKM_ECDSA_SHA3_512             0x0000104AUL
+#endif
+
 #endif
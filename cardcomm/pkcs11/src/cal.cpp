@@ -27,10 +27,13 @@
 #include "util.h"
 #include "cal.h"
 #include "pkcs11log.h"
+#include "objectindex.h"
+#include "arena.h"
 #include "cert.h"
 #include "mw_util.h"
 #include "tlvbuffer.h"
 #include "thread.h"
+#include "apdustats.h"
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 #include "beid_fuzz.h"
 #endif
@@ -61,6 +64,8 @@ extern "C"
 	int cal_map_status(tCardStatus calstatus);
 }
 
+static void cal_dump_apdu_stats();
+
 #ifdef PKCS11_FF
 /*
 static int gnFFReaders;
@@ -123,6 +128,8 @@ CK_RV cal_init()
 	if (gRefCount > 0)
 		return 0;
 
+	CApduStats::Init();
+
 	try
 	{
 		oCardLayer = new CCardLayer();
@@ -160,6 +167,8 @@ void cal_close()
 	//if (--gRefCount > 0)
 	//   return (0);
 
+	cal_dump_apdu_stats();
+
 	if (oCardLayer)
 		delete(oCardLayer);
 	if (oReadersInfo)
@@ -199,6 +208,8 @@ void cal_clean_slots()
 			//if (pObject != NULL)
 			// pObject->state = 0;
 		}
+		p11_index_invalidate(pSlot);
+		p11_arena_release(&pSlot->arena);
 		if (pSlot->pobjects != NULL)
 		{
 			free(pSlot->pobjects);
@@ -279,11 +290,50 @@ CK_RV cal_token_present(CK_SLOT_ID hSlot, int *pPresent)
 
 
 
+/* A reset of the card by another application isn't a reader event, so
+ * cal_update_token() trusts the card until a command fails on it. Do the
+ * full update then: a reset card is reconnected as a new one, which drops
+ * the sessions and the login like a reinserted card. Returns 1 only if the
+ * card was still ours after all (e.g. just the transaction was lost), so
+ * that the caller can try once more. */
+static int cal_card_was_reset(CK_SLOT_ID hSlot, long err, int *pRetried)
+{
+	int status;
+	P11_SLOT *pSlot = NULL;
+
+	if (*pRetried || (err != EIDMW_ERR_CARD_RESET && err != EIDMW_ERR_NOT_TRANSACTED))
+		return 0;
+	*pRetried = 1;
+
+	pSlot = p11_get_slot(hSlot);
+	if (pSlot == NULL)
+		return 0;
+
+	try
+	{
+		if (!oCardLayer->getReader(pSlot->name).NeedsStatus())
+			return 0;
+	}
+	catch( ...)
+	{
+		return 0;
+	}
+
+	if (cal_update_token(hSlot, &status, 0) != CKR_OK)
+		return 0;
+
+	return status == P11_CARD_STILL_PRESENT;
+}
+
+
+
+
 #define WHERE "cal_get_token_info()"
 CK_RV cal_get_token_info(CK_SLOT_ID hSlot, CK_TOKEN_INFO_PTR pInfo)
 {
 	CK_RV ret = CKR_OK;
 	int status;
+	int bRetried = 0;
 	P11_SLOT *pSlot = NULL;
 
 	pInfo->flags = 0;
@@ -297,6 +347,7 @@ CK_RV cal_get_token_info(CK_SLOT_ID hSlot, CK_TOKEN_INFO_PTR pInfo)
 
 	std::string reader = pSlot->name;
 
+      retry:
 	ret = cal_update_token(hSlot, &status, 0);
 	if (ret != CKR_OK)
 		goto cleanup;
@@ -331,6 +382,8 @@ CK_RV cal_get_token_info(CK_SLOT_ID hSlot, CK_TOKEN_INFO_PTR pInfo)
 	}
 	catch(CMWException &e)
 	{
+		if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+			goto retry;
 		return (cal_translate_error(WHERE, e.GetError()));
 	}
 	catch( ...)
@@ -428,7 +481,7 @@ CK_RV cal_get_mechanism_list(CK_SLOT_ID hSlot,
 
 	if (pMechanismList == NULL)
 	{
-		*pulCount = 6;	//for 6 hash algos
+		*pulCount = 9;	//for 9 hash algos
 
 		if (algos & SIGN_ALGO_RSA_PKCS)
 			*pulCount += 1;
@@ -454,9 +507,14 @@ CK_RV cal_get_mechanism_list(CK_SLOT_ID hSlot,
 			*pulCount += 1;
 		if (algos & SIGN_ALGO_SHA512_ECDSA)
 			*pulCount += 1;
+		if (algos & SIGN_ALGO_SHA3_256_ECDSA)
+			*pulCount += 1;
+		if (algos & SIGN_ALGO_SHA3_384_ECDSA)
+			*pulCount += 1;
+		if (algos & SIGN_ALGO_SHA3_512_ECDSA)
+			*pulCount += 1;
 		if (algos & SIGN_ALGO_ECDSA_RAW)
 			*pulCount += 1;
-		// TODO: also add SHA3 mechanisms -- PKCS#11 v2.40 does not yet support those, though; PKCS#11 v3 will, but is not released yet.
 		return (CKR_OK);
 	}
 
@@ -491,6 +549,21 @@ CK_RV cal_get_mechanism_list(CK_SLOT_ID hSlot,
 	else
 		return (CKR_BUFFER_TOO_SMALL);
 
+	if (n++ < *pulCount)
+		pMechanismList[n - 1] = CKM_SHA3_256;
+	else
+		return (CKR_BUFFER_TOO_SMALL);
+
+	if (n++ < *pulCount)
+		pMechanismList[n - 1] = CKM_SHA3_384;
+	else
+		return (CKR_BUFFER_TOO_SMALL);
+
+	if (n++ < *pulCount)
+		pMechanismList[n - 1] = CKM_SHA3_512;
+	else
+		return (CKR_BUFFER_TOO_SMALL);
+
 	/* sign algos */
 	if (algos & SIGN_ALGO_RSA_PKCS)
 	{
@@ -576,6 +649,27 @@ CK_RV cal_get_mechanism_list(CK_SLOT_ID hSlot,
 		else
 			return (CKR_BUFFER_TOO_SMALL);
 	}
+	if (algos & SIGN_ALGO_SHA3_256_ECDSA)
+	{
+		if (n++ < *pulCount)
+			pMechanismList[n - 1] = CKM_ECDSA_SHA3_256;
+		else
+			return (CKR_BUFFER_TOO_SMALL);
+	}
+	if (algos & SIGN_ALGO_SHA3_384_ECDSA)
+	{
+		if (n++ < *pulCount)
+			pMechanismList[n - 1] = CKM_ECDSA_SHA3_384;
+		else
+			return (CKR_BUFFER_TOO_SMALL);
+	}
+	if (algos & SIGN_ALGO_SHA3_512_ECDSA)
+	{
+		if (n++ < *pulCount)
+			pMechanismList[n - 1] = CKM_ECDSA_SHA3_512;
+		else
+			return (CKR_BUFFER_TOO_SMALL);
+	}
 	if (algos & SIGN_ALGO_ECDSA_RAW)
 	{
 		if (n++ < *pulCount)
@@ -681,6 +775,7 @@ CK_RV cal_get_mechanism_info(CK_SLOT_ID hSlot, CK_MECHANISM_TYPE type,
 #define WHERE "cal_connect()"
 CK_RV cal_connect(CK_SLOT_ID hSlot)
 {
+	CCallStats oStats(CK_BEID_CALL_CONNECT);
 	CK_RV ret = CKR_OK;
 	int status;
 	P11_SLOT *pSlot = NULL;
@@ -717,6 +812,7 @@ CK_RV cal_connect(CK_SLOT_ID hSlot)
 #define WHERE "cal_disconnect()"
 CK_RV cal_disconnect(CK_SLOT_ID hSlot)
 {
+	CCallStats oStats(CK_BEID_CALL_DISCONNECT);
 	CK_RV ret = 0;
 	P11_SLOT *pSlot = NULL;
 
@@ -758,6 +854,7 @@ CK_RV cal_disconnect(CK_SLOT_ID hSlot)
 #define WHERE "cal_init_objects()"
 CK_RV cal_init_objects(P11_SLOT * pSlot)
 {
+	CCallStats oStats(CK_BEID_CALL_INIT_OBJECTS);
 	CK_RV ret = CKR_OK;
 	CK_ATTRIBUTE PRV_KEY[] = BEID_TEMPLATE_PRV_KEY;
 	CK_ATTRIBUTE PUB_KEY[] = BEID_TEMPLATE_PUB_KEY;
@@ -818,20 +915,25 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 				goto cleanup;
 			pObject = p11_get_slot_object(pSlot, hObject);
 
-			ret = p11_set_attribute_value(pObject->pAttr,
-						      pObject->count,
-						      CKA_CERTIFICATE_TYPE,
-						      (CK_VOID_PTR) &
-						      certType,
-						      sizeof(CK_ULONG));
+			ret = p11_set_object_value(pObject,
+						   CKA_CERTIFICATE_TYPE,
+						   (CK_VOID_PTR) &
+						   certType,
+						   sizeof(CK_ULONG));
 			if (ret != CKR_OK)
 				goto cleanup;
-			ret = p11_set_attribute_value(pObject->pAttr,
-						      pObject->count,
-						      CKA_LABEL,
-						      (CK_VOID_PTR) clabel,
-						      (CK_ULONG)
-						      strlen(clabel));
+			ret = p11_set_object_value(pObject,
+						   CKA_LABEL,
+						   (CK_VOID_PTR) clabel,
+						   (CK_ULONG)
+						   strlen(clabel));
+			if (ret != CKR_OK)
+				goto cleanup;
+			//TODO Check this in the cal if we can be sure that the certificate can be trusted and not be modified on the card
+			ret = p11_set_object_value(pObject,
+						   CKA_TRUSTED,
+						   (CK_VOID_PTR) & btrue,
+						   sizeof(btrue));
 			if (ret != CKR_OK)
 				goto cleanup;
 
@@ -876,17 +978,15 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 
 					//type = (CK_ULONG) oReader.GetPrivKey(i).;
 					//TODO fixed set to RSA
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_LABEL,
+					ret = p11_set_object_value
+						(pObject, CKA_LABEL,
 						 (CK_VOID_PTR) clabel,
 						 (CK_ULONG) strlen(clabel));
 					if (ret != CKR_OK)
 						goto cleanup;
 
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_KEY_TYPE,
+					ret = p11_set_object_value
+						(pObject, CKA_KEY_TYPE,
 						 (CK_VOID_PTR) & keytype,
 						 sizeof(CK_KEY_TYPE));
 					if (ret != CKR_OK)
@@ -894,9 +994,8 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 
 					//TODO if (ulKeyUsage & SIGN)
 					{
-						ret = p11_set_attribute_value
-							(pObject->pAttr,
-							 pObject->count,
+						ret = p11_set_object_value
+							(pObject,
 							 CKA_SIGN,
 							 (CK_VOID_PTR) &
 							 btrue,
@@ -907,25 +1006,46 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 
 					//TODO error in cal, size is in bits allready
 					modsize = key.ulKeyLenBytes * 8;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count,
+					ret = p11_set_object_value
+						(pObject,
 						 CKA_MODULUS_BITS,
 						 (CK_VOID_PTR) & modsize,
 						 sizeof(CK_ULONG));
 					if (ret != CKR_OK)
 						goto cleanup;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count,
+					ret = p11_set_object_value
+						(pObject,
 						 CKA_EXTRACTABLE,
 						 (CK_VOID_PTR) & bfalse,
 						 sizeof(bfalse));
 					if (ret != CKR_OK)
 						goto cleanup;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_DERIVE,
+					ret = p11_set_object_value
+						(pObject, CKA_SENSITIVE,
+						 (CK_VOID_PTR) & btrue,
+						 sizeof(btrue));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_DECRYPT,
+						 (CK_VOID_PTR) & bfalse,
+						 sizeof(bfalse));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_SIGN_RECOVER,
+						 (CK_VOID_PTR) & bfalse,
+						 sizeof(bfalse));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_UNWRAP,
+						 (CK_VOID_PTR) & bfalse,
+						 sizeof(bfalse));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_DERIVE,
 						 (CK_VOID_PTR) & bfalse,
 						 sizeof(bfalse));
 					if (ret != CKR_OK)
@@ -956,35 +1076,61 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 					//      sprintf_s(clabel,sizeof(clabel), "Public Key %d (%s)", i+1, key.csLabel.c_str());
 					sprintf_s(clabel, sizeof(clabel),
 						  "%s", key.csLabel.c_str());
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_LABEL,
+					ret = p11_set_object_value
+						(pObject, CKA_LABEL,
 						 (CK_VOID_PTR) clabel,
 						 (CK_ULONG) strlen(clabel));
 					if (ret != CKR_OK)
 						goto cleanup;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_KEY_TYPE,
+					ret = p11_set_object_value
+						(pObject, CKA_KEY_TYPE,
 						 (CK_VOID_PTR) & keytype,
 						 sizeof(CK_KEY_TYPE));
 					if (ret != CKR_OK)
 						goto cleanup;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count,
+					ret = p11_set_object_value
+						(pObject,
 						 CKA_MODULUS_BITS,
 						 (CK_VOID_PTR) & modsize,
 						 sizeof(CK_ULONG));
 					if (ret != CKR_OK)
 						goto cleanup;
-					ret = p11_set_attribute_value
-						(pObject->pAttr,
-						 pObject->count, CKA_DERIVE,
+					ret = p11_set_object_value
+						(pObject, CKA_DERIVE,
+						 (CK_VOID_PTR) & bfalse,
+						 sizeof(bfalse));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_SENSITIVE,
+						 (CK_VOID_PTR) & btrue,
+						 sizeof(btrue));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_VERIFY,
+						 (CK_VOID_PTR) & btrue,
+						 sizeof(btrue));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_ENCRYPT,
+						 (CK_VOID_PTR) & bfalse,
+						 sizeof(bfalse));
+					if (ret != CKR_OK)
+						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_WRAP,
 						 (CK_VOID_PTR) & bfalse,
 						 sizeof(bfalse));
 					if (ret != CKR_OK)
 						goto cleanup;
+					ret = p11_set_object_value
+						(pObject, CKA_TRUSTED,
+						 (CK_VOID_PTR) & btrue,
+						 sizeof(btrue));
+					if (ret != CKR_OK)
+						goto cleanup;
 				}
 			}
 		}
@@ -1012,6 +1158,7 @@ CK_RV cal_init_objects(P11_SLOT * pSlot)
 CK_RV cal_logon(CK_SLOT_ID hSlot, size_t l_pin, CK_CHAR_PTR pin,
 		int sec_messaging)
 {
+	CCallStats oStats(CK_BEID_CALL_LOGON);
 	CK_RV ret = CKR_OK;
 	char cpin[20];
 	P11_SLOT *pSlot = NULL;
@@ -1066,6 +1213,7 @@ CK_RV cal_logon(CK_SLOT_ID hSlot, size_t l_pin, CK_CHAR_PTR pin,
 #define WHERE "cal_logout()"
 CK_RV cal_logout(CK_SLOT_ID hSlot)
 {
+	CCallStats oStats(CK_BEID_CALL_LOGOUT);
 	CK_RV ret = CKR_OK;
 	P11_SLOT *pSlot = NULL;
 
@@ -1111,6 +1259,7 @@ CK_RV cal_logout(CK_SLOT_ID hSlot)
 CK_RV cal_change_pin(CK_SLOT_ID hSlot, CK_ULONG l_oldpin, CK_CHAR_PTR oldpin,
 		     CK_ULONG l_newpin, CK_CHAR_PTR newpin)
 {
+	CCallStats oStats(CK_BEID_CALL_CHANGE_PIN);
 	CK_RV ret = CKR_OK;
 	P11_SLOT *pSlot = NULL;
 
@@ -1172,7 +1321,9 @@ CK_RV cal_change_pin(CK_SLOT_ID hSlot, CK_ULONG l_oldpin, CK_CHAR_PTR oldpin,
 //we already know the unsigned data
 CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 {
+	CCallStats oStats(CK_BEID_CALL_GET_CARD_DATA);
 	CK_RV ret = 0;
+	int bRetried = 0;
 	CByteArray oATR;
 	CByteArray oAPDU(5);
 	unsigned char oByte;
@@ -1182,7 +1333,7 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 	//      char cBuffer[250];
 	//      unsigned char ucBuffer[250];
 	const char *plabel = NULL;
-	CTLVBuffer oTLVBuffer;
+	const unsigned char *pucCardData = NULL;
 	P11_SLOT *pSlot = NULL;
 	CK_ATTRIBUTE ID_DATA[] = BEID_TEMPLATE_ID_DATA;
 
@@ -1196,6 +1347,7 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 	}
 
 	szReader = pSlot->name;
+      retry:
 	try
 	{
 		CReader & oReader = oCardLayer->getReader(szReader);
@@ -1235,7 +1387,10 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 		if (ret != CKR_OK)
 			goto cleanup;
 
-		CByteArray data = CByteArray(oCardData.GetBytes(), 16);
+		//the fields below point into the card data, which has them all
+		if (oCardData.Size() < 28)
+			throw CMWEXCEPTION(EIDMW_ERR_PARAM_RANGE);
+		pucCardData = oCardData.GetBytes();
 
 		plabel = BEID_LABEL_DATA_SerialNr;
 		ret = p11_add_slot_ID_object(pSlot, ID_DATA,
@@ -1244,8 +1399,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 					     CKO_DATA, CK_FALSE, &hObject,
 					     (CK_VOID_PTR) plabel,
 					     (CK_ULONG) strlen(plabel),
-					     (CK_VOID_PTR) data.GetBytes(),
-					     (CK_ULONG) data.Size(),
+					     (CK_VOID_PTR) pucCardData,
+					     (CK_ULONG) 16,
 					     (CK_VOID_PTR)
 					     BEID_OBJECTID_CARDDATA,
 					     (CK_ULONG)
@@ -1344,9 +1499,6 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 
 		if (oByte == 0x11)
 		{
-			data.ClearContents();
-			data.Append(oCardData.GetByte(21));
-			data.Append(oCardData.GetByte(22));
 			plabel = BEID_LABEL_DATA_ApplVersion;
 			ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 						     sizeof(ID_DATA) /
@@ -1356,9 +1508,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 						     (CK_VOID_PTR) plabel,
 						     (CK_ULONG)
 						     strlen(plabel),
-						     (CK_VOID_PTR) data.
-						     GetBytes(),
-						     (CK_ULONG) data.Size(),
+						     (CK_VOID_PTR) (pucCardData + 21),
+						     (CK_ULONG) 2,
 						     (CK_VOID_PTR)
 						     BEID_OBJECTID_CARDDATA,
 						     (CK_ULONG)
@@ -1367,9 +1518,6 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 			if (ret != CKR_OK)
 				goto cleanup;
 
-			data.ClearContents();
-			data.Append(oCardData.GetByte(23));
-			data.Append(oCardData.GetByte(24));
 			plabel = BEID_LABEL_DATA_ApplIntVersion;
 			ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 						     sizeof(ID_DATA) /
@@ -1379,9 +1527,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 						     (CK_VOID_PTR) plabel,
 						     (CK_ULONG)
 						     strlen(plabel),
-						     (CK_VOID_PTR) data.
-						     GetBytes(),
-						     (CK_ULONG) data.Size(),
+						     (CK_VOID_PTR) (pucCardData + 23),
+						     (CK_ULONG) 2,
 						     (CK_VOID_PTR)
 						     BEID_OBJECTID_CARDDATA,
 						     (CK_ULONG)
@@ -1390,9 +1537,6 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 			if (ret != CKR_OK)
 				goto cleanup;
 
-			data.ClearContents();
-			data.Append(oCardData.GetByte(25));
-			data.Append(oCardData.GetByte(26));
 			plabel = BEID_LABEL_DATA_PKCS15Version;
 			ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 						     sizeof(ID_DATA) /
@@ -1402,9 +1546,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 						     (CK_VOID_PTR) plabel,
 						     (CK_ULONG)
 						     strlen(plabel),
-						     (CK_VOID_PTR) data.
-						     GetBytes(),
-						     (CK_ULONG) data.Size(),
+						     (CK_VOID_PTR) (pucCardData + 25),
+						     (CK_ULONG) 2,
 						     (CK_VOID_PTR)
 						     BEID_OBJECTID_CARDDATA,
 						     (CK_ULONG)
@@ -1433,9 +1576,6 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 			if (ret != CKR_OK)
 				goto cleanup;
 
-			data.ClearContents();
-			data.Append(oCardData.GetByte(22));
-			data.Append(oCardData.GetByte(23));
 			plabel = BEID_LABEL_DATA_GlobOSVersion;
 			ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 						     sizeof(ID_DATA) /
@@ -1445,9 +1585,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 						     (CK_VOID_PTR) plabel,
 						     (CK_ULONG)
 						     strlen(plabel),
-						     (CK_VOID_PTR) data.
-						     GetBytes(),
-						     (CK_ULONG) data.Size(),
+						     (CK_VOID_PTR) (pucCardData + 22),
+						     (CK_ULONG) 2,
 						     (CK_VOID_PTR)
 						     BEID_OBJECTID_CARDDATA,
 						     (CK_ULONG)
@@ -1545,6 +1684,8 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 	}
 	catch(CMWException &e)
 	{
+		if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+			goto retry;
 		return (cal_translate_error(WHERE, e.GetError()));
 	}
 	catch( ...)
@@ -1569,21 +1710,41 @@ CK_RV cal_get_card_data(CK_SLOT_ID hSlot)
 
 
 
+/* The files behind each data type, in the order in which the cases in
+ * cal_read_ID_files() fall through to each other */
+static const struct
+{
+	CK_ULONG dataType;
+	const char *path;
+} ID_FILES[] =
+{
+	{CACHED_DATA_TYPE_ID, BEID_FILE_ID},
+	{CACHED_DATA_TYPE_ADDRESS, BEID_FILE_ADDRESS},
+	{CACHED_DATA_TYPE_PHOTO, BEID_FILE_PHOTO},
+	{CACHED_DATA_TYPE_RNCERT, BEID_FILE_CERT_RRN},
+	{CACHED_DATA_TYPE_SIGN_DATA_FILE, BEID_FILE_ID_SIGN},
+	{CACHED_DATA_TYPE_SIGN_ADDRESS_FILE, BEID_FILE_ADDRESS_SIGN},
+};
+
 #define WHERE "cal_read_ID_files()"
 CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 {
+	CCallStats oStats(CK_BEID_CALL_READ_ID_FILES);
 	CK_RV ret = CKR_OK;
-	CByteArray oFileData;
+	int bRetried = 0;
+	const CByteArray *poFileData = NULL;
+	std::vector < std::string > vcsPaths;
+	std::vector < CByteArray > voFiles;
+	size_t iFile = 0;
 
 	std::string szReader;
-	char cBuffer[256];
 
 	//      unsigned char ucBuffer[250];
 	const char *plabel = NULL;
 	const char *pobjectID = NULL;
+	const unsigned char *pValue = NULL;
 	unsigned long ulLen = 0;
-	CTLVBuffer oTLVBuffer;
-	CTLVBuffer oTLVBufferAddress;	//need second buffer object, as memory is only freed when this object is destructed
+	CTLVBuffer oTLVBuffer;	//points into the file it parsed, so keep that until its labels are added
 	P11_SLOT *pSlot = NULL;
 	CK_ATTRIBUTE ID_DATA[] = BEID_TEMPLATE_ID_DATA;
 	BEID_DATA_LABELS_NAME ID_LABELS[] = BEID_ID_DATA_LABELS;
@@ -1605,14 +1766,27 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 	}
 
 	szReader = pSlot->name;
+      retry:
+	vcsPaths.clear();
+	iFile = 0;
 	try
 	{
 		CReader & oReader = oCardLayer->getReader(szReader);
+
+		// read all the files we need in one go, so that the card is
+		// only locked once
+		for (i = 0; i < (int) (sizeof(ID_FILES) / sizeof(ID_FILES[0])); i++)
+		{
+			if (dataType == CACHED_DATA_TYPE_ALL_DATA || dataType == ID_FILES[i].dataType)
+				vcsPaths.push_back(ID_FILES[i].path);
+		}
+		voFiles = oReader.ReadFiles(vcsPaths);
+
 		switch (dataType)
 		{
 			case CACHED_DATA_TYPE_ALL_DATA:
 			case CACHED_DATA_TYPE_ID:
-				oFileData = oReader.ReadFile(BEID_FILE_ID);
+				poFileData = &voFiles[iFile++];
 
 //				dataSize = fread((void *)buffer,1,4096, BEIDfile);
 //				fclose(BEIDfile);
@@ -1636,10 +1810,10 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 							     (CK_ULONG)
 							     strlen(plabel),
 							     (CK_VOID_PTR)
-							     oFileData.
+							     poFileData->
 							     GetBytes(),
 							     (CK_ULONG)
-							     oFileData.Size(),
+							     poFileData->Size(),
 							     (CK_VOID_PTR)
 							     pobjectID,
 							     (CK_ULONG)
@@ -1648,8 +1822,8 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 				if (ret)
 					goto cleanup;
 
-				oTLVBuffer.ParseTLV(oFileData.GetBytes(),
-						    oFileData.Size());
+				oTLVBuffer.ParseTLV(poFileData->GetBytes(),
+						    poFileData->Size());
 
 				nrOfItems =
 					sizeof(ID_LABELS) /
@@ -1657,13 +1831,11 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 
 				for (i = 0; i < nrOfItems; i++)
 				{
-					ulLen = sizeof(cBuffer);
-					memset(cBuffer, 0, ulLen);
-					if(oTLVBuffer.FillUTF8Data(ID_LABELS[i].tag, cBuffer, &ulLen)) {
+					if(oTLVBuffer.GetTagData(ID_LABELS[i].tag, &pValue, &ulLen)) {
 						plabel = ID_LABELS[i].name;
 						ret = p11_add_slot_ID_object(pSlot, ID_DATA, sizeof(ID_DATA) / sizeof(CK_ATTRIBUTE),
 									     CK_TRUE, CKO_DATA, CK_FALSE, &hObject, (CK_VOID_PTR)plabel,
-									     (CK_ULONG)strlen(plabel), (CK_VOID_PTR)cBuffer, ulLen,
+									     (CK_ULONG)strlen(plabel), (CK_VOID_PTR)pValue, ulLen,
 									     (CK_VOID_PTR) pobjectID, (CK_ULONG)strlen(pobjectID));
 						if (ret)
 							goto cleanup;
@@ -1675,30 +1847,27 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 				}
 				/* Falls through */
 			case CACHED_DATA_TYPE_ADDRESS:
-				oFileData =
-					oReader.ReadFile(BEID_FILE_ADDRESS);
+				poFileData = &voFiles[iFile++];
 				plabel = BEID_LABEL_ADDRESS_FILE;
 				pobjectID = BEID_OBJECTID_ADDRESS;
 				ret = p11_add_slot_ID_object(pSlot, ID_DATA, sizeof(ID_DATA) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_DATA,
 							     CK_FALSE, &hObject, (CK_VOID_PTR)plabel, (CK_ULONG)strlen(plabel),
-							     (CK_VOID_PTR)oFileData.GetBytes(), (CK_ULONG)oFileData.Size(),
+							     (CK_VOID_PTR)poFileData->GetBytes(), (CK_ULONG)poFileData->Size(),
 							     (CK_VOID_PTR)pobjectID, (CK_ULONG)strlen(pobjectID));
 				if (ret)
 					goto cleanup;
-				oTLVBufferAddress.ParseTLV(oFileData.GetBytes(),
-							   oFileData.Size());
+				oTLVBuffer.ParseTLV(poFileData->GetBytes(),
+						    poFileData->Size());
 				nrOfItems =
 					sizeof(ADDRESS_LABELS) /
 					sizeof(BEID_DATA_LABELS_NAME);
 				for (i = 0; i < nrOfItems; i++)
 				{
-					ulLen = sizeof(cBuffer);
-					memset(cBuffer, 0, ulLen);
-					if(oTLVBufferAddress.FillUTF8Data(ADDRESS_LABELS[i].tag, cBuffer, &ulLen)) {
+					if(oTLVBuffer.GetTagData(ADDRESS_LABELS[i].tag, &pValue, &ulLen)) {
 						plabel = ADDRESS_LABELS[i].name;
 						ret = p11_add_slot_ID_object(pSlot, ID_DATA, sizeof(ID_DATA) / sizeof(CK_ATTRIBUTE), CK_TRUE,
 									     CKO_DATA, CK_FALSE, &hObject, (CK_VOID_PTR)plabel,
-									     (CK_ULONG)strlen(plabel), (CK_VOID_PTR)cBuffer, ulLen,
+									     (CK_ULONG)strlen(plabel), (CK_VOID_PTR)pValue, ulLen,
 									     (CK_VOID_PTR)pobjectID, (CK_ULONG)strlen(pobjectID));
 						if (ret)
 							goto cleanup;
@@ -1712,7 +1881,7 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 			case CACHED_DATA_TYPE_PHOTO:
 				plabel = BEID_LABEL_PHOTO;
 				pobjectID = BEID_OBJECTID_PHOTO;
-				oFileData = oReader.ReadFile(BEID_FILE_PHOTO);
+				poFileData = &voFiles[iFile++];
 				ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 							     sizeof(ID_DATA) /
 							     sizeof
@@ -1726,10 +1895,10 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 							     (CK_ULONG)
 							     strlen(plabel),
 							     (CK_VOID_PTR)
-							     oFileData.
+							     poFileData->
 							     GetBytes(),
 							     (CK_ULONG)
-							     oFileData.Size(),
+							     poFileData->Size(),
 							     (CK_VOID_PTR)
 							     pobjectID,
 							     (CK_ULONG)
@@ -1743,8 +1912,7 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 				}
 				/* Falls through */
 			case CACHED_DATA_TYPE_RNCERT:
-				oFileData =
-					oReader.ReadFile(BEID_FILE_CERT_RRN);
+				poFileData = &voFiles[iFile++];
 				plabel = BEID_LABEL_CERT_RN;
 				pobjectID = BEID_OBJECTID_RNCERT;
 				ret = p11_add_slot_ID_object(pSlot, ID_DATA,
@@ -1760,10 +1928,10 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 							     (CK_ULONG)
 							     strlen(plabel),
 							     (CK_VOID_PTR)
-							     oFileData.
+							     poFileData->
 							     GetBytes(),
 							     (CK_ULONG)
-							     oFileData.Size(),
+							     poFileData->Size(),
 							     (CK_VOID_PTR)
 							     pobjectID,
 							     (CK_ULONG)
@@ -1778,8 +1946,7 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 				/* Falls through */
 			case CACHED_DATA_TYPE_SIGN_DATA_FILE:
 				plabel = BEID_LABEL_SGN_RN;
-				oFileData =
-					oReader.ReadFile(BEID_FILE_ID_SIGN);
+				poFileData = &voFiles[iFile++];
 				ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 							     sizeof(ID_DATA) /
 							     sizeof
@@ -1793,10 +1960,10 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 							     (CK_ULONG)
 							     strlen(plabel),
 							     (CK_VOID_PTR)
-							     oFileData.
+							     poFileData->
 							     GetBytes(),
 							     (CK_ULONG)
-							     oFileData.Size(),
+							     poFileData->Size(),
 							     (CK_VOID_PTR)
 							     BEID_OBJECTID_SIGN_DATA_FILE,
 							     (CK_ULONG)
@@ -1811,9 +1978,7 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 				/* Falls through */
 			case CACHED_DATA_TYPE_SIGN_ADDRESS_FILE:
 				plabel = BEID_LABEL_SGN_ADDRESS;
-				oFileData =
-					oReader.
-					ReadFile(BEID_FILE_ADDRESS_SIGN);
+				poFileData = &voFiles[iFile++];
 				ret = p11_add_slot_ID_object(pSlot, ID_DATA,
 							     sizeof(ID_DATA) /
 							     sizeof
@@ -1827,10 +1992,10 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 							     (CK_ULONG)
 							     strlen(plabel),
 							     (CK_VOID_PTR)
-							     oFileData.
+							     poFileData->
 							     GetBytes(),
 							     (CK_ULONG)
-							     oFileData.Size(),
+							     poFileData->Size(),
 							     (CK_VOID_PTR)
 							     BEID_OBJECTID_SIGN_ADDRESS_FILE,
 							     (CK_ULONG)
@@ -1849,6 +2014,8 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 	}
 	catch(CMWException &e)
 	{
+		if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+			goto retry;
 		return (cal_translate_error(WHERE, e.GetError()));
 	}
 	catch( ...)
@@ -1871,16 +2038,46 @@ CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType)
 
 
 
+/* cal_init_objects() sets all the attributes of the certificates and keys
+   that come from the PKCS#15 structures or are fixed; the others have to be
+   taken from the certificate by cal_read_object(). Only read it when one of
+   those is asked for, an application that picks a key by its CKA_LABEL or
+   CKA_ID doesn't need the certificate. */
+int cal_object_needs_read(P11_OBJECT * pObject, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount)
+{
+	CK_ULONG i;
+
+	if (pObject->state == P11_CACHED)
+		return 0;
+
+	for (i = 0; i < ulCount; i++)
+	{
+		switch (pTemplate[i].type)
+		{
+			case CKA_SUBJECT:
+			case CKA_ISSUER:
+			case CKA_SERIAL_NUMBER:
+			case CKA_VALUE:
+			case CKA_MODULUS:
+			case CKA_PUBLIC_EXPONENT:
+				return 1;
+			default:
+				break;
+		}
+	}
+	return 0;
+}
+
 #define WHERE "cal_read_object()"
 CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 {
+	CCallStats oStats(CK_BEID_CALL_READ_OBJECT);
 	CK_RV ret = CKR_OK;
 	int status;
+	int bRetried = 0;
 	CK_ULONG *pID = NULL;
 	CK_ULONG *pClass = NULL;
 	CK_ULONG len = 0;
-	CK_BBOOL btrue = CK_TRUE;
-	CK_BBOOL bfalse = CK_FALSE;
 	P11_OBJECT *pCertObject = NULL;
 	P11_OBJECT *pPubKeyObject = NULL;
 	P11_OBJECT *pPrivKeyObject = NULL;
@@ -1892,7 +2089,6 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 	std::string szReader;
 	P11_SLOT *pSlot = NULL;
 
-	memset(&certinfo, 0, sizeof(T_CERT_INFO));
 	pSlot = p11_get_slot(hSlot);
 	if (pSlot == NULL)
 	{
@@ -1902,6 +2098,7 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 
 	szReader = pSlot->name;
 
+      retry:
 	ret = cal_update_token(hSlot, &status, 0);
 	if (ret != CKR_OK)
 		goto cleanup;
@@ -1955,6 +2152,7 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 			}
 
             //at least 64K Bytes as size (unsigned int) will suffice for cert length
+			//certinfo points into oCertData, the attributes below are copied from there
 			if (cert_get_info(oCertData.GetBytes(), (unsigned int)(oCertData.Size()), &certinfo) < 0)
 			{
 				// ASN.1 parser failed. Assume hardware failure.
@@ -1962,49 +2160,37 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 				goto cleanup;
 			}
 
-			ret = p11_set_attribute_value(pCertObject->pAttr,
-						      pCertObject->count,
-						      CKA_SUBJECT,
-						      (CK_VOID_PTR) certinfo.
-						      subject,
-						      (CK_ULONG) certinfo.
-						      l_subject);
+			ret = p11_set_object_value(pCertObject,
+						   CKA_SUBJECT,
+						   (CK_VOID_PTR) certinfo.
+						   subject,
+						   (CK_ULONG) certinfo.
+						   l_subject);
 			if (ret != CKR_OK)
 				goto cleanup;
-			ret = p11_set_attribute_value(pCertObject->pAttr,
-						      pCertObject->count,
-						      CKA_ISSUER,
-						      (CK_VOID_PTR) certinfo.
-						      issuer,
-						      (CK_ULONG) certinfo.
-						      l_issuer);
+			ret = p11_set_object_value(pCertObject,
+						   CKA_ISSUER,
+						   (CK_VOID_PTR) certinfo.
+						   issuer,
+						   (CK_ULONG) certinfo.
+						   l_issuer);
 			if (ret != CKR_OK)
 				goto cleanup;
-			ret = p11_set_attribute_value(pCertObject->pAttr,
-						      pCertObject->count,
-						      CKA_SERIAL_NUMBER,
-						      (CK_VOID_PTR) certinfo.
-						      serial,
-						      (CK_ULONG) certinfo.
-						      l_serial);
+			ret = p11_set_object_value(pCertObject,
+						   CKA_SERIAL_NUMBER,
+						   (CK_VOID_PTR) certinfo.
+						   serial,
+						   (CK_ULONG) certinfo.
+						   l_serial);
 			if (ret != CKR_OK)
 				goto cleanup;
 			//use real length from decoder here instead of lg from cal
-			ret = p11_set_attribute_value(pCertObject->pAttr,
-						      pCertObject->count,
-						      CKA_VALUE,
-						      (CK_VOID_PTR) oCertData.
-						      GetBytes(),
-						      (CK_ULONG) certinfo.
-						      lcert);
-			if (ret != CKR_OK)
-				goto cleanup;
-			//TODO Check this in the cal if we can be sure that the certificate can be trusted and not be modified on the card
-			ret = p11_set_attribute_value(pCertObject->pAttr,
-						      pCertObject->count,
-						      CKA_TRUSTED,
-						      (CK_VOID_PTR) & btrue,
-						      sizeof(btrue));
+			ret = p11_set_object_value(pCertObject,
+						   CKA_VALUE,
+						   (CK_VOID_PTR) oCertData.
+						   GetBytes(),
+						   (CK_ULONG) certinfo.
+						   lcert);
 			if (ret != CKR_OK)
 				goto cleanup;
 
@@ -2014,181 +2200,66 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 
 			if (pPrivKeyObject != NULL)
 			{
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_SENSITIVE,
-							      (CK_VOID_PTR) &
-							      btrue,
-							      sizeof(btrue));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_DECRYPT,
-							      (CK_VOID_PTR) &
-							      bfalse,
-							      sizeof(bfalse));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_SIGN_RECOVER,
-							      (CK_VOID_PTR) &
-							      bfalse,
-							      sizeof
-							      (CK_BBOOL));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_UNWRAP,
-							      (CK_VOID_PTR) &
-							      bfalse,
-							      sizeof
-							      (CK_BBOOL));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_SUBJECT,
-							      (CK_VOID_PTR)
-							      certinfo.
-							      subject,
-							      (CK_ULONG)
-							      certinfo.
-							      l_subject);
+				ret = p11_set_object_value(pPrivKeyObject,
+							   CKA_SUBJECT,
+							   (CK_VOID_PTR)
+							   certinfo.
+							   subject,
+							   (CK_ULONG)
+							   certinfo.
+							   l_subject);
 				if (ret != CKR_OK)
 					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_MODULUS,
-							      (CK_VOID_PTR)
-							      certinfo.mod,
-							      (CK_ULONG)
-							      certinfo.l_mod);
+				ret = p11_set_object_value(pPrivKeyObject,
+							   CKA_MODULUS,
+							   (CK_VOID_PTR)
+							   certinfo.mod,
+							   (CK_ULONG)
+							   certinfo.l_mod);
 				if (ret != CKR_OK)
 					goto cleanup;
-				ret = p11_set_attribute_value(pPrivKeyObject->
-							      pAttr,
-							      pPrivKeyObject->
-							      count,
-							      CKA_PUBLIC_EXPONENT,
-							      (CK_VOID_PTR)
-							      certinfo.exp,
-							      (CK_ULONG)
-							      certinfo.l_exp);
+				ret = p11_set_object_value(pPrivKeyObject,
+							   CKA_PUBLIC_EXPONENT,
+							   (CK_VOID_PTR)
+							   certinfo.exp,
+							   (CK_ULONG)
+							   certinfo.l_exp);
 				if (ret != CKR_OK)
 					goto cleanup;
 				pPrivKeyObject->state = P11_CACHED;
 			}
 			if (pPubKeyObject != NULL)
 			{
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_SENSITIVE,
-							      (CK_VOID_PTR) &
-							      btrue,
-							      sizeof(btrue));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_VERIFY,
-							      (CK_VOID_PTR) &
-							      btrue,
-							      sizeof(btrue));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_ENCRYPT,
-							      (CK_VOID_PTR) &
-							      bfalse,
-							      sizeof(bfalse));
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count, CKA_WRAP,
-							      (CK_VOID_PTR) &
-							      bfalse,
-							      sizeof
-							      (CK_BBOOL));
+				ret = p11_set_object_value(pPubKeyObject,
+							   CKA_SUBJECT,
+							   (CK_VOID_PTR)
+							   certinfo.
+							   subject,
+							   (CK_ULONG)
+							   certinfo.
+							   l_subject);
 				if (ret != CKR_OK)
 					goto cleanup;
-
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_SUBJECT,
-							      (CK_VOID_PTR)
-							      certinfo.
-							      subject,
-							      (CK_ULONG)
-							      certinfo.
-							      l_subject);
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_MODULUS,
-							      (CK_VOID_PTR)
-							      certinfo.mod,
-							      certinfo.l_mod);
-				if (ret != CKR_OK)
-					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_VALUE,
-							      (CK_VOID_PTR)
-							      certinfo.pkinfo,
-							      certinfo.
-							      l_pkinfo);
+				ret = p11_set_object_value(pPubKeyObject,
+							   CKA_MODULUS,
+							   (CK_VOID_PTR)
+							   certinfo.mod,
+							   certinfo.l_mod);
 				if (ret != CKR_OK)
 					goto cleanup;
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_PUBLIC_EXPONENT,
-							      (CK_VOID_PTR)
-							      certinfo.exp,
-							      certinfo.l_exp);
+				ret = p11_set_object_value(pPubKeyObject,
+							   CKA_VALUE,
+							   (CK_VOID_PTR)
+							   certinfo.pkinfo,
+							   certinfo.
+							   l_pkinfo);
 				if (ret != CKR_OK)
 					goto cleanup;
-				//TODO test if we can set the trusted flag...
-				ret = p11_set_attribute_value(pPubKeyObject->
-							      pAttr,
-							      pPubKeyObject->
-							      count,
-							      CKA_TRUSTED,
-							      (CK_VOID_PTR) &
-							      btrue,
-							      sizeof(btrue));
+				ret = p11_set_object_value(pPubKeyObject,
+							   CKA_PUBLIC_EXPONENT,
+							   (CK_VOID_PTR)
+							   certinfo.exp,
+							   certinfo.l_exp);
 				if (ret != CKR_OK)
 					goto cleanup;
 
@@ -2197,24 +2268,22 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 		}
 		catch(CMWException &e)
 		{
-			cert_free_info(&certinfo);
+			if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+				goto retry;
 			return (cal_translate_error(WHERE, e.GetError()));
 		}
 		catch( ...)
 		{
 			log_trace(WHERE, "E: unkown exception thrown");
-			cert_free_info(&certinfo);
 			return (CKR_FUNCTION_FAILED);
 		}
 	}
 	if (ret != 0)
 	{
-		cert_free_info(&certinfo);
 		return (CKR_DEVICE_ERROR);
 	}
 
       cleanup:
-	cert_free_info(&certinfo);
 	return (ret);
 }
 
@@ -2224,14 +2293,85 @@ CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject)
 
 
 
+#define WHERE "cal_sign_algo()"
+static CK_RV cal_sign_algo(CK_MECHANISM_TYPE mechanism, unsigned long *algo)
+{
+	switch (mechanism)
+	{
+		case CKM_RSA_PKCS:
+			*algo = SIGN_ALGO_RSA_PKCS;
+			break;
+		case CKM_MD5:
+		case CKM_MD5_RSA_PKCS:
+			*algo = SIGN_ALGO_MD5_RSA_PKCS;
+			break;
+		case CKM_SHA_1:
+		case CKM_SHA1_RSA_PKCS:
+			*algo = SIGN_ALGO_SHA1_RSA_PKCS;
+			break;
+		case CKM_SHA256:
+		case CKM_SHA256_RSA_PKCS:
+			*algo = SIGN_ALGO_SHA256_RSA_PKCS;
+			break;
+		case CKM_SHA384:
+		case CKM_SHA384_RSA_PKCS:
+			*algo = SIGN_ALGO_SHA384_RSA_PKCS;
+			break;
+		case CKM_SHA512:
+		case CKM_SHA512_RSA_PKCS:
+			*algo = SIGN_ALGO_SHA512_RSA_PKCS;
+			break;
+		case CKM_RIPEMD160:
+		case CKM_RIPEMD160_RSA_PKCS:
+			*algo = SIGN_ALGO_RIPEMD160_RSA_PKCS;
+			break;
+		case CKM_SHA1_RSA_PKCS_PSS:
+			*algo = SIGN_ALGO_SHA1_RSA_PSS;
+			break;
+		case CKM_SHA256_RSA_PKCS_PSS:
+			*algo = SIGN_ALGO_SHA256_RSA_PSS;
+			break;
+		case CKM_ECDSA_SHA256:
+			*algo = SIGN_ALGO_SHA256_ECDSA;
+			break;
+		case CKM_ECDSA_SHA384:
+			*algo = SIGN_ALGO_SHA384_ECDSA;
+			break;
+		case CKM_ECDSA_SHA512:
+			*algo = SIGN_ALGO_SHA512_ECDSA;
+			break;
+		case CKM_ECDSA_SHA3_256:
+			*algo = SIGN_ALGO_SHA3_256_ECDSA;
+			break;
+		case CKM_ECDSA_SHA3_384:
+			*algo = SIGN_ALGO_SHA3_384_ECDSA;
+			break;
+		case CKM_ECDSA_SHA3_512:
+			*algo = SIGN_ALGO_SHA3_512_ECDSA;
+			break;
+		case CKM_ECDSA:
+			*algo = SIGN_ALGO_ECDSA_RAW;
+			break;
+		default:
+			return (CKR_MECHANISM_INVALID);
+	}
+	return (CKR_OK);
+}
+
+#undef WHERE
+
+
+
 #define WHERE "cal_sign()"
 CK_RV cal_sign(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData, unsigned char *in,
 	       unsigned long l_in, unsigned char *out, unsigned long *l_out)
 {
+	CCallStats oStats(CK_BEID_CALL_SIGN);
 	CK_RV ret = 0;
 	CByteArray oData(in, l_in);
 	CByteArray oDataOut;
 	unsigned long algo;
+	int bRetried = 0;
 	P11_SLOT *pSlot = NULL;
 
 	pSlot = p11_get_slot(hSlot);
@@ -2253,67 +2393,22 @@ CK_RV cal_sign(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData, unsigned char *in,
 	   if (*l_out < 128)
 	   return(CKR_BUFFER_TOO_SMALL);
 	 */
+      retry:
 	try
 	{
 		CReader & oReader = oCardLayer->getReader(szReader);
 		tPrivKey key = oReader.GetPrivKeyByID(pSignData->id);
 
-		switch (pSignData->mechanism)
-		{
-			case CKM_RSA_PKCS:
-				algo = SIGN_ALGO_RSA_PKCS;
-				break;
-			case CKM_MD5:
-			case CKM_MD5_RSA_PKCS:
-				algo = SIGN_ALGO_MD5_RSA_PKCS;
-				break;
-			case CKM_SHA_1:
-			case CKM_SHA1_RSA_PKCS:
-				algo = SIGN_ALGO_SHA1_RSA_PKCS;
-				break;
-			case CKM_SHA256:
-			case CKM_SHA256_RSA_PKCS:
-				algo = SIGN_ALGO_SHA256_RSA_PKCS;
-				break;
-			case CKM_SHA384:
-			case CKM_SHA384_RSA_PKCS:
-				algo = SIGN_ALGO_SHA384_RSA_PKCS;
-				break;
-			case CKM_SHA512:
-			case CKM_SHA512_RSA_PKCS:
-				algo = SIGN_ALGO_SHA512_RSA_PKCS;
-				break;
-			case CKM_RIPEMD160:
-			case CKM_RIPEMD160_RSA_PKCS:
-				algo = SIGN_ALGO_RIPEMD160_RSA_PKCS;
-				break;
-			case CKM_SHA1_RSA_PKCS_PSS:
-				algo = SIGN_ALGO_SHA1_RSA_PSS;
-				break;
-			case CKM_SHA256_RSA_PKCS_PSS:
-				algo = SIGN_ALGO_SHA256_RSA_PSS;
-				break;
-			case CKM_ECDSA_SHA256:
-				algo = SIGN_ALGO_SHA256_ECDSA;
-				break;
-			case CKM_ECDSA_SHA384:
-				algo = SIGN_ALGO_SHA384_ECDSA;
-				break;
-			case CKM_ECDSA_SHA512:
-				algo = SIGN_ALGO_SHA512_ECDSA;
-				break;
-			case CKM_ECDSA:
-				algo = SIGN_ALGO_ECDSA_RAW;
-				break;
-			default:
-				ret = CKR_MECHANISM_INVALID;
-				goto cleanup;
-		}
+		ret = cal_sign_algo(pSignData->mechanism, &algo);
+		if (ret != CKR_OK)
+			goto cleanup;
 
 		oDataOut = oReader.Sign(key, algo, oData);
 	}
 	catch(CMWException & e)
 	{
+		if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+			goto retry;
 		return (cal_translate_error(WHERE, e.GetError()));
 	}
 	catch( ...)
@@ -2334,6 +2429,86 @@ CK_RV cal_sign(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData, unsigned char *in,
 
 
 
+#define WHERE "cal_sign_batch()"
+CK_RV cal_sign_batch(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData,
+		     CK_BEID_SIGN_ITEM_PTR pItems, CK_ULONG ulCount)
+{
+	CCallStats oStats(CK_BEID_CALL_SIGN_BATCH);
+	CK_RV ret = CKR_OK;
+	unsigned long algo;
+	int bRetried = 0;
+	P11_SLOT *pSlot = NULL;
+	std::vector < CByteArray > voData;
+	std::vector < CByteArray > voSignatures;
+	std::vector < long > vlErrors;
+	std::vector < CK_ULONG > vulItems;	// which item each input belongs to
+	CK_ULONG i;
+
+	pSlot = p11_get_slot(hSlot);
+	if (pSlot == NULL)
+	{
+		log_trace(WHERE, "E: Invalid slot (%d)", hSlot);
+		return (CKR_SLOT_ID_INVALID);
+	}
+	std::string szReader = pSlot->name;
+
+	ret = cal_sign_algo(pSignData->mechanism, &algo);
+	if (ret != CKR_OK)
+		return (ret);
+
+	// only the items that passed the caller's checks go to the card
+	for (i = 0; i < ulCount; i++)
+	{
+		if (pItems[i].rv != CKR_OK)
+			continue;
+		voData.push_back(CByteArray(pItems[i].pDigest, pItems[i].ulDigestLen));
+		vulItems.push_back(i);
+	}
+
+      retry:
+	try
+	{
+		CReader & oReader = oCardLayer->getReader(szReader);
+		tPrivKey key = oReader.GetPrivKeyByID(pSignData->id);
+
+		voSignatures = oReader.SignBatch(key, algo, voData, vlErrors);
+	}
+	catch(CMWException & e)
+	{
+		if (cal_card_was_reset(hSlot, e.GetError(), &bRetried))
+			goto retry;
+		return (cal_translate_error(WHERE, e.GetError()));
+	}
+	catch( ...)
+	{
+		log_trace(WHERE, "E: unkown exception thrown");
+		return (CKR_FUNCTION_FAILED);
+	}
+
+	// nothing was signed if the first one failed on a reset
+	if (!vlErrors.empty() && cal_card_was_reset(hSlot, vlErrors[0], &bRetried))
+		goto retry;
+
+	for (i = 0; i < vulItems.size(); i++)
+	{
+		CK_BEID_SIGN_ITEM_PTR pItem = &pItems[vulItems[i]];
+
+		if (vlErrors[i] != EIDMW_OK)
+		{
+			pItem->rv = cal_translate_error(WHERE, vlErrors[i]);
+			continue;
+		}
+		pItem->ulSignatureLen = voSignatures[i].Size();
+		memcpy(pItem->pSignature, voSignatures[i].GetBytes(), pItem->ulSignatureLen);
+	}
+
+	return (ret);
+}
+
+#undef WHERE
+
+
+
 #define WHERE "cal_validate_session()"
 CK_RV cal_validate_session(P11_SESSION * pSession)
 {
@@ -2401,6 +2576,7 @@ CK_RV cal_validate_session(P11_SESSION * pSession)
 #define WHERE "cal_update_token()"
 CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly)
 {
+	CCallStats oStats(CK_BEID_CALL_UPDATE_TOKEN);
 	P11_OBJECT *pObject = NULL;
 	CK_RV ret = CKR_OK;
 
@@ -2420,12 +2596,23 @@ CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly)
 		std::string reader = pSlot->name;
 		CReader & oReader = oCardLayer->getReader(reader);
 
+		//the objects belong to the card we're still connected to, and the reader
+		//monitor saw no event nor did the card report a reset since we checked:
+		//no need to ask PC/SC again
+		if (pSlot->ulGeneration != 0 && pSlot->ulGeneration == oReader.GetGeneration()
+		    && oReader.CardUnchanged())
+		{
+			*pStatus = P11_CARD_STILL_PRESENT;
+			return (CKR_OK);
+		}
+
 		*pStatus = cal_map_status(oReader.Status(true, bPresenceOnly ? true : false));
 		//we get an error thrown here when the cardobject has not been created yet
 		if ( (*pStatus == P11_CARD_INSERTED) || (*pStatus == P11_CARD_STILL_PRESENT)  || (*pStatus == P11_CARD_OTHER) )
 		{
 			if (!bPresenceOnly && oReader.GetCardType() == CARD_UNKNOWN)
 			{
+				pSlot->ulGeneration = 0;
 				return (CKR_TOKEN_NOT_RECOGNIZED);
 			}
 		}
@@ -2440,10 +2627,13 @@ CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly)
 				//if (pObject != NULL)
 				// pObject->state = 0;
 			}
+			p11_index_invalidate(pSlot);
+			p11_arena_release(&pSlot->arena);
 			pSlot->ulCardDataCached = 0;
 
-			//invalidate sessions
+			//invalidate sessions; a new or reset card has no PIN verified
 			p11_invalidate_sessions(hSlot, *pStatus);
+			pSlot->logged_in = CK_FALSE;
 
 			//if Present, other => init objects
 			if ((*pStatus == P11_CARD_OTHER)
@@ -2462,13 +2652,20 @@ CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly)
 			}
 
 		}
+
+		if ((ret == CKR_OK) && ((*pStatus == P11_CARD_INSERTED) || (*pStatus == P11_CARD_STILL_PRESENT) || (*pStatus == P11_CARD_OTHER)))
+			pSlot->ulGeneration = oReader.GetGeneration();
+		else
+			pSlot->ulGeneration = 0;
 	}
 	catch(CMWException &e)
 	{
+		pSlot->ulGeneration = 0;
 		return (cal_translate_error(WHERE, e.GetError()));
 	}
 	catch( ...)
 	{
+		pSlot->ulGeneration = 0;
 		log_trace(WHERE, "E: unkown exception thrown");
 		return (CKR_SESSION_HANDLE_INVALID);
 	}
@@ -2478,6 +2675,100 @@ CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly)
 #undef WHERE
 
 
+#define WHERE "cal_get_apdu_stats()"
+CK_RV cal_get_apdu_stats(CK_BEID_APDU_STATS_PTR pStats, CK_BBOOL bReset)
+{
+	tApduStats stats;
+	unsigned int i;
+
+	memset(pStats, 0, sizeof(*pStats));
+	pStats->bEnabled = CApduStats::IsEnabled() ? CK_TRUE : CK_FALSE;
+
+	CApduStats::Get(stats);
+	if (bReset)
+		CApduStats::Reset();
+
+	pStats->ullSleepUs = stats.ullSleepUs;
+	pStats->ullSleepSavedUs = stats.ullSleepSavedUs;
+	pStats->ulDelayBackoffs = stats.ulDelayBackoffs;
+	pStats->ulTransactions = stats.ulTransactions;
+	pStats->ullTransactionUs = stats.ullTransactionUs;
+	pStats->ulRetries = stats.ulRetries;
+	pStats->ulRecoveries = stats.ulRecoveries;
+	for (i = 0; i < CK_BEID_CALL_COUNT; i++)
+	{
+		pStats->calls[i].ulCount = stats.calls[i].ulCount;
+		pStats->calls[i].ulApdus = stats.calls[i].ulApdus;
+		pStats->calls[i].ullTimeUs = stats.calls[i].ullTimeUs;
+	}
+	for (i = 0; i < 256; i++)
+	{
+		pStats->ins[i].ulCount = stats.ins[i].ulCount;
+		pStats->ins[i].ulBytesSent = stats.ins[i].ulBytesSent;
+		pStats->ins[i].ulBytesReceived = stats.ins[i].ulBytesReceived;
+		pStats->ins[i].ullTransmitUs = stats.ins[i].ullTransmitUs;
+		pStats->ulApdus += stats.ins[i].ulCount;
+		pStats->ulBytesSent += stats.ins[i].ulBytesSent;
+		pStats->ulBytesReceived += stats.ins[i].ulBytesReceived;
+		pStats->ullTransmitUs += stats.ins[i].ullTransmitUs;
+	}
+
+	return CKR_OK;
+}
+#undef WHERE
+
+static const char *const apdu_stats_calls[CK_BEID_CALL_COUNT] = {
+	"connect", "disconnect", "update_token", "init_objects",
+	"get_card_data", "read_ID_files", "read_object", "logon",
+	"logout", "change_pin", "sign", "sign_batch"
+};
+
+#define WHERE "cal_dump_apdu_stats()"
+static void cal_dump_apdu_stats()
+{
+	CK_BEID_APDU_STATS stats;
+	const std::string & csFile = CApduStats::GetDumpFile();
+	FILE *f;
+	unsigned int i;
+
+	if (!CApduStats::IsEnabled() || csFile.empty())
+		return;
+
+	if (csFile == "-")
+		f = stderr;
+	else if ((f = fopen(csFile.c_str(), "a")) == NULL)
+	{
+		log_trace(WHERE, "E: can't open %s", csFile.c_str());
+		return;
+	}
+
+	cal_get_apdu_stats(&stats, CK_FALSE);
+
+	fprintf(f, "APDUs: %lu, sent %lu bytes, received %lu bytes, card time %llu usec\n",
+		stats.ulApdus, stats.ulBytesSent, stats.ulBytesReceived, stats.ullTransmitUs);
+	fprintf(f, "delays: %llu usec (saved %llu usec, %lu backoffs), transactions: %lu held %llu usec, retries: %lu, recoveries: %lu\n",
+		stats.ullSleepUs, stats.ullSleepSavedUs, stats.ulDelayBackoffs, stats.ulTransactions,
+		stats.ullTransactionUs, stats.ulRetries, stats.ulRecoveries);
+	fprintf(f, "%-6s %8s %10s %10s %12s\n", "INS", "APDUs", "sent", "received", "usec");
+	for (i = 0; i < 256; i++)
+	{
+		if (stats.ins[i].ulCount != 0)
+			fprintf(f, "0x%02X   %8lu %10lu %10lu %12llu\n", i, stats.ins[i].ulCount,
+				stats.ins[i].ulBytesSent, stats.ins[i].ulBytesReceived, stats.ins[i].ullTransmitUs);
+	}
+	fprintf(f, "%-14s %8s %8s %12s\n", "call", "count", "APDUs", "usec");
+	for (i = 0; i < CK_BEID_CALL_COUNT; i++)
+	{
+		if (stats.calls[i].ulCount != 0)
+			fprintf(f, "%-14s %8lu %8lu %12llu\n", apdu_stats_calls[i], stats.calls[i].ulCount,
+				stats.calls[i].ulApdus, stats.calls[i].ullTimeUs);
+	}
+
+	if (f != stderr)
+		fclose(f);
+}
+#undef WHERE
+
 /*
 #define WHERE "cal_wait_for_slot_event()"
 CK_RV cal_wait_for_slot_event(int block)
@@ -2611,6 +2902,11 @@ CK_RV cal_refresh_readers()
 
 	try
 	{
+		//the reader monitor sees readers come and go via the PnP reader,
+		//so there's no need to list them again if it didn't see anything
+		if (oReadersInfo && !oCardLayer->GetReaderMonitor().ReadersChanged())
+			return CKR_OK;
+
 		if (oReadersInfo)
 		{
 			//check if readerlist changed?
@@ -2619,6 +2915,7 @@ CK_RV cal_refresh_readers()
 			{
 				//same reader list as before, so we keep the readers' status
 				delete(pNewReadersInfo);
+				oCardLayer->GetReaderMonitor().Watch(*oReadersInfo);
 				return CKR_OK;
 			} else
 			{
@@ -2632,6 +2929,7 @@ CK_RV cal_refresh_readers()
 		//new _reader list, so please stop the scardgetstatuschange that is waiting on the old list
 		oCardLayer->CancelActions();
 		log_trace(WHERE, "I: called oCardLayer->CancelActions()");
+		oCardLayer->GetReaderMonitor().Watch(*oReadersInfo);
 	}
 	catch(CMWException &e)
 	{
@@ -2730,6 +3028,11 @@ CK_RV cal_translate_error(const char *WHERE, long err)
 			return (CKR_TOKEN_NOT_PRESENT);
 			break;
 
+		/** The card was reset (the sessions are dropped, see cal_card_was_reset()) */
+		case EIDMW_ERR_CARD_RESET:
+			return (CKR_DEVICE_REMOVED);
+			break;
+
 		/** Bad parameter P1 or P2 */
 		case EIDMW_ERR_BAD_P1P2:
 			return (CKR_DEVICE_ERROR);
@@ -2975,6 +3278,16 @@ CK_RV cal_wait_for_slot_event(int block)
 
 #undef WHERE
 
+static bool cal_reader_states_changed(SCARD_READERSTATEA * txReaderStates, unsigned long ulnReaders)
+{
+	for (unsigned long i = 0; i < ulnReaders; i++)
+	{
+		if (txReaderStates[i].dwEventState & SCARD_STATE_CHANGED)
+			return true;
+	}
+	return false;
+}
+
 #define WHERE "cal_wait_for_the_slot_event()"
 CK_RV cal_wait_for_the_slot_event(int block)
 {
@@ -2985,10 +3298,41 @@ CK_RV cal_wait_for_the_slot_event(int block)
 	long lret = SCARD_E_TIMEOUT;
 #endif
 	unsigned long ulnReaders = 0;
+	unsigned long ulGeneration;
 
 	memset(txReaderStates, 0, sizeof(txReaderStates));
 	oReadersInfo->GetReaderStates(txReaderStates, MAX_READERS, &ulnReaders);
 
+	//the reader monitor already waits for changes in all readers,
+	//so use its states if it knows them and sleep until it sees a change
+	if (oCardLayer->GetReaderMonitor().GetStates(txReaderStates, ulnReaders, &ulGeneration))
+	{
+		while (block && !cal_reader_states_changed(txReaderStates, ulnReaders))
+		{
+			CReaderMonitor *poMonitor = &oCardLayer->GetReaderMonitor();
+
+			p11_unlock();
+			poMonitor->WaitForChange(ulGeneration);
+			p11_lock();
+			if (p11_get_init() != BEIDP11_INITIALIZED)
+			{
+				log_trace(WHERE,
+					  "I: leave, p11_get_init returned false");
+				CLEANUP(CKR_CRYPTOKI_NOT_INITIALIZED);
+			}
+			if (oReadersInfo->IsFirstTime()
+			    || !oCardLayer->GetReaderMonitor().GetStates(txReaderStates, ulnReaders, &ulGeneration))
+			{
+				//C_GetSlotList reset oReadersInfo, or the monitor stopped
+				//or lost track of the readers: our states are obsolete
+				CLEANUP(CKR_NO_EVENT);
+			}
+		}
+		log_trace(WHERE, "I: status change received from the reader monitor");
+		oReadersInfo->UpdateReaderStates(txReaderStates, ulnReaders);
+		goto cleanup;
+	}
+
 	try
 	{
 		if (block)
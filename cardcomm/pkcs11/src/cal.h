@@ -23,6 +23,7 @@
 
 #include <stdio.h>
 #include "beid_p11.h"
+#include "beidpkcs11ext.h"
 //#include "CardLayer.h"
 
 #ifdef __cplusplus
@@ -44,6 +45,9 @@ extern "C"
 	{  CKM_SHA384,             384, 384  , CKF_DIGEST         }, \
 	{  CKM_SHA512,             512, 512  , CKF_DIGEST         }, \
 	{  CKM_RIPEMD160,          160, 160  , CKF_DIGEST         }, \
+	{  CKM_SHA3_256,           256, 256  , CKF_DIGEST         }, \
+	{  CKM_SHA3_384,           384, 384  , CKF_DIGEST         }, \
+	{  CKM_SHA3_512,           512, 512  , CKF_DIGEST         }, \
 	{  CKM_RSA_PKCS,           1024, 2048, CKF_HW | CKF_SIGN  }, \
 	{  CKM_MD5_RSA_PKCS,       1024, 2048, CKF_HW | CKF_SIGN  }, \
 	{  CKM_SHA1_RSA_PKCS,      1024, 2048, CKF_HW | CKF_SIGN  }, \
@@ -56,6 +60,9 @@ extern "C"
 	{  CKM_ECDSA_SHA256,	   256,  521,  CKF_HW | CKF_SIGN  }, \
 	{  CKM_ECDSA_SHA384,	   256,  521,  CKF_HW | CKF_SIGN  }, \
 	{  CKM_ECDSA_SHA512,	   256,  521,  CKF_HW | CKF_SIGN  }, \
+	{  CKM_ECDSA_SHA3_256,	   256,  521,  CKF_HW | CKF_SIGN  }, \
+	{  CKM_ECDSA_SHA3_384,	   256,  521,  CKF_HW | CKF_SIGN  }, \
+	{  CKM_ECDSA_SHA3_512,	   256,  521,  CKF_HW | CKF_SIGN  }, \
 	{  CKM_ECDSA,		   256,  521,  CKF_HW | CKF_SIGN  }  \
 }
 
@@ -236,16 +243,21 @@ extern "C"
 			     CK_CHAR_PTR newpin);
 	CK_RV cal_get_card_data(CK_SLOT_ID hSlot);
 	CK_RV cal_read_ID_files(CK_SLOT_ID hSlot, CK_ULONG dataType);
+	int cal_object_needs_read(P11_OBJECT * pObject, CK_ATTRIBUTE_PTR pTemplate,
+				  CK_ULONG ulCount);
 	CK_RV cal_read_object(CK_SLOT_ID hSlot, P11_OBJECT * pObject);
 	CK_RV cal_sign(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData,
 		       unsigned char *in, unsigned long l_in,
 		       unsigned char *out, unsigned long *l_out);
+	CK_RV cal_sign_batch(CK_SLOT_ID hSlot, P11_SIGN_DATA * pSignData,
+			     CK_BEID_SIGN_ITEM_PTR pItems, CK_ULONG ulCount);
 	CK_RV cal_validate_session(P11_SESSION * pSession);
 	CK_RV cal_update_token(CK_SLOT_ID hSlot, int *pStatus, int bPresenceOnly);
 	CK_RV cal_wait_for_slot_event(int block);
 	CK_RV cal_wait_for_the_slot_event(int block);
 	CK_RV cal_get_slot_changes(int *ph);
 	CK_RV cal_refresh_readers(void);
+	CK_RV cal_get_apdu_stats(CK_BEID_APDU_STATS_PTR pStats, CK_BBOOL bReset);
 
 #ifdef __cplusplus
 }
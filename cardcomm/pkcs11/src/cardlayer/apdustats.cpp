@@ -0,0 +1,173 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "apdustats.h"
+#include "common/configuration.h"
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#ifdef WIN32
+#define stat_add(p, n)		InterlockedExchangeAdd((volatile LONG *) (p), (LONG) (n))
+#define stat_add64(p, n)	InterlockedExchangeAdd64((volatile LONGLONG *) (p), (LONGLONG) (n))
+#define THREAD_LOCAL		__declspec(thread)
+#else
+#define stat_add(p, n)		__sync_fetch_and_add((p), (n))
+#define stat_add64(p, n)	__sync_fetch_and_add((p), (n))
+#define THREAD_LOCAL		__thread
+#endif
+
+namespace eIDMW
+{
+
+	volatile bool CApduStats::m_bEnabled = false;
+	std::string CApduStats::m_csDumpFile;
+	tApduStats CApduStats::m_stats;
+
+	// APDUs sent by this thread, to tell a call's own APDUs from those
+	// sent at the same time for another slot
+	static THREAD_LOCAL unsigned long tlsApdus = 0;
+
+	void CApduStats::Init()
+	{
+		// EID_APDU_STATS: 0 = off, 1 = on, anything else = on, and the
+		// file to write the counters to on C_Finalize
+		const char *csEnv = getenv("EID_APDU_STATS");
+
+		if (csEnv != NULL && csEnv[0] != '\0')
+		{
+			m_bEnabled = strcmp(csEnv, "0") != 0;
+			m_csDumpFile = (m_bEnabled && strcmp(csEnv, "1") != 0) ? csEnv : "";
+			return;
+		}
+
+		m_csDumpFile = "";
+		try
+		{
+			m_bEnabled = CConfig::GetLong(CConfig::EIDMW_CONFIG_PARAM_GENERAL_APDUSTATS) != 0;
+		}
+		catch (...)
+		{
+			m_bEnabled = false;
+		}
+	}
+
+	unsigned long long CApduStats::Now()
+	{
+#ifdef WIN32
+		static LARGE_INTEGER freq;
+		LARGE_INTEGER now;
+
+		if (freq.QuadPart == 0)
+			QueryPerformanceFrequency(&freq);
+		QueryPerformanceCounter(&now);
+		return (unsigned long long) (now.QuadPart / freq.QuadPart) * 1000000 +
+			(unsigned long long) (now.QuadPart % freq.QuadPart) * 1000000 / freq.QuadPart;
+#elif defined(CLOCK_MONOTONIC)
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (unsigned long long) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+		struct timeval tv;
+
+		gettimeofday(&tv, NULL);
+		return (unsigned long long) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+	}
+
+	void CApduStats::Transmit(unsigned char ucINS, unsigned long ulSent, unsigned long ulReceived,
+				  unsigned long long ullUs)
+	{
+		tInsStats & ins = m_stats.ins[ucINS];
+
+		stat_add(&ins.ulCount, 1);
+		stat_add(&ins.ulBytesSent, ulSent);
+		stat_add(&ins.ulBytesReceived, ulReceived);
+		stat_add64(&ins.ullTransmitUs, ullUs);
+		tlsApdus++;
+	}
+
+	void CApduStats::Slept(unsigned long ulMs)
+	{
+		if (ulMs != 0)
+			stat_add64(&m_stats.ullSleepUs, (unsigned long long) ulMs * 1000);
+	}
+
+	void CApduStats::SleepSaved(unsigned long ulMs)
+	{
+		if (ulMs != 0)
+			stat_add64(&m_stats.ullSleepSavedUs, (unsigned long long) ulMs * 1000);
+	}
+
+	void CApduStats::DelayBackoff()
+	{
+		stat_add(&m_stats.ulDelayBackoffs, 1);
+	}
+
+	void CApduStats::Retry()
+	{
+		stat_add(&m_stats.ulRetries, 1);
+	}
+
+	void CApduStats::Recovery()
+	{
+		stat_add(&m_stats.ulRecoveries, 1);
+	}
+
+	void CApduStats::Transaction(unsigned long long ullHeldUs)
+	{
+		stat_add(&m_stats.ulTransactions, 1);
+		stat_add64(&m_stats.ullTransactionUs, ullHeldUs);
+	}
+
+	unsigned long CApduStats::ThreadApdus()
+	{
+		return tlsApdus;
+	}
+
+	void CApduStats::Call(unsigned int uiCall, unsigned long ulApdus, unsigned long long ullUs)
+	{
+		if (uiCall >= APDUSTATS_MAX_CALLS)
+			return;
+
+		tCallStats & call = m_stats.calls[uiCall];
+
+		stat_add(&call.ulCount, 1);
+		stat_add(&call.ulApdus, ulApdus);
+		stat_add64(&call.ullTimeUs, ullUs);
+	}
+
+	void CApduStats::Get(tApduStats & stats)
+	{
+		memcpy(&stats, (const void *) &m_stats, sizeof(stats));
+	}
+
+	void CApduStats::Reset()
+	{
+		memset((void *) &m_stats, 0, sizeof(m_stats));
+	}
+
+}
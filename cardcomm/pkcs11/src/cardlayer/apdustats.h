@@ -0,0 +1,145 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * Counters for the communication with the card: APDUs and bytes per INS,
+ * the time spent in SCardTransmit() versus the delays we add ourselves,
+ * how long card transactions are held, retries and recoveries, and the
+ * time and APDUs per card layer call (as numbered by the caller).
+ *
+ * They are process wide and only updated with atomic adds, so they cost
+ * next to nothing; and nothing at all unless enabled by the apdu_stats
+ * setting or the EID_APDU_STATS environment variable.
+ */
+
+#pragma once
+
+#ifndef APDUSTATS_H
+#define APDUSTATS_H
+
+#include <string>
+
+#define APDUSTATS_MAX_CALLS	16
+
+namespace eIDMW
+{
+
+	typedef struct
+	{
+		unsigned long ulCount;
+		unsigned long ulBytesSent;
+		unsigned long ulBytesReceived;
+		unsigned long long ullTransmitUs;
+	} tInsStats;
+
+	typedef struct
+	{
+		unsigned long ulCount;
+		unsigned long ulApdus;
+		unsigned long long ullTimeUs;
+	} tCallStats;
+
+	typedef struct
+	{
+		unsigned long long ullSleepUs;
+		unsigned long long ullSleepSavedUs;
+		unsigned long ulDelayBackoffs;
+		unsigned long ulTransactions;
+		unsigned long long ullTransactionUs;
+		unsigned long ulRetries;
+		unsigned long ulRecoveries;
+		tCallStats calls[APDUSTATS_MAX_CALLS];
+		tInsStats ins[256];
+	} tApduStats;
+
+	class CApduStats
+	{
+public:
+	/** Reads the settings; may be called more than once */
+		static void Init();
+
+		static bool IsEnabled()
+		{
+			return m_bEnabled;
+		}
+
+	/** The file to write the counters to on C_Finalize ("-" = stderr), or "" */
+		static const std::string & GetDumpFile()
+		{
+			return m_csDumpFile;
+		}
+
+	/** A monotonic clock, in usec */
+		static unsigned long long Now();
+
+		static void Transmit(unsigned char ucINS, unsigned long ulSent, unsigned long ulReceived,
+				     unsigned long long ullUs);
+		static void Slept(unsigned long ulMs);
+	/** For the adaptive reader delays: the time not slept compared to the
+	 * fixed delays, and a delay that had to be increased */
+		static void SleepSaved(unsigned long ulMs);
+		static void DelayBackoff();
+		static void Retry();
+		static void Recovery();
+		static void Transaction(unsigned long long ullHeldUs);
+
+	/** The APDUs sent by the calling thread so far, for CCallStats */
+		static unsigned long ThreadApdus();
+		static void Call(unsigned int uiCall, unsigned long ulApdus, unsigned long long ullUs);
+
+	/** Copies the counters; they are not a consistent snapshot while APDUs are being sent */
+		static void Get(tApduStats & stats);
+		static void Reset();
+
+private:
+		static volatile bool m_bEnabled;
+		static std::string m_csDumpFile;
+		static tApduStats m_stats;
+	};
+
+	/** Adds the time and APDUs between its construction and destruction to a call's counters */
+	class CCallStats
+	{
+public:
+		CCallStats(unsigned int uiCall) :m_uiCall(uiCall), m_bEnabled(CApduStats::IsEnabled())
+		{
+			if (m_bEnabled)
+			{
+				m_ulApdus = CApduStats::ThreadApdus();
+				m_ullStart = CApduStats::Now();
+			}
+		}
+
+		~CCallStats()
+		{
+			if (m_bEnabled)
+				CApduStats::Call(m_uiCall, CApduStats::ThreadApdus() - m_ulApdus,
+						 CApduStats::Now() - m_ullStart);
+		}
+
+private:
+		unsigned int m_uiCall;
+		bool m_bEnabled;
+		unsigned long m_ulApdus;
+		unsigned long long m_ullStart;
+	};
+
+}
+#endif
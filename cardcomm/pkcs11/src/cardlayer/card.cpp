@@ -23,6 +23,7 @@
 #include "common/log.h"
 #include "common/thread.h"
 #include "pinpad2.h"
+#include "apdustats.h"
 
 #ifdef FUZZING_BUILD_MODE_UNSAFE_FOR_PRODUCTION
 static std::string fuzz_path = "";
@@ -47,8 +48,9 @@ namespace eIDMW
 {
 
 	CCard::CCard(SCARDHANDLE hCard, CContext * poContext, CPinpad * poPinpad, tSelectAppletMode selectAppletMode, tCardType cardType)
-	  : m_hCard(hCard), m_poContext(poContext), m_poPinpad(poPinpad), m_cardType(cardType), m_ulLockCount(0),
-	    m_bSerialNrString(false), m_selectAppletMode(selectAppletMode), m_ulRemaining(1), m_ucAppletVersion(0), m_ul6CDelay(0), m_ucCLA(0)
+	  : m_hCard(hCard), m_poContext(poContext), m_poPinpad(poPinpad), m_cardType(cardType), m_ulLockCount(0), m_ullLockedAt(0),
+	    m_bSerialNrString(false), m_selectAppletMode(selectAppletMode), m_ulRemaining(1), m_ucAppletVersion(0), m_ul6CDelay(0), m_iExtendedLength(-1),
+	    m_bSecurityEnvSet(false), m_ulSecurityEnvKeyRef(0), m_ulSecurityEnvAlgo(0), m_bNeedsStatus(false), m_ucCLA(0)
 	{
 		try
 		{
@@ -87,6 +89,7 @@ namespace eIDMW
 
 	void CCard::Disconnect(tDisconnectMode disconnectMode)
 	{
+		InvalidateSelection();
 		if (m_hCard != 0)
 		{
 			SCARDHANDLE hTemp = m_hCard;
@@ -108,7 +111,12 @@ namespace eIDMW
 
 	bool CCard::Status()
 	{
-		return m_poContext->m_oPCSC.Status(m_hCard);
+		bool bPresent = m_poContext->m_oPCSC.Status(m_hCard);
+
+		if (bPresent)
+			m_bNeedsStatus = false;
+
+		return bPresent;
 	}
 
 	bool CCard::IsPinpadReader()
@@ -130,7 +138,21 @@ namespace eIDMW
 	void CCard::Lock()
 	{
 		if (m_ulLockCount == 0)
-			m_poContext->m_oPCSC.BeginTransaction(m_hCard);
+		{
+			// Others may have used the card since our last transaction
+			InvalidateSelection();
+			try
+			{
+				m_poContext->m_oPCSC.BeginTransaction(m_hCard);
+			}
+			catch (...)
+			{
+				m_bNeedsStatus = true;
+				throw;
+			}
+			if (CApduStats::IsEnabled())
+				m_ullLockedAt = CApduStats::Now();
+		}
 		m_ulLockCount++;
 	}
 
@@ -142,7 +164,13 @@ namespace eIDMW
 		{
 			m_ulLockCount--;
 			if (m_ulLockCount == 0)
+			{
+				InvalidateSelection();
 				m_poContext->m_oPCSC.EndTransaction(m_hCard);
+				if (CApduStats::IsEnabled() && m_ullLockedAt != 0)
+					CApduStats::Transaction(CApduStats::Now() - m_ullLockedAt);
+				m_ullLockedAt = 0;
+			}
 		}
 	}
 
@@ -197,14 +225,40 @@ namespace eIDMW
 		}
 		return CByteArray();
 #endif
-		CByteArray oData(ulMaxLen);
 		CAutoLock autolock(this);
-		SelectFile(csPath);
+		CByteArray oSelResp = SelectFile(csPath);
+
+		// Reserve the whole file up front if we know (or have been told)
+		// how large it is, instead of growing the buffer for each chunk
+		unsigned long ulCapacity = GetFileSizeFromFCI(oSelResp);
+		if (ulCapacity > ulOffset)
+			ulCapacity -= ulOffset;
+		else if (ulMaxLen != FULL_FILE && ulMaxLen <= 65536)
+			ulCapacity = ulMaxLen;
+		else
+			ulCapacity = MAX_APDU_READ_LEN;
+		if (ulCapacity > ulMaxLen)
+			ulCapacity = ulMaxLen;
+		CByteArray oData(NULL, 0, ulCapacity);
 
 		// Loop until we've read ulMaxLen bytes or until EOF (End Of File)
 		bool bEOF = false;
+		unsigned long i = 0;
 
-		for (unsigned long i = 0; i < ulMaxLen && !bEOF; i += MAX_APDU_READ_LEN)
+		// First try large chunks with an extended Le; on the first sign that
+		// the card or reader doesn't like that, continue with short APDUs
+		while (i < ulMaxLen && !bEOF && ExtendedLengthSupported())
+		{
+			unsigned long ulLen = ulMaxLen - i <= MAX_APDU_EXT_READ_LEN ? ulMaxLen - i : MAX_APDU_EXT_READ_LEN;
+			unsigned long ulPrevSize = oData.Size();
+			bool bExt = ReadBinaryExt(ulOffset + i, ulLen, oData, bEOF);
+
+			i += oData.Size() - ulPrevSize;
+			if (!bExt)
+				break;
+		}
+
+		for (; i < ulMaxLen && !bEOF; i += MAX_APDU_READ_LEN)
 		{
 			unsigned long ulLen = ulMaxLen - i <= MAX_APDU_READ_LEN ? ulMaxLen - i : MAX_APDU_READ_LEN;
 
@@ -250,16 +304,49 @@ namespace eIDMW
 		return oData;
 	}
 
+	std::vector < CByteArray > CCard::ReadFiles(const std::vector < std::string > &vcsPaths)
+	{
+		std::vector < CByteArray > voData(vcsPaths.size());
+
+		// One transaction for all of them, so the card stays in the
+		// DF of the previous file (see SelectFile())
+		CAutoLock autolock(this);
+
+		for (size_t i = 0; i < vcsPaths.size(); i++)
+			voData[i] = ReadFile(vcsPaths[i]);
+
+		return voData;
+	}
+
 	CByteArray CCard::SendAPDU(const CByteArray & oCmdAPDU)
 	{
 		CAutoLock oAutoLock(this);
 		long lRetVal = 0;
+		CByteArray oResp;
 
-		CByteArray oResp = m_poContext->m_oPCSC.Transmit(m_hCard, oCmdAPDU, &lRetVal);
+		// SelectFile() records the new selection once it succeeded
+		if (oCmdAPDU.Size() > 1 && oCmdAPDU.GetByte(1) == 0xA4)
+			InvalidateSelection();
+
+		try
+		{
+			oResp = m_poContext->m_oPCSC.Transmit(m_hCard, oCmdAPDU, &lRetVal);
+		}
+		catch (...)
+		{
+			// e.g. the card was reset or we lost the transaction
+			InvalidateSelection();
+			m_bNeedsStatus = true;
+			throw;
+		}
 
 		if (m_cardType == CARD_BEID && (lRetVal == SCARD_E_COMM_DATA_LOST || lRetVal == SCARD_E_NOT_TRANSACTED))
 		{
+			InvalidateSelection();
 			m_poContext->m_oPCSC.Recover(m_hCard, &m_ulLockCount);
+			// Recover() resets the card, so the PINs aren't verified anymore
+			// either (the selection and security environment are forgotten above)
+			m_verifiedPINs.clear();
 			// try again to select the applet
 			CByteArray oData;
 			CByteArray oCmd(40);
@@ -303,7 +390,11 @@ namespace eIDMW
 				unsigned long ulDelay = Get6CDelay();
 
 				if (ulDelay != 0)
+				{
 					CThread::SleepMillisecs(ulDelay);
+					if (CApduStats::IsEnabled())
+						CApduStats::Slept(ulDelay);
+				}
 
 				return SendAPDU(oNewCmdAPDU);
 			}
@@ -589,6 +680,7 @@ namespace eIDMW
 
 	bool CCard::LogOff(const tPin & Pin)
 	{
+		InvalidateSecurityEnv();
 		m_ucCLA = 0x80;
 
 		// No PIN has to be specified
@@ -622,6 +714,8 @@ namespace eIDMW
 #define EXCL17 if(m_ucAppletVersion != 0x17) { MWLOG(LEV_WARN, MOD_CAL, L"MSE SET: PSS not supported on pre V1.7 cards"); throw CMWEXCEPTION(EIDMW_ERR_NOT_SUPPORTED);}
 	void CCard::SetSecurityEnv(const tPrivKey & key, unsigned long algo, unsigned long ulInputLen)
 	{
+		InvalidateSecurityEnv();
+
 		// Data = [04 80 <algoref> 84 <keyref>]  (5 bytes)
 		CByteArray oData(5);
 		oData.Append(0x04);
@@ -702,6 +796,15 @@ namespace eIDMW
 			}
 		}
 		getSW12(oResp, 0x9000);
+
+		m_bSecurityEnvSet = true;
+		m_ulSecurityEnvKeyRef = key.ulKeyRef;
+		m_ulSecurityEnvAlgo = algo;
+	}
+
+	void CCard::InvalidateSecurityEnv()
+	{
+		m_bSecurityEnvSet = false;
 	}
 
 	CByteArray CCard::SignInternal(const tPrivKey & key, unsigned long algo,
@@ -729,7 +832,15 @@ namespace eIDMW
 				SelectApplet();
 			}
 		}
-		SetSecurityEnv(key, algo, oData.Size());
+		// Another signature with the same key and algorithm in this
+		// transaction can reuse the security environment. A PIN verify
+		// has to follow a fresh MSE SET though.
+		bool bReuseEnv = pPin == NULL && m_bSecurityEnvSet &&
+			m_ulSecurityEnvKeyRef == key.ulKeyRef && m_ulSecurityEnvAlgo == algo;
+		if (bReuseEnv)
+			MWLOG(LEV_DEBUG, MOD_CAL, L"     Reusing the security environment for key 0x%0x", key.ulKeyRef);
+		else
+			SetSecurityEnv(key, algo, oData.Size());
 
 		// Pretty unique for smart cards: first MSE SET, then verify PIN
 		// (needed for the nonrep key/pin, but also usable for the auth key/pin)
@@ -743,13 +854,25 @@ namespace eIDMW
 				m_ulRemaining = ulRemaining;
 				throw CMWEXCEPTION(ulRemaining == 0 ? EIDMW_ERR_PIN_BLOCKED : EIDMW_ERR_PIN_BAD);
 			}
+			// PinCmd() forgot the environment, but this verify is
+			// the one that was meant to follow it
+			m_bSecurityEnvSet = true;
 		}
 
 		// PSO: Compute Digital Signature
 		CByteArray oResp = SendAPDU(0x2A, 0x9E, 0x9A, oData);
 		unsigned long ulSW12 = getSW12(oResp);
 
+		if (ulSW12 != 0x9000 && bReuseEnv && ulSW12 != 0x6982)
+		{
+			// The card may have dropped the environment after all
+			SetSecurityEnv(key, algo, oData.Size());
+			oResp = SendAPDU(0x2A, 0x9E, 0x9A, oData);
+			ulSW12 = getSW12(oResp);
+		}
+
 		if (ulSW12 != 0x9000) {
+			InvalidateSecurityEnv();
 			throw CMWEXCEPTION(m_poContext->m_oPCSC.SW12ToErr(ulSW12));
 		}
 
@@ -770,6 +893,7 @@ namespace eIDMW
 
 	bool CCard::SelectApplet()
 	{
+		InvalidateSelection();
 		return BeidCardSelectApplet(m_poContext, m_hCard);
 	}
 
@@ -909,6 +1033,9 @@ namespace eIDMW
 		if (operation == PIN_OP_LOGOFF)
 			return LogOff(Pin);
 
+		// The MSE SET before a signature has to precede its PIN verify
+		InvalidateSecurityEnv();
+
 		bool bRet = false;
 
 		std::string csReadPin1, csReadPin2;
@@ -1081,7 +1208,7 @@ namespace eIDMW
 	}
 
 
-	void CCard::SelectFile(const std::string & csPath)
+	CByteArray CCard::SelectFile(const std::string & csPath)
 	{
 		CByteArray oResp;
 
@@ -1096,11 +1223,28 @@ namespace eIDMW
 
 		CAutoLock autolock(this);
 
-		if (m_selectAppletMode == ALW_SELECT_APPLET)
+		// Still selected by an earlier command in this transaction
+		if (!m_csSelectedPath.empty() && csPath == m_csSelectedPath)
+		{
+			MWLOG(LEV_DEBUG, MOD_CAL, L"   Select file %ls: already selected", utilStringWiden(csPath).c_str());
+			return m_oSelectResp;
+		}
+
+		// If we know which DF the card is in, we know whether the file ID
+		// alone will do, or whether the full path is needed
+		bool bInParentDF = !m_csSelectedDF.empty() && ulPathLen > 2 &&
+			csPath.compare(0, csPath.size() - 4, m_csSelectedDF) == 0;
+		bool bInOtherDF = !m_csSelectedDF.empty() && !bInParentDF;
+
+		if (m_selectAppletMode == ALW_SELECT_APPLET && !bInParentDF)
 		{
 			SelectApplet();
 			oResp = SelectByPath(csPath);
 		}
+		else if (bInOtherDF)
+		{
+			oResp = SelectByPath(csPath);
+		}
 		else
 		{
 			// First try to select the file by ID, assuming we're in the correct DF
@@ -1119,6 +1263,8 @@ namespace eIDMW
 					throw CMWEXCEPTION(m_poContext->m_oPCSC.SW12ToErr(ulSW12));
 
 				// The file wasn't found in this DF, so let's select by full path
+				if (m_selectAppletMode == ALW_SELECT_APPLET)
+					SelectApplet();
 				oResp = SelectByPath(csPath);
 			}
 			else
@@ -1126,6 +1272,36 @@ namespace eIDMW
 				getSW12(oResp, 0x9000);
 			}
 		}
+
+		SetSelection(csPath, oResp);
+		return oResp;
+	}
+
+	void CCard::SetSelection(const std::string & csPath, const CByteArray & oResp)
+	{
+		// Only absolute paths tell us where we are
+		if (csPath.size() < 4 || csPath.compare(0, 4, "3F00") != 0)
+		{
+			InvalidateSelection();
+			return;
+		}
+
+		// The Belpic DFs are the MF and DFxx; anything else is an EF
+		std::string csLastID = csPath.substr(csPath.size() - 4);
+		bool bIsDF = csLastID == "3F00" || csLastID.compare(0, 2, "DF") == 0;
+
+		m_csSelectedPath = csPath;
+		m_csSelectedDF = bIsDF ? csPath : csPath.substr(0, csPath.size() - 4);
+		m_oSelectResp = oResp;
+	}
+
+	void CCard::InvalidateSelection()
+	{
+		m_csSelectedPath.clear();
+		m_csSelectedDF.clear();
+		// selecting a DF or resetting the card also resets the
+		// security environment
+		InvalidateSecurityEnv();
 	}
 
 
@@ -1225,6 +1401,209 @@ namespace eIDMW
 		return SendAPDU(0xB0, (unsigned char)(ulOffset / 256), (unsigned char)(ulOffset % 256), (unsigned char)(ulLen));
 	}
 
+	/**
+	 * Read Binary with a 3-byte extended Le (00 LeHi LeLo). The command
+	 * is sent directly, since SendAPDU() would turn a 61XX or 6CXX
+	 * response into a short Get Response or re-issued command.
+	 * The data is appended to oData; returns false (and remembers that
+	 * extended length can't be used) if the card or reader refused it.
+	 * On a card whose ATR doesn't tell, each one is a probe until more
+	 * than a short Le's worth of data proves that it works. A shorter
+	 * answer is the end of the file whether or not the card used the
+	 * extended Le, so small files don't cost an extra APDU; only an
+	 * answer of exactly the short Le can't tell, and settles it as no.
+	 */
+	bool CCard::ReadBinaryExt(unsigned long ulOffset, unsigned long ulLen, CByteArray & oData, bool & bEOF)
+	{
+		CByteArray oCmd(7);
+
+		oCmd.Append(m_ucCLA);
+		oCmd.Append(0xB0);
+		oCmd.Append((unsigned char)(ulOffset / 256));
+		oCmd.Append((unsigned char)(ulOffset % 256));
+		oCmd.Append(0x00);
+		oCmd.Append((unsigned char)(ulLen / 256));
+		oCmd.Append((unsigned char)(ulLen % 256));
+
+		CByteArray oResp;
+		long lRetVal = 0;
+
+		try
+		{
+			oResp = m_poContext->m_oPCSC.Transmit(m_hCard, oCmd, &lRetVal);
+		}
+		catch(CMWException & e)
+		{
+			long lErr = e.GetError();
+
+			// Nothing to do with the extended Le; the caller handles these
+			if (lErr == EIDMW_ERR_NO_CARD || lErr == EIDMW_ERR_CARD_RESET
+			    || lErr == EIDMW_ERR_NOT_TRANSACTED || lErr == EIDMW_ERR_NO_READER)
+				throw;
+
+			MWLOG(LEV_INFO, MOD_CAL, L"   Extended Read Binary failed (err 0x%0x), using short APDUs", lErr);
+			m_iExtendedLength = 0;
+			return false;
+		}
+
+		unsigned long ulSW12 = getSW12(oResp);
+
+		if (ulSW12 == 0x9000 || ulSW12 == 0x6282)
+		{
+			unsigned long ulRecv = oResp.Size() - 2;
+
+			oData.Append(oResp.GetBytes(), ulRecv);
+			if (m_iExtendedLength < 0 && ulRecv > 256)
+			{
+				MWLOG(LEV_INFO, MOD_CAL, L"   Extended Read Binary works, using it for this card");
+				m_iExtendedLength = 1;
+			}
+			else if (m_iExtendedLength < 0 && ulSW12 == 0x9000 && ulRecv < ulLen
+				 && ulRecv == (ulLen % 256 == 0 ? 256 : ulLen % 256))
+			{
+				// The end of the file, or a card that took the low
+				// byte of the extended Le as a short Le: the short
+				// APDUs go on from here, for this card too
+				MWLOG(LEV_INFO, MOD_CAL, L"   Extended Read Binary returned %d bytes, can't tell if it works, using short APDUs", ulRecv);
+				m_iExtendedLength = 0;
+				return false;
+			}
+			if (ulSW12 == 0x6282 || ulRecv < ulLen)
+				bEOF = true;
+			return true;
+		}
+		if (ulSW12 == 0x6B00 && ulOffset != 0)
+		{
+			bEOF = true;
+			return true;
+		}
+		if (ulSW12 == 0x6982)
+			throw CNotAuthenticatedException(EIDMW_ERR_NOT_AUTHENTICATED);
+
+		// 6700, 6D00, 6E00, 6A86, 61XX, 6CXX, ...: let the short
+		// APDUs (and their error handling) take over from here
+		MWLOG(LEV_INFO, MOD_CAL, L"   Extended Read Binary returned SW12 = %04X, using short APDUs", ulSW12);
+		m_iExtendedLength = 0;
+		return false;
+	}
+
+	bool CCard::ExtendedLengthSupported()
+	{
+		// No Belpic ATR announces it, so if the ATR doesn't either the
+		// next Read Binary tries it once (see ReadBinaryExt())
+		if (m_iExtendedLength < 0 && ATRIndicatesExtendedLength(GetATR()))
+			m_iExtendedLength = 1;
+
+		return m_iExtendedLength != 0;
+	}
+
+	/**
+	 * Look for the card capabilities (compact-TLV tag 7, ISO 7816-4 8.1.1.2.7)
+	 * in the historical bytes of the ATR; bit 7 of the 3rd byte indicates
+	 * support for extended Lc and Le fields.
+	 */
+	bool CCard::ATRIndicatesExtendedLength(const CByteArray & oATR)
+	{
+		unsigned long ulSize = oATR.Size();
+		const unsigned char *pucATR = oATR.GetBytes();
+
+		if (ulSize < 2)
+			return false;
+
+		// Skip TS, T0 and the interface bytes
+		unsigned long ulHistLen = pucATR[1] & 0x0F;
+		unsigned long ulPos = 1;
+		unsigned char ucY = pucATR[1] & 0xF0;
+
+		while (ucY != 0)
+		{
+			unsigned char ucTD = 0;
+
+			for (int bit = 0x10; bit <= 0x80; bit <<= 1)
+			{
+				if (ucY & bit)
+				{
+					ulPos++;
+					if (ulPos >= ulSize)
+						return false;
+					if (bit == 0x80)
+						ucTD = pucATR[ulPos];
+				}
+			}
+			ucY = ucTD & 0xF0;
+		}
+		ulPos++;
+
+		if (ulHistLen == 0 || ulPos + ulHistLen > ulSize)
+			return false;
+
+		const unsigned char *pucHist = pucATR + ulPos;
+		unsigned long ulEnd = ulHistLen;
+
+		// Category indicator: 0x80 = compact-TLV objects, 0x00 = compact-TLV
+		// objects followed by a 3-byte status indicator
+		if (pucHist[0] == 0x00)
+		{
+			if (ulEnd < 4)
+				return false;
+			ulEnd -= 3;
+		}
+		else if (pucHist[0] != 0x80)
+			return false;
+
+		for (unsigned long j = 1; j < ulEnd;)
+		{
+			unsigned char ucTag = pucHist[j] >> 4;
+			unsigned long ulLen = pucHist[j] & 0x0F;
+
+			if (j + 1 + ulLen > ulEnd)
+				break;
+			if (ucTag == 0x07 && ulLen >= 3)
+				return (pucHist[j + 3] & 0x40) != 0;
+			j += 1 + ulLen;
+		}
+
+		return false;
+	}
+
+	/**
+	 * Returns the file size (tag 80 or 81) from an FCP/FCI template
+	 * returned by a Select File, or 0 if it isn't there.
+	 */
+	unsigned long CCard::GetFileSizeFromFCI(const CByteArray & oResp)
+	{
+		unsigned long ulSize = oResp.Size();
+		const unsigned char *pucResp = oResp.GetBytes();
+
+		if (ulSize < 4 || pucResp[ulSize - 2] != 0x90 || pucResp[ulSize - 1] != 0x00)
+			return 0;
+		if (pucResp[0] != 0x62 && pucResp[0] != 0x6F)
+			return 0;
+
+		unsigned long ulEnd = 2 + pucResp[1];
+		if (pucResp[1] > 0x7F || ulEnd > ulSize - 2)
+			return 0;
+
+		for (unsigned long j = 2; j + 2 <= ulEnd;)
+		{
+			unsigned char ucTag = pucResp[j];
+			unsigned long ulLen = pucResp[j + 1];
+
+			if (ulLen > 0x7F || j + 2 + ulLen > ulEnd)
+				break;
+			if ((ucTag == 0x80 || ucTag == 0x81) && ulLen >= 1 && ulLen <= 4)
+			{
+				unsigned long ulFileSize = 0;
+				for (unsigned long k = 0; k < ulLen; k++)
+					ulFileSize = (ulFileSize << 8) | pucResp[j + 2 + k];
+				return ulFileSize;
+			}
+			j += 2 + ulLen;
+		}
+
+		return 0;
+	}
+
 	CByteArray CCard::UpdateBinary(unsigned long ulOffset, const CByteArray & oData)
 	{
 		// Update Binary
@@ -76,6 +76,10 @@ namespace eIDMW
 
 		/** Return true if there is definitely a card in the reader, false otherwise */
 		bool Status();
+		/** Return true if a card command or transaction failed since the
+			last successful Status(), e.g. because another application
+			reset the card; the card shouldn't be trusted before asking Status() */
+		bool NeedsStatus() { return m_bNeedsStatus; };
 
 		/** Return true if the card reader has a PIN pad */
 		bool IsPinpadReader();
@@ -96,6 +100,9 @@ namespace eIDMW
 		void SelectApplication(const CByteArray & oAID);
 
 		CByteArray ReadFile(const std::string & csPath, unsigned long ulOffset = 0, unsigned long ulMaxLen = FULL_FILE);
+		/** Read several complete files, in the given order, within one
+			transaction; returns their contents in the same order */
+		std::vector < CByteArray > ReadFiles(const std::vector < std::string > &vcsPaths);
 
 		unsigned long PinStatus(const tPin & Pin);
 		bool PinCmd(tPinOperation operation, const tPin & Pin, const std::string & csPin1,
@@ -144,6 +151,11 @@ namespace eIDMW
 		std::vector < unsigned long >m_verifiedPINs;
 
 		CByteArray ReadBinary(unsigned long ulOffset, unsigned long ulLen);
+		/** Returns false if the card or reader doesn't support extended Le */
+		bool ReadBinaryExt(unsigned long ulOffset, unsigned long ulLen, CByteArray & oData, bool & bEOF);
+		bool ExtendedLengthSupported();
+		static bool ATRIndicatesExtendedLength(const CByteArray & oATR);
+		static unsigned long GetFileSizeFromFCI(const CByteArray & oResp);
 		CByteArray UpdateBinary(unsigned long ulOffset, const CByteArray & oData);
 		unsigned char PinUsage2Pinpad(const tPin & Pin, const tPrivKey * pKey);
 		DlgPinOperation PinOperation2Dlg(tPinOperation operation);
@@ -168,8 +180,16 @@ namespace eIDMW
 		bool SelectApplet();
 
 		tBelpicDF getDF(const std::string & csPath, unsigned long &ulOffset);
-		void SelectFile(const std::string & csPath);
+		/** Returns the response to the last select command (the FCI, if the card returned one) */
+		CByteArray SelectFile(const std::string & csPath);
 		CByteArray SelectByPath(const std::string & csPath);
+		/** Remember which file SelectFile() left selected */
+		void SetSelection(const std::string & csPath, const CByteArray & oResp);
+		/** Forget it, after anything that may change the card's selection
+		 *  (another SELECT, a reset, or the end of our transaction) */
+		void InvalidateSelection();
+		/** Forget which key/algorithm the last MSE SET selected */
+		void InvalidateSecurityEnv();
 
 		void showPinDialog(tPinOperation operation, const tPin & Pin, std::string & csPin1,
 			std::string & csPin2, const tPrivKey * pKey);
@@ -182,6 +202,7 @@ namespace eIDMW
 		CPinpad *m_poPinpad;
 		tCardType m_cardType;
 		unsigned long m_ulLockCount;
+		unsigned long long m_ullLockedAt;	// for CApduStats, when the transaction began
 		bool m_bSerialNrString;
 		tSelectAppletMode m_selectAppletMode;
 		unsigned long m_ulRemaining;
@@ -189,15 +210,27 @@ namespace eIDMW
 		CByteArray m_oSerialNr;
 		unsigned char m_ucAppletVersion;
 		unsigned long m_ul6CDelay;
+		int m_iExtendedLength;	// -1 = not known yet (each Read Binary probes it), 0 = no, 1 = yes
+		// The key and algorithm of the last successful MSE SET; like the
+		// selection, only valid while we hold the transaction
+		bool m_bSecurityEnvSet;
+		unsigned long m_ulSecurityEnvKeyRef;
+		unsigned long m_ulSecurityEnvAlgo;
+		bool m_bNeedsStatus;	// see NeedsStatus()
 
 #ifdef WIN32
 #pragma warning(push)
 #pragma warning(disable:4251)	// m_csSerialNr does not need to have dll-interface
 #endif
 		std::string m_csSerialNr;
+		// What the card has selected, as far as we know. Only valid while
+		// we hold the transaction; empty if not known.
+		std::string m_csSelectedPath;	// the last selected file
+		std::string m_csSelectedDF;	// the DF it is in (or itself)
 #ifdef WIN32
 #pragma warning(pop)
 #endif
+		CByteArray m_oSelectResp;	// the response to that select
 
 		unsigned char m_ucCLA;
 
@@ -0,0 +1,1097 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#ifdef BEID_CARD_EMULATOR
+
+#ifdef UNICODE
+#undef UNICODE
+#endif
+
+#include "cardemu.h"
+#include "pcsc.h"
+#include "common/log.h"
+#include "common/thread.h"
+#include "common/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#define EMU_CONTEXT		((SCARDCONTEXT) 0x454D55)
+#define EMU_WAIT_SLICE		50	// msec
+#define EMU_PNP_READER		"\\\\?PnP?\\Notification"
+
+namespace eIDMW
+{
+	static const unsigned char BELPIC_AID[] = { 0xA0, 0x00, 0x00, 0x01, 0x77, 0x50, 0x4B, 0x43, 0x53, 0x2D, 0x31, 0x35 };
+	static const unsigned char APPLET_AID[] = { 0xA0, 0x00, 0x00, 0x00, 0x30, 0x29, 0x05, 0x70, 0x00, 0xAD, 0x13, 0x10, 0x01, 0x01, 0xFF };
+
+	// DigestInfo prefixes for the MSE SET algorithm references
+	static const unsigned char SHA1_PREFIX[] = {
+		0x30, 0x21, 0x30, 0x09, 0x06, 0x05, 0x2B, 0x0E, 0x03, 0x02, 0x1A, 0x05, 0x00, 0x04, 0x14
+	};
+	static const unsigned char MD5_PREFIX[] = {
+		0x30, 0x20, 0x30, 0x0C, 0x06, 0x08, 0x2A, 0x86, 0x48, 0x86, 0xF7, 0x0D, 0x02, 0x05, 0x05, 0x00, 0x04, 0x10
+	};
+	static const unsigned char SHA256_PREFIX[] = {
+		0x30, 0x31, 0x30, 0x0D, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+	};
+
+	static void AppendSW(CByteArray & oResp, unsigned long ulSW12)
+	{
+		oResp.Append((unsigned char) (ulSW12 >> 8));
+		oResp.Append((unsigned char) (ulSW12 & 0xFF));
+	}
+
+	/* RSA private key operation, on 32-bit limbs (least significant first)
+	 * with Montgomery multiplication. Slow compared to a real crypto library,
+	 * but fast enough for tests and without any dependency. */
+
+	typedef std::vector < unsigned int >tLimbs;
+
+	static tLimbs BytesToLimbs(const CByteArray & oBytes, size_t s)
+	{
+		tLimbs x(s, 0);
+		unsigned long ulSize = oBytes.Size();
+
+		for (unsigned long i = 0; i < ulSize && i / 4 < s; i++)
+			x[i / 4] |= ((unsigned int) oBytes.GetByte(ulSize - 1 - i)) << (8 * (i % 4));
+
+		return x;
+	}
+
+	static CByteArray LimbsToBytes(const tLimbs & x, unsigned long ulLen)
+	{
+		CByteArray oBytes(ulLen);
+
+		for (unsigned long i = ulLen; i > 0; i--)
+		{
+			unsigned long j = i - 1;
+
+			oBytes.Append(j / 4 < x.size() ? (unsigned char) (x[j / 4] >> (8 * (j % 4))) : 0);
+		}
+
+		return oBytes;
+	}
+
+	// r = a * b / R mod n, with R = 2^(32*s); r may be a or b
+	static void MontMul(const tLimbs & a, const tLimbs & b, const tLimbs & n, unsigned int n0inv, tLimbs & r)
+	{
+		size_t s = n.size();
+		std::vector < unsigned int >t(s + 2, 0);
+		unsigned long long cs;
+
+		for (size_t i = 0; i < s; i++)
+		{
+			unsigned int m;
+
+			cs = 0;
+			for (size_t j = 0; j < s; j++)
+			{
+				cs = (unsigned long long) t[j] + (unsigned long long) a[j] * b[i] + (cs >> 32);
+				t[j] = (unsigned int) cs;
+			}
+			cs = (unsigned long long) t[s] + (cs >> 32);
+			t[s] = (unsigned int) cs;
+			t[s + 1] = (unsigned int) (cs >> 32);
+
+			m = t[0] * n0inv;
+			cs = (unsigned long long) t[0] + (unsigned long long) m * n[0];
+			for (size_t j = 1; j < s; j++)
+			{
+				cs = (unsigned long long) t[j] + (unsigned long long) m * n[j] + (cs >> 32);
+				t[j - 1] = (unsigned int) cs;
+			}
+			cs = (unsigned long long) t[s] + (cs >> 32);
+			t[s - 1] = (unsigned int) cs;
+			t[s] = t[s + 1] + (unsigned int) (cs >> 32);
+		}
+
+		// t < 2n, so at most one subtraction
+		bool bGreaterEqual = t[s] != 0;
+
+		if (!bGreaterEqual)
+		{
+			size_t i = s;
+
+			while (i > 0 && t[i - 1] == n[i - 1])
+				i--;
+			bGreaterEqual = (i == 0) || t[i - 1] > n[i - 1];
+		}
+		r.resize(s);
+		if (bGreaterEqual)
+		{
+			unsigned long long borrow = 0;
+
+			for (size_t j = 0; j < s; j++)
+			{
+				cs = (unsigned long long) t[j] - n[j] - borrow;
+				r[j] = (unsigned int) cs;
+				borrow = (cs >> 63);
+			}
+		}
+		else
+		{
+			for (size_t j = 0; j < s; j++)
+				r[j] = t[j];
+		}
+	}
+
+	// Returns base^exp mod modulus, as many bytes as the modulus; base < modulus
+	static CByteArray ModExp(const CByteArray & oBase, const CByteArray & oExp, const CByteArray & oModulus)
+	{
+		size_t s = (oModulus.Size() + 3) / 4;
+		tLimbs n = BytesToLimbs(oModulus, s);
+		tLimbs rr(s, 0);
+		tLimbs one(s, 0);
+		tLimbs x, a;
+		unsigned int inv = 1;
+
+		// -1/n[0] mod 2^32 with Newton's iteration (n is odd)
+		for (int i = 0; i < 5; i++)
+			inv *= 2 - n[0] * inv;
+		inv = 0 - inv;
+
+		// R^2 mod n, by doubling 1 a 2*32*s times
+		rr[0] = 1;
+		for (size_t k = 0; k < 64 * s; k++)
+		{
+			unsigned int carry = 0;
+			bool bGreaterEqual;
+
+			for (size_t j = 0; j < s; j++)
+			{
+				unsigned int next = rr[j] >> 31;
+
+				rr[j] = (rr[j] << 1) | carry;
+				carry = next;
+			}
+			bGreaterEqual = carry != 0;
+			if (!bGreaterEqual)
+			{
+				size_t i = s;
+
+				while (i > 0 && rr[i - 1] == n[i - 1])
+					i--;
+				bGreaterEqual = (i == 0) || rr[i - 1] > n[i - 1];
+			}
+			if (bGreaterEqual)
+			{
+				unsigned long long borrow = 0;
+
+				for (size_t j = 0; j < s; j++)
+				{
+					unsigned long long d = (unsigned long long) rr[j] - n[j] - borrow;
+
+					rr[j] = (unsigned int) d;
+					borrow = d >> 63;
+				}
+			}
+		}
+
+		one[0] = 1;
+		MontMul(BytesToLimbs(oBase, s), rr, n, inv, a);
+		MontMul(one, rr, n, inv, x);
+		for (unsigned long i = 0; i < oExp.Size(); i++)
+		{
+			unsigned char uc = oExp.GetByte(i);
+
+			for (int bit = 7; bit >= 0; bit--)
+			{
+				MontMul(x, x, n, inv, x);
+				if ((uc >> bit) & 1)
+					MontMul(x, a, n, inv, x);
+			}
+		}
+		MontMul(x, one, n, inv, x);
+
+		return LimbsToBytes(x, oModulus.Size());
+	}
+
+	static CByteArray StripLeadingZeros(const CByteArray & oBytes)
+	{
+		unsigned long i = 0;
+
+		while (i < oBytes.Size() && oBytes.GetByte(i) == 0)
+			i++;
+
+		return oBytes.GetBytes(i);
+	}
+
+	// Reads a line of any length, without the line end; false at EOF
+	static bool ReadLine(FILE * f, std::string & csLine)
+	{
+		char csBuf[1024];
+
+		csLine.clear();
+		while (fgets(csBuf, sizeof(csBuf), f) != NULL)
+		{
+			csLine += csBuf;
+			if (csLine[csLine.size() - 1] == '\n')
+				break;
+		}
+		if (csLine.empty())
+			return false;
+
+		while (!csLine.empty() && (csLine[csLine.size() - 1] == '\n' || csLine[csLine.size() - 1] == '\r'))
+			csLine.erase(csLine.size() - 1);
+
+		return true;
+	}
+
+	// Splits off the first word of csLine
+	static std::string NextWord(std::string & csLine)
+	{
+		size_t start = csLine.find_first_not_of(" \t");
+
+		if (start == std::string::npos)
+		{
+			csLine.clear();
+			return "";
+		}
+		size_t end = csLine.find_first_of(" \t", start);
+		std::string csWord = csLine.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+		csLine = end == std::string::npos ? "" : csLine.substr(end + 1);
+
+		return csWord;
+	}
+
+	static std::string ToUpper(const std::string & csIn)
+	{
+		std::string csOut(csIn);
+
+		for (size_t i = 0; i < csOut.size(); i++)
+			if (csOut[i] >= 'a' && csOut[i] <= 'z')
+				csOut[i] = csOut[i] - 'a' + 'A';
+
+		return csOut;
+	}
+
+	CCardEmulator::CCardEmulator(const std::wstring & wsImage)
+		: m_wsImage(wsImage), m_bLoaded(false), m_ulLatency(0), m_ulByteLatency(0), m_ulSignLatency(0),
+		  m_bEnvSet(false), m_ucEnvAlgo(0), m_ucEnvKey(0), m_hLastCard(0), m_ulSleptUs(0), m_bCancelled(false)
+	{
+		Reset();
+	}
+
+	CCardEmulator::~CCardEmulator()
+	{
+		for (std::map < unsigned char, tEmuKey >::iterator it = m_keys.begin(); it != m_keys.end(); ++it)
+			it->second.oPrivExp.SecureClearContents();
+	}
+
+	bool CCardEmulator::Load()
+	{
+		FILE *f = NULL;
+		std::string csLine;
+		unsigned long ulLineNr = 0;
+		bool bOK = true;
+
+#ifdef WIN32
+		if (_wfopen_s(&f, m_wsImage.c_str(), L"r") != 0)
+			f = NULL;
+#else
+		f = fopen(utilStringNarrow(m_wsImage).c_str(), "r");
+#endif
+		if (f == NULL)
+		{
+			MWLOG(LEV_ERROR, MOD_CAL, L"Card emulator: can't open card image %ls", m_wsImage.c_str());
+			return false;
+		}
+
+		while (bOK && ReadLine(f, csLine))
+		{
+			std::string csKeyword = NextWord(csLine);
+
+			ulLineNr++;
+			if (csKeyword.empty() || csKeyword[0] == '#')
+				continue;
+
+			if (csKeyword == "reader")
+			{
+				size_t start = csLine.find_first_not_of(" \t");
+
+				m_csReader = start == std::string::npos ? "" : csLine.substr(start);
+			}
+			else if (csKeyword == "atr")
+				m_oATR = CByteArray(csLine, true);
+			else if (csKeyword == "carddata")
+				m_oCardData = CByteArray(csLine, true);
+			else if (csKeyword == "latency")
+				m_ulLatency = strtoul(csLine.c_str(), NULL, 10);
+			else if (csKeyword == "byte_latency")
+				m_ulByteLatency = strtoul(csLine.c_str(), NULL, 10);
+			else if (csKeyword == "sign_latency")
+				m_ulSignLatency = strtoul(csLine.c_str(), NULL, 10);
+			else if (csKeyword == "file")
+			{
+				std::string csPath = ToUpper(NextWord(csLine));
+
+				bOK = !csPath.empty() && csPath.size() % 4 == 0;
+				if (bOK)
+					m_files[csPath] = CByteArray(csLine, true);
+			}
+			else if (csKeyword == "pin")
+			{
+				tEmuPin pin;
+				unsigned long ulRef = strtoul(NextWord(csLine).c_str(), NULL, 16);
+				std::string csTries;
+
+				pin.csValue = NextWord(csLine);
+				csTries = NextWord(csLine);
+				pin.ulMaxTries = csTries.empty() ? 3 : strtoul(csTries.c_str(), NULL, 10);
+				pin.ulTries = pin.ulMaxTries;
+				pin.bVerified = false;
+				pin.bVerifiedAfterMSE = false;
+				bOK = ulRef <= 0xFF && pin.csValue.size() >= 4 && pin.csValue.size() <= 12
+					&& pin.csValue.find_first_not_of("0123456789") == std::string::npos
+					&& pin.ulMaxTries > 0 && pin.ulMaxTries <= 15;
+				if (bOK)
+					m_pins[(unsigned char) ulRef] = pin;
+			}
+			else if (csKeyword == "key")
+			{
+				tEmuKey key;
+				unsigned long ulRef = strtoul(NextWord(csLine).c_str(), NULL, 16);
+				unsigned long ulPinRef = strtoul(NextWord(csLine).c_str(), NULL, 16);
+
+				key.ucPinRef = (unsigned char) ulPinRef;
+				key.bConsent = NextWord(csLine) == "1";
+				key.oModulus = StripLeadingZeros(CByteArray(NextWord(csLine), true));
+				key.oPrivExp = CByteArray(NextWord(csLine), true);
+				bOK = ulRef <= 0xFF && ulPinRef <= 0xFF && key.oModulus.Size() >= 64
+					&& (key.oModulus.GetByte(key.oModulus.Size() - 1) & 1) == 1 && key.oPrivExp.Size() > 0;
+				if (bOK)
+					m_keys[(unsigned char) ulRef] = key;
+			}
+			else
+				bOK = false;
+
+			if (!bOK)
+				MWLOG(LEV_ERROR, MOD_CAL, L"Card emulator: %ls line %lu: bad \"%ls\" line",
+				      m_wsImage.c_str(), ulLineNr, utilStringWiden(csKeyword).c_str());
+		}
+		fclose(f);
+
+		if (bOK && (m_csReader.empty() || m_oATR.Size() == 0))
+		{
+			MWLOG(LEV_ERROR, MOD_CAL, L"Card emulator: %ls has no reader or atr line", m_wsImage.c_str());
+			bOK = false;
+		}
+		for (std::map < unsigned char, tEmuKey >::iterator it = m_keys.begin(); bOK && it != m_keys.end(); ++it)
+		{
+			if (m_pins.find(it->second.ucPinRef) == m_pins.end())
+			{
+				MWLOG(LEV_ERROR, MOD_CAL, L"Card emulator: key 0x%02x has no PIN 0x%02x",
+				      it->first, it->second.ucPinRef);
+				bOK = false;
+			}
+		}
+
+		if (bOK)
+			MWLOG(LEV_INFO, MOD_CAL, L"Card emulator: loaded %ls (%lu files, %lu keys, %lu msec/APDU)",
+			      m_wsImage.c_str(), (unsigned long) m_files.size(), (unsigned long) m_keys.size(), m_ulLatency);
+
+		return bOK;
+	}
+
+	void CCardEmulator::Reset()
+	{
+		for (std::map < unsigned char, tEmuPin >::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+		{
+			it->second.bVerified = false;
+			it->second.bVerifiedAfterMSE = false;
+		}
+		m_csDF = "3F00";
+		m_csEF = "";
+		m_bEnvSet = false;
+		m_oPending.ClearContents();
+	}
+
+	bool CCardEmulator::IsOurs(SCARDHANDLE hCard)
+	{
+		return hCard != 0 && hCard <= m_hLastCard;
+	}
+
+	long CCardEmulator::EstablishContext(SCARDCONTEXT * phContext)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		if (!m_bLoaded)
+		{
+			if (!Load())
+				return SCARD_E_NO_SERVICE;
+			m_bLoaded = true;
+		}
+		*phContext = EMU_CONTEXT;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::ReleaseContext(SCARDCONTEXT hContext)
+	{
+		return hContext == EMU_CONTEXT ? SCARD_S_SUCCESS : SCARD_E_INVALID_HANDLE;
+	}
+
+	long CCardEmulator::Cancel(SCARDCONTEXT hContext)
+	{
+		m_bCancelled = true;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::ListReaders(SCARDCONTEXT hContext, char *mszReaders, DWORD * pcchReaders)
+	{
+		DWORD dwLen = (DWORD) m_csReader.size() + 2;
+
+		if (hContext != EMU_CONTEXT)
+			return SCARD_E_INVALID_HANDLE;
+
+		if (mszReaders != NULL)
+		{
+			if (*pcchReaders < dwLen)
+			{
+				*pcchReaders = dwLen;
+				return SCARD_E_INSUFFICIENT_BUFFER;
+			}
+			memcpy(mszReaders, m_csReader.c_str(), m_csReader.size() + 1);
+			mszReaders[dwLen - 1] = '\0';
+		}
+		*pcchReaders = dwLen;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::GetStatusChange(SCARDCONTEXT hContext, DWORD dwTimeout,
+					    SCARD_READERSTATEA * rgReaderStates, DWORD cReaders)
+	{
+		unsigned long ulWaited = 0;
+
+		if (hContext != EMU_CONTEXT)
+			return SCARD_E_INVALID_HANDLE;
+
+		// like pcsc-lite, only a wait that is in progress gets cancelled
+		m_bCancelled = false;
+
+		for (;;)
+		{
+			bool bChanged = false;
+
+			for (DWORD i = 0; i < cReaders; i++)
+			{
+				SCARD_READERSTATEA *pState = &rgReaderStates[i];
+				DWORD dwCurrent = pState->dwCurrentState;
+
+				if (dwCurrent & SCARD_STATE_IGNORE)
+					pState->dwEventState = SCARD_STATE_IGNORE;
+				else if (strcmp(pState->szReader, EMU_PNP_READER) == 0)
+					pState->dwEventState = dwCurrent & ~SCARD_STATE_CHANGED;
+				else if (m_csReader == pState->szReader)
+				{
+					// The card is always present and never gets replaced
+					pState->dwEventState = SCARD_STATE_PRESENT;
+					if ((dwCurrent & (SCARD_STATE_PRESENT | SCARD_STATE_EMPTY)) != SCARD_STATE_PRESENT)
+						pState->dwEventState |= SCARD_STATE_CHANGED;
+					if (m_oATR.Size() <= sizeof(pState->rgbAtr))
+					{
+						memcpy(pState->rgbAtr, m_oATR.GetBytes(), m_oATR.Size());
+						pState->cbAtr = m_oATR.Size();
+					}
+				}
+				else
+				{
+					pState->dwEventState = SCARD_STATE_UNKNOWN;
+					if ((dwCurrent & SCARD_STATE_UNKNOWN) == 0)
+						pState->dwEventState |= SCARD_STATE_CHANGED;
+				}
+				bChanged |= (pState->dwEventState & SCARD_STATE_CHANGED) != 0;
+			}
+
+			if (bChanged)
+				return SCARD_S_SUCCESS;
+			if (m_bCancelled)
+			{
+				m_bCancelled = false;
+				return SCARD_E_CANCELLED;
+			}
+			if (dwTimeout != INFINITE && ulWaited >= dwTimeout)
+				return SCARD_E_TIMEOUT;
+
+			unsigned long ulSlice = EMU_WAIT_SLICE;
+
+			if (dwTimeout != INFINITE && dwTimeout - ulWaited < ulSlice)
+				ulSlice = dwTimeout - ulWaited;
+			CThread::SleepMillisecs(ulSlice);
+			ulWaited += ulSlice;
+		}
+	}
+
+	long CCardEmulator::Connect(SCARDCONTEXT hContext, const char *szReader, DWORD dwShareMode,
+				    DWORD dwPreferredProtocols, SCARDHANDLE * phCard, DWORD * pdwActiveProtocol)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		if (hContext != EMU_CONTEXT)
+			return SCARD_E_INVALID_HANDLE;
+		if (m_csReader != szReader)
+			return SCARD_E_UNKNOWN_READER;
+		if ((dwPreferredProtocols & SCARD_PROTOCOL_T0) == 0)
+			return SCARD_E_PROTO_MISMATCH;
+
+		*phCard = ++m_hLastCard;
+		*pdwActiveProtocol = SCARD_PROTOCOL_T0;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::Reconnect(SCARDHANDLE hCard, DWORD dwShareMode, DWORD dwPreferredProtocols,
+				      DWORD dwInitialization, DWORD * pdwActiveProtocol)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		if (!IsOurs(hCard))
+			return SCARD_E_INVALID_HANDLE;
+		if (dwInitialization == SCARD_RESET_CARD || dwInitialization == SCARD_UNPOWER_CARD)
+			Reset();
+		*pdwActiveProtocol = SCARD_PROTOCOL_T0;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::Disconnect(SCARDHANDLE hCard, DWORD dwDisposition)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		if (!IsOurs(hCard))
+			return SCARD_E_INVALID_HANDLE;
+		if (dwDisposition == SCARD_RESET_CARD || dwDisposition == SCARD_UNPOWER_CARD)
+			Reset();
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::Status(SCARDHANDLE hCard, DWORD * pdwState, DWORD * pdwProtocol,
+				   unsigned char *pbAtr, DWORD * pcbAtrLen)
+	{
+		if (!IsOurs(hCard))
+			return SCARD_E_INVALID_HANDLE;
+		if (*pcbAtrLen < m_oATR.Size())
+			return SCARD_E_INSUFFICIENT_BUFFER;
+
+		*pdwState = SCARD_SPECIFIC;
+		*pdwProtocol = SCARD_PROTOCOL_T0;
+		memcpy(pbAtr, m_oATR.GetBytes(), m_oATR.Size());
+		*pcbAtrLen = m_oATR.Size();
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::GetAttrib(SCARDHANDLE hCard, DWORD dwAttrId, unsigned char *pbAttr, DWORD * pcbAttrLen)
+	{
+		if (!IsOurs(hCard))
+			return SCARD_E_INVALID_HANDLE;
+		if (dwAttrId != SCARD_ATTR_VENDOR_IFD_VERSION)
+			return SCARD_E_UNSUPPORTED_FEATURE;
+		if (*pcbAttrLen < 4)
+			return SCARD_E_INSUFFICIENT_BUFFER;
+
+		// version 1.0.0, as a DWORD
+		pbAttr[0] = 0x00;
+		pbAttr[1] = 0x00;
+		pbAttr[2] = 0x00;
+		pbAttr[3] = 0x01;
+		*pcbAttrLen = 4;
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::Transmit(SCARDHANDLE hCard, const SCARD_IO_REQUEST * pioSendPci,
+				     const unsigned char *pbSendBuffer, DWORD cbSendLength,
+				     SCARD_IO_REQUEST * pioRecvPci, unsigned char *pbRecvBuffer, DWORD * pcbRecvLength)
+	{
+		CByteArray oResp;
+		unsigned long ulSleep;
+
+		if (!IsOurs(hCard))
+			return SCARD_E_INVALID_HANDLE;
+
+		m_Mutex.Lock();
+		Process(pbSendBuffer, cbSendLength, oResp);
+
+		m_ulSleptUs += m_ulByteLatency * (cbSendLength + oResp.Size());
+		ulSleep = m_ulLatency + m_ulSleptUs / 1000;
+		m_ulSleptUs %= 1000;
+		if (cbSendLength >= 2 && pbSendBuffer[1] == 0x2A && oResp.GetByte(oResp.Size() - 2) == 0x61)
+			ulSleep += m_ulSignLatency;
+		m_Mutex.Unlock();
+
+		if (ulSleep > 0)
+			CThread::SleepMillisecs(ulSleep);
+
+		if (*pcbRecvLength < oResp.Size())
+			return SCARD_E_INSUFFICIENT_BUFFER;
+		memcpy(pbRecvBuffer, oResp.GetBytes(), oResp.Size());
+		*pcbRecvLength = oResp.Size();
+
+		return SCARD_S_SUCCESS;
+	}
+
+	long CCardEmulator::Control(SCARDHANDLE hCard, DWORD dwControlCode, const unsigned char *pbSendBuffer,
+				    DWORD cbSendLength, unsigned char *pbRecvBuffer, DWORD cbRecvLength,
+				    DWORD * lpBytesReturned)
+	{
+		// no pinpad, no reader features
+		return IsOurs(hCard) ? SCARD_E_UNSUPPORTED_FEATURE : SCARD_E_INVALID_HANDLE;
+	}
+
+	long CCardEmulator::BeginTransaction(SCARDHANDLE hCard)
+	{
+		return IsOurs(hCard) ? SCARD_S_SUCCESS : SCARD_E_INVALID_HANDLE;
+	}
+
+	long CCardEmulator::EndTransaction(SCARDHANDLE hCard, DWORD dwDisposition)
+	{
+		return IsOurs(hCard) ? SCARD_S_SUCCESS : SCARD_E_INVALID_HANDLE;
+	}
+
+	void CCardEmulator::Process(const unsigned char *pucAPDU, unsigned long ulLen, CByteArray & oResp)
+	{
+		CByteArray oData;
+		unsigned long ulLe = 0;
+		bool bExtended = false;
+
+		if (ulLen < 4)
+		{
+			AppendSW(oResp, 0x6700);
+			return;
+		}
+
+		unsigned char ucCLA = pucAPDU[0];
+		unsigned char ucINS = pucAPDU[1];
+		unsigned char ucP1 = pucAPDU[2];
+		unsigned char ucP2 = pucAPDU[3];
+
+		// Split the body into the data and Le, see ISO 7816-3 12.1.3
+		if (ulLen == 5)
+			ulLe = pucAPDU[4] == 0 ? 256 : pucAPDU[4];
+		else if (ulLen == 7 && pucAPDU[4] == 0)
+		{
+			bExtended = true;
+			ulLe = 256 * pucAPDU[5] + pucAPDU[6];
+			if (ulLe == 0)
+				ulLe = 65536;
+		}
+		else if (ulLen > 5 && pucAPDU[4] != 0 && (ulLen == 5UL + pucAPDU[4] || ulLen == 6UL + pucAPDU[4]))
+		{
+			oData = CByteArray(pucAPDU + 5, pucAPDU[4]);
+			if (ulLen == 6UL + pucAPDU[4])
+				ulLe = pucAPDU[ulLen - 1] == 0 ? 256 : pucAPDU[ulLen - 1];
+		}
+		else if (ulLen != 4)
+		{
+			AppendSW(oResp, 0x6700);
+			return;
+		}
+
+		// Only GET RESPONSE may follow the command that produced its data
+		if (ucINS != 0xC0)
+			m_oPending.ClearContents();
+
+		if (ucCLA == 0x80)
+		{
+			switch (ucINS)
+			{
+				case 0xE4:	// GET CARD DATA
+					if (m_oCardData.Size() == 0)
+						AppendSW(oResp, 0x6D00);
+					else if (ulLe < m_oCardData.Size() && m_oCardData.Size() < 256)
+						AppendSW(oResp, 0x6C00 | m_oCardData.Size());
+					else
+					{
+						oResp.Append(m_oCardData);
+						AppendSW(oResp, 0x9000);
+					}
+					break;
+				case 0xEA:	// GET PIN STATUS
+					if (m_pins.find(ucP2) == m_pins.end())
+						AppendSW(oResp, 0x6A88);
+					else
+					{
+						oResp.Append((unsigned char) m_pins[ucP2].ulTries);
+						AppendSW(oResp, 0x9000);
+					}
+					break;
+				case 0xE6:	// LOGOFF
+					for (std::map < unsigned char, tEmuPin >::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+					{
+						it->second.bVerified = false;
+						it->second.bVerifiedAfterMSE = false;
+					}
+					AppendSW(oResp, 0x9000);
+					break;
+				default:
+					AppendSW(oResp, 0x6D00);
+			}
+			return;
+		}
+		if (ucCLA != 0x00)
+		{
+			AppendSW(oResp, 0x6E00);
+			return;
+		}
+
+		switch (ucINS)
+		{
+			case 0xA4:	// SELECT
+				SelectFile(ucP1, oData, oResp);
+				break;
+			case 0xB0:	// READ BINARY
+				if (ucP1 & 0x80)
+					AppendSW(oResp, 0x6A81);	// no short EF identifiers
+				else
+					ReadBinary(256 * ucP1 + ucP2, ulLe, bExtended, oResp);
+				break;
+			case 0xC0:	// GET RESPONSE
+				GetResponse(ulLe, oResp);
+				break;
+			case 0x20:	// VERIFY
+				VerifyPin(ucP2, oData, oResp);
+				break;
+			case 0x24:	// CHANGE REFERENCE DATA
+				ChangePin(ucP2, oData, oResp);
+				break;
+			case 0x22:	// MSE SET
+				if (ucP1 != 0x41 || ucP2 != 0xB6)
+					AppendSW(oResp, 0x6A86);
+				else
+					SetSecurityEnv(oData, oResp);
+				break;
+			case 0x2A:	// PSO: COMPUTE DIGITAL SIGNATURE
+				if (ucP1 != 0x9E || ucP2 != 0x9A)
+					AppendSW(oResp, 0x6A86);
+				else
+					Sign(oData, oResp);
+				break;
+			default:
+				AppendSW(oResp, 0x6D00);
+		}
+	}
+
+	void CCardEmulator::SelectFile(unsigned char ucP1, const CByteArray & oData, CByteArray & oResp)
+	{
+		if (ucP1 == 0x04)
+		{
+			// Selecting a DF resets the security environment
+			if (oData.Equals(CByteArray(BELPIC_AID, sizeof(BELPIC_AID))))
+				m_csDF = "3F00DF00";
+			else if (oData.Equals(CByteArray(APPLET_AID, sizeof(APPLET_AID))))
+				m_csDF = "3F00";
+			else
+			{
+				AppendSW(oResp, 0x6A82);
+				return;
+			}
+			m_csEF = "";
+			m_bEnvSet = false;
+			AppendSW(oResp, 0x9000);
+			return;
+		}
+		if ((ucP1 != 0x00 && ucP1 != 0x02) || oData.Size() != 2)
+		{
+			AppendSW(oResp, 0x6A86);
+			return;
+		}
+
+		std::string csFID = oData.ToString(false);
+
+		if (csFID == "3F00")
+		{
+			m_csDF = "3F00";
+			m_csEF = "";
+			m_bEnvSet = false;
+			AppendSW(oResp, 0x9000);
+			return;
+		}
+
+		// Look among the children of the current DF, then of its parent
+		std::string csParent = m_csDF.size() > 4 ? m_csDF.substr(0, m_csDF.size() - 4) : m_csDF;
+		const std::string csDirs[2] = { m_csDF, csParent };
+
+		for (int i = 0; i < 2; i++)
+		{
+			std::string csPath = csDirs[i] + csFID;
+			std::map < std::string, CByteArray >::iterator it = m_files.lower_bound(csPath);
+
+			if (it == m_files.end() || it->first.compare(0, csPath.size(), csPath) != 0)
+				continue;
+			if (it->first == csPath)
+				m_csEF = csPath;
+			else
+			{
+				m_csDF = csPath;
+				m_csEF = "";
+				m_bEnvSet = false;
+			}
+			AppendSW(oResp, 0x9000);
+			return;
+		}
+
+		AppendSW(oResp, 0x6A82);
+	}
+
+	void CCardEmulator::ReadBinary(unsigned long ulOffset, unsigned long ulLe, bool bExtended, CByteArray & oResp)
+	{
+		if (m_csEF.empty())
+		{
+			AppendSW(oResp, 0x6986);
+			return;
+		}
+
+		const CByteArray & oFile = m_files[m_csEF];
+
+		if (ulOffset >= oFile.Size())
+		{
+			AppendSW(oResp, 0x6B00);
+			return;
+		}
+
+		unsigned long ulLeft = oFile.Size() - ulOffset;
+
+		if (!bExtended && ulLe > ulLeft)
+		{
+			// the exact length to use for Le
+			AppendSW(oResp, 0x6C00 | ulLeft);
+			return;
+		}
+		oResp.Append(oFile.GetBytes(ulOffset, ulLe < ulLeft ? ulLe : ulLeft));
+		AppendSW(oResp, ulLe > ulLeft ? 0x6282 : 0x9000);
+	}
+
+	// Decodes a GlobalPlatform format 2 PIN block; false if it isn't one
+	static bool DecodePinBlock(const CByteArray & oBlock, std::string & csPin)
+	{
+		unsigned long ulLen;
+
+		csPin.clear();
+		if (oBlock.Size() != 8 || (oBlock.GetByte(0) & 0xF0) != 0x20)
+			return false;
+		ulLen = oBlock.GetByte(0) & 0x0F;
+		if (ulLen < 4 || ulLen > 12)
+			return false;
+
+		for (unsigned long i = 0; i < 14; i++)
+		{
+			unsigned char ucNibble = (oBlock.GetByte(1 + i / 2) >> (i % 2 == 0 ? 4 : 0)) & 0x0F;
+
+			if (i < ulLen && ucNibble > 9)
+				return false;
+			if (i >= ulLen && ucNibble != 0x0F)
+				return false;
+			if (i < ulLen)
+				csPin += (char) ('0' + ucNibble);
+		}
+
+		return true;
+	}
+
+	void CCardEmulator::VerifyPin(unsigned char ucRef, const CByteArray & oData, CByteArray & oResp)
+	{
+		std::string csPin;
+
+		if (m_pins.find(ucRef) == m_pins.end())
+		{
+			AppendSW(oResp, 0x6A88);
+			return;
+		}
+		tEmuPin & pin = m_pins[ucRef];
+
+		if (oData.Size() != 8)
+		{
+			AppendSW(oResp, 0x6700);
+			return;
+		}
+		if (pin.ulTries == 0)
+		{
+			AppendSW(oResp, 0x6983);
+			return;
+		}
+		if (!DecodePinBlock(oData, csPin))
+		{
+			AppendSW(oResp, 0x6A80);
+			return;
+		}
+
+		if (csPin == pin.csValue)
+		{
+			pin.ulTries = pin.ulMaxTries;
+			pin.bVerified = true;
+			pin.bVerifiedAfterMSE = true;
+			AppendSW(oResp, 0x9000);
+		}
+		else
+		{
+			pin.ulTries--;
+			pin.bVerified = false;
+			pin.bVerifiedAfterMSE = false;
+			AppendSW(oResp, pin.ulTries == 0 ? 0x6983 : 0x63C0 | pin.ulTries);
+		}
+	}
+
+	void CCardEmulator::ChangePin(unsigned char ucRef, const CByteArray & oData, CByteArray & oResp)
+	{
+		std::string csNewPin;
+		unsigned long ulRespStart = oResp.Size();
+
+		if (oData.Size() != 16)
+		{
+			AppendSW(oResp, 0x6700);
+			return;
+		}
+		if (!DecodePinBlock(oData.GetBytes(8, 8), csNewPin))
+		{
+			AppendSW(oResp, 0x6A80);
+			return;
+		}
+
+		VerifyPin(ucRef, oData.GetBytes(0, 8), oResp);
+		if (oResp.GetByte(ulRespStart) == 0x90)
+			m_pins[ucRef].csValue = csNewPin;
+	}
+
+	void CCardEmulator::SetSecurityEnv(const CByteArray & oData, CByteArray & oResp)
+	{
+		// Data = [04 80 <algoref> 84 <keyref>]
+		if (oData.Size() != 5 || oData.GetByte(0) != 0x04 || oData.GetByte(1) != 0x80 || oData.GetByte(3) != 0x84)
+		{
+			AppendSW(oResp, 0x6A80);
+			return;
+		}
+
+		unsigned char ucAlgo = oData.GetByte(2);
+		unsigned char ucKey = oData.GetByte(4);
+
+		m_bEnvSet = false;
+		for (std::map < unsigned char, tEmuPin >::iterator it = m_pins.begin(); it != m_pins.end(); ++it)
+			it->second.bVerifiedAfterMSE = false;
+
+		if (m_keys.find(ucKey) == m_keys.end())
+		{
+			AppendSW(oResp, 0x6A88);
+			return;
+		}
+		// Only PKCS#1 v1.5 (and no PSS) is emulated
+		if (ucAlgo != 0x01 && ucAlgo != 0x02 && ucAlgo != 0x04 && ucAlgo != 0x08)
+		{
+			AppendSW(oResp, 0x6A80);
+			return;
+		}
+
+		m_bEnvSet = true;
+		m_ucEnvAlgo = ucAlgo;
+		m_ucEnvKey = ucKey;
+		AppendSW(oResp, 0x9000);
+	}
+
+	void CCardEmulator::Sign(const CByteArray & oData, CByteArray & oResp)
+	{
+		CByteArray oDigestInfo;
+		unsigned long ulHashLen = 0;
+
+		if (!m_bEnvSet)
+		{
+			AppendSW(oResp, 0x6985);
+			return;
+		}
+
+		tEmuKey & key = m_keys[m_ucEnvKey];
+		tEmuPin & pin = m_pins[key.ucPinRef];
+
+		if (!pin.bVerified || (key.bConsent && !pin.bVerifiedAfterMSE))
+		{
+			AppendSW(oResp, 0x6982);
+			return;
+		}
+
+		switch (m_ucEnvAlgo)
+		{
+			case 0x02:
+				oDigestInfo.Append(SHA1_PREFIX, sizeof(SHA1_PREFIX));
+				ulHashLen = 20;
+				break;
+			case 0x04:
+				oDigestInfo.Append(MD5_PREFIX, sizeof(MD5_PREFIX));
+				ulHashLen = 16;
+				break;
+			case 0x08:
+				oDigestInfo.Append(SHA256_PREFIX, sizeof(SHA256_PREFIX));
+				ulHashLen = 32;
+				break;
+		}
+		unsigned long ulModLen = key.oModulus.Size();
+
+		if ((ulHashLen != 0 && oData.Size() != ulHashLen) || oDigestInfo.Size() + oData.Size() + 11 > ulModLen)
+		{
+			AppendSW(oResp, 0x6700);
+			return;
+		}
+		oDigestInfo.Append(oData);
+
+		// EMSA-PKCS1-v1_5: 00 01 FF .. FF 00 DigestInfo
+		CByteArray oEncoded(ulModLen);
+
+		oEncoded.Append(0x00);
+		oEncoded.Append(0x01);
+		while (oEncoded.Size() < ulModLen - oDigestInfo.Size() - 1)
+			oEncoded.Append(0xFF);
+		oEncoded.Append(0x00);
+		oEncoded.Append(oDigestInfo);
+
+		m_oPending = ModExp(oEncoded, key.oPrivExp, key.oModulus);
+		if (key.bConsent)
+			pin.bVerifiedAfterMSE = false;
+
+		AppendSW(oResp, 0x6100 | (m_oPending.Size() & 0xFF));
+	}
+
+	void CCardEmulator::GetResponse(unsigned long ulLe, CByteArray & oResp)
+	{
+		unsigned long ulAvail = m_oPending.Size();
+
+		if (ulAvail == 0)
+		{
+			AppendSW(oResp, 0x6985);
+			return;
+		}
+		if (ulLe >= ulAvail)
+		{
+			oResp.Append(m_oPending);
+			m_oPending.ClearContents();
+			AppendSW(oResp, 0x9000);
+			return;
+		}
+
+		oResp.Append(m_oPending.GetBytes(0, ulLe));
+		m_oPending = m_oPending.GetBytes(ulLe);
+		AppendSW(oResp, 0x6100 | (m_oPending.Size() > 255 ? 0 : m_oPending.Size()));
+	}
+
+}
+#endif
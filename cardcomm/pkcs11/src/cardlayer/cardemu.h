@@ -0,0 +1,153 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * A software BEID card (applet 1.7, RSA keys) in a software reader, for
+ * testing and benchmarking the card layer without hardware.
+ *
+ * Only built with --enable-card-emulator, and only used if the
+ * EID_CARD_EMULATOR_IMAGE environment variable or the card_emulator_image
+ * config setting names a card image. That is a text file with one
+ * directive per line ('#' starts a comment; hex strings may contain spaces,
+ * except for the two numbers on a key line):
+ *
+ *   reader <name>                 name of the emulated reader
+ *   atr <hex>
+ *   carddata <hex>                response to GET CARD DATA
+ *   latency <msec>                time each APDU takes
+ *   byte_latency <usec>           extra time per APDU byte sent or received
+ *   sign_latency <msec>           extra time a signature takes
+ *   file <path> <hex>             e.g. file 3F00DF014031 <hex>
+ *   pin <ref> <digits> [<tries>]  the reference is in hex
+ *   key <ref> <pinref> <consent> <modulus hex> <private exponent hex>
+ *
+ * A key with consent = 1 needs a PIN verification after each MSE SET,
+ * like the non-repudiation key. See tests/emulator for a sample image.
+ *
+ * The card state (PINs verified, selected file, security environment)
+ * lives as long as the CCardEmulator object; a card reset clears it.
+ */
+
+#pragma once
+
+#ifndef CARDEMU_H
+#define CARDEMU_H
+
+#include <map>
+#include <string>
+#include "cardtransport.h"
+#include "common/bytearray.h"
+#include "common/mutex.h"
+
+namespace eIDMW
+{
+
+	typedef struct
+	{
+		std::string csValue;
+		unsigned long ulTries;	// remaining
+		unsigned long ulMaxTries;
+		bool bVerified;
+		bool bVerifiedAfterMSE;	// verified since the last MSE SET
+	} tEmuPin;
+
+	typedef struct
+	{
+		unsigned char ucPinRef;
+		bool bConsent;
+		CByteArray oModulus;
+		CByteArray oPrivExp;
+	} tEmuKey;
+
+	class CCardEmulator:public CCardTransport
+	{
+public:
+		CCardEmulator(const std::wstring & wsImage);
+		~CCardEmulator();
+
+		long EstablishContext(SCARDCONTEXT * phContext);
+		long ReleaseContext(SCARDCONTEXT hContext);
+		long Cancel(SCARDCONTEXT hContext);
+		long ListReaders(SCARDCONTEXT hContext, char *mszReaders, DWORD * pcchReaders);
+		long GetStatusChange(SCARDCONTEXT hContext, DWORD dwTimeout,
+				     SCARD_READERSTATEA * rgReaderStates, DWORD cReaders);
+
+		long Connect(SCARDCONTEXT hContext, const char *szReader, DWORD dwShareMode,
+			     DWORD dwPreferredProtocols, SCARDHANDLE * phCard, DWORD * pdwActiveProtocol);
+		long Reconnect(SCARDHANDLE hCard, DWORD dwShareMode, DWORD dwPreferredProtocols,
+			       DWORD dwInitialization, DWORD * pdwActiveProtocol);
+		long Disconnect(SCARDHANDLE hCard, DWORD dwDisposition);
+		long Status(SCARDHANDLE hCard, DWORD * pdwState, DWORD * pdwProtocol,
+			    unsigned char *pbAtr, DWORD * pcbAtrLen);
+		long GetAttrib(SCARDHANDLE hCard, DWORD dwAttrId, unsigned char *pbAttr, DWORD * pcbAttrLen);
+
+		long Transmit(SCARDHANDLE hCard, const SCARD_IO_REQUEST * pioSendPci,
+			      const unsigned char *pbSendBuffer, DWORD cbSendLength,
+			      SCARD_IO_REQUEST * pioRecvPci, unsigned char *pbRecvBuffer, DWORD * pcbRecvLength);
+		long Control(SCARDHANDLE hCard, DWORD dwControlCode, const unsigned char *pbSendBuffer,
+			     DWORD cbSendLength, unsigned char *pbRecvBuffer, DWORD cbRecvLength,
+			     DWORD * lpBytesReturned);
+
+		long BeginTransaction(SCARDHANDLE hCard);
+		long EndTransaction(SCARDHANDLE hCard, DWORD dwDisposition);
+
+private:
+		bool Load();
+		void Reset();
+		bool IsOurs(SCARDHANDLE hCard);
+
+		// Each of these appends the response (incl. SW12) to oResp
+		void Process(const unsigned char *pucAPDU, unsigned long ulLen, CByteArray & oResp);
+		void SelectFile(unsigned char ucP1, const CByteArray & oData, CByteArray & oResp);
+		void ReadBinary(unsigned long ulOffset, unsigned long ulLe, bool bExtended, CByteArray & oResp);
+		void VerifyPin(unsigned char ucRef, const CByteArray & oData, CByteArray & oResp);
+		void ChangePin(unsigned char ucRef, const CByteArray & oData, CByteArray & oResp);
+		void SetSecurityEnv(const CByteArray & oData, CByteArray & oResp);
+		void Sign(const CByteArray & oData, CByteArray & oResp);
+		void GetResponse(unsigned long ulLe, CByteArray & oResp);
+
+		std::wstring m_wsImage;
+		bool m_bLoaded;
+
+		std::string m_csReader;
+		CByteArray m_oATR;
+		CByteArray m_oCardData;
+		unsigned long m_ulLatency;
+		unsigned long m_ulByteLatency;
+		unsigned long m_ulSignLatency;
+		std::map < std::string, CByteArray > m_files;
+		std::map < unsigned char, tEmuPin > m_pins;
+		std::map < unsigned char, tEmuKey > m_keys;
+
+		std::string m_csDF;	// path of the current DF
+		std::string m_csEF;	// path of the current EF, or empty
+		bool m_bEnvSet;
+		unsigned char m_ucEnvAlgo;
+		unsigned char m_ucEnvKey;
+		CByteArray m_oPending;	// for GET RESPONSE
+
+		SCARDHANDLE m_hLastCard;
+		unsigned long m_ulSleptUs;	// byte latencies that didn't add up to a msec yet
+		volatile bool m_bCancelled;
+		CMutex m_Mutex;
+	};
+
+}
+#endif
@@ -24,6 +24,7 @@
 #include "thread.h"
 #include "common/log.h"
 #include "card.h"
+#include "apdustats.h"
 
 #include <string>
 
@@ -44,6 +45,8 @@ namespace eIDMW
 		if (poContext->m_ulConnectionDelay != 0)
 		{
 			CThread::SleepMillisecs(poContext->m_ulConnectionDelay);
+			if (CApduStats::IsEnabled())
+				CApduStats::Slept(poContext->m_ulConnectionDelay);
 		}
 		// Try if we can connect to the card via a normal SCardConnect()
 		SCARDHANDLE hCard = 0;
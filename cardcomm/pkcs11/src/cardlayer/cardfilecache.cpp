@@ -0,0 +1,397 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2010 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "cardfilecache.h"
+#include "common/configuration.h"
+#include "common/hash.h"
+#include "common/log.h"
+#include "common/util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <vector>
+#ifdef WIN32
+#include <windows.h>
+#include <sys/stat.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#define CACHE_MAGIC          "BEIDFC01"
+#define CACHE_MAGIC_LEN      8
+#define CACHE_HASH_LEN       32
+#define CACHE_MAX_FILE_SIZE  (1024 * 1024)
+
+namespace eIDMW
+{
+
+	// The files that can't change during the lifetime of a card:
+	// identity (+ signature), photo and the certificates.
+	static const char *CACHEABLE_FILES[] = {
+		"3F00DF014031",	// identity
+		"3F00DF014032",	// identity signature
+		"3F00DF014035",	// photo
+		"3F00DF005038",	// authentication cert
+		"3F00DF005039",	// signature cert
+		"3F00DF00503A",	// CA cert
+		"3F00DF00503B",	// root cert
+		"3F00DF00503C",	// RRN cert
+		"PKCS15",	// not a file: the parsed PKCS#15 structure (see pkcs15cache.h)
+		NULL
+	};
+
+	static unsigned long GetBE32(const unsigned char *pucData)
+	{
+		return ((unsigned long)pucData[0] << 24) | ((unsigned long)pucData[1] << 16) |
+			((unsigned long)pucData[2] << 8) | (unsigned long)pucData[3];
+	}
+
+	static void AppendBE32(CByteArray & oData, unsigned long ulVal)
+	{
+		oData.Append((unsigned char)(ulVal >> 24));
+		oData.Append((unsigned char)(ulVal >> 16));
+		oData.Append((unsigned char)(ulVal >> 8));
+		oData.Append((unsigned char)ulVal);
+	}
+
+	CCardFileCache::CCardFileCache() : m_bInitialized(false), m_bEnabled(false)
+	{
+	}
+
+	CCardFileCache::~CCardFileCache()
+	{
+	}
+
+	void CCardFileCache::Init()
+	{
+		if (m_bInitialized)
+			return;
+
+		m_bInitialized = true;
+		try
+		{
+			m_bEnabled = CConfig::GetLong(CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHE) != 0;
+			if (m_bEnabled)
+				m_wsCacheDir = CConfig::GetString(CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHEDIR);
+		}
+		catch (...)
+		{
+			m_bEnabled = false;
+		}
+
+		if (m_bEnabled && m_wsCacheDir.empty())
+			m_bEnabled = false;
+
+		if (m_bEnabled)
+		{
+#ifdef WIN32
+			CreateDirectoryW(m_wsCacheDir.c_str(), NULL);
+#else
+			mkdir(utilStringNarrow(m_wsCacheDir).c_str(), 0700);
+#endif
+			MWLOG(LEV_INFO, MOD_CAL, L"Card file cache enabled in %ls", m_wsCacheDir.c_str());
+		}
+	}
+
+	bool CCardFileCache::IsEnabled()
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		Init();
+
+		return m_bEnabled;
+	}
+
+	bool CCardFileCache::IsCacheable(const std::string & csPath)
+	{
+		for (int i = 0; CACHEABLE_FILES[i] != NULL; i++)
+		{
+			const char *pc1 = csPath.c_str();
+			const char *pc2 = CACHEABLE_FILES[i];
+
+			while (*pc1 != '\0' && toupper((unsigned char)*pc1) == *pc2)
+			{
+				pc1++;
+				pc2++;
+			}
+			if (*pc1 == '\0' && *pc2 == '\0')
+				return true;
+		}
+
+		return false;
+	}
+
+	std::wstring CCardFileCache::GetCacheFileName(const CByteArray & oSerialNr)
+	{
+		return m_wsCacheDir + WDIRSEP + oSerialNr.ToWString(false) + L".bin";
+	}
+
+	bool CCardFileCache::MapFile(const std::wstring & wsFileName, const unsigned char **ppucData, unsigned long *pulLen)
+	{
+#ifdef WIN32
+		FILE *f = NULL;
+		struct _stat st;
+
+		if (_wstat(wsFileName.c_str(), &st) != 0 || st.st_size <= 0 || st.st_size > CACHE_MAX_FILE_SIZE)
+			return false;
+		if (_wfopen_s(&f, wsFileName.c_str(), L"rb") != 0 || f == NULL)
+			return false;
+
+		unsigned char *pucBuf = (unsigned char *)malloc(st.st_size);
+		if (pucBuf == NULL || fread(pucBuf, 1, st.st_size, f) != (size_t)st.st_size)
+		{
+			free(pucBuf);
+			fclose(f);
+			return false;
+		}
+		fclose(f);
+
+		*ppucData = pucBuf;
+		*pulLen = (unsigned long)st.st_size;
+#else
+		struct stat st;
+		int fd = open(utilStringNarrow(wsFileName).c_str(), O_RDONLY);
+
+		if (fd < 0)
+			return false;
+		if (fstat(fd, &st) != 0 || st.st_size <= 0 || st.st_size > CACHE_MAX_FILE_SIZE)
+		{
+			close(fd);
+			return false;
+		}
+
+		void *pMap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (pMap == MAP_FAILED)
+			return false;
+
+		*ppucData = (const unsigned char *)pMap;
+		*pulLen = (unsigned long)st.st_size;
+#endif
+		return true;
+	}
+
+	void CCardFileCache::UnmapFile(const unsigned char *pucData, unsigned long ulLen)
+	{
+#ifdef WIN32
+		free((void *)pucData);
+#else
+		munmap((void *)pucData, ulLen);
+#endif
+	}
+
+	/* Walk over the cache file. If csPath is found and its hash is correct,
+	 * the data is copied to poData (if not NULL). All other (valid) entries
+	 * are copied as-is to poOtherEntries (if not NULL).
+	 * Returns true if csPath was found; false if it wasn't or if the
+	 * cache file doesn't belong to this card or is corrupt. */
+	bool CCardFileCache::ParseFile(const unsigned char *pucData, unsigned long ulLen,
+				       const CByteArray & oCardData, const std::string & csPath,
+				       CByteArray * poData, CByteArray * poOtherEntries,
+				       unsigned long *pulOtherCount)
+	{
+		unsigned long ulPos = 0;
+		bool bFound = false;
+		CHash oHash;
+
+		if (ulLen < CACHE_MAGIC_LEN + 4 || memcmp(pucData, CACHE_MAGIC, CACHE_MAGIC_LEN) != 0)
+			return false;
+		ulPos = CACHE_MAGIC_LEN;
+
+		unsigned long ulCardDataLen = GetBE32(pucData + ulPos);
+		ulPos += 4;
+		if (ulCardDataLen != oCardData.Size() || ulLen - ulPos < ulCardDataLen + 4)
+			return false;
+		if (memcmp(pucData + ulPos, oCardData.GetBytes(), ulCardDataLen) != 0)
+			return false;
+		ulPos += ulCardDataLen;
+
+		unsigned long ulCount = GetBE32(pucData + ulPos);
+		ulPos += 4;
+
+		for (unsigned long i = 0; i < ulCount; i++)
+		{
+			unsigned long ulStart = ulPos;
+
+			if (ulLen - ulPos < 1)
+				return false;
+			unsigned long ulPathLen = pucData[ulPos++];
+			if (ulLen - ulPos < ulPathLen + 4 + CACHE_HASH_LEN)
+				return false;
+			std::string csEntryPath((const char *)pucData + ulPos, ulPathLen);
+			ulPos += ulPathLen;
+			unsigned long ulDataLen = GetBE32(pucData + ulPos);
+			ulPos += 4;
+			const unsigned char *pucHash = pucData + ulPos;
+			ulPos += CACHE_HASH_LEN;
+			if (ulLen - ulPos < ulDataLen)
+				return false;
+
+			CByteArray oHashValue = oHash.Hash(ALGO_SHA256, CByteArray(pucData + ulPos, ulDataLen));
+			if (memcmp(oHashValue.GetBytes(), pucHash, CACHE_HASH_LEN) != 0)
+			{
+				MWLOG(LEV_WARN, MOD_CAL, L"Card file cache: bad hash for %ls, ignoring cache",
+				      utilStringWiden(csEntryPath).c_str());
+				return false;
+			}
+
+			if (csEntryPath == csPath)
+			{
+				if (poData != NULL)
+					*poData = CByteArray(pucData + ulPos, ulDataLen);
+				bFound = true;
+			}
+			else if (poOtherEntries != NULL)
+			{
+				poOtherEntries->Append(pucData + ulStart, ulPos + ulDataLen - ulStart);
+				(*pulOtherCount)++;
+			}
+			ulPos += ulDataLen;
+		}
+
+		return bFound;
+	}
+
+	bool CCardFileCache::Get(const CByteArray & oSerialNr, const CByteArray & oCardData,
+				 const std::string & csPath, CByteArray & oData)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		const unsigned char *pucData = NULL;
+		unsigned long ulLen = 0;
+		bool bFound;
+
+		Init();
+		if (!m_bEnabled || oSerialNr.Size() == 0 || oCardData.Size() == 0 || !IsCacheable(csPath))
+			return false;
+
+		if (!MapFile(GetCacheFileName(oSerialNr), &pucData, &ulLen))
+			return false;
+
+		bFound = ParseFile(pucData, ulLen, oCardData, csPath, &oData, NULL, NULL);
+		UnmapFile(pucData, ulLen);
+
+		if (bFound)
+			MWLOG(LEV_INFO, MOD_CAL, L"   Read file %ls (%d bytes) from cache",
+			      utilStringWiden(csPath).c_str(), oData.Size());
+
+		return bFound;
+	}
+
+	void CCardFileCache::Put(const CByteArray & oSerialNr, const CByteArray & oCardData,
+				 const std::string & csPath, const CByteArray & oData)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		const unsigned char *pucData = NULL;
+		unsigned long ulLen = 0;
+		CByteArray oOtherEntries;
+		unsigned long ulOtherCount = 0;
+		CHash oHash;
+
+		Init();
+		if (!m_bEnabled || oSerialNr.Size() == 0 || oCardData.Size() == 0 || !IsCacheable(csPath))
+			return;
+		if (csPath.size() > 0xFF || oData.Size() > CACHE_MAX_FILE_SIZE)
+			return;
+
+		std::wstring wsFileName = GetCacheFileName(oSerialNr);
+
+		// Keep the other entries of this card, if any
+		if (MapFile(wsFileName, &pucData, &ulLen))
+		{
+			ParseFile(pucData, ulLen, oCardData, csPath, NULL, &oOtherEntries, &ulOtherCount);
+			UnmapFile(pucData, ulLen);
+		}
+
+		CByteArray oContents(CACHE_MAGIC_LEN + 8 + oCardData.Size() + oOtherEntries.Size() +
+				     1 + csPath.size() + 4 + CACHE_HASH_LEN + oData.Size());
+		oContents.Append((const unsigned char *)CACHE_MAGIC, CACHE_MAGIC_LEN);
+		AppendBE32(oContents, oCardData.Size());
+		oContents.Append(oCardData);
+		AppendBE32(oContents, ulOtherCount + 1);
+		oContents.Append(oOtherEntries);
+		oContents.Append((unsigned char)csPath.size());
+		oContents.Append((const unsigned char *)csPath.c_str(), (unsigned long)csPath.size());
+		AppendBE32(oContents, oData.Size());
+		oContents.Append(oHash.Hash(ALGO_SHA256, oData));
+		oContents.Append(oData);
+
+		// Write to a temp file first, so other processes never see a partial
+		// file; its name is unique, so processes writing the same card at the
+		// same time don't write into each other's temp file
+		FILE *f = NULL;
+#ifdef WIN32
+		std::wstring wsTmpFileName = wsFileName + L".XXXXXX";
+		std::vector<wchar_t> tmpName(wsTmpFileName.begin(), wsTmpFileName.end());
+		tmpName.push_back(L'\0');
+		if (_wmktemp_s(&tmpName[0], tmpName.size()) == 0)
+		{
+			wsTmpFileName = &tmpName[0];
+			if (_wfopen_s(&f, wsTmpFileName.c_str(), L"wb") != 0)
+				f = NULL;
+		}
+#else
+		std::string csTmpFileName = utilStringNarrow(wsFileName) + ".XXXXXX";
+		std::vector<char> tmpName(csTmpFileName.begin(), csTmpFileName.end());
+		tmpName.push_back('\0');
+		int fd = mkstemp(&tmpName[0]);	// creates it with mode 0600
+		if (fd >= 0)
+		{
+			csTmpFileName = &tmpName[0];
+			f = fdopen(fd, "wb");
+			if (f == NULL)
+			{
+				close(fd);
+				unlink(csTmpFileName.c_str());
+			}
+		}
+		std::wstring wsTmpFileName = utilStringWiden(csTmpFileName);
+#endif
+		if (f == NULL)
+		{
+			MWLOG(LEV_WARN, MOD_CAL, L"Card file cache: can't write to %ls", wsTmpFileName.c_str());
+			return;
+		}
+
+		bool bOK = fwrite(oContents.GetBytes(), 1, oContents.Size(), f) == oContents.Size();
+		bOK = (fclose(f) == 0) && bOK;
+
+#ifdef WIN32
+		if (bOK)
+		{
+			_wremove(wsFileName.c_str());
+			bOK = _wrename(wsTmpFileName.c_str(), wsFileName.c_str()) == 0;
+		}
+		if (!bOK)
+			_wremove(wsTmpFileName.c_str());
+#else
+		if (bOK)
+			bOK = rename(csTmpFileName.c_str(), utilStringNarrow(wsFileName).c_str()) == 0;
+		if (!bOK)
+			unlink(csTmpFileName.c_str());
+#endif
+		if (!bOK)
+			MWLOG(LEV_WARN, MOD_CAL, L"Card file cache: failed to update %ls", wsFileName.c_str());
+	}
+
+}
@@ -0,0 +1,106 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2010 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * Persistent cache of the files read from a card.
+ *
+ * There is one cache file per card, named after the card's serial number.
+ * Each cache file starts with the "Get Card Data" response of the card it
+ * belongs to; if that doesn't match the card currently in the reader, the
+ * whole cache file is ignored (and overwritten on the next Put()).
+ * Every cached file is stored with its SHA-256 hash, which is checked
+ * before the data is returned.
+ *
+ * Layout of a cache file (all numbers big endian):
+ *   "BEIDFC01"                    magic
+ *   4 bytes                       length of the card data
+ *   card data
+ *   4 bytes                       number of entries
+ *   per entry:
+ *     1 byte                      length of the path
+ *     path                        (e.g. "3F00DF014031")
+ *     4 bytes                     length of the file data
+ *     32 bytes                    SHA-256 of the file data
+ *     file data
+ *
+ * Only files that can't change during the lifetime of a card are cached;
+ * the address files are always read from the card. The entry "PKCS15"
+ * isn't a file on the card but its parsed PKCS#15 structure, which is
+ * kept here by CPKCS15Cache.
+ */
+
+#pragma once
+
+#ifndef CARDFILECACHE_H
+#define CARDFILECACHE_H
+
+#include <string>
+#include "common/bytearray.h"
+#include "common/mutex.h"
+
+namespace eIDMW
+{
+
+	class CCardFileCache
+	{
+public:
+		CCardFileCache();
+		~CCardFileCache();
+
+	/** Returns true if the cache has been turned on in the config */
+		bool IsEnabled();
+
+	/** Returns true if the file indicated by csPath may be cached */
+		static bool IsCacheable(const std::string & csPath);
+
+	/**
+	 * Look up the file csPath of the card with serial nr. oSerialNr
+	 * and card data oCardData. Returns true and fills in oData on a
+	 * cache hit, returns false otherwise.
+	 */
+		bool Get(const CByteArray & oSerialNr, const CByteArray & oCardData,
+			 const std::string & csPath, CByteArray & oData);
+
+	/** Store (or replace) the file csPath of the card in the cache */
+		void Put(const CByteArray & oSerialNr, const CByteArray & oCardData,
+			 const std::string & csPath, const CByteArray & oData);
+
+private:
+		// No copies allowed
+		CCardFileCache(const CCardFileCache & oCache);
+		CCardFileCache & operator =(const CCardFileCache & oCache);
+
+		void Init();
+		std::wstring GetCacheFileName(const CByteArray & oSerialNr);
+		bool MapFile(const std::wstring & wsFileName, const unsigned char **ppucData, unsigned long *pulLen);
+		void UnmapFile(const unsigned char *pucData, unsigned long ulLen);
+		static bool ParseFile(const unsigned char *pucData, unsigned long ulLen,
+				      const CByteArray & oCardData, const std::string & csPath,
+				      CByteArray * poData, CByteArray * poOtherEntries,
+				      unsigned long *pulOtherCount);
+
+		bool m_bInitialized;
+		bool m_bEnabled;
+		std::wstring m_wsCacheDir;
+		CMutex m_Mutex;
+	};
+
+}
+#endif
@@ -62,6 +62,11 @@ namespace eIDMW
 		return m_oContext.m_oPCSC.GetTheStatusChange(ulTimeout, txReaderStates, ulReaderCount);
 	}
 
+	CReaderMonitor & CCardLayer::GetReaderMonitor()
+	{
+		return m_oContext.m_oMonitor;
+	}
+
 /**
  * This is something you typically do just once, unless you
  * want to check if new readers were inserted/removed.
@@ -102,6 +107,8 @@ namespace eIDMW
 
 	CReader & CCardLayer::getReader(const std::string & csReaderName)
 	{
+		CAutoMutex autoMutex(&m_oReadersMutex);
+
 		// Do an SCardEstablishContext() if not done yet
 		m_oContext.m_oPCSC.EstablishContext();
 
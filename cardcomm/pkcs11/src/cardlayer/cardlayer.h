@@ -24,6 +24,7 @@
 #include "reader.h"
 #include "readersinfo.h"
 #include "context.h"
+#include "common/mutex.h"
 
 namespace eIDMW
 {
@@ -70,6 +71,11 @@ namespace eIDMW
 		 */
 		long GetStatusChange(unsigned long ulTimeout, SCARD_READERSTATEA * txReaderStates, unsigned long ulReaderCount);
 
+		/* the thread that keeps the last state of the readers
+		 * (see readermonitor.h)
+		 */
+		CReaderMonitor & GetReaderMonitor();
+
 		/**
 		 * Return the list of all available readers, plus info on the
 		 * presence of cards in those readers.
@@ -105,6 +111,7 @@ namespace eIDMW
 
 		unsigned long m_ulReaderCount;
 		CReader *m_tpReaders[MAX_READERS];
+		CMutex m_oReadersMutex;	// getReader() can be called for different slots at the same time
 	};
 
 }
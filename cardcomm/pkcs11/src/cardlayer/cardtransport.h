@@ -0,0 +1,89 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * The calls that CPCSC makes to the PC/SC resource manager.
+ *
+ * Normally these go straight to winscard/pcsc-lite; a build configured
+ * with --enable-card-emulator can instead answer them from a card image
+ * (see cardemu.h), so the card layer can be used without a reader.
+ * The functions have the same parameters and return values as their
+ * SCardXxx() counterparts, except that SCardStatus() doesn't return the
+ * reader name and SCardControl() always has the new (pcsc-lite >= 1.3) API.
+ */
+
+#pragma once
+
+#ifndef CARDTRANSPORT_H
+#define CARDTRANSPORT_H
+
+#include <winscard.h>
+
+#ifndef WIN32
+#include "wintypes.h"
+
+// see pcsc.h
+#ifndef SCARD_READERSTATE_A
+#define SCARD_READERSTATE_A SCARD_READERSTATE
+#endif
+#ifndef SCARD_READERSTATEA
+#define SCARD_READERSTATEA SCARD_READERSTATE_A
+#endif
+#endif
+
+namespace eIDMW
+{
+
+	class CCardTransport
+	{
+public:
+		virtual ~CCardTransport()
+		{
+		}
+
+		virtual long EstablishContext(SCARDCONTEXT * phContext) = 0;
+		virtual long ReleaseContext(SCARDCONTEXT hContext) = 0;
+		virtual long Cancel(SCARDCONTEXT hContext) = 0;
+		virtual long ListReaders(SCARDCONTEXT hContext, char *mszReaders, DWORD * pcchReaders) = 0;
+		virtual long GetStatusChange(SCARDCONTEXT hContext, DWORD dwTimeout,
+					     SCARD_READERSTATEA * rgReaderStates, DWORD cReaders) = 0;
+
+		virtual long Connect(SCARDCONTEXT hContext, const char *szReader, DWORD dwShareMode,
+				     DWORD dwPreferredProtocols, SCARDHANDLE * phCard, DWORD * pdwActiveProtocol) = 0;
+		virtual long Reconnect(SCARDHANDLE hCard, DWORD dwShareMode, DWORD dwPreferredProtocols,
+				       DWORD dwInitialization, DWORD * pdwActiveProtocol) = 0;
+		virtual long Disconnect(SCARDHANDLE hCard, DWORD dwDisposition) = 0;
+		virtual long Status(SCARDHANDLE hCard, DWORD * pdwState, DWORD * pdwProtocol,
+				    unsigned char *pbAtr, DWORD * pcbAtrLen) = 0;
+		virtual long GetAttrib(SCARDHANDLE hCard, DWORD dwAttrId, unsigned char *pbAttr, DWORD * pcbAttrLen) = 0;
+
+		virtual long Transmit(SCARDHANDLE hCard, const SCARD_IO_REQUEST * pioSendPci,
+				      const unsigned char *pbSendBuffer, DWORD cbSendLength,
+				      SCARD_IO_REQUEST * pioRecvPci, unsigned char *pbRecvBuffer, DWORD * pcbRecvLength) = 0;
+		virtual long Control(SCARDHANDLE hCard, DWORD dwControlCode, const unsigned char *pbSendBuffer,
+				     DWORD cbSendLength, unsigned char *pbRecvBuffer, DWORD cbRecvLength,
+				     DWORD * lpBytesReturned) = 0;
+
+		virtual long BeginTransaction(SCARDHANDLE hCard) = 0;
+		virtual long EndTransaction(SCARDHANDLE hCard, DWORD dwDisposition) = 0;
+	};
+
+}
+#endif
@@ -23,7 +23,7 @@
 
 namespace eIDMW
 {
-	CContext::CContext()
+	CContext::CContext() : m_oPKCS15Cache(&m_oFileCache)
 	{
 		m_bSSO = CConfig::GetLong(CConfig:: EIDMW_CONFIG_PARAM_SECURITY_SINGLESIGNON) != 0;
 
@@ -24,6 +24,9 @@
 #define CONTEXT_H
 
 #include "pcsc.h"
+#include "cardfilecache.h"
+#include "pkcs15cache.h"
+#include "readermonitor.h"
 
 namespace eIDMW
 {
@@ -35,6 +38,9 @@ public:
 		~CContext();
 
 		CPCSC m_oPCSC;
+		CCardFileCache m_oFileCache;
+		CPKCS15Cache m_oPKCS15Cache;	// uses m_oFileCache
+		CReaderMonitor m_oMonitor;	// has its own PC/SC context
 
 		bool m_bSSO; // force Single Sign-On
 		unsigned long m_ulConnectionDelay;
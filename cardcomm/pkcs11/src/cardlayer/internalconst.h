@@ -38,6 +38,9 @@ namespace eIDMW
 #endif
 	const unsigned long MAX_APDU_LEN = 256;
 	const unsigned long APDU_BUF_LEN = MAX_APDU_LEN + 2;	// for SW1 and SW2
+	// Read Binary with an extended Le, if both the card and the reader support it
+	const unsigned long MAX_APDU_EXT_READ_LEN = 4096;
+	const unsigned long EXT_APDU_BUF_LEN = MAX_APDU_EXT_READ_LEN + 2;	// for SW1 and SW2
 	const unsigned long CTRL_BUF_LEN = 258;	// Fixme: this won't be enough for a pinpad init !!!
 
 	typedef enum
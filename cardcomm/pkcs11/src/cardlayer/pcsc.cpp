@@ -29,6 +29,11 @@
 #include "common/log.h"
 #include "common/thread.h"
 #include "common/util.h"
+#include "apdustats.h"
+#ifdef BEID_CARD_EMULATOR
+#include "cardemu.h"
+#include <stdlib.h>
+#endif
 #include <exception>
 //#include <Winsvc.h>
 
@@ -36,8 +41,96 @@
 
 namespace eIDMW
 {
-	static SCARD_IO_REQUEST m_ioSendPci;
-	static SCARD_IO_REQUEST m_ioRecvPci;
+	// The real thing: winscard or pcsc-lite
+	class CPCSCTransport:public CCardTransport
+	{
+public:
+		long EstablishContext(SCARDCONTEXT * phContext)
+		{
+			return SCardEstablishContext(SCARD_SCOPE_USER, NULL, NULL, phContext);
+		}
+
+		long ReleaseContext(SCARDCONTEXT hContext)
+		{
+			return SCardReleaseContext(hContext);
+		}
+
+		long Cancel(SCARDCONTEXT hContext)
+		{
+			return SCardCancel(hContext);
+		}
+
+		long ListReaders(SCARDCONTEXT hContext, char *mszReaders, DWORD * pcchReaders)
+		{
+			return SCardListReaders(hContext, NULL, mszReaders, pcchReaders);
+		}
+
+		long GetStatusChange(SCARDCONTEXT hContext, DWORD dwTimeout,
+				     SCARD_READERSTATEA * rgReaderStates, DWORD cReaders)
+		{
+			return SCardGetStatusChange(hContext, dwTimeout, rgReaderStates, cReaders);
+		}
+
+		long Connect(SCARDCONTEXT hContext, const char *szReader, DWORD dwShareMode,
+			     DWORD dwPreferredProtocols, SCARDHANDLE * phCard, DWORD * pdwActiveProtocol)
+		{
+			return SCardConnect(hContext, szReader, dwShareMode, dwPreferredProtocols, phCard, pdwActiveProtocol);
+		}
+
+		long Reconnect(SCARDHANDLE hCard, DWORD dwShareMode, DWORD dwPreferredProtocols,
+			       DWORD dwInitialization, DWORD * pdwActiveProtocol)
+		{
+			return SCardReconnect(hCard, dwShareMode, dwPreferredProtocols, dwInitialization, pdwActiveProtocol);
+		}
+
+		long Disconnect(SCARDHANDLE hCard, DWORD dwDisposition)
+		{
+			return SCardDisconnect(hCard, dwDisposition);
+		}
+
+		long Status(SCARDHANDLE hCard, DWORD * pdwState, DWORD * pdwProtocol,
+			    unsigned char *pbAtr, DWORD * pcbAtrLen)
+		{
+			DWORD dwReaderLen = 0;
+
+			return SCardStatus(hCard, NULL, &dwReaderLen, pdwState, pdwProtocol, pbAtr, pcbAtrLen);
+		}
+
+		long GetAttrib(SCARDHANDLE hCard, DWORD dwAttrId, unsigned char *pbAttr, DWORD * pcbAttrLen)
+		{
+			return SCardGetAttrib(hCard, dwAttrId, pbAttr, pcbAttrLen);
+		}
+
+		long Transmit(SCARDHANDLE hCard, const SCARD_IO_REQUEST * pioSendPci,
+			      const unsigned char *pbSendBuffer, DWORD cbSendLength,
+			      SCARD_IO_REQUEST * pioRecvPci, unsigned char *pbRecvBuffer, DWORD * pcbRecvLength)
+		{
+			return SCardTransmit(hCard, pioSendPci, pbSendBuffer, cbSendLength, pioRecvPci, pbRecvBuffer, pcbRecvLength);
+		}
+
+		long Control(SCARDHANDLE hCard, DWORD dwControlCode, const unsigned char *pbSendBuffer,
+			     DWORD cbSendLength, unsigned char *pbRecvBuffer, DWORD cbRecvLength,
+			     DWORD * lpBytesReturned)
+		{
+#ifndef __OLD_PCSC_API__
+			return SCardControl(hCard, dwControlCode, pbSendBuffer, cbSendLength,
+					    pbRecvBuffer, cbRecvLength, lpBytesReturned);
+#else
+			*lpBytesReturned = cbRecvLength;
+			return SCardControl(hCard, pbSendBuffer, cbSendLength, pbRecvBuffer, lpBytesReturned);
+#endif
+		}
+
+		long BeginTransaction(SCARDHANDLE hCard)
+		{
+			return SCardBeginTransaction(hCard);
+		}
+
+		long EndTransaction(SCARDHANDLE hCard, DWORD dwDisposition)
+		{
+			return SCardEndTransaction(hCard, dwDisposition);
+		}
+	};
 
 	                 CPCSC::CPCSC()
 	{
@@ -50,11 +143,28 @@ namespace eIDMW
 		        m_hContext = 0;
 		        m_iTimeoutCount = 0;
 		        m_iListReadersCount = 0;
+		        m_poTransport = NULL;
+
+#ifdef BEID_CARD_EMULATOR
+		// The environment variable makes it easy to use from tests
+		const char *csImage = getenv("EID_CARD_EMULATOR_IMAGE");
+		std::wstring wsImage = csImage != NULL ? utilStringWiden(csImage) :
+			config.GetString(CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDEMULATORIMAGE);
+
+		if (!wsImage.empty())
+		{
+			MWLOG(LEV_INFO, MOD_CAL, L"Using the card emulator with card image %ls", wsImage.c_str());
+			m_poTransport = new CCardEmulator(wsImage);
+		}
+#endif
+		if (m_poTransport == NULL)
+			m_poTransport = new CPCSCTransport();
 	}
 
 	CPCSC::  ~CPCSC(void)
 	{
 		ReleaseContext();
+		delete m_poTransport;
 	}
 
 	void CPCSC::EstablishContext()
@@ -62,9 +172,7 @@ namespace eIDMW
 		if (m_hContext == 0)
 		{
 			SCARDCONTEXT hCtx = 0;
-			long lRet =
-				SCardEstablishContext(SCARD_SCOPE_USER, NULL,
-						      NULL, &hCtx);
+			long lRet = m_poTransport->EstablishContext(&hCtx);
 			MWLOG(LEV_DEBUG, MOD_CAL,
 			      L"    SCardEstablishContext(): 0x%0x", lRet);
 			if (SCARD_S_SUCCESS != lRet)
@@ -76,19 +184,49 @@ namespace eIDMW
 
 	void CPCSC::ReleaseContext()
 	{
+		{
+			CAutoMutex oAutoMutex(&m_ContextMutex);
+			std::map < std::string, SCARDCONTEXT >::iterator it;
+
+			for (it = m_readerContexts.begin(); it != m_readerContexts.end(); it++)
+				m_poTransport->ReleaseContext(it->second);
+			m_readerContexts.clear();
+		}
+
 		if (m_hContext != 0)
 		{
 			//              SCardCancel(m_hContext);
-			SCardReleaseContext(m_hContext);
+			m_poTransport->ReleaseContext(m_hContext);
 			m_hContext = 0;
 		}
 	}
 
+	SCARDCONTEXT CPCSC::GetReaderContext(const std::string & csReader)
+	{
+		CAutoMutex oAutoMutex(&m_ContextMutex);
+		std::map < std::string, SCARDCONTEXT >::iterator it = m_readerContexts.find(csReader);
+
+		if (it != m_readerContexts.end())
+			return it->second;
+
+		SCARDCONTEXT hCtx = 0;
+		long lRet = m_poTransport->EstablishContext(&hCtx);
+		MWLOG(LEV_DEBUG, MOD_CAL,
+		      L"    SCardEstablishContext(%ls): 0x%0x",
+		      utilStringWiden(csReader).c_str(), lRet);
+		if (SCARD_S_SUCCESS != lRet)
+			throw CMWEXCEPTION(PcscToErr(lRet));
+
+		m_readerContexts[csReader] = hCtx;
+
+		return hCtx;
+	}
+
 	void CPCSC::Cancel()
 	{
 		if (m_hContext != 0)
 		{
-			SCardCancel(m_hContext);
+			m_poTransport->Cancel(m_hContext);
 		}
 	}
 
@@ -98,8 +236,8 @@ namespace eIDMW
 		DWORD dwReadersLen = sizeof(csReaders);
 
 		long lRet =
-			SCardListReaders(m_hContext, NULL, csReaders,
-					 &dwReadersLen);
+			m_poTransport->ListReaders(m_hContext, csReaders,
+						   &dwReadersLen);
 		if (SCARD_S_SUCCESS != lRet || m_iListReadersCount < 6)
 		{
 			MWLOG(LEV_DEBUG, MOD_CAL,
@@ -259,7 +397,7 @@ namespace eIDMW
 		xReaderState.dwCurrentState = 0;
 		xReaderState.cbAtr = 0;
 
-		long lRet = SCardGetStatusChange(m_hContext, 0, &xReaderState, 1);
+		long lRet = m_poTransport->GetStatusChange(m_hContext, 0, &xReaderState, 1);
 		if (SCARD_S_SUCCESS != lRet)
 			throw CMWEXCEPTION(PcscToErr(lRet));
 
@@ -279,9 +417,9 @@ namespace eIDMW
 
 		//    MWLOG(LEV_DEBUG, MOD_CAL, L"    Calling connect: %0x, %ls, 0x%0x, %0x\n", m_hContext, utilStringWiden(csReader).c_str(), ulShareMode, ulPreferredProtocols);
 
-		long lRet = SCardConnect(m_hContext, csReader.c_str(),
-					 ulShareMode, ulPreferredProtocols,
-					 &hCard, &dwProtocol);
+		long lRet = m_poTransport->Connect(GetReaderContext(csReader), csReader.c_str(),
+						   ulShareMode, ulPreferredProtocols,
+						   &hCard, &dwProtocol);
 
 		/*      if (SCARD_S_SUCCESS != lRet)
 		   {
@@ -306,14 +444,25 @@ namespace eIDMW
 
 		else
 		{
-			m_ioSendPci.dwProtocol = dwProtocol;
-			m_ioSendPci.cbPciLength = sizeof(SCARD_IO_REQUEST);
-			m_ioRecvPci.dwProtocol = dwProtocol;
-			m_ioRecvPci.cbPciLength = sizeof(SCARD_IO_REQUEST);
+			SetProtocol(hCard, dwProtocol);
 
 			// If you do an SCardTransmit() too fast after an SCardConnect(),
 			// some cards/readers will return an error (e.g. 0x801002f)
-			CThread::SleepMillisecs(200);
+			if (m_oDelay.IsAdaptive())
+			{
+				unsigned long ulDelay = m_oDelay.Connected(hCard, csReader, GetIFDVersion(hCard));
+
+				if (ulDelay > 0)
+					CThread::SleepMillisecs(ulDelay);
+				if (CApduStats::IsEnabled())
+					CApduStats::Slept(ulDelay);
+			}
+			else
+			{
+				CThread::SleepMillisecs(200);
+				if (CApduStats::IsEnabled())
+					CApduStats::Slept(200);
+			}
 		}
 
 		return hCard;
@@ -327,7 +476,13 @@ namespace eIDMW
 			DISCONNECT_RESET_CARD ? SCARD_RESET_CARD :
 			SCARD_LEAVE_CARD;
 
-		long lRet = SCardDisconnect(hCard, dwDisposition);
+		m_oDelay.Disconnected(hCard);
+		{
+			CAutoMutex oAutoMutex(&m_ProtocolMutex);
+			m_protocols.erase(hCard);
+		}
+
+		long lRet = m_poTransport->Disconnect(hCard, dwDisposition);
 
 		MWLOG(LEV_DEBUG, MOD_CAL,
 		      L"    SCardDisconnect(0x%0x): 0x%0x ; mode: %d", hCard,
@@ -338,14 +493,12 @@ namespace eIDMW
 
 	CByteArray CPCSC::GetATR(SCARDHANDLE hCard)
 	{
-		DWORD dwReaderLen = 0;
 		DWORD dwState, dwProtocol;
 		unsigned char tucATR[64];
 		DWORD dwATRLen = sizeof(tucATR);
 
-		long lRet = SCardStatus(hCard, NULL, &dwReaderLen,
-					&dwState, &dwProtocol, tucATR,
-					&dwATRLen);
+		long lRet = m_poTransport->Status(hCard, &dwState,
+						  &dwProtocol, tucATR, &dwATRLen);
 		MWLOG(LEV_DEBUG, MOD_CAL, L"    SCardStatus(0x%0x): 0x%0x",
 		      hCard, lRet);
 		if (SCARD_S_SUCCESS != lRet)
@@ -360,8 +513,8 @@ namespace eIDMW
 		DWORD dwIFDVersLen = sizeof(tucIFDVers);
 
 		long lRet =
-			SCardGetAttrib(hCard, SCARD_ATTR_VENDOR_IFD_VERSION,
-				       tucIFDVers, &dwIFDVersLen);
+			m_poTransport->GetAttrib(hCard, SCARD_ATTR_VENDOR_IFD_VERSION,
+						 tucIFDVers, &dwIFDVersLen);
 
 		MWLOG(LEV_DEBUG, MOD_CAL, L"    SCardGetAttrib(0x%0x): 0x%0x",
 		      hCard, lRet);
@@ -371,15 +524,13 @@ namespace eIDMW
 
 	bool CPCSC::Status(SCARDHANDLE hCard)
 	{
-		DWORD dwReaderLen = 0;
 		DWORD dwState, dwProtocol;
 		unsigned char tucATR[64];
 		DWORD dwATRLen = sizeof(tucATR);
 		static int iStatusCount = 0;
 
-		long lRet = SCardStatus(hCard, NULL, &dwReaderLen,
-					&dwState, &dwProtocol, tucATR,
-					&dwATRLen);
+		long lRet = m_poTransport->Status(hCard, &dwState,
+						  &dwProtocol, tucATR, &dwATRLen);
 
 		if (iStatusCount < 5 || SCARD_S_SUCCESS != lRet)
 		{
@@ -391,12 +542,42 @@ namespace eIDMW
 		return SCARD_S_SUCCESS == lRet;
 	}
 
+	// The errors that go away when sending a bit slower, see CReaderDelay
+	static bool IsTransientError(long lRet, const unsigned char *pucRecv, DWORD dwRecvLen)
+	{
+		if (lRet == (long) SCARD_E_COMM_DATA_LOST)
+			return true;
+
+		return lRet == SCARD_S_SUCCESS && dwRecvLen == 2 && pucRecv[0] == 0x6D && pucRecv[1] == 0x00;
+	}
+
+	// Commands that don't change the card's state (other than the
+	// current file) and so can be resent after a communication error
+	static bool IsRepeatable(const CByteArray & oCmdAPDU)
+	{
+		if (oCmdAPDU.Size() < 4)
+			return false;
+
+		switch (oCmdAPDU.GetByte(1))
+		{
+			case 0xA4:	// SELECT
+			case 0xB0:	// READ BINARY
+			case 0xC0:	// GET RESPONSE
+			case 0xE4:	// GET CARD DATA
+			case 0xEA:	// GET PIN STATUS
+			case 0x22:	// MSE SET
+				return true;
+			default:
+				return false;
+		}
+	}
+
 	CByteArray CPCSC::Transmit(SCARDHANDLE hCard,
 				   const CByteArray & oCmdAPDU,
 				   long *plRetVal, void *pSendPci,
 				   void *pRecvPci)
 	{
-		unsigned char tucRecv[APDU_BUF_LEN];
+		unsigned char tucRecv[EXT_APDU_BUF_LEN];
 
 		memset(tucRecv, 0, sizeof(tucRecv));
 		DWORD dwRecvLen = sizeof(tucRecv);
@@ -406,8 +587,15 @@ namespace eIDMW
 		unsigned long ulLen = ucINS == 0xA4
 			|| ucINS == 0x22 ? 0xFFFFFFFF : 5;
 
-		SCARD_IO_REQUEST *pioSendPci = (pSendPci != NULL) ? (SCARD_IO_REQUEST *) pSendPci : &m_ioSendPci;
-		SCARD_IO_REQUEST *pioRecvPci = (pRecvPci != NULL) ? (SCARD_IO_REQUEST *) pRecvPci : &m_ioRecvPci;
+		SCARD_IO_REQUEST ioSendPci;
+		SCARD_IO_REQUEST ioRecvPci;
+
+		ioSendPci.dwProtocol = GetProtocol(hCard);
+		ioSendPci.cbPciLength = sizeof(SCARD_IO_REQUEST);
+		ioRecvPci = ioSendPci;
+
+		SCARD_IO_REQUEST *pioSendPci = (pSendPci != NULL) ? (SCARD_IO_REQUEST *) pSendPci : &ioSendPci;
+		SCARD_IO_REQUEST *pioRecvPci = (pRecvPci != NULL) ? (SCARD_IO_REQUEST *) pRecvPci : &ioRecvPci;
 
 		MWLOG(LEV_DEBUG, MOD_CAL, L"      SCardTransmit(%ls)", oCmdAPDU.ToWString(true, true, 0, ulLen).c_str());
 		//MWLOG(LEV_DEBUG, MOD_CAL, L"      SCardTransmit pioSendPci (dwProtocol = 0X%x, cbPciLength = 0x%x)", pioSendPci->dwProtocol, pioSendPci->cbPciLength);
@@ -418,17 +606,71 @@ namespace eIDMW
 		// It occurs with most readers (some more then others) and depends heavily
 		// on the type of card (e.g. nearly always with the test Kids card).
 		// It seems to be fixed when adding a delay before sending something to the card...
-		CThread::SleepMillisecs(m_ulCardTxDelay);
+		// If card_adaptive_delay is on, this delay is only added for the readers that need it.
+		bool bAdaptive = m_oDelay.IsAdaptive();
+		unsigned long ulDelay = bAdaptive ? m_oDelay.GetTxDelay(hCard) : m_ulCardTxDelay;
+
+		bool bStats = CApduStats::IsEnabled();
+		unsigned long long ullTransmitUs = 0;
+		unsigned long long ullStart = 0;
+
+		if (ulDelay > 0)
+		{
+			CThread::SleepMillisecs(ulDelay);
+			if (bStats)
+				CApduStats::Slept(ulDelay);
+		}
 
 #ifdef __APPLE__
 		int iRetryCount = 0;
 
 	      try_again:
 #endif
-		long lRet = SCardTransmit(hCard,
-					  pioSendPci, oCmdAPDU.GetBytes(),
-					  (DWORD) oCmdAPDU.Size(),
-					  pioRecvPci, tucRecv, &dwRecvLen);
+		if (bStats)
+			ullStart = CApduStats::Now();
+		long lRet = m_poTransport->Transmit(hCard,
+						    pioSendPci, oCmdAPDU.GetBytes(),
+						    (DWORD) oCmdAPDU.Size(),
+						    pioRecvPci, tucRecv, &dwRecvLen);
+		if (bStats)
+			ullTransmitUs += CApduStats::Now() - ullStart;
+
+		if (bAdaptive && IsTransientError(lRet, tucRecv, dwRecvLen))
+		{
+			// 6D 00 means the APDU wasn't executed; after a communication
+			// error we don't know, so only resend what can safely be repeated
+			bool bSW6D00 = (lRet == SCARD_S_SUCCESS);
+			unsigned long ulRetryDelay = m_oDelay.Backoff(hCard);
+
+			if (bSW6D00 || IsRepeatable(oCmdAPDU))
+			{
+				MWLOG(LEV_DEBUG, MOD_CAL, L"        SCardTransmit(): 0x%0x, retrying after %lu msec", lRet, ulRetryDelay);
+				CThread::SleepMillisecs(ulRetryDelay);
+				ulDelay += ulRetryDelay;
+				if (bStats)
+				{
+					CApduStats::Slept(ulRetryDelay);
+					CApduStats::Retry();
+					ullStart = CApduStats::Now();
+				}
+
+				dwRecvLen = sizeof(tucRecv);
+				lRet = m_poTransport->Transmit(hCard,
+							       pioSendPci, oCmdAPDU.GetBytes(),
+							       (DWORD) oCmdAPDU.Size(),
+							       pioRecvPci, tucRecv, &dwRecvLen);
+				if (bStats)
+					ullTransmitUs += CApduStats::Now() - ullStart;
+
+				// Same answer: the card really doesn't support this instruction
+				if (bSW6D00 && IsTransientError(lRet, tucRecv, dwRecvLen))
+					m_oDelay.UndoBackoff(hCard);
+				else if (bStats)
+					CApduStats::DelayBackoff();
+			}
+			else if (bStats)
+				CApduStats::DelayBackoff();
+		}
 
 		*plRetVal = lRet;
 		if (SCARD_S_SUCCESS != lRet)
@@ -439,25 +681,44 @@ namespace eIDMW
 			{
 				iRetryCount++;
 				CThread::SleepMillisecs(500);
+				if (bStats)
+				{
+					CApduStats::Slept(500);
+					CApduStats::Retry();
+				}
 				goto try_again;
 			}
 #endif
+			if (bStats)
+				CApduStats::Transmit(ucINS, oCmdAPDU.Size(), 0, ullTransmitUs);
 			MWLOG(LEV_DEBUG, MOD_CAL,
 			      L"        SCardTransmit(): 0x%0x", lRet);
 			throw CMWEXCEPTION(PcscToErr(lRet));
 		}
+		if (bStats)
+			CApduStats::Transmit(ucINS, oCmdAPDU.Size(), dwRecvLen, ullTransmitUs);
 		// Don't log the full response for privacy reasons, only SW1-SW2
 		//MWLOG(LEV_DEBUG, MOD_CAL, L"        SCardTransmit(): %ls", CByteArray(tucRecv, (unsigned long) dwRecvLen).ToWString(true, true, 0, (unsigned long) dwRecvLen).c_str() );
 		MWLOG(LEV_DEBUG, MOD_CAL,
 		      L"        SCardTransmit(): SW12 = %02X %02X",
 		      tucRecv[dwRecvLen - 2], tucRecv[dwRecvLen - 1]);
 		//check response, and add 25 ms delay when error was returned
+		//(with card_adaptive_delay, a learned delay is added before the next APDU instead)
+
+		if (bAdaptive)
+		{
+			bool bErrorSW = (tucRecv[dwRecvLen - 2] != 0x90 || tucRecv[dwRecvLen - 1] != 0x00)
+				&& tucRecv[dwRecvLen - 2] != 0x61;
 
-		if ((tucRecv[dwRecvLen - 2] != 0x90)
+			m_oDelay.TransmitDone(hCard, ulDelay, bErrorSW);
+		}
+		else if ((tucRecv[dwRecvLen - 2] != 0x90)
 		    && (tucRecv[dwRecvLen - 1] != 0x00)
 		    && (tucRecv[dwRecvLen - 2] != 0x61))
 		{
 			CThread::SleepMillisecs(25);
+			if (bStats)
+				CApduStats::Slept(25);
 		}
 
 		return CByteArray(tucRecv, (unsigned long) dwRecvLen);
@@ -465,6 +726,22 @@ namespace eIDMW
 
 
 
+	void CPCSC::SetProtocol(SCARDHANDLE hCard, DWORD dwProtocol)
+	{
+		CAutoMutex oAutoMutex(&m_ProtocolMutex);
+
+		m_protocols[hCard] = dwProtocol;
+	}
+
+	DWORD CPCSC::GetProtocol(SCARDHANDLE hCard)
+	{
+		CAutoMutex oAutoMutex(&m_ProtocolMutex);
+		std::map < SCARDHANDLE, DWORD >::iterator it = m_protocols.find(hCard);
+
+		//handles we didn't connect ourselves (e.g. the card emulator's) get T=0, as asked by Connect()
+		return it != m_protocols.end() ? it->second : SCARD_PROTOCOL_T0;
+	}
+
 	void CPCSC::Recover(SCARDHANDLE hCard, unsigned long *pulLockCount)
 	{
 		//try to recover when the card is not responding (properly) anymore
@@ -475,17 +752,23 @@ namespace eIDMW
 
 		MWLOG(LEV_WARN, MOD_CAL,
 		      L"Card is not responding properly, trying to recover...");
+		if (CApduStats::IsEnabled())
+			CApduStats::Recovery();
 
 		for (i = 0;
 		     (i < EID_RECOVER_RETRIES) && (lRet != SCARD_S_SUCCESS);
 		     i++)
 		{
 			if (i != 0)
+			{
 				CThread::SleepMillisecs(1000);
+				if (CApduStats::IsEnabled())
+					CApduStats::Slept(1000);
+			}
 
-			lRet = SCardReconnect(hCard, SCARD_SHARE_SHARED,
-					      SCARD_PROTOCOL_T0,
-					      SCARD_RESET_CARD, &ap);
+			lRet = m_poTransport->Reconnect(hCard, SCARD_SHARE_SHARED,
+							SCARD_PROTOCOL_T0,
+							SCARD_RESET_CARD, &ap);
 			if (lRet != SCARD_S_SUCCESS)
 			{
 				MWLOG(LEV_DEBUG, MOD_CAL,
@@ -493,10 +776,12 @@ namespace eIDMW
 				      i, lRet);
 				continue;
 			}
+			SetProtocol(hCard, ap);
+
 			// transaction is lost after an SCardReconnect()
 			if (*pulLockCount > 0)
 			{
-				lRet = SCardBeginTransaction(hCard);
+				lRet = m_poTransport->BeginTransaction(hCard);
 				if (lRet != SCARD_S_SUCCESS)
 				{
 					MWLOG(LEV_DEBUG, MOD_CAL,
@@ -531,15 +816,9 @@ namespace eIDMW
 			throw CMWEXCEPTION(EIDMW_ERR_MEMORY);
 		DWORD dwRecvLen = ulMaxResponseSize;
 
-#ifndef __OLD_PCSC_API__
-		long lRet = SCardControl(hCard, ulControl,
-					 oCmd.GetBytes(), (DWORD) oCmd.Size(),
-					 pucRecv, dwRecvLen, &dwRecvLen);
-#else
-		long lRet = SCardControl((SCARDHANDLE) hCard,
-					 oCmd.GetBytes(), (DWORD) oCmd.Size(),
-					 pucRecv, &dwRecvLen);
-#endif
+		long lRet = m_poTransport->Control(hCard, ulControl,
+						   oCmd.GetBytes(), (DWORD) oCmd.Size(),
+						   pucRecv, dwRecvLen, &dwRecvLen);
 		if (SCARD_S_SUCCESS != lRet)
 		{
 			MWLOG(LEV_DEBUG, MOD_CAL,
@@ -567,7 +846,7 @@ namespace eIDMW
 
 	void CPCSC::BeginTransaction(SCARDHANDLE hCard)
 	{
-		long lRet = SCardBeginTransaction(hCard);
+		long lRet = m_poTransport->BeginTransaction(hCard);
 
 		MWLOG(LEV_DEBUG, MOD_CAL,
 		      L"    SCardBeginTransaction(0x%0x): 0x%0x", hCard,
@@ -578,7 +857,7 @@ namespace eIDMW
 
 	void CPCSC::EndTransaction(SCARDHANDLE hCard)
 	{
-		long lRet = SCardEndTransaction(hCard, SCARD_LEAVE_CARD);
+		long lRet = m_poTransport->EndTransaction(hCard, SCARD_LEAVE_CARD);
 
 		MWLOG(LEV_DEBUG, MOD_CAL,
 		      L"    SCardEndTransaction(0x%0x): 0x%0x", hCard, lRet);
@@ -694,9 +973,9 @@ namespace eIDMW
 
 		do
 		{
-			lRet = SCardGetStatusChange(m_hContext,
-						    ulTimeout, txReaderStates,
-						    ulReaderCount);
+			lRet = m_poTransport->GetStatusChange(m_hContext,
+							      ulTimeout, txReaderStates,
+							      ulReaderCount);
 			if ((long) SCARD_E_TIMEOUT != lRet)
 			{
 				if (SCARD_S_SUCCESS != lRet)
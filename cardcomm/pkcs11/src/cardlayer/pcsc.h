@@ -30,11 +30,15 @@ Takes care of
 #ifndef PCSC_H
 #define PCSC_H
 
+#include <map>
 #include "common/eiderrors.h"
 #include "common/bytearray.h"
 #include "common/mwexception.h"
+#include "common/mutex.h"
 #include "cardlayerconst.h"
 #include "internalconst.h"
+#include "readerdelay.h"
+#include "cardtransport.h"
 
 #include <winscard.h>
 
@@ -166,18 +170,36 @@ public:
 
 		long SW12ToErr(unsigned long ulSW12);
 
+
 private:
 		long PcscToErr(unsigned long lRet);
+		void SetProtocol(SCARDHANDLE hCard, DWORD dwProtocol);
+		DWORD GetProtocol(SCARDHANDLE hCard);
+		SCARDCONTEXT GetReaderContext(const std::string & csReader);
 
 		//unsigned long m_hContext;
 		SCARDCONTEXT m_hContext;
 
+		//pcsc-lite handles the calls on one context one after the other,
+		//so the cards in each reader are connected through a context of
+		//their own; m_hContext is used to list and wait for the readers
+		std::map < std::string, SCARDCONTEXT > m_readerContexts;
+		CMutex m_ContextMutex;
+
+		CCardTransport *m_poTransport;	//the PC/SC resource manager, or a card emulator
+
 		friend class CPinpad;
 
 		int m_iTimeoutCount;
 		int m_iListReadersCount;
 
 		unsigned long m_ulCardTxDelay;	//delay before each transmission to a smartcard; in millie-seconds, default 1
+		CReaderDelay m_oDelay;	//learned delays, used instead of the fixed ones if card_adaptive_delay = 1
+
+		//the active protocol of each card handle, for the PCI of SCardTransmit();
+		//the slots are locked separately, so this is shared by concurrent calls
+		std::map < SCARDHANDLE, DWORD > m_protocols;
+		CMutex m_ProtocolMutex;
 
 	};
 
@@ -67,7 +67,7 @@ namespace eIDMW
 	{
 		if (m_bNewCard)
 		{
-			m_bUsePinpadLib = m_oPinpadLib.Load((unsigned long) m_poContext->m_oPCSC.m_hContext, m_hCard, m_csReader,
+			m_bUsePinpadLib = m_oPinpadLib.Load((unsigned long) m_poContext->m_oPCSC.GetReaderContext(m_csReader), m_hCard, m_csReader,
 				     m_csPinpadPrefix, GetLanguage());
 
 			// The GemPC pinpad reader does a "Verify PIN" with empty buffer in an attempt
@@ -59,7 +59,7 @@ namespace eIDMW
 	const std::string defaultEFODF = "3F00DF005031";
 
 
-	CPKCS15::CPKCS15(void) :m_poParser(NULL)
+	CPKCS15::CPKCS15(void) :m_poParser(NULL), m_poCache(NULL)
 	{
 		Clear();
 	}
@@ -95,6 +95,66 @@ namespace eIDMW
 	void CPKCS15::SetCard(CCard *poCard)
 	{
 		m_poCard = poCard;
+		if (m_poCard != NULL)
+			LoadFromCache();
+	}
+
+	void CPKCS15::SetCache(CPKCS15Cache *poCache)
+	{
+		m_poCache = poCache;
+	}
+
+	void CPKCS15::LoadFromCache()
+	{
+		tPKCS15Info info;
+
+		if (m_poCache == NULL ||
+		    !m_poCache->Get(m_poCard->GetSerialNrBytes(), m_poCard->GetAppletVersion(), m_poCard->GetInfo(), info))
+			return;
+
+		if (info.ucParts & PKCS15CACHE_TOKENINFO) {
+			m_csSerial = info.csSerial;
+			m_csLabel = info.csLabel;
+			m_xTokenInfo.isRead = true;
+		}
+		if (info.ucParts & PKCS15CACHE_PINS) {
+			m_oPins = info.oPins;
+			m_xAODF.isRead = true;
+		}
+		if (info.ucParts & PKCS15CACHE_CERTS) {
+			m_oCertificates = info.oCertificates;
+			m_xCDF.isRead = true;
+		}
+		if (info.ucParts & PKCS15CACHE_PRKEYS) {
+			m_oPrKeys = info.oPrKeys;
+			m_xPrKDF.isRead = true;
+		}
+	}
+
+	void CPKCS15::StoreInCache(unsigned char ucPart)
+	{
+		tPKCS15Info info;
+
+		if (m_poCache == NULL)
+			return;
+
+		info.ucParts = ucPart;
+		switch (ucPart) {
+		case PKCS15CACHE_TOKENINFO:
+			info.csSerial = m_csSerial;
+			info.csLabel = m_csLabel;
+			break;
+		case PKCS15CACHE_PINS:
+			info.oPins = m_oPins;
+			break;
+		case PKCS15CACHE_CERTS:
+			info.oCertificates = m_oCertificates;
+			break;
+		case PKCS15CACHE_PRKEYS:
+			info.oPrKeys = m_oPrKeys;
+			break;
+		}
+		m_poCache->Put(m_poCard->GetSerialNrBytes(), m_poCard->GetAppletVersion(), m_poCard->GetInfo(), info);
 	}
 
 
@@ -229,9 +289,31 @@ namespace eIDMW
 		// propagate the information about the path of the corresponding level 3 (only ODF)
 		tOdfInfo resultOdf;
 		tTokenInfo resultTokenInfo;
-		switch (name) {
-		case ODF:
-			ReadFile(&m_xODF, 1);
+
+		if (name != ODF && name != TOKENINFO) {
+			// error: this method can only be called with ODF or TOKENINFO
+			return;
+		}
+
+		// Both files are in the application DF and both are needed sooner
+		// or later, so read the one that was asked for together with the
+		// other one if that wasn't read yet
+		CAutoLock autolock(m_poCard);
+		if (m_xODF.path == "" || m_xTokenInfo.path == "")
+			ReadLevel1();
+
+		bool bODF = name == ODF || !m_xODF.isRead;
+		bool bTokenInfo = name == TOKENINFO || !m_xTokenInfo.isRead;
+		std::vector < std::string > vcsPaths;
+		if (bODF)
+			vcsPaths.push_back(m_xODF.path);
+		if (bTokenInfo)
+			vcsPaths.push_back(m_xTokenInfo.path);
+		std::vector < CByteArray > voData = m_poCard->ReadFiles(vcsPaths);
+
+		if (bODF) {
+			m_xODF.byteArray = voData.front();
+			m_xODF.isRead = true;
 			// parse
 			resultOdf = m_poParser->ParseOdf(m_xODF.byteArray);
 			// propagate the path info  
@@ -239,17 +321,15 @@ namespace eIDMW
 			m_xCDF.path = resultOdf.csCdfPath;
 			m_xPrKDF.path = resultOdf.csPrkdfPath;
 			m_xPuKDF.path = resultOdf.csPukdfPath;
-			break;
-		case TOKENINFO:
-			ReadFile(&m_xTokenInfo, 1);
+		}
+		if (bTokenInfo) {
+			m_xTokenInfo.byteArray = voData.back();
+			m_xTokenInfo.isRead = true;
 			// parse
 			resultTokenInfo = m_poParser->ParseTokenInfo(m_xTokenInfo.byteArray);
 			m_csSerial = resultTokenInfo.csSerial;
 			m_csLabel = resultTokenInfo.csLabel;
-			break;
-		default:
-			// error: this method can only be called with ODF or TOKENINFO
-			return;
+			StoreInCache(PKCS15CACHE_TOKENINFO);
 		}
 	}
 
@@ -260,17 +340,19 @@ namespace eIDMW
 			ReadFile(&m_xAODF, 2);
 			// parse
 			m_oPins = m_poParser->ParseAodf(m_xAODF.byteArray);
-
+			StoreInCache(PKCS15CACHE_PINS);
 			break;
 		case CDF:
 			ReadFile(&m_xCDF, 2);
 			// parse 
 			m_oCertificates = m_poParser->ParseCdf(m_xCDF.byteArray);
+			StoreInCache(PKCS15CACHE_CERTS);
 			break;
 		case PRKDF:
 			ReadFile(&m_xPrKDF, 2);
 			// parse
 			m_oPrKeys = m_poParser->ParsePrkdf(m_xPrKDF.byteArray);
+			StoreInCache(PKCS15CACHE_PRKEYS);
 			break;
 		default:
 			// error: this method can only be called with AODF, CDF or PRKDF
@@ -279,6 +361,9 @@ namespace eIDMW
 	}
 
 	void CPKCS15::ReadFile(tPKCSFile* pFile, int upperLevel) {
+		// EF(DIR), the ODF and the file itself in one transaction
+		CAutoLock autolock(m_poCard);
+
 		if (pFile->path == "") {
 			switch (upperLevel) {
 			case 1:
@@ -29,6 +29,7 @@
 #include "common/mwexception.h"
 #include "p15objects.h"
 #include "pkcs15parser.h"
+#include "pkcs15cache.h"
 
 namespace eIDMW
 {
@@ -73,6 +74,8 @@ public:
 
 		void Clear(CCard * poCard = NULL);
 		void SetCard(CCard * poCard);
+		/** Where to remember the structure of the cards seen, may be NULL */
+		void SetCache(CPKCS15Cache * poCache);
 
 		     std::string GetSerialNr();
 		     std::string GetCardLabel();
@@ -93,6 +96,7 @@ public:
 private:
 		     CCard * m_poCard;
 		PKCS15Parser *m_poParser;
+		CPKCS15Cache *m_poCache;
 
 #ifdef WIN32
 // Get rid of warnings like "warning C4251: 'eIDMW::CPKCS15::m_oPins' : class 'std::vector<_Ty>'
@@ -134,6 +138,10 @@ private:
 		void ReadLevel3(tPKCSFileName name);
 
 		void ReadFile(tPKCSFile * pFile, int upperLevel);
+
+		// take what's known about the card from the cache, add what was just parsed to it
+		void LoadFromCache();
+		void StoreInCache(unsigned char ucPart);
 	};
 
 }
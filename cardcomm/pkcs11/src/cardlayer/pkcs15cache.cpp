@@ -0,0 +1,403 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "pkcs15cache.h"
+#include "cardfilecache.h"
+#include "common/configuration.h"
+#include "common/log.h"
+
+#include <string.h>
+
+#define PKCS15CACHE_MAGIC	"BEIDP15\x01"
+#define PKCS15CACHE_MAGIC_LEN	8
+#define PKCS15CACHE_FILE	"PKCS15"
+#define PKCS15CACHE_MAX_COUNT	64
+
+namespace eIDMW
+{
+
+	static void AppendBE32(CByteArray & oData, unsigned long ulVal)
+	{
+		oData.Append((unsigned char)(ulVal >> 24));
+		oData.Append((unsigned char)(ulVal >> 16));
+		oData.Append((unsigned char)(ulVal >> 8));
+		oData.Append((unsigned char)ulVal);
+	}
+
+	static void AppendString(CByteArray & oData, const std::string & csVal)
+	{
+		AppendBE32(oData, (unsigned long)csVal.size());
+		oData.Append((const unsigned char *)csVal.c_str(), (unsigned long)csVal.size());
+	}
+
+	// Reads the fields back; after the first read past the end, m_bOK is
+	// false and everything reads as 0 or ""
+	class CInfoReader
+	{
+public:
+		CInfoReader(const CByteArray & oData) :m_pucData(oData.GetBytes()), m_ulLen(oData.Size()), m_ulPos(0), m_bOK(true)
+		{
+		}
+
+		unsigned char Byte()
+		{
+			if (!Has(1))
+				return 0;
+			return m_pucData[m_ulPos++];
+		}
+
+		bool Bool()
+		{
+			return Byte() != 0;
+		}
+
+		unsigned long BE32()
+		{
+			if (!Has(4))
+				return 0;
+			const unsigned char *puc = m_pucData + m_ulPos;
+			m_ulPos += 4;
+			return ((unsigned long)puc[0] << 24) | ((unsigned long)puc[1] << 16) |
+				((unsigned long)puc[2] << 8) | (unsigned long)puc[3];
+		}
+
+		std::string String()
+		{
+			unsigned long ulLen = BE32();
+
+			if (!Has(ulLen))
+				return "";
+			std::string csVal((const char *)m_pucData + m_ulPos, ulLen);
+			m_ulPos += ulLen;
+			return csVal;
+		}
+
+		bool Has(unsigned long ulLen)
+		{
+			if (m_bOK && m_ulLen - m_ulPos < ulLen)
+				m_bOK = false;
+			return m_bOK;
+		}
+
+		bool AtEnd()
+		{
+			return m_bOK && m_ulPos == m_ulLen;
+		}
+
+		bool OK()
+		{
+			return m_bOK;
+		}
+
+private:
+		const unsigned char *m_pucData;
+		unsigned long m_ulLen;
+		unsigned long m_ulPos;
+		bool m_bOK;
+	};
+
+	CMutex CPKCS15Cache::m_Mutex;
+	std::map < std::string, tPKCS15Info > CPKCS15Cache::m_oCache;
+
+	CPKCS15Cache::CPKCS15Cache(CCardFileCache * poFileCache)
+		: m_bInitialized(false), m_bEnabled(false), m_poFileCache(poFileCache)
+	{
+	}
+
+	CPKCS15Cache::~CPKCS15Cache()
+	{
+	}
+
+	void CPKCS15Cache::Init()
+	{
+		if (m_bInitialized)
+			return;
+
+		m_bInitialized = true;
+		try
+		{
+			m_bEnabled = CConfig::GetLong(CConfig::EIDMW_CONFIG_PARAM_GENERAL_PKCS15CACHE) != 0;
+		}
+		catch (...)
+		{
+			m_bEnabled = false;
+		}
+	}
+
+	std::string CPKCS15Cache::GetKey(const CByteArray & oSerialNr, unsigned char ucAppletVersion)
+	{
+		return oSerialNr.ToString(false) + "/" + CByteArray(&ucAppletVersion, 1).ToString(false);
+	}
+
+	bool CPKCS15Cache::Get(const CByteArray & oSerialNr, unsigned char ucAppletVersion,
+			       const CByteArray & oCardData, tPKCS15Info & info)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		Init();
+		if (!m_bEnabled || oSerialNr.Size() == 0)
+			return false;
+
+		std::string csKey = GetKey(oSerialNr, ucAppletVersion);
+		std::map < std::string, tPKCS15Info >::const_iterator it = m_oCache.find(csKey);
+		if (it != m_oCache.end())
+		{
+			info = it->second;
+			return true;
+		}
+
+		// Not seen by this process yet, maybe by another one
+		CByteArray oData;
+		if (m_poFileCache != NULL && m_poFileCache->IsEnabled() &&
+		    m_poFileCache->Get(oSerialNr, oCardData, PKCS15CACHE_FILE, oData))
+		{
+			if (Deserialize(oData, info))
+			{
+				m_oCache[csKey] = info;
+				return true;
+			}
+			MWLOG(LEV_WARN, MOD_CAL, L"PKCS#15 cache: ignoring invalid cache entry");
+		}
+
+		return false;
+	}
+
+	void CPKCS15Cache::Put(const CByteArray & oSerialNr, unsigned char ucAppletVersion,
+			       const CByteArray & oCardData, const tPKCS15Info & info)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		Init();
+		if (!m_bEnabled || oSerialNr.Size() == 0 || info.ucParts == 0)
+			return;
+
+		std::string csKey = GetKey(oSerialNr, ucAppletVersion);
+		if (m_oCache.find(csKey) == m_oCache.end())
+		{
+			tPKCS15Info empty;
+
+			empty.ucParts = 0;
+			m_oCache[csKey] = empty;
+		}
+
+		tPKCS15Info & cached = m_oCache[csKey];
+		unsigned char ucNew = info.ucParts & ~cached.ucParts;
+
+		if (ucNew == 0)
+			return;
+
+		if (ucNew & PKCS15CACHE_TOKENINFO)
+		{
+			cached.csSerial = info.csSerial;
+			cached.csLabel = info.csLabel;
+		}
+		if (ucNew & PKCS15CACHE_PINS)
+			cached.oPins = info.oPins;
+		if (ucNew & PKCS15CACHE_CERTS)
+			cached.oCertificates = info.oCertificates;
+		if (ucNew & PKCS15CACHE_PRKEYS)
+			cached.oPrKeys = info.oPrKeys;
+		cached.ucParts |= ucNew;
+
+		if (m_poFileCache != NULL && m_poFileCache->IsEnabled())
+			m_poFileCache->Put(oSerialNr, oCardData, PKCS15CACHE_FILE, Serialize(cached));
+	}
+
+	CByteArray CPKCS15Cache::Serialize(const tPKCS15Info & info)
+	{
+		CByteArray oData(512);
+		size_t i;
+
+		oData.Append((const unsigned char *)PKCS15CACHE_MAGIC, PKCS15CACHE_MAGIC_LEN);
+		oData.Append(info.ucParts);
+
+		if (info.ucParts & PKCS15CACHE_TOKENINFO)
+		{
+			AppendString(oData, info.csSerial);
+			AppendString(oData, info.csLabel);
+		}
+		if (info.ucParts & PKCS15CACHE_PINS)
+		{
+			AppendBE32(oData, (unsigned long)info.oPins.size());
+			for (i = 0; i < info.oPins.size(); i++)
+			{
+				const tPin & pin = info.oPins[i];
+
+				oData.Append((unsigned char)pin.bValid);
+				AppendString(oData, pin.csLabel);
+				AppendBE32(oData, pin.ulFlags);
+				AppendBE32(oData, pin.ulAuthID);
+				AppendBE32(oData, pin.ulUserConsent);
+				AppendBE32(oData, pin.ulID);
+				AppendBE32(oData, pin.ulPinFlags);
+				AppendBE32(oData, pin.ulPinType);
+				AppendBE32(oData, pin.ulMinLen);
+				AppendBE32(oData, pin.ulStoredLen);
+				AppendBE32(oData, pin.ulMaxLen);
+				AppendBE32(oData, pin.ulPinRef);
+				oData.Append(pin.ucPadChar);
+				AppendBE32(oData, (unsigned long)pin.encoding);
+				AppendString(oData, pin.csLastChange);
+				AppendString(oData, pin.csPath);
+			}
+		}
+		if (info.ucParts & PKCS15CACHE_CERTS)
+		{
+			AppendBE32(oData, (unsigned long)info.oCertificates.size());
+			for (i = 0; i < info.oCertificates.size(); i++)
+			{
+				const tCert & cert = info.oCertificates[i];
+
+				oData.Append((unsigned char)cert.bValid);
+				AppendString(oData, cert.csLabel);
+				AppendBE32(oData, cert.ulFlags);
+				AppendBE32(oData, cert.ulAuthID);
+				AppendBE32(oData, cert.ulUserConsent);
+				AppendBE32(oData, cert.ulID);
+				oData.Append((unsigned char)cert.bAuthority);
+				oData.Append((unsigned char)cert.bImplicitTrust);
+				AppendString(oData, cert.csPath);
+			}
+		}
+		if (info.ucParts & PKCS15CACHE_PRKEYS)
+		{
+			AppendBE32(oData, (unsigned long)info.oPrKeys.size());
+			for (i = 0; i < info.oPrKeys.size(); i++)
+			{
+				const tPrivKey & key = info.oPrKeys[i];
+
+				oData.Append((unsigned char)key.bValid);
+				AppendString(oData, key.csLabel);
+				AppendBE32(oData, key.ulFlags);
+				AppendBE32(oData, key.ulAuthID);
+				AppendBE32(oData, key.ulUserConsent);
+				AppendBE32(oData, key.ulID);
+				AppendBE32(oData, key.ulKeyUsageFlags);
+				AppendBE32(oData, key.ulKeyAccessFlags);
+				AppendBE32(oData, key.ulKeyRef);
+				AppendString(oData, key.csPath);
+				AppendBE32(oData, key.ulKeyLenBytes);
+				oData.Append((unsigned char)key.bUsedInP11);
+			}
+		}
+
+		return oData;
+	}
+
+	bool CPKCS15Cache::Deserialize(const CByteArray & oData, tPKCS15Info & info)
+	{
+		CInfoReader oReader(oData);
+		unsigned long ulCount, i;
+
+		if (oData.Size() < PKCS15CACHE_MAGIC_LEN ||
+		    memcmp(oData.GetBytes(), PKCS15CACHE_MAGIC, PKCS15CACHE_MAGIC_LEN) != 0)
+			return false;
+		for (i = 0; i < PKCS15CACHE_MAGIC_LEN; i++)
+			oReader.Byte();
+
+		info.ucParts = oReader.Byte();
+		info.csSerial = "";
+		info.csLabel = "";
+		info.oPins.clear();
+		info.oCertificates.clear();
+		info.oPrKeys.clear();
+
+		if (info.ucParts & PKCS15CACHE_TOKENINFO)
+		{
+			info.csSerial = oReader.String();
+			info.csLabel = oReader.String();
+		}
+		if (info.ucParts & PKCS15CACHE_PINS)
+		{
+			ulCount = oReader.BE32();
+			for (i = 0; i < ulCount && i < PKCS15CACHE_MAX_COUNT && oReader.OK(); i++)
+			{
+				tPin pin;
+
+				pin.bValid = oReader.Bool();
+				pin.csLabel = oReader.String();
+				pin.ulFlags = oReader.BE32();
+				pin.ulAuthID = oReader.BE32();
+				pin.ulUserConsent = oReader.BE32();
+				pin.ulID = oReader.BE32();
+				pin.ulPinFlags = oReader.BE32();
+				pin.ulPinType = oReader.BE32();
+				pin.ulMinLen = oReader.BE32();
+				pin.ulStoredLen = oReader.BE32();
+				pin.ulMaxLen = oReader.BE32();
+				pin.ulPinRef = oReader.BE32();
+				pin.ucPadChar = oReader.Byte();
+				pin.encoding = (tPinEncoding) oReader.BE32();
+				pin.csLastChange = oReader.String();
+				pin.csPath = oReader.String();
+				info.oPins.push_back(pin);
+			}
+			if (ulCount > PKCS15CACHE_MAX_COUNT)
+				return false;
+		}
+		if (info.ucParts & PKCS15CACHE_CERTS)
+		{
+			ulCount = oReader.BE32();
+			for (i = 0; i < ulCount && i < PKCS15CACHE_MAX_COUNT && oReader.OK(); i++)
+			{
+				tCert cert;
+
+				cert.bValid = oReader.Bool();
+				cert.csLabel = oReader.String();
+				cert.ulFlags = oReader.BE32();
+				cert.ulAuthID = oReader.BE32();
+				cert.ulUserConsent = oReader.BE32();
+				cert.ulID = oReader.BE32();
+				cert.bAuthority = oReader.Bool();
+				cert.bImplicitTrust = oReader.Bool();
+				cert.csPath = oReader.String();
+				info.oCertificates.push_back(cert);
+			}
+			if (ulCount > PKCS15CACHE_MAX_COUNT)
+				return false;
+		}
+		if (info.ucParts & PKCS15CACHE_PRKEYS)
+		{
+			ulCount = oReader.BE32();
+			for (i = 0; i < ulCount && i < PKCS15CACHE_MAX_COUNT && oReader.OK(); i++)
+			{
+				tPrivKey key;
+
+				key.bValid = oReader.Bool();
+				key.csLabel = oReader.String();
+				key.ulFlags = oReader.BE32();
+				key.ulAuthID = oReader.BE32();
+				key.ulUserConsent = oReader.BE32();
+				key.ulID = oReader.BE32();
+				key.ulKeyUsageFlags = oReader.BE32();
+				key.ulKeyAccessFlags = oReader.BE32();
+				key.ulKeyRef = oReader.BE32();
+				key.csPath = oReader.String();
+				key.ulKeyLenBytes = oReader.BE32();
+				key.bUsedInP11 = oReader.Bool();
+				info.oPrKeys.push_back(key);
+			}
+			if (ulCount > PKCS15CACHE_MAX_COUNT)
+				return false;
+		}
+
+		return oReader.AtEnd();
+	}
+
+}
@@ -0,0 +1,122 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * Cache of the parsed PKCS#15 structure of a card: the token info and the
+ * PINs, keys and certificates from the AODF, PrKDF and CDF.
+ *
+ * This never changes during the lifetime of a card, so it is kept per
+ * serial nr. and applet version for as long as the module is loaded; a
+ * card that was seen before then needs no APDUs at all to find out what
+ * objects it has. If the card file cache is enabled (see cardfilecache.h),
+ * the structure is also stored there, as the pseudo-file "PKCS15" of the
+ * card, so that it survives the process.
+ *
+ * Layout of the "PKCS15" data (all numbers big endian, strings are a
+ * 4-byte length followed by the characters):
+ *   "BEIDP15\x01"                 magic + version
+ *   1 byte                        the parts that are present (PKCS15CACHE_*)
+ *   if PKCS15CACHE_TOKENINFO:     serial nr., label
+ *   if PKCS15CACHE_PINS:          4-byte count, then per PIN all tPin fields
+ *   if PKCS15CACHE_CERTS:         4-byte count, then per cert all tCert fields
+ *   if PKCS15CACHE_PRKEYS:        4-byte count, then per key all tPrivKey fields
+ * (in the order in which they're declared in p15objects.h; bools and
+ * the PIN padding char are 1 byte, the other numbers 4 bytes)
+ */
+
+#pragma once
+
+#ifndef PKCS15CACHE_H
+#define PKCS15CACHE_H
+
+#include <map>
+#include <string>
+#include <vector>
+#include "common/bytearray.h"
+#include "common/mutex.h"
+#include "p15objects.h"
+
+namespace eIDMW
+{
+	class CCardFileCache;
+
+	// The parts of tPKCS15Info that are filled in
+	const unsigned char PKCS15CACHE_TOKENINFO = 0x01;
+	const unsigned char PKCS15CACHE_PINS = 0x02;
+	const unsigned char PKCS15CACHE_CERTS = 0x04;
+	const unsigned char PKCS15CACHE_PRKEYS = 0x08;
+
+	typedef struct
+	{
+		unsigned char ucParts;
+		std::string csSerial;
+		std::string csLabel;
+		std::vector < tPin > oPins;
+		std::vector < tCert > oCertificates;
+		std::vector < tPrivKey > oPrKeys;
+	} tPKCS15Info;
+
+	class CPKCS15Cache
+	{
+public:
+		CPKCS15Cache(CCardFileCache * poFileCache);
+		~CPKCS15Cache();
+
+	/**
+	 * Look up the PKCS#15 structure of the card with serial nr. oSerialNr,
+	 * applet version ucAppletVersion and card data oCardData. Returns true
+	 * and fills in info if (part of) it is known, returns false otherwise.
+	 */
+		bool Get(const CByteArray & oSerialNr, unsigned char ucAppletVersion,
+			 const CByteArray & oCardData, tPKCS15Info & info);
+
+	/** Add the parts in info to what is known about the card */
+		void Put(const CByteArray & oSerialNr, unsigned char ucAppletVersion,
+			 const CByteArray & oCardData, const tPKCS15Info & info);
+
+		static CByteArray Serialize(const tPKCS15Info & info);
+		static bool Deserialize(const CByteArray & oData, tPKCS15Info & info);
+
+private:
+		// No copies allowed
+		CPKCS15Cache(const CPKCS15Cache & oCache);
+		CPKCS15Cache & operator =(const CPKCS15Cache & oCache);
+
+		void Init();
+		static std::string GetKey(const CByteArray & oSerialNr, unsigned char ucAppletVersion);
+
+		bool m_bInitialized;
+		bool m_bEnabled;
+		CCardFileCache *m_poFileCache;
+
+		// Shared by all instances, so it outlives a C_Finalize()
+		static CMutex m_Mutex;
+#ifdef WIN32
+#pragma warning(push)
+#pragma warning(disable:4251)
+#endif
+		static std::map < std::string, tPKCS15Info > m_oCache;
+#ifdef WIN32
+#pragma warning(pop)
+#endif
+	};
+
+}
+#endif
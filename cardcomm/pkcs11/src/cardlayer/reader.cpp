@@ -80,6 +80,10 @@ namespace eIDMW
 		m_poContext = poContext;
 		m_poCard = NULL;
 		m_bIgnoreRemoval = false;
+		m_bMonitorEvents = false;
+		m_ulMonitorEvents = 0;
+		m_ulGeneration = 1;
+		m_oPKCS15.SetCache(&poContext->m_oPKCS15Cache);
 	}
 
 	CReader::~CReader(void)
@@ -124,11 +128,13 @@ namespace eIDMW
 	{
 		tCardStatus status;
 		static int iStatusCount = 0;
+		unsigned long ulState, ulEvents;
+		bool bKnown = m_poContext->m_oMonitor.GetState(m_csReader, &ulState, &ulEvents);
 
 		try {
 			if (m_poCard == NULL)
 			{
-				if (m_poContext->m_oPCSC.Status(m_csReader))
+				if (bKnown ? (ulState & SCARD_STATE_PRESENT) != 0 : m_poContext->m_oPCSC.Status(m_csReader))
 				{
 					if (!bPresenceOnly) {
 						status = Connect()? CARD_INSERTED : CARD_NOT_PRESENT;
@@ -138,6 +144,16 @@ namespace eIDMW
 				}
 				else
 					status = CARD_NOT_PRESENT;
+			} else if (bKnown && m_bMonitorEvents
+				   && ulEvents == m_ulMonitorEvents
+				   && (ulState & SCARD_STATE_PRESENT)
+				   && (bPresenceOnly || !m_poCard->NeedsStatus()))
+			{
+				// The reader didn't report anything since we connected.
+				// A reset by another application isn't reported as a
+				// reader event, but our next command to the card fails
+				// on it, and then NeedsStatus() makes us ask PC/SC.
+				status = CARD_STILL_PRESENT;
 			} else
 			{
 #ifndef __APPLE__
@@ -180,6 +196,29 @@ namespace eIDMW
 		return status;
 	}
 
+	bool CReader::CardUnchanged()
+	{
+		unsigned long ulState, ulEvents;
+
+		if (m_poCard == NULL || !m_bMonitorEvents || m_poCard->NeedsStatus())
+			return false;
+
+		if (!m_poContext->m_oMonitor.GetState(m_csReader, &ulState, &ulEvents))
+			return false;
+
+		return ulEvents == m_ulMonitorEvents && (ulState & SCARD_STATE_PRESENT);
+	}
+
+	bool CReader::NeedsStatus()
+	{
+		return m_poCard != NULL && m_poCard->NeedsStatus();
+	}
+
+	unsigned long CReader::GetGeneration()
+	{
+		return m_ulGeneration;
+	}
+
 // Used for logging in Connect()
 	static const inline wchar_t *Type2String(tCardType cardType)
 	{
@@ -194,10 +233,17 @@ namespace eIDMW
 
 	bool CReader::Connect()
 	{
+		unsigned long ulState;
+
 		if (m_poCard != NULL)
 			Disconnect(DISCONNECT_LEAVE_CARD);
 
+		// Take the count before connecting, so that a change while
+		// connecting is noticed by Status()
+		m_bMonitorEvents = m_poContext->m_oMonitor.GetState(m_csReader, &ulState, &m_ulMonitorEvents);
 		m_poCard = CardConnect(m_csReader, m_poContext, &m_oPinpad);
+		if (++m_ulGeneration == 0)
+			m_ulGeneration = 1;
 		if (m_poCard != NULL)
 		{
 			m_oPKCS15.SetCard(m_poCard);
@@ -236,6 +282,8 @@ namespace eIDMW
 			CCard *poTemp = m_poCard;
 
 			m_poCard = NULL;
+			if (++m_ulGeneration == 0)
+				m_ulGeneration = 1;
 			try
 			{
 				poTemp->Disconnect(disconnectMode);
@@ -334,9 +382,24 @@ namespace eIDMW
 		if (m_poCard == NULL)
 			throw CMWEXCEPTION(EIDMW_ERR_NO_CARD);
 
+		// Only complete files are cached
+		bool bUseCache = ulOffset == 0 && ulMaxLen == FULL_FILE &&
+			CCardFileCache::IsCacheable(csPath) && m_poContext->m_oFileCache.IsEnabled();
+		if (bUseCache)
+		{
+			CByteArray oData;
+
+			if (m_poContext->m_oFileCache.Get(m_poCard->GetSerialNrBytes(), m_poCard->GetInfo(), csPath, oData))
+				return oData;
+		}
+
 		try
 		{
-			return m_poCard->ReadFile(csPath, ulOffset, ulMaxLen);
+			CByteArray oData = m_poCard->ReadFile(csPath, ulOffset, ulMaxLen);
+
+			if (bUseCache)
+				m_poContext->m_oFileCache.Put(m_poCard->GetSerialNrBytes(), m_poCard->GetInfo(), csPath, oData);
+			return oData;
 		}
 		catch(const CNotAuthenticatedException & e)
 		{
@@ -362,6 +425,32 @@ namespace eIDMW
 		}
 	}
 
+	std::vector < CByteArray > CReader::ReadFiles(const std::vector < std::string > &vcsPaths)
+	{
+		if (m_poCard == NULL)
+			throw CMWEXCEPTION(EIDMW_ERR_NO_CARD);
+
+		std::vector < CByteArray > voData(vcsPaths.size());
+		std::vector < size_t > order;
+
+		for (size_t i = 0; i < vcsPaths.size(); i++)
+		{
+			size_t j = order.size();
+
+			order.push_back(i);
+			for (; j > 0 && vcsPaths[order[j - 1]] > vcsPaths[i]; j--)
+				order[j] = order[j - 1];
+			order[j] = i;
+		}
+
+		CAutoLock autolock(m_poCard);
+
+		for (size_t k = 0; k < order.size(); k++)
+			voData[order[k]] = ReadFile(vcsPaths[order[k]]);
+
+		return voData;
+	}
+
 	unsigned long CReader::PinStatus(const tPin & Pin)
 	{
 		if (m_poCard == NULL)
@@ -456,6 +545,84 @@ namespace eIDMW
 		}
 	}
 
+	// The errors after which the rest of a batch can't succeed either
+	static bool StopsBatch(long err)
+	{
+		return err == EIDMW_ERR_NO_CARD || err == EIDMW_ERR_CARD_RESET ||
+			err == EIDMW_ERR_NOT_TRANSACTED || err == EIDMW_ERR_CARD_COMM ||
+			err == EIDMW_ERR_PIN_CANCEL || err == EIDMW_ERR_PIN_BLOCKED;
+	}
+
+	static long SignBatchItem(CReader & oReader, const tPrivKey & key, unsigned long algo,
+		const CByteArray & oData, CByteArray & oSignature)
+	{
+		try
+		{
+			oSignature = oReader.Sign(key, algo, oData);
+		}
+		catch(CMWException & e)
+		{
+			return e.GetError();
+		}
+		return EIDMW_OK;
+	}
+
+	std::vector < CByteArray > CReader::SignBatch(const tPrivKey & key, unsigned long algo,
+		const std::vector < CByteArray > &voData, std::vector < long > &vlErrors)
+	{
+		if (m_poCard == NULL)
+			throw CMWEXCEPTION(EIDMW_ERR_NO_CARD);
+
+		std::vector < CByteArray > voSignatures(voData.size());
+		size_t i = 0;
+		long err = EIDMW_OK;
+
+		vlErrors.assign(voData.size(), EIDMW_OK);
+
+		// Until a signature went through, the card may want the PIN, and a
+		// PIN dialog or pinpad prompt mustn't keep other applications off
+		// the card: sign outside a transaction. A key that wants the PIN
+		// for each signature (user consent) stays in here.
+		for (; i < voData.size() && !StopsBatch(err); i++)
+		{
+			err = vlErrors[i] = SignBatchItem(*this, key, algo, voData[i], voSignatures[i]);
+			if (err == EIDMW_OK && key.ulUserConsent == 0)
+			{
+				i++;
+				break;
+			}
+		}
+
+		// Only the MSE SETs and PSOs are left, they share one transaction
+		if (i < voData.size() && !StopsBatch(err))
+		{
+			try
+			{
+				CAutoLock autolock(m_poCard);
+
+				for (; i < voData.size() && !StopsBatch(err); i++)
+					err = vlErrors[i] = SignBatchItem(*this, key, algo, voData[i], voSignatures[i]);
+			}
+			catch(CMWException & e)
+			{
+				// no transaction: keep what was signed, the rest fails
+				err = e.GetError();
+				for (; i < voData.size(); i++)
+					vlErrors[i] = err;
+			}
+		}
+
+		if (StopsBatch(err) && i < voData.size())
+		{
+			MWLOG(LEV_WARN, MOD_CAL, L"     Batch signing stopped at %d of %d: 0x%0x",
+				(int) i - 1, (int) voData.size(), err);
+			for (; i < voData.size(); i++)
+				vlErrors[i] = err;
+		}
+
+		return voSignatures;
+	}
+
 	CByteArray CReader::SendAPDU(const CByteArray & oCmdAPDU)
 	{
 		if (m_poCard == NULL)
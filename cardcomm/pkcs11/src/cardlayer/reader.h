@@ -58,6 +58,28 @@ public:
 	 */
 		tCardStatus Status(bool bReconnect = false, bool bPresenceOnly = false);
 
+	/**
+	 * Returns true if we're connected to a card that is known to be present
+	 * and unchanged, without asking PC/SC: the reader monitor saw no event
+	 * since Connect() and no command to the card failed since the last
+	 * Status(). Status() would return CARD_STILL_PRESENT in that case.
+	 */
+		bool CardUnchanged();
+
+	/**
+	 * Returns true if a command to the card failed since the last Status(),
+	 * e.g. because another application reset it.
+	 */
+		bool NeedsStatus();
+
+	/**
+	 * Returns a number that changes each time we connect to or disconnect
+	 * from a card in this reader, so callers can tell whether what they
+	 * know about the card still belongs to the current connection.
+	 * It's never 0.
+	 */
+		unsigned long GetGeneration();
+
 	/**
 	 * Connect to the card; it's sae to call this function multiple times.
 	 * Returns true if successfully connected, false otherwise (in which case
@@ -102,6 +124,12 @@ public:
 		 * number of bytes that are available. */
 		CByteArray ReadFile(const std::string & csPath, unsigned long ulOffset = 0, unsigned long ulMaxLen = FULL_FILE);
 
+		/* Read several complete files, as ReadFile() does, while holding
+		 * the card for the whole batch. The files are read in path order,
+		 * so that files in the same DF need one DF select between them;
+		 * the contents are returned in the order of vcsPaths. */
+		std::vector < CByteArray > ReadFiles(const std::vector < std::string > &vcsPaths);
+
 		/* Return the remaining PIN attempts;
 		 * returns PIN_STATUS_UNKNOWN if this info isn't available */
 		unsigned long PinStatus(const tPin & Pin);
@@ -118,6 +146,15 @@ public:
 
 		/* Sign data. If necessary, a PIN will be asked */
 		CByteArray Sign(const tPrivKey & key, unsigned long algo, const CByteArray & oData);
+		/* Sign each of voData as Sign() does. Once the first one went
+		 * through (and the PIN was asked for, outside a transaction),
+		 * the others follow back to back in one transaction so the key
+		 * is selected and the security environment set only once for
+		 * all of them.
+		 * vlErrors receives EIDMW_OK or the error for each input; the
+		 * signature of a failed one is empty. */
+		std::vector < CByteArray > SignBatch(const tPrivKey & key, unsigned long algo,
+			const std::vector < CByteArray > &voData, std::vector < long > &vlErrors);
 
 		CByteArray SendAPDU(const CByteArray & oCmdAPDU);
 
@@ -168,6 +205,10 @@ private:
 #endif
 
 		CCard *m_poCard;
+		// The reader monitor's event count when m_poCard was connected
+		bool m_bMonitorEvents;
+		unsigned long m_ulMonitorEvents;
+		unsigned long m_ulGeneration;	// see GetGeneration()
 		CPKCS15 m_oPKCS15;
 		CPinpad m_oPinpad;
 
@@ -0,0 +1,364 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2010 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "readerdelay.h"
+#include "apdustats.h"
+#include "common/configuration.h"
+#include "common/log.h"
+#include "common/util.h"
+
+#include <stdio.h>
+#include <string.h>
+#ifndef WIN32
+#include <unistd.h>
+#endif
+
+// The fixed delays that were used before
+#define LEGACY_CONNECT_DELAY	200
+#define LEGACY_ERR_DELAY	25
+
+#define MAX_DELAY		200	// never sleep longer than this (msec)
+#define MIN_BACKOFF		5	// first increase of a delay that is 0
+#define DECAY_APDUS		1024	// lower the delays by 25% after this many APDUs without error
+#define DECAY_CONNECTS		16	// halve the connect delay after this many clean connects
+
+#define BACKOFF_NONE		0
+#define BACKOFF_TX		1
+#define BACKOFF_CONNECT		2
+#define BACKOFF_ERR		3
+
+namespace eIDMW
+{
+
+	static unsigned long Increase(unsigned long ulDelay)
+	{
+		ulDelay = (ulDelay == 0) ? MIN_BACKOFF : 2 * ulDelay;
+		return ulDelay > MAX_DELAY ? MAX_DELAY : ulDelay;
+	}
+
+	CReaderDelay::CReaderDelay() : m_bInitialized(false), m_bAdaptive(false), m_bDirty(false), m_ulFixedTxDelay(0)
+	{
+	}
+
+	CReaderDelay::~CReaderDelay()
+	{
+		if (m_bDirty)
+			Save();
+	}
+
+	void CReaderDelay::Init()
+	{
+		if (m_bInitialized)
+			return;
+
+		m_bInitialized = true;
+		try
+		{
+			m_ulFixedTxDelay = CConfig::GetLong(CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDTXDELAY);
+			m_bAdaptive = CConfig::GetLong(CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDADAPTIVEDELAY) != 0;
+			if (m_bAdaptive)
+				m_wsFileName = CConfig::GetString(CConfig::EIDMW_CONFIG_PARAM_GENERAL_READERDELAYFILE);
+		}
+		catch (...)
+		{
+			m_bAdaptive = false;
+		}
+
+		if (m_bAdaptive)
+			Load();
+	}
+
+	bool CReaderDelay::IsAdaptive()
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		Init();
+
+		return m_bAdaptive;
+	}
+
+	/* File format: one line per reader: "<tx> <connect> <err> <reader name>|<IFD version>" */
+	void CReaderDelay::Load()
+	{
+		FILE *f = NULL;
+		char csLine[512];
+
+		if (m_wsFileName.empty())
+			return;
+#ifdef WIN32
+		if (_wfopen_s(&f, m_wsFileName.c_str(), L"r") != 0)
+			f = NULL;
+#else
+		f = fopen(utilStringNarrow(m_wsFileName).c_str(), "r");
+#endif
+		if (f == NULL)
+			return;
+
+		while (fgets(csLine, sizeof(csLine), f) != NULL)
+		{
+			unsigned long ulTx, ulConnect, ulErr;
+			int iKeyStart = 0;
+
+			if (sscanf(csLine, "%lu %lu %lu %n", &ulTx, &ulConnect, &ulErr, &iKeyStart) != 3 || iKeyStart == 0)
+				continue;
+
+			std::string csKey(csLine + iKeyStart);
+			while (!csKey.empty() && (csKey[csKey.size() - 1] == '\n' || csKey[csKey.size() - 1] == '\r'))
+				csKey.erase(csKey.size() - 1);
+			if (csKey.empty())
+				continue;
+
+			tDelay & delay = GetDelay(csKey);
+			delay.ulTxDelay = ulTx > MAX_DELAY ? MAX_DELAY : ulTx;
+			delay.ulConnectDelay = ulConnect > MAX_DELAY ? MAX_DELAY : ulConnect;
+			delay.ulErrDelay = ulErr > MAX_DELAY ? MAX_DELAY : ulErr;
+		}
+
+		fclose(f);
+	}
+
+	void CReaderDelay::Save()
+	{
+		FILE *f = NULL;
+
+		m_bDirty = false;
+		if (m_wsFileName.empty())
+			return;
+
+		std::wstring wsTmpFileName = m_wsFileName + L".tmp";
+#ifdef WIN32
+		if (_wfopen_s(&f, wsTmpFileName.c_str(), L"w") != 0)
+			f = NULL;
+#else
+		f = fopen(utilStringNarrow(wsTmpFileName).c_str(), "w");
+#endif
+		if (f == NULL)
+		{
+			MWLOG(LEV_WARN, MOD_CAL, L"Can't save the reader delays to %ls", wsTmpFileName.c_str());
+			return;
+		}
+
+		for (std::map < std::string, tDelay >::iterator it = m_delays.begin(); it != m_delays.end(); ++it)
+		{
+			fprintf(f, "%lu %lu %lu %s\n", it->second.ulTxDelay, it->second.ulConnectDelay,
+				it->second.ulErrDelay, it->first.c_str());
+		}
+		fclose(f);
+
+#ifdef WIN32
+		_wremove(m_wsFileName.c_str());
+		_wrename(wsTmpFileName.c_str(), m_wsFileName.c_str());
+#else
+		if (rename(utilStringNarrow(wsTmpFileName).c_str(), utilStringNarrow(m_wsFileName).c_str()) != 0)
+			unlink(utilStringNarrow(wsTmpFileName).c_str());
+#endif
+	}
+
+	CReaderDelay::tDelay & CReaderDelay::GetDelay(const std::string & csKey)
+	{
+		std::map < std::string, tDelay >::iterator it = m_delays.find(csKey);
+
+		if (it == m_delays.end())
+		{
+			tDelay delay;
+
+			memset(&delay, 0, sizeof(delay));
+			it = m_delays.insert(std::make_pair(csKey, delay)).first;
+		}
+
+		return it->second;
+	}
+
+	CReaderDelay::tHandleState *CReaderDelay::GetHandle(SCARDHANDLE hCard)
+	{
+		std::map < SCARDHANDLE, tHandleState >::iterator it = m_handles.find(hCard);
+
+		return it == m_handles.end() ? NULL : &it->second;
+	}
+
+	unsigned long CReaderDelay::Connected(SCARDHANDLE hCard, const std::string & csReader, const CByteArray & oIFDVersion)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState state;
+
+		Init();
+
+		// '|' separates the reader name from the IFD version, a newline would break the file format
+		std::string csKey = csReader;
+		for (size_t i = 0; i < csKey.size(); i++)
+		{
+			if (csKey[i] == '|' || csKey[i] == '\n' || csKey[i] == '\r')
+				csKey[i] = '_';
+		}
+		csKey += "|" + oIFDVersion.ToString(false);
+
+		state.csKey = csKey;
+		state.bJustConnected = true;
+		state.bLastError = false;
+		state.iLastBackoff = BACKOFF_NONE;
+		state.ulLastBackoffOld = 0;
+		m_handles[hCard] = state;
+
+		tDelay & delay = GetDelay(csKey);
+		if (delay.ulConnectDelay > 0 && ++delay.ulCleanConnects >= DECAY_CONNECTS)
+		{
+			delay.ulConnectDelay /= 2;
+			delay.ulCleanConnects = 0;
+			m_bDirty = true;
+		}
+		delay.stats.ulSleptMs += delay.ulConnectDelay;
+		delay.stats.ulSavedMs += LEGACY_CONNECT_DELAY - delay.ulConnectDelay;
+		if (CApduStats::IsEnabled())
+			CApduStats::SleepSaved(LEGACY_CONNECT_DELAY - delay.ulConnectDelay);
+
+		return delay.ulConnectDelay;
+	}
+
+	void CReaderDelay::Disconnected(SCARDHANDLE hCard)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState *pState = GetHandle(hCard);
+
+		if (pState == NULL)
+			return;
+
+		tDelay & delay = GetDelay(pState->csKey);
+		MWLOG(LEV_INFO, MOD_CAL, L"    Reader delays (tx %lu, connect %lu, err %lu msec): %lu APDUs, slept %lu msec, saved %lu msec, %lu backoffs",
+		      delay.ulTxDelay, delay.ulConnectDelay, delay.ulErrDelay,
+		      delay.stats.ulTransmits, delay.stats.ulSleptMs, delay.stats.ulSavedMs, delay.stats.ulBackoffs);
+
+		m_handles.erase(hCard);
+		if (m_bDirty)
+			Save();
+	}
+
+	unsigned long CReaderDelay::GetTxDelay(SCARDHANDLE hCard)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState *pState = GetHandle(hCard);
+
+		if (pState == NULL)
+			return m_bAdaptive ? 0 : m_ulFixedTxDelay;
+
+		tDelay & delay = GetDelay(pState->csKey);
+
+		return delay.ulTxDelay + (pState->bLastError ? delay.ulErrDelay : 0);
+	}
+
+	unsigned long CReaderDelay::Backoff(SCARDHANDLE hCard)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState *pState = GetHandle(hCard);
+		unsigned long *pulDelay;
+
+		if (pState == NULL)
+			return MIN_BACKOFF;
+
+		tDelay & delay = GetDelay(pState->csKey);
+		if (pState->bJustConnected)
+		{
+			pState->iLastBackoff = BACKOFF_CONNECT;
+			pulDelay = &delay.ulConnectDelay;
+			delay.ulCleanConnects = 0;
+		}
+		else if (pState->bLastError)
+		{
+			pState->iLastBackoff = BACKOFF_ERR;
+			pulDelay = &delay.ulErrDelay;
+		}
+		else
+		{
+			pState->iLastBackoff = BACKOFF_TX;
+			pulDelay = &delay.ulTxDelay;
+		}
+
+		pState->ulLastBackoffOld = *pulDelay;
+		*pulDelay = Increase(*pulDelay);
+		delay.ulCleanCount = 0;
+		delay.stats.ulBackoffs++;
+		m_bDirty = true;
+
+		MWLOG(LEV_DEBUG, MOD_CAL, L"        Reader delay (type %d) increased from %lu to %lu msec",
+		      pState->iLastBackoff, pState->ulLastBackoffOld, *pulDelay);
+
+		return *pulDelay;
+	}
+
+	void CReaderDelay::UndoBackoff(SCARDHANDLE hCard)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState *pState = GetHandle(hCard);
+
+		if (pState == NULL)
+			return;
+
+		tDelay & delay = GetDelay(pState->csKey);
+		switch (pState->iLastBackoff)
+		{
+			case BACKOFF_CONNECT:
+				delay.ulConnectDelay = pState->ulLastBackoffOld;
+				break;
+			case BACKOFF_ERR:
+				delay.ulErrDelay = pState->ulLastBackoffOld;
+				break;
+			case BACKOFF_TX:
+				delay.ulTxDelay = pState->ulLastBackoffOld;
+				break;
+			default:
+				return;
+		}
+		pState->iLastBackoff = BACKOFF_NONE;
+		delay.stats.ulBackoffs--;
+	}
+
+	void CReaderDelay::TransmitDone(SCARDHANDLE hCard, unsigned long ulSleptMs, bool bErrorSW)
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+		tHandleState *pState = GetHandle(hCard);
+
+		if (pState == NULL)
+			return;
+
+		tDelay & delay = GetDelay(pState->csKey);
+		unsigned long ulLegacy = m_ulFixedTxDelay + (pState->bLastError ? LEGACY_ERR_DELAY : 0);
+
+		delay.stats.ulTransmits++;
+		delay.stats.ulSleptMs += ulSleptMs;
+		if (ulLegacy > ulSleptMs)
+		{
+			delay.stats.ulSavedMs += ulLegacy - ulSleptMs;
+			if (CApduStats::IsEnabled())
+				CApduStats::SleepSaved(ulLegacy - ulSleptMs);
+		}
+
+		if (++delay.ulCleanCount >= DECAY_APDUS)
+		{
+			if (delay.ulTxDelay > 0 || delay.ulErrDelay > 0)
+				m_bDirty = true;
+			delay.ulTxDelay -= (delay.ulTxDelay + 3) / 4;
+			delay.ulErrDelay -= (delay.ulErrDelay + 3) / 4;
+			delay.ulCleanCount = 0;
+		}
+
+		pState->bJustConnected = false;
+		pState->bLastError = bErrorSW;
+		pState->iLastBackoff = BACKOFF_NONE;
+	}
+
+}
@@ -0,0 +1,129 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2010 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * Adaptive delays for the communication with a reader.
+ *
+ * Some reader/card combinations return a communication error
+ * (SCARD_E_COMM_DATA_LOST) or SW12 = 6D 00 if an APDU is sent too
+ * fast: right after an SCardConnect(), after an error response or
+ * just after the previous APDU. Instead of always sleeping, the delays
+ * start at 0 and are only increased when such an error occurs; after
+ * a long enough run without errors they are slowly lowered again.
+ *
+ * The delays are learned per reader (reader name + IFD version) and
+ * saved to a file, so the next process starts with the learned values.
+ */
+
+#pragma once
+
+#ifndef READERDELAY_H
+#define READERDELAY_H
+
+#include <map>
+#include <string>
+#include "common/bytearray.h"
+#include "common/mutex.h"
+
+#include <winscard.h>
+
+namespace eIDMW
+{
+
+	typedef struct
+	{
+		unsigned long ulTransmits;	// number of SCardTransmit() calls
+		unsigned long ulSleptMs;	// time slept before/after them, in msec
+		unsigned long ulSavedMs;	// time saved compared to the fixed delays, in msec
+		unsigned long ulBackoffs;	// number of times a delay was increased
+	} tReaderDelayStats;
+
+	class CReaderDelay
+	{
+public:
+		CReaderDelay();
+		~CReaderDelay();
+
+	/** Returns false if the fixed delays (card_adaptive_delay = 0) should be used */
+		bool IsAdaptive();
+
+	/** To be called after a successful SCardConnect(); returns the time to sleep */
+		unsigned long Connected(SCARDHANDLE hCard, const std::string & csReader, const CByteArray & oIFDVersion);
+		void Disconnected(SCARDHANDLE hCard);
+
+	/** Returns the time to sleep before the next SCardTransmit() */
+		unsigned long GetTxDelay(SCARDHANDLE hCard);
+
+	/**
+	 * To be called if SCardTransmit() returned lRet or SW12 = 6D 00.
+	 * Increases the delay that is most likely responsible and returns the
+	 * time to sleep before retrying.
+	 */
+		unsigned long Backoff(SCARDHANDLE hCard);
+
+	/** The retry returned the same error, so the increase wasn't needed */
+		void UndoBackoff(SCARDHANDLE hCard);
+
+	/** To be called after each SCardTransmit() that returned a response;
+	 * ulSleptMs is the total time slept for it (including a retry) */
+		void TransmitDone(SCARDHANDLE hCard, unsigned long ulSleptMs, bool bErrorSW);
+
+private:
+		// No copies allowed
+		CReaderDelay(const CReaderDelay & oDelay);
+		CReaderDelay & operator =(const CReaderDelay & oDelay);
+
+		typedef struct
+		{
+			unsigned long ulTxDelay;	// before each APDU
+			unsigned long ulConnectDelay;	// before the first APDU after a connect
+			unsigned long ulErrDelay;	// before an APDU that follows an error SW
+			unsigned long ulCleanCount;	// consecutive APDUs without backoff
+			unsigned long ulCleanConnects;	// consecutive connects without backoff
+			tReaderDelayStats stats;
+		} tDelay;
+
+		typedef struct
+		{
+			std::string csKey;
+			bool bJustConnected;
+			bool bLastError;
+			int iLastBackoff;	// which delay was increased by the last Backoff()
+			unsigned long ulLastBackoffOld;
+		} tHandleState;
+
+		void Init();
+		void Load();
+		void Save();
+		tDelay & GetDelay(const std::string & csKey);
+		tHandleState *GetHandle(SCARDHANDLE hCard);
+
+		bool m_bInitialized;
+		bool m_bAdaptive;
+		bool m_bDirty;
+		unsigned long m_ulFixedTxDelay;
+		std::wstring m_wsFileName;
+		std::map < std::string, tDelay > m_delays;
+		std::map < SCARDHANDLE, tHandleState > m_handles;
+		CMutex m_Mutex;
+	};
+
+}
+#endif
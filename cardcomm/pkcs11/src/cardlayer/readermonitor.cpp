@@ -0,0 +1,382 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "readermonitor.h"
+#include "common/log.h"
+
+#include <algorithm>
+#include <string.h>
+#ifndef WIN32
+#include <sys/time.h>
+#include <time.h>
+#endif
+
+#ifdef WIN32
+#define mon_load(p)		InterlockedCompareExchange((volatile LONG *) (p), 0, 0)
+#define mon_store(p, v)		InterlockedExchange((volatile LONG *) (p), (LONG) (v))
+#else
+#define mon_load(p)		__sync_fetch_and_add((p), 0)
+#define mon_store(p, v)		(__sync_synchronize(), (void) __sync_lock_test_and_set((p), (v)))
+#endif
+
+#define PNP_READER		"\\\\?PnP?\\Notification"
+
+namespace eIDMW
+{
+
+	CReaderMonitor::CReaderMonitor()
+	{
+		m_poPCSC = NULL;
+		m_ulReaderCount = 0;
+		m_lPnP = -1;
+		m_lPnPListed = 0;
+		m_ulGeneration = 0;
+		m_bStopping = false;
+		m_iWaiters = 0;
+		memset((void *) m_alState, 0, sizeof(m_alState));
+		memset((void *) m_alEvents, 0, sizeof(m_alEvents));
+#ifdef WIN32
+		InitializeCriticalSection(&m_Lock);
+		InitializeConditionVariable(&m_Cond);
+#else
+		pthread_mutex_init(&m_Lock, NULL);
+		pthread_cond_init(&m_Cond, NULL);
+#endif
+	}
+
+	CReaderMonitor::~CReaderMonitor()
+	{
+		StopMonitor();
+		delete m_poPCSC;
+#ifdef WIN32
+		DeleteCriticalSection(&m_Lock);
+#else
+		pthread_cond_destroy(&m_Cond);
+		pthread_mutex_destroy(&m_Lock);
+#endif
+	}
+
+	void CReaderMonitor::Watch(CReadersInfo & oReadersInfo)
+	{
+		std::vector < std::string > oReaders;
+		unsigned long ulGeneration;
+
+		for (unsigned long i = 0; i < oReadersInfo.ReaderCount(); i++)
+			oReaders.push_back(oReadersInfo.ReaderName(i));
+
+		if (m_isRunning && oReaders.size() == m_ulReaderCount
+		    && std::equal(oReaders.begin(), oReaders.end(), m_oReaders.begin()))
+		{
+			if (m_lPnP >= 0)
+				m_lPnPListed = mon_load(&m_alEvents[m_lPnP]);
+			return;
+		}
+
+		StopMonitor();
+
+		m_oReaders = oReaders;
+		m_ulReaderCount = (unsigned long) oReaders.size();
+		m_lPnP = Find(PNP_READER);
+		if (m_lPnP < 0 && m_oReaders.size() < MAX_READERS + 1)
+		{
+			m_lPnP = (long) m_oReaders.size();
+			m_oReaders.push_back(PNP_READER);
+		}
+
+		if (m_poPCSC == NULL)
+			m_poPCSC = new CPCSC();
+
+		Lock();
+		m_bStopping = false;
+		ulGeneration = m_ulGeneration;
+		Unlock();
+
+		m_bStopRequest = false;
+		if (Start() != 0)
+		{
+			MWLOG(LEV_WARN, MOD_CAL, L"Couldn't start the reader monitor thread");
+			return;
+		}
+
+		// The first SCardGetStatusChange() returns immediately
+		Lock();
+		for (int i = 0; i < 20 && m_ulGeneration == ulGeneration && m_isRunning; i++)
+			Wait(100);
+		Unlock();
+
+		if (m_lPnP >= 0)
+			m_lPnPListed = mon_load(&m_alEvents[m_lPnP]);
+	}
+
+	void CReaderMonitor::StopMonitor()
+	{
+		Lock();
+		m_bStopping = true;
+		Broadcast();
+		while (m_iWaiters > 0)
+			Wait(TIMEOUT_INFINITE);
+		Unlock();
+
+		if (m_isRunning)
+		{
+			RequestStop();
+			// SCardCancel() only cancels an SCardGetStatusChange() that
+			// is in progress, so keep trying until the thread noticed it
+			while (IsRunning())
+			{
+				m_poPCSC->Cancel();
+				SleepMillisecs(10);
+			}
+			m_poPCSC->ReleaseContext();
+		}
+
+		Forget();
+	}
+
+	bool CReaderMonitor::ReadersChanged()
+	{
+		if (m_lPnP < 0 || mon_load(&m_alEvents[m_lPnP]) == 0)
+			return true;
+
+		// No PnP support in the resource manager
+		if (mon_load(&m_alState[m_lPnP]) & SCARD_STATE_UNKNOWN)
+			return true;
+
+		return mon_load(&m_alEvents[m_lPnP]) != m_lPnPListed;
+	}
+
+	bool CReaderMonitor::GetState(const std::string & csReader,
+				      unsigned long *pulState,
+				      unsigned long *pulEvents)
+	{
+		long i = Find(csReader);
+
+		if (i < 0)
+			return false;
+
+		// See Publish() for the order
+		long lEvents = mon_load(&m_alEvents[i]);
+
+		if (lEvents == 0)
+			return false;
+
+		*pulState = (unsigned long) mon_load(&m_alState[i]);
+		*pulEvents = (unsigned long) lEvents;
+
+		return true;
+	}
+
+	bool CReaderMonitor::GetStates(SCARD_READERSTATEA * txReaderStates,
+				       unsigned long ulReaderCount,
+				       unsigned long *pulGeneration)
+	{
+		// Take the generation first, so that a change while we're
+		// reading the states makes WaitForChange() return at once
+		Lock();
+		*pulGeneration = m_ulGeneration;
+		Unlock();
+
+		for (unsigned long i = 0; i < ulReaderCount; i++)
+		{
+			unsigned long ulState, ulEvents;
+
+			if (txReaderStates[i].szReader == NULL
+			    || !GetState(txReaderStates[i].szReader, &ulState, &ulEvents))
+				return false;
+
+			txReaderStates[i].dwEventState = ulState;
+			if (ulState != txReaderStates[i].dwCurrentState)
+				txReaderStates[i].dwEventState |= SCARD_STATE_CHANGED;
+		}
+
+		return true;
+	}
+
+	bool CReaderMonitor::WaitForChange(unsigned long ulGeneration)
+	{
+		bool bRet;
+
+		Lock();
+		m_iWaiters++;
+		while (m_ulGeneration == ulGeneration && !m_bStopping)
+			Wait(TIMEOUT_INFINITE);
+		bRet = !m_bStopping;
+		m_iWaiters--;
+		Broadcast();	// StopMonitor() may be waiting for us
+		Unlock();
+
+		return bRet;
+	}
+
+	void CReaderMonitor::Run()
+	{
+		SCARD_READERSTATEA txStates[MAX_READERS + 1];
+		unsigned long ulCount = (unsigned long) m_oReaders.size();
+		unsigned long i;
+
+#ifndef WIN32
+		//Nobody joins this thread
+		pthread_detach(pthread_self());
+#endif
+
+		memset(txStates, 0, sizeof(txStates));
+		for (i = 0; i < ulCount; i++)
+		{
+			txStates[i].szReader = m_oReaders[i].c_str();
+			txStates[i].dwCurrentState = SCARD_STATE_UNAWARE;
+		}
+
+		while (!m_bStopRequest)
+		{
+			bool bChanged = false;
+
+			try
+			{
+				m_poPCSC->EstablishContext();
+				m_poPCSC->GetTheStatusChange(TIMEOUT_INFINITE, txStates, ulCount);
+			}
+			catch(CMWException & e)
+			{
+				if (m_bStopRequest)
+					break;
+
+				// Start all over again in a while
+				MWLOG(LEV_WARN, MOD_CAL, L"Reader monitor: SCardGetStatusChange() failed: 0x%0x", e.GetError());
+				Forget();
+				m_poPCSC->ReleaseContext();
+				for (i = 0; i < ulCount; i++)
+					txStates[i].dwCurrentState = SCARD_STATE_UNAWARE;
+				Lock();
+				if (!m_bStopping)
+					Wait(1000);
+				Unlock();
+				continue;
+			}
+
+			for (i = 0; i < ulCount; i++)
+			{
+				unsigned long ulState = txStates[i].dwEventState & ~SCARD_STATE_CHANGED;
+
+				if (ulState != txStates[i].dwCurrentState
+				    || mon_load(&m_alEvents[i]) == 0)
+				{
+					Publish(i, ulState);
+					txStates[i].dwCurrentState = ulState;
+					bChanged = true;
+				}
+			}
+
+			if (bChanged)
+				Changed();
+		}
+	}
+
+	long CReaderMonitor::Find(const std::string & csReader)
+	{
+		for (size_t i = 0; i < m_oReaders.size(); i++)
+		{
+			if (m_oReaders[i] == csReader)
+				return (long) i;
+		}
+
+		return -1;
+	}
+
+	// The state is stored before the event counter is increased, and read
+	// after it, so that a reader that sees an unchanged count never gets a
+	// state that is newer than that count.
+	void CReaderMonitor::Publish(unsigned long i, unsigned long ulState)
+	{
+		long lEvents = mon_load(&m_alEvents[i]) + 1;
+
+		mon_store(&m_alState[i], (long) ulState);
+		mon_store(&m_alEvents[i], lEvents == 0 ? 1 : lEvents);
+	}
+
+	void CReaderMonitor::Forget()
+	{
+		for (unsigned long i = 0; i < MAX_READERS + 1; i++)
+			mon_store(&m_alEvents[i], 0);
+		Changed();
+	}
+
+	void CReaderMonitor::Changed()
+	{
+		Lock();
+		m_ulGeneration++;
+		Broadcast();
+		Unlock();
+	}
+
+	void CReaderMonitor::Lock()
+	{
+#ifdef WIN32
+		EnterCriticalSection(&m_Lock);
+#else
+		pthread_mutex_lock(&m_Lock);
+#endif
+	}
+
+	void CReaderMonitor::Unlock()
+	{
+#ifdef WIN32
+		LeaveCriticalSection(&m_Lock);
+#else
+		pthread_mutex_unlock(&m_Lock);
+#endif
+	}
+
+	// Call with the lock taken
+	void CReaderMonitor::Wait(unsigned long ulMillisecs)
+	{
+#ifdef WIN32
+		SleepConditionVariableCS(&m_Cond, &m_Lock,
+					 ulMillisecs == TIMEOUT_INFINITE ? INFINITE : ulMillisecs);
+#else
+		if (ulMillisecs == TIMEOUT_INFINITE)
+		{
+			pthread_cond_wait(&m_Cond, &m_Lock);
+			return;
+		}
+
+		struct timeval now;
+		struct timespec until;
+
+		gettimeofday(&now, NULL);
+		until.tv_sec = now.tv_sec + ulMillisecs / 1000;
+		until.tv_nsec = (now.tv_usec + (ulMillisecs % 1000) * 1000) * 1000;
+		if (until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&m_Cond, &m_Lock, &until);
+#endif
+	}
+
+	void CReaderMonitor::Broadcast()
+	{
+#ifdef WIN32
+		WakeAllConditionVariable(&m_Cond);
+#else
+		pthread_cond_broadcast(&m_Cond);
+#endif
+	}
+
+}
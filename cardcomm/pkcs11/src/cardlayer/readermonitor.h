@@ -0,0 +1,154 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/**
+ * Background thread that waits in SCardGetStatusChange() for changes to
+ * the readers, and to the PnP pseudo-reader that reports readers that are
+ * attached or removed.
+ *
+ * The last state of each reader is kept in memory, so that the presence
+ * of a card and the reader events for C_WaitForSlotEvent() can be known
+ * without asking the PC/SC resource manager; and C_GetSlotList() only has
+ * to list the readers again after the PnP pseudo-reader saw a change.
+ *
+ * The thread has its own PC/SC context, as pcsc-lite doesn't allow other
+ * calls on a context while an SCardGetStatusChange() is waiting on it.
+ * If something goes wrong (e.g. the resource manager is restarted), the
+ * states are forgotten until the next successful SCardGetStatusChange();
+ * in the mean time, GetState() and GetStates() return false and the
+ * caller has to ask PC/SC itself.
+ *
+ * The states are read without taking a lock. The list of readers only
+ * changes in Watch(), which the caller must not call at the same time as
+ * any of the other functions (the PKCS#11 module does this with all slots
+ * locked), except for WaitForChange().
+ */
+
+#pragma once
+
+#ifndef READERMONITOR_H
+#define READERMONITOR_H
+
+#include <string>
+#include <vector>
+#include "common/thread.h"
+#include "pcsc.h"
+#include "readersinfo.h"
+
+namespace eIDMW
+{
+
+	class CReaderMonitor:public CThread
+	{
+public:
+		CReaderMonitor();
+		~CReaderMonitor();
+
+	/**
+	 * Start monitoring the readers in oReadersInfo, or if that's done
+	 * already, mark the list of readers as up to date (see ReadersChanged()).
+	 * Returns once the first states are known (or after at most 2 seconds).
+	 */
+		void Watch(CReadersInfo & oReadersInfo);
+
+	/** Stop the thread; does nothing if it's not running */
+		void StopMonitor();
+
+	/**
+	 * Returns false if a reader was attached or removed since the last
+	 * Watch(), true if that happened or if it can't be known.
+	 */
+		bool ReadersChanged();
+
+	/**
+	 * Get the last SCARD_READERSTATE.dwEventState (without SCARD_STATE_CHANGED)
+	 * of the reader, and the number of changes seen so far. Returns false if
+	 * the reader isn't monitored or its state isn't known at the moment.
+	 */
+		bool GetState(const std::string & csReader,
+			      unsigned long *pulState,
+			      unsigned long *pulEvents);
+
+	/**
+	 * Fill in the dwEventState of the readers in txReaderStates like
+	 * SCardGetStatusChange() would, and return the generation to
+	 * pass to WaitForChange(). Returns false if the state of one of
+	 * the readers isn't known.
+	 */
+		bool GetStates(SCARD_READERSTATEA * txReaderStates,
+			       unsigned long ulReaderCount,
+			       unsigned long *pulGeneration);
+
+	/**
+	 * Block until a reader changes state after GetStates() returned
+	 * ulGeneration. Returns false if the monitor is stopped instead.
+	 */
+		bool WaitForChange(unsigned long ulGeneration);
+
+		void Run();
+
+private:
+		// No copies allowed
+		CReaderMonitor(const CReaderMonitor & oMonitor);
+		CReaderMonitor & operator =(const CReaderMonitor & oMonitor);
+
+		long Find(const std::string & csReader);
+		void Publish(unsigned long i, unsigned long ulState);
+		void Forget();
+		void Changed();
+		void Lock();
+		void Unlock();
+		void Wait(unsigned long ulMillisecs);
+		void Broadcast();
+
+		CPCSC *m_poPCSC;	// created by the first Watch()
+
+		// Readers[0 .. m_ulReaderCount - 1] are those from Watch(), m_lPnP is
+		// the index of the PnP pseudo-reader or -1 if there's none
+#ifdef WIN32
+#pragma warning(push)
+#pragma warning(disable:4251)
+#endif
+		std::vector < std::string > m_oReaders;
+#ifdef WIN32
+#pragma warning(pop)
+#endif
+		unsigned long m_ulReaderCount;
+		long m_lPnP;
+
+		volatile long m_alState[MAX_READERS + 1];
+		volatile long m_alEvents[MAX_READERS + 1];	// 0 = the state is not known
+		volatile long m_lPnPListed;	// m_alEvents[m_lPnP] at the last Watch()
+
+		// Protect m_ulGeneration, m_bStopping and m_iWaiters
+#ifdef WIN32
+		CRITICAL_SECTION m_Lock;
+		CONDITION_VARIABLE m_Cond;
+#else
+		pthread_mutex_t m_Lock;
+		pthread_cond_t m_Cond;
+#endif
+		unsigned long m_ulGeneration;
+		bool m_bStopping;
+		int m_iWaiters;
+	};
+
+}
+#endif
@@ -29,152 +29,169 @@
 #include "cert.h"
 
 
-int cert_get_info(const unsigned char *pcert, unsigned int lcert, T_CERT_INFO *info)
+/* reads the DER encoded TLV at *pp (ending before end) into item and
+   moves *pp past it; only the single byte tags of X.509 are accepted */
+static int cert_next_tlv(const unsigned char **pp, const unsigned char *end, ASN1_ITEM *item)
 {
-int ret = 0;
-ASN1_ITEM item;
+const unsigned char *p = *pp;
+unsigned int len, n;
 
-//should be done already
-memset(info, 0, sizeof(T_CERT_INFO));
+if (p >= end)
+   return (E_X509_INCOMPLETE);
+if ((*p & TAG_MASK) == TAG_MASK)
+   return (E_X509_DECODE);
+item->tag = ((*p & CLASS_MASK) >> 6) | ((*p & TYPE_MASK) >> 3) | ((*p & TAG_MASK) << 3);
+item->p_raw = p++;
 
-//check size of cert
-ret = asn1_get_item(pcert, lcert, "\1", &item);
-if (ret)
-   return(ret);
-if (item.l_raw <= lcert)
-   lcert = info->lcert = item.l_raw;
-else
+if (p >= end)
+   return (E_X509_INCOMPLETE);
+len = *p++;
+if (len & EXT_LEN)
+   {
+   /* no indefinite lengths in DER, and 4 length bytes will do */
+   n = len & LEN_MASK;
+   if (n == 0 || n > 4)
+      return (E_X509_DECODE);
+   if ((unsigned int)(end - p) < n)
+      return (E_X509_INCOMPLETE);
+   for (len = 0; n > 0; n--)
+      len = (len << 8) | *p++;
+   }
+if ((unsigned int)(end - p) < len)
    return (E_X509_INCOMPLETE);
 
-ret = asn1_get_item(pcert, lcert, X509_SUBJECT, &item);
-if (ret)
-   return(ret);
+item->p_data = p;
+item->l_data = len;
+item->l_raw = (unsigned int)(p + len - item->p_raw);
+item->nsubitems = 0;
+*pp = p + len;
 
-info->subject = (char*) malloc(item.l_raw);
-if (info->subject == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->subject, item.p_raw, item.l_raw);
-info->l_subject = item.l_raw;
+return (0);
+}
 
-ret = asn1_get_item(pcert, lcert, X509_ISSUER, &item);
-if (ret)
-   return(ret);
+/* same, but the item must have the given tag */
+static int cert_next_tag(const unsigned char **pp, const unsigned char *end, unsigned int tag, ASN1_ITEM *item)
+{
+int ret = cert_next_tlv(pp, end, item);
 
-info->issuer = (char*) malloc(item.l_raw);
-if (info->issuer == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->issuer, item.p_raw, item.l_raw);
-info->l_issuer = item.l_raw;
+if (ret == 0 && item->tag != tag)
+   ret = E_X509_DECODE;
+return (ret);
+}
 
-ret = asn1_get_item(pcert, lcert, X509_SERIAL, &item);
-if (ret)
-   return(ret);
-else if (item.tag != ASN_INTEGER)
-   return(E_X509_DECODE);
+/* the data of an ASN_INTEGER, without the leading zero it may have */
+static void cert_unsigned(const ASN1_ITEM *item, const unsigned char **pp, unsigned int *l)
+{
+*pp = item->p_data;
+*l = item->l_data;
+if (*l > 0 && **pp == 0)
+   {
+   (*pp)++;
+   (*l)--;
+   }
+}
 
-info->serial = (char*) malloc (item.l_raw);
-if (info->serial == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->serial, item.p_raw, item.l_raw);
-info->l_serial = item.l_raw;
+/* Finds the fields in a single walk over the TBSCertificate instead of
+   looking up each of them from the start with asn1_get_item(). Nothing is
+   copied, info points into pcert. */
+int cert_get_info(const unsigned char *pcert, unsigned int lcert, T_CERT_INFO *info)
+{
+int ret = 0;
+ASN1_ITEM item;
+const unsigned char *p = pcert;
+const unsigned char *end;
+const unsigned char *p_key;
+const unsigned char *end_key;
 
-ret = asn1_get_item(pcert, lcert, X509_VALID_FROM, &item);
-if (ret)
-   return(ret);
+memset(info, 0, sizeof(T_CERT_INFO));
 
-info->validfrom = (char*) malloc(item.l_data);
-if (info->validfrom == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->validfrom, item.p_data, item.l_data);
-info->l_validfrom = item.l_data;
+/* Certificate, TBSCertificate; the card file can be longer than the cert */
+if ((ret = cert_next_tag(&p, pcert + lcert, ASN_SEQUENCE, &item)) != 0)
+   return (ret);
+info->lcert = item.l_raw;
+p = item.p_data;
+if ((ret = cert_next_tag(&p, item.p_data + item.l_data, ASN_SEQUENCE, &item)) != 0)
+   return (ret);
+p = item.p_data;
+end = item.p_data + item.l_data;
+
+/* [0] version is optional */
+if ((ret = cert_next_tlv(&p, end, &item)) != 0)
+   return (ret);
+if (item.tag == (ASN_CONTEXT | ASN_CONSTRUCTED))
+   {
+   if ((ret = cert_next_tlv(&p, end, &item)) != 0)
+      return (ret);
+   }
 
-ret = asn1_get_item(pcert, lcert, X509_VALID_UNTIL, &item);
-if (ret)
-   return(ret);
+if (item.tag != ASN_INTEGER)
+   return (E_X509_DECODE);
+info->serial = item.p_raw;
+info->l_serial = item.l_raw;
 
-info->validto = (char*) malloc(item.l_data);
-if (info->validto == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->validto, item.p_data, item.l_data);
-info->l_validto = item.l_data;
+/* signature algorithm */
+if ((ret = cert_next_tlv(&p, end, &item)) != 0)
+   return (ret);
 
-/* check for RSA keytype */
-/*ret = asn1_get_item(pcert, lcert, X509_KEYTYPE, &item);
-if (ret)
-   return(ret);
-else if (item.tag != ASN_OID)
-   return (E_X509_DECODE);
-else if (item.l_data != sizeof(OID_RSA_ENCRYPTION)-1)
-   return (E_X509_UNKNOWN_KEYTYPE);
-else if (memcmp(item.p_data, OID_RSA_ENCRYPTION, item.l_data) != 0)
-   return (E_X509_UNKNOWN_KEYTYPE);
-*/
-
-/* RSA: modulus and exponent */
-ret = asn1_get_item(pcert, lcert, X509_RSA_MOD, &item);
-if (ret)
-   return(ret);
-if (*(item.p_data) == 0)
-   {
-   /* first byte could be zero in ASN_INTEGER, skip this */
-   item.p_data++;
-   item.l_data--;
-   }
+if ((ret = cert_next_tlv(&p, end, &item)) != 0)
+   return (ret);
+info->issuer = item.p_raw;
+info->l_issuer = item.l_raw;
 
-info->mod = (char*) malloc(item.l_data);
-if (info->mod == NULL)
-   return(E_X509_ALLOC);
+/* validity: notBefore, notAfter */
+if ((ret = cert_next_tag(&p, end, ASN_SEQUENCE, &item)) != 0)
+   return (ret);
+p_key = item.p_data;
+end_key = item.p_data + item.l_data;
+if ((ret = cert_next_tlv(&p_key, end_key, &item)) != 0)
+   return (ret);
+info->validfrom = item.p_data;
+info->l_validfrom = item.l_data;
+if ((ret = cert_next_tlv(&p_key, end_key, &item)) != 0)
+   return (ret);
+info->validto = item.p_data;
+info->l_validto = item.l_data;
+
+if ((ret = cert_next_tlv(&p, end, &item)) != 0)
+   return (ret);
+info->subject = item.p_raw;
+info->l_subject = item.l_raw;
 
-memcpy(info->mod, item.p_data, item.l_data);
-info->l_mod = item.l_data;
+/* SubjectPublicKeyInfo: algorithm, BIT STRING with the key */
+if ((ret = cert_next_tag(&p, end, ASN_SEQUENCE, &item)) != 0)
+   return (ret);
+p_key = item.p_data;
+end_key = item.p_data + item.l_data;
+if ((ret = cert_next_tlv(&p_key, end_key, &item)) != 0)
+   return (ret);
+if ((ret = cert_next_tag(&p_key, end_key, ASN_BIT_STRING, &item)) != 0)
+   return (ret);
+if (item.l_data < 1)
+   return (E_X509_DECODE);
 
-ret = asn1_get_item(pcert, lcert, X509_RSA_EXP, &item);
-if (ret)
-   return(ret);
-if (*(item.p_data) == 0)
+/* skip the unused bits byte; for RSA, what follows is the RSAPublicKey
+   SEQUENCE of modulus and exponent */
+p_key = item.p_data + 1;
+end_key = item.p_data + item.l_data;
+info->pkinfo = p_key;
+info->l_pkinfo = (unsigned int)(end_key - p_key);
+if (cert_next_tag(&p_key, end_key, ASN_SEQUENCE, &item) != 0)
    {
-   /* first byte could be zero in ASN_INTEGER, skip this */
-   item.p_data++;
-   item.l_data--;
+   /* not RSA: no modulus or exponent */
+   info->mod = info->exp = info->pkinfo;
+   return (0);
    }
-info->exp = (char*) malloc(item.l_data);
-if (info->exp == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->exp, item.p_data, item.l_data);
-info->l_exp = item.l_data;
-
-/* PKINFO */
-ret = asn1_get_item(pcert, lcert, X509_PKINFO, &item);
-if (ret)
-   return(ret);
-info->pkinfo = malloc(item.l_raw);
-if (info->pkinfo == NULL)
-   return(E_X509_ALLOC);
-memcpy(info->pkinfo, item.p_raw, item.l_raw);
+info->pkinfo = item.p_raw;
 info->l_pkinfo = item.l_raw;
 
-return (0);
-}
-
+p_key = item.p_data;
+end_key = item.p_data + item.l_data;
+if ((ret = cert_next_tag(&p_key, end_key, ASN_INTEGER, &item)) != 0)
+   return (ret);
+cert_unsigned(&item, &info->mod, &info->l_mod);
+if ((ret = cert_next_tag(&p_key, end_key, ASN_INTEGER, &item)) != 0)
+   return (ret);
+cert_unsigned(&item, &info->exp, &info->l_exp);
 
-void cert_free_info(T_CERT_INFO *info)
-{
-	if(info != NULL)
-	{
-		if(info->subject != NULL)
-			free(info->subject);
-		if(info->issuer != NULL)
-			free(info->issuer);
-		if(info->mod != NULL)
-			free(info->mod);
-		if(info->pkinfo != NULL)
-			free(info->pkinfo);
-		if(info->serial != NULL)
-			free(info->serial);
-		if(info->validfrom != NULL)
-			free(info->validfrom);
-		if(info->validto != NULL)
-			free(info->validto);
-	}
+return (0);
 }
-
@@ -65,31 +65,34 @@ extern "C"
 #define X509_SIGNATURE_OID    "\1\2\1"
 #define X509_SIGNATURE        "\1\3"
 
+	/* Where the fields the PKCS#11 module needs are in a DER certificate,
+	 * found with cert_get_info() in a single pass over it. The pointers
+	 * point into the certificate that was passed, so they are only valid
+	 * as long as it is. mod, exp are zero-length if the key is not RSA. */
 	typedef struct
 	{
 		unsigned int lcert;
-		char *subject;
+		const unsigned char *subject;
 		unsigned int l_subject;
-		char *issuer;
+		const unsigned char *issuer;
 		unsigned int l_issuer;
-		char *mod;
+		const unsigned char *mod;
 		unsigned int l_mod;
-		char *exp;
+		const unsigned char *exp;
 		unsigned int l_exp;
-		char *pkinfo;
+		const unsigned char *pkinfo;
 		unsigned int l_pkinfo;
-		char *serial;
+		const unsigned char *serial;
 		unsigned int l_serial;
-		char *validfrom;
+		const unsigned char *validfrom;
 		unsigned int l_validfrom;
-		char *validto;
+		const unsigned char *validto;
 		unsigned int l_validto;
 	} T_CERT_INFO;
 
 
 	int cert_get_info(const unsigned char *pcert, unsigned int lcert,
 			  T_CERT_INFO * info);
-	void cert_free_info(T_CERT_INFO * info);
 
 #ifdef __cplusplus
 }
@@ -33,6 +33,20 @@ namespace eIDMW
 		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDTXDELAY, 3 };
 	const struct CConfig::Param_Num CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDCONNDELAY =
 		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDCONNDELAY, 0 };
+	const struct CConfig::Param_Num CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDADAPTIVEDELAY =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDADAPTIVEDELAY, 0 };
+	const struct CConfig::Param_Str CConfig::EIDMW_CONFIG_PARAM_GENERAL_READERDELAYFILE =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_READERDELAYFILE, L"$home/.eid-reader-delays" };
+	const struct CConfig::Param_Num CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHE =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDFILECACHE, 0 };
+	const struct CConfig::Param_Str CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHEDIR =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDFILECACHEDIR, L"$home/.eid-cache" };
+	const struct CConfig::Param_Str CConfig::EIDMW_CONFIG_PARAM_GENERAL_CARDEMULATORIMAGE =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_CARDEMULATORIMAGE, L"" };
+	const struct CConfig::Param_Num CConfig::EIDMW_CONFIG_PARAM_GENERAL_PKCS15CACHE =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_PKCS15CACHE, 1 };
+	const struct CConfig::Param_Num CConfig::EIDMW_CONFIG_PARAM_GENERAL_APDUSTATS =
+		{ EIDMW_CNF_SECTION_GENERAL, EIDMW_CNF_GENERAL_APDUSTATS, 0 };
 
 //LOGGING
 	const struct CConfig::Param_Str CConfig::EIDMW_CONFIG_PARAM_LOGGING_DIRNAME =
@@ -19,11 +19,14 @@
 
 **************************************************************************** */
 #include <iostream>
+#include <vector>
 #include <stdlib.h>
 #include <limits.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 
 #include "configuration.h"
 #include "configbase.h"
@@ -32,6 +35,14 @@
 #include "eiderrors.h"
 #include "mwexception.h"
 #include "loglevels.h"
+#include "thread.h"
+
+#ifdef HAVE_SYS_INOTIFY_H
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
 
 // open the user config file and also the general config file
 // search first in the user config file and then in the general one
@@ -39,6 +50,17 @@
 // setters: set always in the user config file unless the admin is executing the programme
 // ---> now the choice of the file is made via the location::USER and location::SYSTEM,
 //      still one should check the permissions for the requested location
+
+// The getters don't read the files: both files are parsed once into a
+// CConfigSnapshot, a hash table from (location, section, key) to the value,
+// the expanded value and the value as a number. The current snapshot is
+// published through m_poSnapshot and read without taking m_Mutex. Reload()
+// builds a new snapshot and swaps the pointer; this is done after a Set or
+// Del, and by the CConfigWatcher thread when inotify reports that one of
+// the files changed (without inotify, the modification times of the files
+// are checked at most once a second instead).
+// A replaced snapshot may still be in use by a reader, so it's only deleted
+// when the module is unloaded.
 namespace eIDMW
 {
 
@@ -47,9 +69,424 @@ namespace eIDMW
 	CDataFile CConfig::o_userDataFile;
 	CDataFile CConfig::o_systemDataFile;
 	CMutex CConfig::m_Mutex;
+	CConfigSnapshot *CConfig::m_poSnapshot = NULL;
 
 	       std::wstring home_path;
 
+	static std::wstring wsUserFile;
+	static std::wstring wsSystemFile;
+
+	std::wstring ExpandSection(const std::wstring & czSectionOriginal);
+
+	typedef struct
+	{
+		CConfig::tLocation location;
+		unsigned long ulHash;
+		std::wstring wsSection;
+		std::wstring wsName;
+		std::wstring wsValue;
+		std::wstring wsExpanded;	// wsValue with the $-macros expanded
+		long lValue;		// wsValue as a number
+	} tConfigValue;
+
+	// Gives access to the parsed sections of a config file
+	class CConfigFile:public CDataFile
+	{
+public:
+		CConfigFile(const std::wstring & wsFileName):CDataFile(wsFileName)
+		{
+		}
+
+		const SectionList & GetSections()
+		{
+			Load();
+			return m_Sections;
+		}
+	};
+
+	class CConfigSnapshot
+	{
+public:
+		CConfigSnapshot();
+
+		const tConfigValue *Find(CConfig::tLocation location,
+					 const wchar_t *csName,
+					 const wchar_t *csSection) const;
+		/** Search the USER location first, then the SYSTEM location */
+		const tConfigValue *Find(const wchar_t *csName,
+					 const wchar_t *csSection) const;
+#ifndef HAVE_SYS_INOTIFY_H
+		/** Returns true if one of the files changed since the snapshot was taken */
+		bool IsOutdated() const;
+#endif
+
+private:
+		void Add(CConfig::tLocation location, const std::wstring & wsFile);
+		static unsigned long Hash(CConfig::tLocation location,
+					  const wchar_t *csName,
+					  const wchar_t *csSection);
+		static bool EqualNoCase(const std::wstring & wsStr,
+					const wchar_t *csStr);
+		static time_t FileTime(const std::wstring & wsFile);
+
+		std::vector < tConfigValue > m_oValues;
+		std::vector < long > m_oIndex;	// open addressing, -1 = empty slot
+		unsigned long m_ulMask;
+		time_t m_tUserFile;
+		time_t m_tSystemFile;
+	};
+
+	static inline wchar_t FoldCase(wchar_t c)
+	{
+		// Same as the strcasecmp() of CompareNoCase(): only ASCII letters
+		return (c >= L'A' && c <= L'Z') ? c + (L'a' - L'A') : c;
+	}
+
+	CConfigSnapshot::CConfigSnapshot()
+	{
+		m_tUserFile = FileTime(wsUserFile);
+		m_tSystemFile = FileTime(wsSystemFile);
+
+		Add(CConfig::USER, wsUserFile);
+		Add(CConfig::SYSTEM, wsSystemFile);
+
+		unsigned long ulSize = 16;
+
+		while (ulSize < 2 * m_oValues.size())
+			ulSize *= 2;
+		m_ulMask = ulSize - 1;
+		m_oIndex.assign(ulSize, -1);
+
+		for (size_t i = 0; i < m_oValues.size(); i++)
+		{
+			unsigned long j = m_oValues[i].ulHash & m_ulMask;
+
+			while (m_oIndex[j] >= 0)
+				j = (j + 1) & m_ulMask;
+			m_oIndex[j] = (long) i;
+		}
+	}
+
+	void CConfigSnapshot::Add(CConfig::tLocation location,
+				  const std::wstring & wsFile)
+	{
+		CConfigFile oFile(wsFile);
+		const SectionList & oSections = oFile.GetSections();
+		std::vector < tConfigValue > oValues;
+
+		for (SectionList::const_iterator s = oSections.begin();
+		     s != oSections.end(); s++)
+		{
+			// Keys outside of a section can't be retrieved
+			if (s->szName.size() == 0)
+				continue;
+
+			for (KeyList::const_iterator k = s->Keys.begin();
+			     k != s->Keys.end(); k++)
+			{
+				// An empty value is the same as a missing one
+				if (k->szValue.size() == 0)
+					continue;
+
+				tConfigValue oValue;
+
+				oValue.location = location;
+				oValue.ulHash = Hash(location, k->szKey.c_str(),
+						     s->szName.c_str());
+				oValue.wsSection = s->szName;
+				oValue.wsName = k->szKey;
+				oValue.wsValue = k->szValue;
+				oValue.wsExpanded = ExpandSection(k->szValue);
+				oValue.lValue = atol(utilStringNarrow(k->szValue).c_str());
+
+				// Like CDataFile::GetKey(), the first one wins
+				bool bDuplicate = false;
+
+				for (size_t i = 0; i < oValues.size() && !bDuplicate; i++)
+					bDuplicate = oValues[i].ulHash == oValue.ulHash
+						&& EqualNoCase(oValues[i].wsName, k->szKey.c_str())
+						&& EqualNoCase(oValues[i].wsSection, s->szName.c_str());
+				if (!bDuplicate)
+					oValues.push_back(oValue);
+			}
+		}
+
+		m_oValues.insert(m_oValues.end(), oValues.begin(), oValues.end());
+	}
+
+	// FNV-1a over the case folded section and key names
+	unsigned long CConfigSnapshot::Hash(CConfig::tLocation location,
+					    const wchar_t *csName,
+					    const wchar_t *csSection)
+	{
+		unsigned long ulHash = 2166136261UL;
+
+		for (; *csSection != L'\0'; csSection++)
+			ulHash = (ulHash ^ (unsigned long) FoldCase(*csSection)) * 16777619UL;
+		ulHash = (ulHash ^ L'[') * 16777619UL;
+		for (; *csName != L'\0'; csName++)
+			ulHash = (ulHash ^ (unsigned long) FoldCase(*csName)) * 16777619UL;
+		ulHash = (ulHash ^ (unsigned long) location) * 16777619UL;
+
+		return ulHash;
+	}
+
+	bool CConfigSnapshot::EqualNoCase(const std::wstring & wsStr,
+					  const wchar_t *csStr)
+	{
+		size_t i;
+
+		for (i = 0; i < wsStr.size(); i++)
+		{
+			if (FoldCase(wsStr[i]) != FoldCase(csStr[i]))
+				return false;
+		}
+
+		return csStr[i] == L'\0';
+	}
+
+	time_t CConfigSnapshot::FileTime(const std::wstring & wsFile)
+	{
+		struct stat oStat;
+
+		if (stat(utilStringNarrow(wsFile).c_str(), &oStat) != 0)
+			return 0;
+
+		return oStat.st_mtime;
+	}
+
+	const tConfigValue *CConfigSnapshot::Find(CConfig::tLocation location,
+						  const wchar_t *csName,
+						  const wchar_t *csSection) const
+	{
+		unsigned long ulHash = Hash(location, csName, csSection);
+
+		// The table is at least half empty, so this always ends
+		for (unsigned long i = ulHash & m_ulMask;; i = (i + 1) & m_ulMask)
+		{
+			long lIndex = m_oIndex[i];
+
+			if (lIndex < 0)
+				return NULL;
+
+			const tConfigValue & oValue = m_oValues[lIndex];
+
+			if (oValue.ulHash == ulHash && oValue.location == location
+			    && EqualNoCase(oValue.wsName, csName)
+			    && EqualNoCase(oValue.wsSection, csSection))
+				return &oValue;
+		}
+	}
+
+	const tConfigValue *CConfigSnapshot::Find(const wchar_t *csName,
+						  const wchar_t *csSection) const
+	{
+		const tConfigValue *poValue = Find(CConfig::USER, csName, csSection);
+
+		return poValue != NULL ? poValue : Find(CConfig::SYSTEM, csName, csSection);
+	}
+
+#ifndef HAVE_SYS_INOTIFY_H
+	bool CConfigSnapshot::IsOutdated() const
+	{
+		return FileTime(wsUserFile) != m_tUserFile
+			|| FileTime(wsSystemFile) != m_tSystemFile;
+	}
+
+	static volatile time_t tChecked = 0;
+#endif
+
+#ifdef HAVE_SYS_INOTIFY_H
+	// Waits for changes to the config files and calls CConfig::Reload().
+	// The directories are watched rather than the files themselves, so
+	// that a file that is created, or replaced by a rename, is noticed too.
+	class CConfigWatcher:public CThread
+	{
+public:
+		CConfigWatcher();
+		~CConfigWatcher();
+
+		/** Returns 0 if something is watched and the thread was started, -1 otherwise */
+		int Start();
+		void Stop();
+		void Run();
+
+private:
+		void Watch(const std::wstring & wsFile);
+		bool IsWatched(int iWatch, const char *csName);
+
+		int m_iNotify;
+		int m_aiWake[2];	// written to by Stop()
+		pid_t m_Pid;		// a fork()ed child doesn't have the thread
+		std::vector < int >m_oWatches;
+		std::vector < std::string > m_oNames;
+	};
+
+	CConfigWatcher::CConfigWatcher()
+	{
+		m_iNotify = -1;
+		m_aiWake[0] = m_aiWake[1] = -1;
+		m_Pid = 0;
+	}
+
+	CConfigWatcher::~CConfigWatcher()
+	{
+		if (m_iNotify >= 0)
+			close(m_iNotify);
+		if (m_aiWake[0] >= 0)
+		{
+			close(m_aiWake[0]);
+			close(m_aiWake[1]);
+		}
+	}
+
+	void CConfigWatcher::Watch(const std::wstring & wsFile)
+	{
+		std::string csFile = utilStringNarrow(wsFile);
+		size_t pos = csFile.find_last_of('/');
+
+		if (pos == std::string::npos)
+			return;
+
+		int iWatch = inotify_add_watch(m_iNotify,
+					       csFile.substr(0, pos + 1).c_str(),
+					       IN_CLOSE_WRITE | IN_CREATE |
+					       IN_DELETE | IN_MOVED_FROM |
+					       IN_MOVED_TO);
+
+		if (iWatch >= 0)
+		{
+			m_oWatches.push_back(iWatch);
+			m_oNames.push_back(csFile.substr(pos + 1));
+		}
+	}
+
+	bool CConfigWatcher::IsWatched(int iWatch, const char *csName)
+	{
+		for (size_t i = 0; i < m_oWatches.size(); i++)
+		{
+			if (m_oWatches[i] == iWatch && m_oNames[i] == csName)
+				return true;
+		}
+
+		return false;
+	}
+
+	int CConfigWatcher::Start()
+	{
+		m_iNotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+		if (m_iNotify < 0)
+			return -1;
+
+		Watch(wsUserFile);
+		Watch(wsSystemFile);
+		if (m_oWatches.empty() || pipe(m_aiWake) != 0)
+			return -1;
+		fcntl(m_aiWake[0], F_SETFD, FD_CLOEXEC);
+		fcntl(m_aiWake[1], F_SETFD, FD_CLOEXEC);
+
+		m_Pid = getpid();
+		m_bStopRequest = false;
+
+		return CThread::Start();
+	}
+
+	void CConfigWatcher::Stop()
+	{
+		if (m_Pid != getpid() || !m_isRunning)
+			return;
+
+		RequestStop();
+		if (write(m_aiWake[1], "", 1) != 1)
+			return;
+		WaitTillStopped(5);
+	}
+
+	void CConfigWatcher::Run()
+	{
+		//Nobody joins this thread
+		pthread_detach(pthread_self());
+
+		while (!m_bStopRequest)
+		{
+			struct pollfd aFds[2];
+
+			aFds[0].fd = m_iNotify;
+			aFds[0].events = POLLIN;
+			aFds[1].fd = m_aiWake[0];
+			aFds[1].events = POLLIN;
+			if (poll(aFds, 2, -1) < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				break;
+			}
+			if (m_bStopRequest || aFds[1].revents != 0)
+				break;
+
+			union
+			{
+				struct inotify_event ev;
+				char buf[4096];
+			} oEvents;
+			bool bChanged = false;
+			ssize_t len;
+
+			// Handle everything that is queued with a single reload
+			while ((len = read(m_iNotify, oEvents.buf, sizeof(oEvents.buf))) > 0)
+			{
+				for (ssize_t i = 0; i < len;)
+				{
+					struct inotify_event *ev = (struct inotify_event *) (oEvents.buf + i);
+
+					if ((ev->mask & IN_Q_OVERFLOW) != 0
+					    || (ev->len > 0 && IsWatched(ev->wd, ev->name)))
+						bChanged = true;
+					i += sizeof(struct inotify_event) + ev->len;
+				}
+			}
+
+			if (bChanged)
+			{
+				try
+				{
+					CConfig::Reload();
+				}
+				catch( ...)
+				{
+				}
+			}
+		}
+	}
+
+	static CConfigWatcher *poWatcher = NULL;
+#endif
+
+	static std::vector < CConfigSnapshot * >oRetired;
+
+	// Stops the watcher and frees the snapshots when the module is unloaded
+	static class CConfigCleanup
+	{
+public:
+		~CConfigCleanup()
+		{
+#ifdef HAVE_SYS_INOTIFY_H
+			if (poWatcher != NULL && poWatcher->m_isRunning)
+				poWatcher->Stop();
+			if (poWatcher != NULL && !poWatcher->m_isRunning)
+			{
+				delete poWatcher;
+				poWatcher = NULL;
+			}
+#endif
+			for (size_t i = 0; i < oRetired.size(); i++)
+				delete oRetired[i];
+			oRetired.clear();
+			delete CConfig::m_poSnapshot;
+			CConfig::m_poSnapshot = NULL;
+		}
+	} oCleanup;
+
 	       CConfig::CConfig(void)
 	{
 	}
@@ -99,10 +536,62 @@ namespace eIDMW
 
 			o_systemDataFile.SetFileName(systemFile);
 
+			wsUserFile = userFile;
+			wsSystemFile = systemFile;
+
+#ifdef HAVE_SYS_INOTIFY_H
+			poWatcher = new CConfigWatcher();
+			if (poWatcher->Start() != 0)
+			{
+				delete poWatcher;
+				poWatcher = NULL;
+			}
+#endif
+
 			bIsInitialized = true;
 		}
 	}
 
+	const CConfigSnapshot *CConfig::GetSnapshot()
+	{
+		CConfigSnapshot *poSnapshot =
+			__atomic_load_n(&m_poSnapshot, __ATOMIC_ACQUIRE);
+
+		if (poSnapshot == NULL)
+		{
+			Reload();
+			poSnapshot = __atomic_load_n(&m_poSnapshot, __ATOMIC_ACQUIRE);
+		}
+#ifndef HAVE_SYS_INOTIFY_H
+		else if (time(NULL) != tChecked)
+		{
+			tChecked = time(NULL);
+			if (poSnapshot->IsOutdated())
+			{
+				Reload();
+				poSnapshot = __atomic_load_n(&m_poSnapshot, __ATOMIC_ACQUIRE);
+			}
+		}
+#endif
+
+		return poSnapshot;
+	}
+
+	void CConfig::Reload()
+	{
+		CAutoMutex autoMutex(&m_Mutex);
+
+		if (!bIsInitialized)
+			Init();
+
+		CConfigSnapshot *poSnapshot = new CConfigSnapshot();
+		CConfigSnapshot *poOld = m_poSnapshot;
+
+		__atomic_store_n(&m_poSnapshot, poSnapshot, __ATOMIC_RELEASE);
+		if (poOld != NULL)
+			oRetired.push_back(poOld);
+	}
+
 /**
  * Macro expansion:
  *  - $install -> $PREFIX (default: /usr/local)
@@ -173,22 +662,12 @@ namespace eIDMW
 					   const std::wstring & csSection,
 					   bool bExpand)
 	{
-		CAutoMutex autoMutex(&m_Mutex);
-
-		if (!bIsInitialized)
-			Init();
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(location, csName.c_str(),
+					    csSection.c_str());
 
-		std::wstring csResult = L"";
-
-		if (location == CConfig::SYSTEM)
-			csResult =
-				o_systemDataFile.GetString(csName, csSection);
-		else
-			csResult =
-				o_userDataFile.GetString(csName, csSection);
-
-		if (csResult != L"")
-			return bExpand ? ExpandSection(csResult) : csResult;
+		if (poValue != NULL)
+			return bExpand ? poValue->wsExpanded : poValue->wsValue;
 
 		throw CMWEXCEPTION(EIDMW_CONF);
 	}
@@ -197,25 +676,26 @@ namespace eIDMW
 					   const std::wstring & csSection,
 					   bool bExpand)
 	{
-		try
-		{
-			return GetStringInt(CConfig::USER, csName, csSection,
-					    bExpand);
-		}
-		catch( ...)
-		{
-			return GetStringInt(CConfig::SYSTEM, csName,
-					    csSection, bExpand);
-		}
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(csName.c_str(), csSection.c_str());
+
+		if (poValue != NULL)
+			return bExpand ? poValue->wsExpanded : poValue->wsValue;
+
+		throw CMWEXCEPTION(EIDMW_CONF);
 	}
 
 
 	// std::wstring CConfig::GetString(t_Str szKey, t_Str szSection)
 	std::wstring CConfig::GetString(const Param_Str param)
 	{
-		return (GetString
-			(param.csParam, param.csSection, param.csDefault,
-			 true));
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(param.csParam, param.csSection);
+
+		if (poValue != NULL)
+			return poValue->wsExpanded;
+
+		return ExpandSection(param.csDefault);
 	}
 
 
@@ -230,15 +710,13 @@ namespace eIDMW
 					const std::wstring & csDefaultValue,
 					bool bExpand)
 	{
-		try
-		{
-			return GetStringInt(csName, czSection, bExpand);
-		}
-		catch( ...)
-		{
-			return bExpand ? ExpandSection(csDefaultValue) :
-				csDefaultValue;
-		}
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(csName.c_str(), czSection.c_str());
+
+		if (poValue != NULL)
+			return bExpand ? poValue->wsExpanded : poValue->wsValue;
+
+		return bExpand ? ExpandSection(csDefaultValue) : csDefaultValue;
 	};
 
 	std::wstring CConfig::GetString(tLocation location,
@@ -263,42 +741,34 @@ namespace eIDMW
 					const std::wstring & csDefaultValue,
 					bool bExpand)
 	{
-		try
-		{
-			return GetStringInt(location, csName, czSection,
-					    bExpand);
-		}
-		catch( ...)
-		{
-			return bExpand ? ExpandSection(csDefaultValue) :
-				csDefaultValue;
-		}
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(location, csName.c_str(),
+					    czSection.c_str());
+
+		if (poValue != NULL)
+			return bExpand ? poValue->wsExpanded : poValue->wsValue;
+
+		return bExpand ? ExpandSection(csDefaultValue) : csDefaultValue;
 	};
 
 	long CConfig::GetLong(tLocation location, const Param_Num param)
 	{
-		return (GetLong
-			(location, param.csParam, param.csSection,
-			 param.lDefault));
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(location, param.csParam,
+					    param.csSection);
+
+		return poValue != NULL ? poValue->lValue : param.lDefault;
 	}
 
 	long CConfig::GetLong(tLocation location, const std::wstring & csName,
 			      const std::wstring & czSection)
 	{
-		CAutoMutex autoMutex(&m_Mutex);
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(location, csName.c_str(),
+					    czSection.c_str());
 
-		if (!bIsInitialized)
-			Init();
-
-		long lResult = LONG_MIN;
-
-		if (location == CConfig::SYSTEM)
-			lResult = o_systemDataFile.GetLong(csName, czSection);
-		else
-			lResult = o_userDataFile.GetLong(csName, czSection);
-
-		if (lResult != LONG_MIN)
-			return lResult;
+		if (poValue != NULL)
+			return poValue->lValue;
 
 		throw CMWEXCEPTION(EIDMW_CONF);
 	};
@@ -308,34 +778,31 @@ namespace eIDMW
 			      const std::wstring & czSection,
 			      long lDefaultValue)
 	{
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(location, csName.c_str(),
+					    czSection.c_str());
 
-		try
-		{
-			return GetLong(location, csName, czSection);
-		}
-		catch( ...)
-		{
-			return lDefaultValue;
-		}
+		return poValue != NULL ? poValue->lValue : lDefaultValue;
 	};
 
 	long CConfig::GetLong(const Param_Num param)
 	{
-		return (GetLong
-			(param.csParam, param.csSection, param.lDefault));
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(param.csParam, param.csSection);
+
+		return poValue != NULL ? poValue->lValue : param.lDefault;
 	}
 
 	long CConfig::GetLong(const std::wstring & csName,
 			      const std::wstring & czSection)
 	{
-		try
-		{
-			return GetLong(CConfig::USER, csName, czSection);
-		}
-		catch( ...)
-		{
-			return GetLong(CConfig::SYSTEM, csName, czSection);
-		}
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(csName.c_str(), czSection.c_str());
+
+		if (poValue != NULL)
+			return poValue->lValue;
+
+		throw CMWEXCEPTION(EIDMW_CONF);
 	};
 
 
@@ -343,15 +810,10 @@ namespace eIDMW
 			      const std::wstring & czSection,
 			      long lDefaultValue)
 	{
+		const tConfigValue *poValue =
+			GetSnapshot()->Find(csName.c_str(), czSection.c_str());
 
-		try
-		{
-			return GetLong(csName, czSection);
-		}
-		catch( ...)
-		{
-			return lDefaultValue;
-		}
+		return poValue != NULL ? poValue->lValue : lDefaultValue;
 	};
 
 	void CConfig::SetString(tLocation location,
@@ -378,12 +840,14 @@ namespace eIDMW
 						  czSection);
 			if (!o_systemDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		} else
 		{
 			o_userDataFile.SetValue(csName, csValue, L"",
 						czSection);
 			if (!o_userDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		}
 	};
 
@@ -408,12 +872,14 @@ namespace eIDMW
 						 czSection);
 			if (!o_systemDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		} else
 		{
 			o_userDataFile.SetLong(csName, lValue, L"",
 					       czSection);
 			if (!o_userDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		}
 	};
 
@@ -439,6 +905,7 @@ namespace eIDMW
 
 			if (!o_systemDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		} else
 		{
 			if (!o_userDataFile.DeleteKey(csName, czSection))
@@ -446,6 +913,7 @@ namespace eIDMW
 
 			if (!o_userDataFile.Save())
 				throw CMWEXCEPTION(EIDMW_CONF);
+			Reload();
 		}
 	};
 
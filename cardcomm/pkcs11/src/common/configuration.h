@@ -36,6 +36,8 @@ replace $install by string in install parameter
   The project-file determinates the specific location inside the registry/ini-file.
 
 - GetString retrieves data from the registry/ini-file.
+  On Linux and Mac, the ini-files are parsed only once into a hash table (see configuration.cpp),
+  which is read without locking and is rebuilt when one of the files changes.
 - SetString writes data into the registry/ini-file.
 
 - You can specify a default value for each Getxxxx.  The default value is returned in case that the specified key does not exist.
@@ -134,6 +136,13 @@ replace $install by string in install parameter
 
 #define EIDMW_CNF_GENERAL_CARDTXDELAY   L"card_transmit_delay"	//number, delay while communicating with the smartcard, in mili-seconds, default 1 mSec
 #define EIDMW_CNF_GENERAL_CARDCONNDELAY L"card_connect_delay"	//number, delay before connecting to a smartcard, in mili-seconds, default 0 mSec
+#define EIDMW_CNF_GENERAL_CARDADAPTIVEDELAY L"card_adaptive_delay"	//number; 1=yes, 0=no (default); If yes, the delays before sending to a smartcard are learned per reader instead of fixed
+#define EIDMW_CNF_GENERAL_READERDELAYFILE L"reader_delay_file"	//string, file in which the learned reader delays are saved; $home/.eid-reader-delays
+#define EIDMW_CNF_GENERAL_CARDFILECACHE L"card_file_cache"	//number; 0=no (default), 1=yes; If yes, files that don't change (identity, photo, certificates) are cached on disk per card
+#define EIDMW_CNF_GENERAL_CARDFILECACHEDIR L"card_file_cache_dirname"	//string, location of the card file cache; $home/.eid-cache
+#define EIDMW_CNF_GENERAL_CARDEMULATORIMAGE L"card_emulator_image"	//string, card image for the card emulator (only with --enable-card-emulator); empty = use the real readers (default)
+#define EIDMW_CNF_GENERAL_PKCS15CACHE L"pkcs15_cache"	//number; 0=no, 1=yes (default); If yes, the PINs, keys and certificates of a card are remembered per card (and stored in the card file cache, if enabled)
+#define EIDMW_CNF_GENERAL_APDUSTATS L"apdu_stats"	//number; 0 = no APDU counters (default), 1 = count APDUs and card time for C_BEID_GetApduStats
 
 #define EIDMW_CNF_SECTION_LOGGING       L"logging"	//section with the logging parameters
 #define EIDMW_CNF_LOGGING_DIRNAME       L"log_dirname"	//string, location of the log-file; $home/beid/ Full path with volume name.
@@ -153,6 +162,7 @@ replace $install by string in install parameter
 
 namespace eIDMW
 {
+	class CConfigSnapshot;
 
 #ifdef WIN32
 #define WDIRSEP L"\\"
@@ -267,6 +277,13 @@ public:
 		static const struct Param_Str EIDMW_CONFIG_PARAM_GENERAL_LANGUAGE;
 		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_CARDTXDELAY;
 		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_CARDCONNDELAY;
+		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_CARDADAPTIVEDELAY;
+		static const struct Param_Str EIDMW_CONFIG_PARAM_GENERAL_READERDELAYFILE;
+		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHE;
+		static const struct Param_Str EIDMW_CONFIG_PARAM_GENERAL_CARDFILECACHEDIR;
+		static const struct Param_Str EIDMW_CONFIG_PARAM_GENERAL_CARDEMULATORIMAGE;
+		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_PKCS15CACHE;
+		static const struct Param_Num EIDMW_CONFIG_PARAM_GENERAL_APDUSTATS;
 
 		//LOGGING
 		static const struct Param_Str EIDMW_CONFIG_PARAM_LOGGING_DIRNAME;
@@ -286,8 +303,17 @@ private:
 		//below info if not needed any more when the ini-file is hard-coded.
 		// See http://groups.google.com/group/microsoft.public.vc.stl/msg/c4dfeb8987d7b8f0
 #ifndef WIN32
+		friend class CConfigWatcher;
+		friend class CConfigCleanup;
+
 		static CDataFile o_userDataFile;
 		static CDataFile o_systemDataFile;
+
+		/** Returns the current snapshot of both ini-files, never NULL */
+		static const CConfigSnapshot *GetSnapshot();
+		/** Re-read the ini-files into a new snapshot */
+		static void Reload();
+		static CConfigSnapshot *m_poSnapshot;	/**< Only changed by Reload() */
 #endif
 		static CMutex m_Mutex;	/**< Mutex for exclusive access */
 	};
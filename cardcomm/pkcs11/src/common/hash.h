@@ -61,6 +61,9 @@ namespace eIDMW
 		ALGO_SHA384, // 48-byte hash
 		ALGO_SHA512, // 64-byte hash
 		ALGO_RIPEMD160,	// 64-byte hash
+		ALGO_SHA3_256,	// 32-byte hash
+		ALGO_SHA3_384,	// 48-byte hash
+		ALGO_SHA3_512,	// 64-byte hash
 	};
 
 	class CHash
@@ -77,6 +80,7 @@ public:
 		void Init(tHashAlgo algo);
 		void Update(const CByteArray & data);
 		void Update(const CByteArray & data, unsigned long ulOffset, unsigned long ulLen);
+		void Update(const unsigned char *pucData, unsigned long ulLen);
 		CByteArray GetHash();
 
 private:
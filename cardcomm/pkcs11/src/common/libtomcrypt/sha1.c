@@ -52,6 +52,13 @@ static int  sha1_compress(hash_state *md, unsigned char *buf)
     ulong32 t;
 #endif
 
+#ifdef LTC_SHA_X86
+    if (sha1_x86_available()) {
+        sha1_compress_x86(md->sha1.state, buf, 1);
+        return CRYPT_OK;
+    }
+#endif
+
     /* copy the state into 512-bits into W[0..15] */
     for (i = 0; i < 16; i++) {
         LOAD32H(W[i], buf + (4*i));
@@ -182,7 +189,39 @@ int sha1_init(hash_state * md)
    @param inlen  The length of the data (octets)
    @return CRYPT_OK if successful
 */
+#ifdef LTC_SHA_X86
+static HASH_PROCESS(_sha1_process, sha1_compress, sha1, 64)
+
+int sha1_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+    int           err;
+
+    if (!sha1_x86_available()) {
+       return _sha1_process(md, in, inlen);
+    }
+
+    /* top up a partly filled buffer, then hand all whole blocks to the x86 code in one call */
+    n = (md->sha1.curlen == 0) ? 0 : MIN(inlen, 64 - md->sha1.curlen);
+    if (n > 0) {
+       if ((err = _sha1_process(md, in, n)) != CRYPT_OK) {
+          return err;
+       }
+       in    += n;
+       inlen -= n;
+    }
+    n = inlen / 64;
+    if (n > 0) {
+       sha1_compress_x86(md->sha1.state, in, n);
+       md->sha1.length += (ulong64)n * 512;
+       in    += n * 64;
+       inlen -= n * 64;
+    }
+    return (inlen > 0) ? _sha1_process(md, in, inlen) : CRYPT_OK;
+}
+#else
 HASH_PROCESS(sha1_process, sha1_compress, sha1, 64)
+#endif
 
 /**
    Terminate the hash to get the digest
@@ -79,6 +79,13 @@ static int  sha256_compress(hash_state * md, unsigned char *buf)
 #endif
     int i;
 
+#ifdef LTC_SHA_X86
+    if (sha256_x86_available()) {
+        sha256_compress_x86(md->sha256.state, buf, 1);
+        return CRYPT_OK;
+    }
+#endif
+
     /* copy state into S */
     for (i = 0; i < 8; i++) {
         S[i] = md->sha256.state[i];
@@ -229,7 +236,39 @@ int sha256_init(hash_state * md)
    @param inlen  The length of the data (octets)
    @return CRYPT_OK if successful
 */
+#ifdef LTC_SHA_X86
+static HASH_PROCESS(_sha256_process, sha256_compress, sha256, 64)
+
+int sha256_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+    int           err;
+
+    if (!sha256_x86_available()) {
+       return _sha256_process(md, in, inlen);
+    }
+
+    /* top up a partly filled buffer, then hand all whole blocks to the x86 code in one call */
+    n = (md->sha256.curlen == 0) ? 0 : MIN(inlen, 64 - md->sha256.curlen);
+    if (n > 0) {
+       if ((err = _sha256_process(md, in, n)) != CRYPT_OK) {
+          return err;
+       }
+       in    += n;
+       inlen -= n;
+    }
+    n = inlen / 64;
+    if (n > 0) {
+       sha256_compress_x86(md->sha256.state, in, n);
+       md->sha256.length += (ulong64)n * 512;
+       in    += n * 64;
+       inlen -= n * 64;
+    }
+    return (inlen > 0) ? _sha256_process(md, in, inlen) : CRYPT_OK;
+}
+#else
 HASH_PROCESS(sha256_process, sha256_compress, sha256, 64)
+#endif
 
 /**
    Terminate the hash to get the digest
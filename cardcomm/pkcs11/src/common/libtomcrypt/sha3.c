@@ -0,0 +1,272 @@
+/* LibTomCrypt, modular cryptographic library -- Tom St Denis
+ *
+ * LibTomCrypt is a library that provides various cryptographic
+ * algorithms in a highly modular and flexible manner.
+ *
+ * The library is free for all purposes without any express
+ * guarantee it works.
+ *
+ * Tom St Denis, tomstdenis@iahu.ca, http://libtomcrypt.org
+ */
+
+#include "tomcrypt_hash.h"
+
+/**
+  @file sha3.c
+  SHA3-256/384/512 (FIPS 202), Keccak-f[1600] sponge
+*/
+
+#ifdef USE_SHA3
+
+const struct ltc_hash_descriptor sha3_256_desc =
+{
+    "sha3-256",
+    17,
+    32,
+    136,
+
+    /* DER identifier */
+    { 0x30, 0x31, 0x30, 0x0D, 0x06, 0x09, 0x60, 0x86,
+      0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x08, 0x05,
+      0x00, 0x04, 0x20 },
+    19,
+
+    &sha3_256_init,
+    &sha3_process,
+    &sha3_done,
+    NULL,
+};
+
+const struct ltc_hash_descriptor sha3_384_desc =
+{
+    "sha3-384",
+    19,
+    48,
+    104,
+
+    /* DER identifier */
+    { 0x30, 0x41, 0x30, 0x0D, 0x06, 0x09, 0x60, 0x86,
+      0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x09, 0x05,
+      0x00, 0x04, 0x30 },
+    19,
+
+    &sha3_384_init,
+    &sha3_process,
+    &sha3_done,
+    NULL,
+};
+
+const struct ltc_hash_descriptor sha3_512_desc =
+{
+    "sha3-512",
+    20,
+    64,
+    72,
+
+    /* DER identifier */
+    { 0x30, 0x51, 0x30, 0x0D, 0x06, 0x09, 0x60, 0x86,
+      0x48, 0x01, 0x65, 0x03, 0x04, 0x02, 0x0A, 0x05,
+      0x00, 0x04, 0x40 },
+    19,
+
+    &sha3_512_init,
+    &sha3_process,
+    &sha3_done,
+    NULL,
+};
+
+/* the round constants */
+static const ulong64 keccakf_rndc[24] = {
+    CONST64(0x0000000000000001), CONST64(0x0000000000008082),
+    CONST64(0x800000000000808A), CONST64(0x8000000080008000),
+    CONST64(0x000000000000808B), CONST64(0x0000000080000001),
+    CONST64(0x8000000080008081), CONST64(0x8000000000008009),
+    CONST64(0x000000000000008A), CONST64(0x0000000000000088),
+    CONST64(0x0000000080008009), CONST64(0x000000008000000A),
+    CONST64(0x000000008000808B), CONST64(0x800000000000008B),
+    CONST64(0x8000000000008089), CONST64(0x8000000000008003),
+    CONST64(0x8000000000008002), CONST64(0x8000000000000080),
+    CONST64(0x000000000000800A), CONST64(0x800000008000000A),
+    CONST64(0x8000000080008081), CONST64(0x8000000000008080),
+    CONST64(0x0000000080000001), CONST64(0x8000000080008008)
+};
+
+/* rho rotations and pi lane order */
+static const unsigned keccakf_rotc[24] = {
+    1, 3, 6, 10, 15, 21, 28, 36, 45, 55, 2, 14,
+    27, 41, 56, 8, 25, 43, 62, 18, 39, 61, 20, 44
+};
+
+static const unsigned keccakf_piln[24] = {
+    10, 7, 11, 17, 18, 3, 5, 16, 8, 21, 24, 4,
+    15, 23, 19, 13, 12, 2, 20, 14, 22, 9, 6, 1
+};
+
+/* the ROL64 helpers in tomcrypt_macros.h work on unsigned long, which is
+ * only 32 bits wide on Win64 */
+#define ROL64K(x, n)    (((x) << (n)) | ((x) >> (64 - (n))))
+
+static void keccakf(ulong64 s[25])
+{
+    ulong64 t, bc[5], d[5];
+    int i, j, round;
+
+    for (round = 0; round < 24; round++) {
+        /* theta */
+        for (i = 0; i < 5; i++) {
+            bc[i] = s[i] ^ s[i + 5] ^ s[i + 10] ^ s[i + 15] ^ s[i + 20];
+        }
+        d[0] = bc[4] ^ ROL64K(bc[1], 1);
+        d[1] = bc[0] ^ ROL64K(bc[2], 1);
+        d[2] = bc[1] ^ ROL64K(bc[3], 1);
+        d[3] = bc[2] ^ ROL64K(bc[4], 1);
+        d[4] = bc[3] ^ ROL64K(bc[0], 1);
+        for (j = 0; j < 25; j += 5) {
+            s[j]     ^= d[0];
+            s[j + 1] ^= d[1];
+            s[j + 2] ^= d[2];
+            s[j + 3] ^= d[3];
+            s[j + 4] ^= d[4];
+        }
+
+        /* rho and pi */
+        t = s[1];
+        for (i = 0; i < 24; i++) {
+            j = keccakf_piln[i];
+            bc[0] = s[j];
+            s[j] = ROL64K(t, keccakf_rotc[i]);
+            t = bc[0];
+        }
+
+        /* chi */
+        for (j = 0; j < 25; j += 5) {
+            for (i = 0; i < 5; i++) {
+                bc[i] = s[j + i];
+            }
+            s[j]     ^= (~bc[1]) & bc[2];
+            s[j + 1] ^= (~bc[2]) & bc[3];
+            s[j + 2] ^= (~bc[3]) & bc[4];
+            s[j + 3] ^= (~bc[4]) & bc[0];
+            s[j + 4] ^= (~bc[0]) & bc[1];
+        }
+
+        /* iota */
+        s[0] ^= keccakf_rndc[round];
+    }
+}
+
+/* absorb one block of md->sha3.rate bytes */
+static void sha3_absorb(hash_state * md, const unsigned char *buf)
+{
+    ulong64 t;
+    unsigned long i;
+
+    for (i = 0; i < md->sha3.rate / 8; i++) {
+        LOAD64L(t, buf + (8*i));
+        md->sha3.s[i] ^= t;
+    }
+    keccakf(md->sha3.s);
+}
+
+static int sha3_init(hash_state * md, unsigned long hashsize)
+{
+    LTC_ARGCHK(md != NULL);
+
+    memset(&md->sha3, 0, sizeof(md->sha3));
+    md->sha3.hashsize = hashsize;
+    md->sha3.rate = 200 - 2 * hashsize;
+    return CRYPT_OK;
+}
+
+/**
+   Initialize the hash state
+   @param md   The hash state you wish to initialize
+   @return CRYPT_OK if successful
+*/
+int sha3_256_init(hash_state * md)
+{
+    return sha3_init(md, 32);
+}
+
+int sha3_384_init(hash_state * md)
+{
+    return sha3_init(md, 48);
+}
+
+int sha3_512_init(hash_state * md)
+{
+    return sha3_init(md, 64);
+}
+
+/**
+   Process a block of memory though the hash
+   @param md     The hash state
+   @param in     The data to hash
+   @param inlen  The length of the data (octets)
+   @return CRYPT_OK if successful
+*/
+int sha3_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+
+    LTC_ARGCHK(md != NULL);
+    LTC_ARGCHK(in != NULL);
+    if (md->sha3.rate == 0 || md->sha3.curlen >= md->sha3.rate) {
+       return CRYPT_INVALID_ARG;
+    }
+    while (inlen > 0) {
+        if (md->sha3.curlen == 0 && inlen >= md->sha3.rate) {
+           sha3_absorb(md, in);
+           in    += md->sha3.rate;
+           inlen -= md->sha3.rate;
+        } else {
+           n = MIN(inlen, (md->sha3.rate - md->sha3.curlen));
+           memcpy(md->sha3.buf + md->sha3.curlen, in, (size_t)n);
+           md->sha3.curlen += n;
+           in    += n;
+           inlen -= n;
+           if (md->sha3.curlen == md->sha3.rate) {
+              sha3_absorb(md, md->sha3.buf);
+              md->sha3.curlen = 0;
+           }
+        }
+    }
+    return CRYPT_OK;
+}
+
+/**
+   Terminate the hash to get the digest
+   @param md  The hash state
+   @param out [out] The destination of the hash (hashsize bytes)
+   @return CRYPT_OK if successful
+*/
+int sha3_done(hash_state * md, unsigned char *out)
+{
+    unsigned long i;
+
+    LTC_ARGCHK(md  != NULL);
+    LTC_ARGCHK(out != NULL);
+
+    if (md->sha3.rate == 0 || md->sha3.curlen >= md->sha3.rate) {
+       return CRYPT_INVALID_ARG;
+    }
+
+    /* the SHA-3 domain bits and the first pad bit, then pad10*1 */
+    md->sha3.buf[md->sha3.curlen++] = (unsigned char)0x06;
+    while (md->sha3.curlen < md->sha3.rate) {
+        md->sha3.buf[md->sha3.curlen++] = (unsigned char)0;
+    }
+    md->sha3.buf[md->sha3.rate - 1] |= (unsigned char)0x80;
+    sha3_absorb(md, md->sha3.buf);
+
+    /* every SHA-3 digest length is a whole number of lanes */
+    for (i = 0; i < md->sha3.hashsize / 8; i++) {
+        STORE64L(md->sha3.s[i], out + (8*i));
+    }
+#ifdef LTC_CLEAN_STACK
+    zeromem(md, sizeof(hash_state));
+#endif
+    return CRYPT_OK;
+}
+
+#endif
@@ -101,6 +101,13 @@ static int  sha512_compress(hash_state * md, unsigned char *buf)
     ulong64 S[8], W[80], t0, t1;
     int i;
 
+#ifdef LTC_SHA_X86
+    if (sha512_x86_available()) {
+        sha512_compress_x86(md->sha512.state, buf, 1);
+        return CRYPT_OK;
+    }
+#endif
+
     /* copy state into S */
     for (i = 0; i < 8; i++) {
         S[i] = md->sha512.state[i];
@@ -197,7 +204,39 @@ int sha512_init(hash_state * md)
    @param inlen  The length of the data (octets)
    @return CRYPT_OK if successful
 */
+#ifdef LTC_SHA_X86
+static HASH_PROCESS(_sha512_process, sha512_compress, sha512, 128)
+
+int sha512_process(hash_state * md, const unsigned char *in, unsigned long inlen)
+{
+    unsigned long n;
+    int           err;
+
+    if (!sha512_x86_available()) {
+       return _sha512_process(md, in, inlen);
+    }
+
+    /* top up a partly filled buffer, then hand all whole blocks to the x86 code in one call */
+    n = (md->sha512.curlen == 0) ? 0 : MIN(inlen, 128 - md->sha512.curlen);
+    if (n > 0) {
+       if ((err = _sha512_process(md, in, n)) != CRYPT_OK) {
+          return err;
+       }
+       in    += n;
+       inlen -= n;
+    }
+    n = inlen / 128;
+    if (n > 0) {
+       sha512_compress_x86(md->sha512.state, in, n);
+       md->sha512.length += (ulong64)n * 1024;
+       in    += n * 128;
+       inlen -= n * 128;
+    }
+    return (inlen > 0) ? _sha512_process(md, in, inlen) : CRYPT_OK;
+}
+#else
 HASH_PROCESS(sha512_process, sha512_compress, sha512, 128)
+#endif
 
 /**
    Terminate the hash to get the digest
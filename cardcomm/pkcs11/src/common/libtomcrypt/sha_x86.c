@@ -0,0 +1,653 @@
+/* LibTomCrypt, modular cryptographic library -- Tom St Denis
+ *
+ * LibTomCrypt is a library that provides various cryptographic
+ * algorithms in a highly modular and flexible manner.
+ *
+ * The library is free for all purposes without any express
+ * guarantee it works.
+ *
+ * Tom St Denis, tomstdenis@iahu.ca, http://libtomcrypt.org
+ */
+
+#include "tomcrypt_hash.h"
+
+/**
+  @file sha_x86.c
+  SHA-1, SHA-256 and SHA-512 block functions for x86 CPUs.
+  SHA-1 and SHA-256 use the SHA extensions. The SHA extensions have no
+  SHA-512 instructions, and many AVX2 CPUs (e.g. Haswell to Cascade Lake)
+  lack them altogether; SHA-512, and SHA-256 on those CPUs, compute the
+  message schedule with AVX2 and the rounds with the BMI2 rotates.
+  sha1.c, sha256.c and sha512.c only call these when the matching
+  *_x86_available() says the CPU can run them, and fall back to their
+  portable code otherwise.
+*/
+
+#ifdef LTC_SHA_X86
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <immintrin.h>
+#define SHA_X86_TARGET
+#define AVX2_X86_TARGET
+#else
+#include <cpuid.h>
+#include <immintrin.h>
+/* the rest of the library is built for the baseline CPU; only these
+ * functions may use the SHA, SSSE3, SSE4.1, AVX2 and BMI2 instructions */
+#define SHA_X86_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#define AVX2_X86_TARGET __attribute__((target("avx2,bmi2")))
+#endif
+
+#define SHA_X86_SHA     1   /* SHA extensions, SSSE3 and SSE4.1 */
+#define SHA_X86_AVX2    2   /* AVX2 and BMI2, and the OS saves the ymm registers */
+
+static int sha_x86_cpuid(void)
+{
+    int features = 0;
+#ifdef _MSC_VER
+    int r[4];
+    int ecx1;
+
+    __cpuid(r, 0);
+    if (r[0] < 7) {
+        return 0;
+    }
+    __cpuid(r, 1);
+    ecx1 = r[2];
+    __cpuidex(r, 7, 0);
+    if ((ecx1 & (1 << 9)) != 0 && (ecx1 & (1 << 19)) != 0 && (r[1] & (1 << 29)) != 0) {
+        features |= SHA_X86_SHA;
+    }
+    /* OSXSAVE and AVX, xmm and ymm state enabled, AVX2 and BMI2 */
+    if ((ecx1 & (1 << 27)) != 0 && (ecx1 & (1 << 28)) != 0 &&
+        (_xgetbv(0) & 6) == 6 && (r[1] & (1 << 5)) != 0 && (r[1] & (1 << 8)) != 0) {
+        features |= SHA_X86_AVX2;
+    }
+#else
+    unsigned int a, b, c, d;
+    unsigned int ecx1, xcr0, edx0;
+
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid(1, a, b, c, d);
+    ecx1 = c;
+    __cpuid_count(7, 0, a, b, c, d);
+    if ((ecx1 & (1U << 9)) != 0 && (ecx1 & (1U << 19)) != 0 && (b & (1U << 29)) != 0) {
+        features |= SHA_X86_SHA;
+    }
+    /* OSXSAVE and AVX, xmm and ymm state enabled, AVX2 and BMI2 */
+    if ((ecx1 & (1U << 27)) != 0 && (ecx1 & (1U << 28)) != 0) {
+        __asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(edx0) : "c"(0));
+        if ((xcr0 & 6) == 6 && (b & (1U << 5)) != 0 && (b & (1U << 8)) != 0) {
+            features |= SHA_X86_AVX2;
+        }
+    }
+#endif
+    return features;
+}
+
+static int sha_x86_features(void)
+{
+    /* every thread computes the same answer, so racing first calls are harmless */
+    static volatile int features = -1;
+
+    if (features < 0) {
+        features = sha_x86_cpuid();
+    }
+    return features;
+}
+
+/**
+   Check whether sha1_compress_x86() may be used
+   @return 1 if the CPU supports SHA, SSSE3 and SSE4.1, 0 otherwise
+*/
+int sha1_x86_available(void)
+{
+    return (sha_x86_features() & SHA_X86_SHA) != 0;
+}
+
+/**
+   Check whether sha256_compress_x86() may be used
+   @return 1 if the CPU has the SHA extensions or AVX2 and BMI2, 0 otherwise
+*/
+int sha256_x86_available(void)
+{
+    return sha_x86_features() != 0;
+}
+
+/**
+   Check whether sha512_compress_x86() may be used
+   @return 1 if the CPU supports AVX2 and BMI2, 0 otherwise
+*/
+int sha512_x86_available(void)
+{
+    return (sha_x86_features() & SHA_X86_AVX2) != 0;
+}
+
+/**
+   Compress a number of consecutive 64 byte blocks into a SHA-1 state
+   @param state   The five SHA-1 chaining values
+   @param in      The data, blocks * 64 bytes
+   @param blocks  The number of blocks
+*/
+SHA_X86_TARGET
+void sha1_compress_x86(ulong32 state[5], const unsigned char *in, unsigned long blocks)
+{
+    __m128i ABCD, ABCD_SAVE, E0, E0_SAVE, E1;
+    __m128i MSG0, MSG1, MSG2, MSG3;
+    const __m128i MASK = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                       7, 6, 5, 4, 3, 2, 1, 0);
+
+    ABCD = _mm_loadu_si128((const __m128i *)state);
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    E0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    for (; blocks > 0; blocks--, in += 64) {
+        ABCD_SAVE = ABCD;
+        E0_SAVE = E0;
+
+        /* rounds 0-3 */
+        MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 0)), MASK);
+        E0 = _mm_add_epi32(E0, MSG0);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+
+        /* rounds 4-7 */
+        MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+
+        /* rounds 8-11 */
+        MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), MASK);
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        /* rounds 12-15 */
+        MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 48)), MASK);
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 0);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        /* rounds 16-19 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 0);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        /* rounds 20-23 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        /* rounds 24-27 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        /* rounds 28-31 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        /* rounds 32-35 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 1);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        /* rounds 36-39 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 1);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        /* rounds 40-43 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        /* rounds 44-47 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        /* rounds 48-51 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        /* rounds 52-55 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 2);
+        MSG0 = _mm_sha1msg1_epu32(MSG0, MSG1);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        /* rounds 56-59 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 2);
+        MSG1 = _mm_sha1msg1_epu32(MSG1, MSG2);
+        MSG0 = _mm_xor_si128(MSG0, MSG2);
+
+        /* rounds 60-63 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        MSG0 = _mm_sha1msg2_epu32(MSG0, MSG3);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG2 = _mm_sha1msg1_epu32(MSG2, MSG3);
+        MSG1 = _mm_xor_si128(MSG1, MSG3);
+
+        /* rounds 64-67 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG0);
+        E1 = ABCD;
+        MSG1 = _mm_sha1msg2_epu32(MSG1, MSG0);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+        MSG3 = _mm_sha1msg1_epu32(MSG3, MSG0);
+        MSG2 = _mm_xor_si128(MSG2, MSG0);
+
+        /* rounds 68-71 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG1);
+        E0 = ABCD;
+        MSG2 = _mm_sha1msg2_epu32(MSG2, MSG1);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+        MSG3 = _mm_xor_si128(MSG3, MSG1);
+
+        /* rounds 72-75 */
+        E0 = _mm_sha1nexte_epu32(E0, MSG2);
+        E1 = ABCD;
+        MSG3 = _mm_sha1msg2_epu32(MSG3, MSG2);
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E0, 3);
+
+        /* rounds 76-79 */
+        E1 = _mm_sha1nexte_epu32(E1, MSG3);
+        E0 = ABCD;
+        ABCD = _mm_sha1rnds4_epu32(ABCD, E1, 3);
+
+        E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+        ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+    }
+
+    ABCD = _mm_shuffle_epi32(ABCD, 0x1B);
+    _mm_storeu_si128((__m128i *)state, ABCD);
+    state[4] = (ulong32)_mm_extract_epi32(E0, 3);
+}
+
+static const ulong32 K256[64] = {
+    0x428a2f98UL, 0x71374491UL, 0xb5c0fbcfUL, 0xe9b5dba5UL, 0x3956c25bUL,
+    0x59f111f1UL, 0x923f82a4UL, 0xab1c5ed5UL, 0xd807aa98UL, 0x12835b01UL,
+    0x243185beUL, 0x550c7dc3UL, 0x72be5d74UL, 0x80deb1feUL, 0x9bdc06a7UL,
+    0xc19bf174UL, 0xe49b69c1UL, 0xefbe4786UL, 0x0fc19dc6UL, 0x240ca1ccUL,
+    0x2de92c6fUL, 0x4a7484aaUL, 0x5cb0a9dcUL, 0x76f988daUL, 0x983e5152UL,
+    0xa831c66dUL, 0xb00327c8UL, 0xbf597fc7UL, 0xc6e00bf3UL, 0xd5a79147UL,
+    0x06ca6351UL, 0x14292967UL, 0x27b70a85UL, 0x2e1b2138UL, 0x4d2c6dfcUL,
+    0x53380d13UL, 0x650a7354UL, 0x766a0abbUL, 0x81c2c92eUL, 0x92722c85UL,
+    0xa2bfe8a1UL, 0xa81a664bUL, 0xc24b8b70UL, 0xc76c51a3UL, 0xd192e819UL,
+    0xd6990624UL, 0xf40e3585UL, 0x106aa070UL, 0x19a4c116UL, 0x1e376c08UL,
+    0x2748774cUL, 0x34b0bcb5UL, 0x391c0cb3UL, 0x4ed8aa4aUL, 0x5b9cca4fUL,
+    0x682e6ff3UL, 0x748f82eeUL, 0x78a5636fUL, 0x84c87814UL, 0x8cc70208UL,
+    0x90befffaUL, 0xa4506cebUL, 0xbef9a3f7UL, 0xc67178f2UL
+};
+
+/* four rounds on message words w, then the schedule step that turns
+ * w0..w3 (W[i-4]..W[i-1]) into the next four words in w0 */
+#define RNDS(w, k)                                                          \
+    M = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *)(K256 + (k))));   \
+    CDGH = _mm_sha256rnds2_epu32(CDGH, ABEF, M);                            \
+    ABEF = _mm_sha256rnds2_epu32(ABEF, CDGH, _mm_shuffle_epi32(M, 0x0E));
+
+#define SCHED(w0, w1, w2, w3)                                               \
+    w0 = _mm_sha256msg2_epu32(_mm_add_epi32(_mm_sha256msg1_epu32(w0, w1),   \
+                                            _mm_alignr_epi8(w3, w2, 4)), w3);
+
+SHA_X86_TARGET
+static void sha256_compress_sha(ulong32 state[8], const unsigned char *in, unsigned long blocks)
+{
+    __m128i ABEF, CDGH, ABEF_SAVE, CDGH_SAVE, T, M;
+    __m128i W0, W1, W2, W3;
+    const __m128i MASK = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4,
+                                       11, 10, 9, 8, 15, 14, 13, 12);
+    int i;
+
+    /* the round instructions want the state as ABEF and CDGH */
+    T = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0xB1);
+    CDGH = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)(state + 4)), 0x1B);
+    ABEF = _mm_alignr_epi8(T, CDGH, 8);
+    CDGH = _mm_blend_epi16(CDGH, T, 0xF0);
+
+    for (; blocks > 0; blocks--, in += 64) {
+        ABEF_SAVE = ABEF;
+        CDGH_SAVE = CDGH;
+
+        W0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 0)), MASK);
+        W1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16)), MASK);
+        W2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 32)), MASK);
+        W3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 48)), MASK);
+
+        RNDS(W0, 0);
+        RNDS(W1, 4);
+        RNDS(W2, 8);
+        RNDS(W3, 12);
+        for (i = 16; i < 64; i += 16) {
+            SCHED(W0, W1, W2, W3);
+            RNDS(W0, i);
+            SCHED(W1, W2, W3, W0);
+            RNDS(W1, i + 4);
+            SCHED(W2, W3, W0, W1);
+            RNDS(W2, i + 8);
+            SCHED(W3, W0, W1, W2);
+            RNDS(W3, i + 12);
+        }
+
+        ABEF = _mm_add_epi32(ABEF, ABEF_SAVE);
+        CDGH = _mm_add_epi32(CDGH, CDGH_SAVE);
+    }
+
+    /* back to ABCD and EFGH */
+    T = _mm_shuffle_epi32(ABEF, 0x1B);
+    CDGH = _mm_shuffle_epi32(CDGH, 0xB1);
+    ABEF = _mm_blend_epi16(T, CDGH, 0xF0);
+    CDGH = _mm_alignr_epi8(CDGH, T, 8);
+    _mm_storeu_si128((__m128i *)state, ABEF);
+    _mm_storeu_si128((__m128i *)(state + 4), CDGH);
+}
+
+#undef RNDS
+#undef SCHED
+
+/* Without the SHA extensions the rounds stay scalar, but the message schedule
+ * is computed four words at a time, 16 words ahead of the rounds, so it runs
+ * in the shadow of their dependency chain. The rounds use rorx, which leaves
+ * the flags alone and doesn't overwrite its source, and carry a ^ b over to
+ * the next round's Maj(). W[t-2] and W[t-1] of the last two of every four
+ * words are among those four, so sigma1 is done in halves. */
+
+#define ROTR32(x, n)    (((x) >> (n)) | ((x) << (32 - (n))))
+#define ROTR64(x, n)    (((x) >> (n)) | ((x) << (64 - (n))))
+#define Ch(x, y, z)     ((z) ^ ((x) & ((y) ^ (z))))
+
+#define VROR32(x, n)    _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define VROR64(x, n)    _mm256_or_si256(_mm256_srli_epi64(x, n), _mm256_slli_epi64(x, 64 - (n)))
+
+/* one round; bc holds b ^ c and ab gets a ^ b, so Maj(a, b, c) is b ^ (ab & bc) */
+#define RND256(a, b, c, d, e, f, g, h, wk, bc, ab)                                  \
+    t0 = h + (wk) + Ch(e, f, g) + (ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25));      \
+    ab = a ^ b;                                                                     \
+    t1 = (ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22)) + (b ^ (ab & bc));             \
+    d += t0;                                                                        \
+    h = t0 + t1;
+
+#define RND512(a, b, c, d, e, f, g, h, wk, bc, ab)                                  \
+    t0 = h + (wk) + Ch(e, f, g) + (ROTR64(e, 14) ^ ROTR64(e, 18) ^ ROTR64(e, 41));     \
+    ab = a ^ b;                                                                     \
+    t1 = (ROTR64(a, 28) ^ ROTR64(a, 34) ^ ROTR64(a, 39)) + (b ^ (ab & bc));            \
+    d += t0;                                                                        \
+    h = t0 + t1;
+
+#define RNDS8(RND, wk)                                                              \
+    RND(a, b, c, d, e, f, g, h, (wk)[0], x, y);                                     \
+    RND(h, a, b, c, d, e, f, g, (wk)[1], y, x);                                     \
+    RND(g, h, a, b, c, d, e, f, (wk)[2], x, y);                                     \
+    RND(f, g, h, a, b, c, d, e, (wk)[3], y, x);                                     \
+    RND(e, f, g, h, a, b, c, d, (wk)[4], x, y);                                     \
+    RND(d, e, f, g, h, a, b, c, (wk)[5], y, x);                                     \
+    RND(c, d, e, f, g, h, a, b, (wk)[6], x, y);                                     \
+    RND(b, c, d, e, f, g, h, a, (wk)[7], y, x);
+
+/* W[t..t+3] of two blocks (one per 128 bit lane) from w0..w3 = W[t-16..t-1] */
+AVX2_X86_TARGET
+static __m256i sha256_sched_avx2(__m256i w0, __m256i w1, __m256i w2, __m256i w3)
+{
+    __m256i x, s, lo, hi;
+
+    /* W[t-16] + sigma0(W[t-15]) + W[t-7] */
+    x = _mm256_alignr_epi8(w1, w0, 4);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR32(x, 7), VROR32(x, 18)), _mm256_srli_epi32(x, 3));
+    x = _mm256_add_epi32(_mm256_add_epi32(w0, s), _mm256_alignr_epi8(w3, w2, 4));
+
+    /* + sigma1(W[t-2]), sigma1(W[t-1]) for the first two words */
+    lo = _mm256_shuffle_epi32(w3, 0xFE);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR32(lo, 17), VROR32(lo, 19)), _mm256_srli_epi32(lo, 10));
+    x = _mm256_add_epi32(x, _mm256_blend_epi32(s, _mm256_setzero_si256(), 0xCC));
+
+    /* + sigma1 of those two for the last two */
+    hi = _mm256_shuffle_epi32(x, 0x40);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR32(hi, 17), VROR32(hi, 19)), _mm256_srli_epi32(hi, 10));
+    return _mm256_add_epi32(x, _mm256_blend_epi32(s, _mm256_setzero_si256(), 0x33));
+}
+
+/* the next four words of the schedule, and W + K of them for both blocks */
+#define SCHED256(i)                                                                 \
+    T = sha256_sched_avx2(W0, W1, W2, W3);                                          \
+    W0 = W1;                                                                        \
+    W1 = W2;                                                                        \
+    W2 = W3;                                                                        \
+    W3 = T;                                                                         \
+    WK256(W3, i);
+
+#define WK256(w, i)                                                                 \
+    T = _mm256_add_epi32(w, _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(K256 + (i))))); \
+    _mm_storeu_si128((__m128i *)(wk[0] + (i)), _mm256_castsi256_si128(T));         \
+    _mm_storeu_si128((__m128i *)(wk[1] + (i)), _mm256_extracti128_si256(T, 1));
+
+#define LOAD256(i)                                                                  \
+    _mm256_shuffle_epi8(_mm256_inserti128_si256(                                    \
+        _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + (i)))),       \
+        _mm_loadu_si128((const __m128i *)(in2 + (i))), 1), MASK)
+
+/* two blocks at a time, one per 128 bit lane: the schedule of the second
+ * block costs nothing extra, and its rounds have it ready */
+AVX2_X86_TARGET
+static void sha256_compress_avx2(ulong32 state[8], const unsigned char *in, unsigned long blocks)
+{
+    ulong32 wk[2][64];
+    ulong32 a, b, c, d, e, f, g, h, t0, t1, x, y;
+    __m256i W0, W1, W2, W3, T;
+    const __m256i MASK = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+                                          3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const unsigned char *in2;
+    int i;
+
+    for (; blocks > 0; blocks -= (blocks > 1) ? 2 : 1, in += 128) {
+        /* an odd last block is scheduled twice, the copy isn't used */
+        in2 = (blocks > 1) ? in + 64 : in;
+        W0 = LOAD256(0);
+        W1 = LOAD256(16);
+        W2 = LOAD256(32);
+        W3 = LOAD256(48);
+        WK256(W0, 0);
+        WK256(W1, 4);
+        WK256(W2, 8);
+        WK256(W3, 12);
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+        x = b ^ c;
+        for (i = 0; i < 64; i += 8) {
+            if (i < 48) {
+                SCHED256(i + 16);
+                SCHED256(i + 20);
+            }
+            RNDS8(RND256, wk[0] + i);
+        }
+        a = state[0] += a; b = state[1] += b; c = state[2] += c; d = state[3] += d;
+        e = state[4] += e; f = state[5] += f; g = state[6] += g; h = state[7] += h;
+        if (blocks == 1) {
+            break;
+        }
+
+        x = b ^ c;
+        for (i = 0; i < 64; i += 8) {
+            RNDS8(RND256, wk[1] + i);
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+/**
+   Compress a number of consecutive 64 byte blocks into a SHA-256 state
+   @param state   The eight SHA-256 chaining values
+   @param in      The data, blocks * 64 bytes
+   @param blocks  The number of blocks
+*/
+void sha256_compress_x86(ulong32 state[8], const unsigned char *in, unsigned long blocks)
+{
+    if (sha_x86_features() & SHA_X86_SHA) {
+        sha256_compress_sha(state, in, blocks);
+    } else {
+        sha256_compress_avx2(state, in, blocks);
+    }
+}
+
+static const ulong64 K512[80] = {
+    CONST64(0x428a2f98d728ae22), CONST64(0x7137449123ef65cd), CONST64(0xb5c0fbcfec4d3b2f), CONST64(0xe9b5dba58189dbbc),
+    CONST64(0x3956c25bf348b538), CONST64(0x59f111f1b605d019), CONST64(0x923f82a4af194f9b), CONST64(0xab1c5ed5da6d8118),
+    CONST64(0xd807aa98a3030242), CONST64(0x12835b0145706fbe), CONST64(0x243185be4ee4b28c), CONST64(0x550c7dc3d5ffb4e2),
+    CONST64(0x72be5d74f27b896f), CONST64(0x80deb1fe3b1696b1), CONST64(0x9bdc06a725c71235), CONST64(0xc19bf174cf692694),
+    CONST64(0xe49b69c19ef14ad2), CONST64(0xefbe4786384f25e3), CONST64(0x0fc19dc68b8cd5b5), CONST64(0x240ca1cc77ac9c65),
+    CONST64(0x2de92c6f592b0275), CONST64(0x4a7484aa6ea6e483), CONST64(0x5cb0a9dcbd41fbd4), CONST64(0x76f988da831153b5),
+    CONST64(0x983e5152ee66dfab), CONST64(0xa831c66d2db43210), CONST64(0xb00327c898fb213f), CONST64(0xbf597fc7beef0ee4),
+    CONST64(0xc6e00bf33da88fc2), CONST64(0xd5a79147930aa725), CONST64(0x06ca6351e003826f), CONST64(0x142929670a0e6e70),
+    CONST64(0x27b70a8546d22ffc), CONST64(0x2e1b21385c26c926), CONST64(0x4d2c6dfc5ac42aed), CONST64(0x53380d139d95b3df),
+    CONST64(0x650a73548baf63de), CONST64(0x766a0abb3c77b2a8), CONST64(0x81c2c92e47edaee6), CONST64(0x92722c851482353b),
+    CONST64(0xa2bfe8a14cf10364), CONST64(0xa81a664bbc423001), CONST64(0xc24b8b70d0f89791), CONST64(0xc76c51a30654be30),
+    CONST64(0xd192e819d6ef5218), CONST64(0xd69906245565a910), CONST64(0xf40e35855771202a), CONST64(0x106aa07032bbd1b8),
+    CONST64(0x19a4c116b8d2d0c8), CONST64(0x1e376c085141ab53), CONST64(0x2748774cdf8eeb99), CONST64(0x34b0bcb5e19b48a8),
+    CONST64(0x391c0cb3c5c95a63), CONST64(0x4ed8aa4ae3418acb), CONST64(0x5b9cca4f7763e373), CONST64(0x682e6ff3d6b2b8a3),
+    CONST64(0x748f82ee5defb2fc), CONST64(0x78a5636f43172f60), CONST64(0x84c87814a1f0ab72), CONST64(0x8cc702081a6439ec),
+    CONST64(0x90befffa23631e28), CONST64(0xa4506cebde82bde9), CONST64(0xbef9a3f7b2c67915), CONST64(0xc67178f2e372532b),
+    CONST64(0xca273eceea26619c), CONST64(0xd186b8c721c0c207), CONST64(0xeada7dd6cde0eb1e), CONST64(0xf57d4f7fee6ed178),
+    CONST64(0x06f067aa72176fba), CONST64(0x0a637dc5a2c898a6), CONST64(0x113f9804bef90dae), CONST64(0x1b710b35131c471b),
+    CONST64(0x28db77f523047d84), CONST64(0x32caab7b40c72493), CONST64(0x3c9ebe0a15c9bebc), CONST64(0x431d67c49c100d4c),
+    CONST64(0x4cc5d4becb3e42b6), CONST64(0x597f299cfc657e2a), CONST64(0x5fcb6fab3ad6faec), CONST64(0x6c44198c4a475817)
+};
+
+/* W[t..t+3] from w0..w3 = W[t-16..t-1] */
+AVX2_X86_TARGET
+static __m256i sha512_sched_avx2(__m256i w0, __m256i w1, __m256i w2, __m256i w3)
+{
+    __m256i x, s, lo, hi;
+
+    /* W[t-16] + sigma0(W[t-15]) + W[t-7]; alignr only shifts within a
+     * 128 bit lane, so it gets the next lane's words from a permute */
+    x = _mm256_alignr_epi8(_mm256_permute2x128_si256(w0, w1, 0x21), w0, 8);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR64(x, 1), VROR64(x, 8)), _mm256_srli_epi64(x, 7));
+    x = _mm256_add_epi64(_mm256_add_epi64(w0, s),
+                         _mm256_alignr_epi8(_mm256_permute2x128_si256(w2, w3, 0x21), w2, 8));
+
+    /* + sigma1(W[t-2]), sigma1(W[t-1]) for the first two words */
+    lo = _mm256_permute4x64_epi64(w3, 0x0E);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR64(lo, 19), VROR64(lo, 61)), _mm256_srli_epi64(lo, 6));
+    x = _mm256_add_epi64(x, _mm256_blend_epi32(s, _mm256_setzero_si256(), 0xF0));
+
+    /* + sigma1 of those two for the last two */
+    hi = _mm256_permute4x64_epi64(x, 0x40);
+    s = _mm256_xor_si256(_mm256_xor_si256(VROR64(hi, 19), VROR64(hi, 61)), _mm256_srli_epi64(hi, 6));
+    return _mm256_add_epi64(x, _mm256_blend_epi32(s, _mm256_setzero_si256(), 0x0F));
+}
+
+#define SCHED512(i)                                                                 \
+    T = sha512_sched_avx2(W0, W1, W2, W3);                                          \
+    W0 = W1;                                                                        \
+    W1 = W2;                                                                        \
+    W2 = W3;                                                                        \
+    W3 = T;                                                                         \
+    WK512(W3, i);
+
+#define WK512(w, i)                                                                 \
+    _mm256_storeu_si256((__m256i *)(wk + (i)),                                      \
+                        _mm256_add_epi64(w, _mm256_loadu_si256((const __m256i *)(K512 + (i)))));
+
+/**
+   Compress a number of consecutive 128 byte blocks into a SHA-512 state
+   @param state   The eight SHA-512 chaining values
+   @param in      The data, blocks * 128 bytes
+   @param blocks  The number of blocks
+*/
+AVX2_X86_TARGET
+void sha512_compress_x86(ulong64 state[8], const unsigned char *in, unsigned long blocks)
+{
+    ulong64 wk[80];
+    ulong64 a, b, c, d, e, f, g, h, t0, t1, x, y;
+    __m256i W0, W1, W2, W3, T;
+    const __m256i MASK = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8,
+                                          7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+    int i;
+
+    for (; blocks > 0; blocks--, in += 128) {
+        W0 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + 0)), MASK);
+        W1 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + 32)), MASK);
+        W2 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + 64)), MASK);
+        W3 = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + 96)), MASK);
+        WK512(W0, 0);
+        WK512(W1, 4);
+        WK512(W2, 8);
+        WK512(W3, 12);
+
+        a = state[0]; b = state[1]; c = state[2]; d = state[3];
+        e = state[4]; f = state[5]; g = state[6]; h = state[7];
+        x = b ^ c;
+        for (i = 0; i < 80; i += 8) {
+            if (i < 64) {
+                SCHED512(i + 16);
+                SCHED512(i + 20);
+            }
+            RNDS8(RND512, wk + i);
+        }
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+}
+
+#undef ROTR32
+#undef ROTR64
+#undef Ch
+#undef VROR32
+#undef VROR64
+#undef RND256
+#undef RND512
+#undef RNDS8
+#undef SCHED256
+#undef SCHED512
+#undef WK256
+#undef WK512
+#undef LOAD256
+
+#endif
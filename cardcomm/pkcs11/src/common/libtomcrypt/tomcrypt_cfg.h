@@ -65,6 +65,15 @@ int XMEMCMP(const void *s1, const void *s2, size_t n);
 #define ENDIAN_NEUTRAL
 #endif
 
+/* SHA-1, SHA-256 and SHA-512 block functions for x86 CPUs with the SHA extensions or AVX2 (sha_x86.c), picked at run time.
+ * Define LTC_NO_SHA_X86 to build only the portable code.
+ */
+#if !defined(LTC_NO_SHA_X86) && \
+    ((defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))) || \
+     (defined(_MSC_VER) && _MSC_VER >= 1900 && (defined(_M_X64) || defined(_M_IX86))))
+#define LTC_SHA_X86
+#endif
+
 /* packet code */
 #if defined(MRSA) || defined(MDH) || defined(MECC)
 #define PACKET
@@ -5,6 +5,7 @@
 #define USE_SHA256
 #define USE_SHA384
 #define USE_SHA512
+#define USE_SHA3
 #define USE_MD5
 #define USE_RIPEMD160
 
@@ -28,6 +29,15 @@ extern "C"
 #endif
 
 /* ---- HASH FUNCTIONS ---- */
+#ifdef USE_SHA3
+	struct sha3_state
+	{
+		ulong64 s[25];
+		unsigned long hashsize, rate, curlen;
+		unsigned char buf[136];	/* the rate of SHA3-256, the largest one used */
+	};
+#endif
+
 #ifdef USE_SHA512
 	struct sha512_state
 	{
@@ -134,6 +144,9 @@ extern "C"
 #ifdef USE_WHIRLPOOL
 		struct whirlpool_state whirlpool;
 #endif
+#ifdef USE_SHA3
+		struct sha3_state sha3;
+#endif
 #ifdef USE_SHA512
 		struct sha512_state sha512;
 #endif
@@ -251,6 +264,18 @@ extern "C"
 	extern const struct ltc_hash_descriptor sha384_desc;
 #endif
 
+#ifdef USE_SHA3
+	int sha3_256_init(hash_state * md);
+	int sha3_384_init(hash_state * md);
+	int sha3_512_init(hash_state * md);
+	int sha3_process(hash_state * md, const unsigned char *in,
+			 unsigned long inlen);
+	int sha3_done(hash_state * md, unsigned char *hash);
+	extern const struct ltc_hash_descriptor sha3_256_desc;
+	extern const struct ltc_hash_descriptor sha3_384_desc;
+	extern const struct ltc_hash_descriptor sha3_512_desc;
+#endif
+
 #ifdef USE_SHA256
 	int sha256_init(hash_state * md);
 	int sha256_process(hash_state * md, const unsigned char *in,
@@ -334,6 +359,18 @@ extern "C"
 	extern const struct ltc_hash_descriptor rmd160_desc;
 #endif
 
+#ifdef LTC_SHA_X86
+	int sha1_x86_available(void);
+	int sha256_x86_available(void);
+	int sha512_x86_available(void);
+	void sha1_compress_x86(ulong32 state[5], const unsigned char *in,
+			       unsigned long blocks);
+	void sha256_compress_x86(ulong32 state[8], const unsigned char *in,
+				 unsigned long blocks);
+	void sha512_compress_x86(ulong64 state[8], const unsigned char *in,
+				 unsigned long blocks);
+#endif
+
 	int find_hash(const char *name);
 	int find_hash_id(unsigned char ID);
 	int find_hash_any(const char *name, int digestlen);
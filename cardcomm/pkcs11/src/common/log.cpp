@@ -98,8 +98,8 @@ namespace eIDMW
 		return CLogger::instance().getLogW(group.c_str());
 	}
 
-// MWLOG(tLevel level, tModule mod, const char *format, ...)
-	bool MWLOG(tLevel level, tModule mod, const wchar_t * format, ...)
+// MWLOGWrite(tLevel level, tModule mod, const char *format, ...)
+	bool MWLOGWrite(tLevel level, tModule mod, const wchar_t * format, ...)
 	{
 
 #ifdef DO_LOGGING
@@ -130,8 +130,8 @@ namespace eIDMW
 		return true;
 	}
 
-// MWLOG(tLevel level, tModule mod, CMWEXCEPTION theException)
-	bool MWLOG(tLevel level, tModule mod, CMWException theException)
+// MWLOGWrite(tLevel level, tModule mod, CMWEXCEPTION theException)
+	bool MWLOGWrite(tLevel level, tModule mod, CMWException theException)
 	{
 
 #ifdef DO_LOGGING
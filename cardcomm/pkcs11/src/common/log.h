@@ -69,14 +69,28 @@ namespace eIDMW
  * Example:
  *          MWLOG(LEV_ERROR, MOD_P11, "Invalid session handle %d\n", handle);
  */
-	bool MWLOG(tLevel level, tModule mod, const wchar_t * format, ...);
+	bool MWLOGWrite(tLevel level, tModule mod, const wchar_t * format, ...);
 
 /**
  * Log.
  * Example:
  *          MWLOG(LEV_ERROR, theException);
  */
-	bool MWLOG(tLevel level, tModule mod, CMWException theException);
+	bool MWLOGWrite(tLevel level, tModule mod, CMWException theException);
 
 
 }
+
+/* Messages above this level are left out at compile time (see --disable-debug-log) */
+#ifdef BEID_NO_DEBUG_LOG
+#define MWLOG_MAX_LEVEL		eIDMW::LEV_INFO
+#else
+#define MWLOG_MAX_LEVEL		eIDMW::LEV_DEBUG
+#endif
+
+/* True if messages of this level are written; doesn't need the logger's lock */
+#define MWLOG_ON(level)		((level) <= MWLOG_MAX_LEVEL && (long) (level) <= eIDMW::CLogger::MaxLevel())
+
+/* MWLOG() only evaluates its arguments, e.g. a hex dump of an APDU, if the
+ * level is written; so it can't be used where a function is needed. */
+#define MWLOG(level, mod, ...)	(MWLOG_ON(level) ? eIDMW::MWLOGWrite((level), (mod), __VA_ARGS__) : false)
@@ -19,6 +19,7 @@
 
 **************************************************************************** */
 #include "logbase.h"
+#include "logqueue.h"
 #include "eiderrors.h"
 #include "mwexception.h"
 
@@ -39,16 +40,9 @@
 #include "sys/stat.h"
 #include "util.h"
 
-#define fwprintf_s fwprintf
-#define vfwprintf_s vfwprintf
-#define swprintf_s swprintf
-#define _stat stat
-
 #define LOG_DIRECTORY_DEFAULT  L"/tmp"
 #endif
 
-#define LOG_OPENFAILED_MAXALLOWED  10
-
 namespace eIDMW
 {
 
@@ -73,22 +67,14 @@ namespace eIDMW
 /* ******************
 *** CLogger Class ***
 ******************* */
-//-----------------------------------------------
-// The logger needs a systemwide mutex to control the access to the
-// logfile. A systemwide mutex on Windows is a named mutex.
-// For Linux/Mac we don't change the current code.
-//-----------------------------------------------
-#ifdef WIN32
-	HANDLE LogMutex;     // named mutex for Windows
-#endif
-
 	static CMutex m_mutex;	// mutex for:
 
-	//   - non-windows
+	//   - building a line, from writeLineHeader to writeLineMessage
 	//   - used as automutex for creating a logger instance
 
 	std::auto_ptr < CLogger > CLogger::m_instance;
 	bool CLogger::m_bApplicationLeaving = false;
+	volatile long CLogger::m_lMaxLevel = LOG_LEVEL_DEBUG;
 
 //Default constructor
 	CLogger::CLogger()
@@ -134,13 +120,6 @@ namespace eIDMW
 
 			m_logStore.pop_back();
 		}
-#ifdef WIN32
-		//--------------------------------
-		// Close the mutex handle. The last instance using the named mutex will
-		// destroy the mutex
-		//--------------------------------
-		CloseHandle(LogMutex);
-#endif
 	}
 
 //Get the singleton instance of the logger
@@ -152,13 +131,6 @@ namespace eIDMW
 
 		if (m_instance.get() == 0)
 		{
-#ifdef WIN32
-			//----------------------------------------------
-			// always create the logger mutex. Only the first time the named mutex is
-			// used, it is created. After that it is equivalent to opening the mutex
-			//----------------------------------------------
-			LogMutex = CreateMutex(0, FALSE, L"LogMutex");
-#endif
 			CAutoMutex autoMutex(&m_mutex);
 
 			m_instance.reset(new CLogger);
@@ -176,6 +148,7 @@ namespace eIDMW
 		m_filesize = filesize;
 		m_filenr = filenr;
 		m_maxlevel = maxlevel;
+		m_lMaxLevel = maxlevel;
 		m_groupinnewfile = groupinnewfile;
 	}
 
@@ -382,14 +355,12 @@ namespace eIDMW
 /* ***************
 *** CLog Class ***
 **************** */
-	long CLog::m_sopenfailed = 0;
-
 //PRIVATE: Default constructor
 	CLog::CLog(const wchar_t * directory, const wchar_t * prefix,
 		   const wchar_t * group, long filesize, long filenr,
 		   tLOG_Level maxlevel, bool groupinnewfile)
 	{
-		m_f = NULL;
+		m_sink = -1;
 		m_directory = directory;
 		m_prefix = prefix;
 		m_group = group;
@@ -397,10 +368,6 @@ namespace eIDMW
 		m_filenr = filenr;
 		m_maxlevel = maxlevel;
 		m_groupinnewfile = groupinnewfile;
-		m_openfailed = 0;
-#ifndef WIN32
-		m_flock = NULL;
-#endif
 	}
 
 //Copy constructor
@@ -408,17 +375,14 @@ namespace eIDMW
 		m_prefix(log.m_prefix), m_group(log.m_group),
 		m_filesize(log.m_filesize), m_filenr(log.m_filenr),
 		m_maxlevel(log.m_maxlevel), m_groupinnewfile(log.m_groupinnewfile),
-		m_openfailed(log.m_openfailed), m_f(log.m_f)
-#ifndef WIN32
-		, m_flock(log.m_flock)
-#endif
+		m_sink(log.m_sink)
 	{ }
 
 	CLog & CLog::operator=(const CLog & log)
 	{
 		if (this != &log)
 		{
-			m_f = log.m_f;
+			m_sink = log.m_sink;
 			m_directory = log.m_directory;
 			m_prefix = log.m_prefix;
 			m_group = log.m_group;
@@ -426,10 +390,6 @@ namespace eIDMW
 			m_filenr = log.m_filenr;
 			m_maxlevel = log.m_maxlevel;
 			m_groupinnewfile = log.m_groupinnewfile;
-			m_openfailed = log.m_openfailed;
-#ifndef WIN32
-			m_flock = NULL;
-#endif
 		}
 		return *this;
 	}
@@ -439,9 +399,12 @@ namespace eIDMW
 	{
 	}
 
-//PRIVATE: Return the name of to file to write into
-	void CLog::getFilename(std::wstring & filename)
+//PRIVATE: Register the set of files <prefix>_[<group>_]<index>.log with the log writer
+	int CLog::getSink()
 	{
+		if (m_sink >= 0)
+			return m_sink;
+
 		//Test if the directory exist
 		std::wstring directory;
 
@@ -478,241 +441,13 @@ namespace eIDMW
 		if (m_groupinnewfile && m_group.size() > 0)
 			root_filename += m_group + L"_";
 
-		wchar_t index[5];
-
-		swprintf_s(index, 5, L"%d", 0);
-
-		//If there is a maximal file size, 
-		//  we parse the file from index 0 to m_filenr-1 
-		//  until we find one -that doesn't exist 
-		//                    or
-		//                    -with a size smaller than m_filesize
-		//  If we don't, we have to rename the files
-		//
-		//Else If there is only one file its index is 0
-		if (m_filesize > 0)
-		{
-			//There must be at least 2 files
-			if (m_filenr < 2)
-				m_filenr = 2;
-
-			std::wstring file;
-#ifdef WIN32
-			struct _stat results;
-#else
-			struct stat results;
-#endif
-			bool find = false;
-
-			for (int i = 0; i < m_filenr; i++)
-			{
-
-				swprintf_s(index, 5, L"%d", i);
-
-				file = root_filename + index + L".log";
-#ifdef WIN32
-				if (_wstat(file.c_str(), &results) != 0
-				    || results.st_size < m_filesize)
-#else
-				if (stat
-				    (utilStringNarrow(file).c_str(),
-				     &results) != 0
-				    || results.st_size < m_filesize)
-#endif
-				{
-					find = true;
-					break;
-				}
-			}
-			if (!find)
-			{
-				renameFiles(root_filename.c_str());
-				swprintf_s(index, 5, L"%d", m_filenr - 1);
-			}
-		}
-
-		filename = root_filename + index + L".log";
+		//There must be at least 2 files
+		if (m_filenr < 2)
+			m_filenr = 2;
 
-	}
-
-//PRIVATE: Delete file with index 0 et rename all file i to i-1 until m_filenr-1
-//After this function, the file with index m_filenr-1 is free (it doesn't exist)
-	void CLog::renameFiles(const wchar_t * root_filename)
-	{
-		//We remove the file 0
-		std::wstring src;
-		src = root_filename;
-		src += L"0.log";
-
-#ifdef WIN32
-		_wremove(src.c_str());
-#else
-		remove(utilStringNarrow(src).c_str());
-#endif
-
-		std::wstring dest;
-		wchar_t isrc[5];
-		wchar_t idest[5];
-
-#ifdef WIN32
-		struct _stat results;
-#else
-		struct stat results;
-#endif
-
-		//For all file until m_filenr-1
-		// 1 become 0
-		// 2 become 1
-		//i+1 become i
-		//m_filenr-1 become m_filenr-2
-		for (int i = 0; i < m_filenr; i++)
-		{
-			swprintf_s(isrc, 5, L"%d", i + 1);
-			swprintf_s(idest, 5, L"%d", i);
-
-			//if the source does not exist, we stop
-			src = root_filename;
-			src += isrc;
-			src += L".log";
-
-#ifdef WIN32
-			if (_wstat(src.c_str(), &results) != 0)
-				break;
-#else
-			if (stat(utilStringNarrow(src).c_str(), &results) !=
-			    0)
-				break;
-#endif
-			dest = root_filename;
-			dest += idest;
-			dest += L".log";
-
-			//Rename of the file
-#ifdef WIN32
-			_wrename(src.c_str(), dest.c_str());
-#else
-			rename(utilStringNarrow(src).c_str(),
-			       utilStringNarrow(dest).c_str());
-#endif
-		}
-	}
-
-//PRIVATE: Open the file with the correct name
-	bool CLog::open(bool bWchar)
-	{
-		if (!canWeTryToOpen())
-		{
-			incrementOpenFailed();
-			return false;
-		}
-#ifdef WIN32
-		WaitForSingleObject(LogMutex, INFINITE);
-#else
-		m_mutex.Lock();
-#endif
-
-		if (m_f)	//Should not happend
-		{
-			close();
-			throw CMWEXCEPTION(EIDMW_ERR_UNKNOWN);
-		}
-#ifndef WIN32
-		m_flock = (struct flock *) malloc(sizeof(struct flock));
-		m_flock->l_type = F_WRLCK;	/* F_RDLCK, F_WRLCK, F_UNLCK    */
-		m_flock->l_whence = SEEK_SET;	/* SEEK_SET, SEEK_CUR, SEEK_END */
-		m_flock->l_start = 0;	/* Offset from l_whence         */
-		m_flock->l_len = 0;	/* length, 0 = to EOF           */
-		m_flock->l_pid = getpid();	/* our PID                      */
-#endif
-
-		int err = 0;
-
-		std::wstring filename;
-
-		int iLoop = 0;
-
-		do		//If the file is locked by another process, we wait
-		{
-			getFilename(filename);	//We get the file name in the loop because other process may rename the files
-
-#ifdef WIN32
-			if (bWchar)
-				err = _wfopen_s(&m_f, filename.c_str(),
-						L"a, ccs=UTF-8");
-			else
-				err = fopen_s(&m_f,
-					      utilStringNarrow(filename).
-					      c_str(), "a");
-#else
-			m_f = fopen(utilStringNarrow(filename).c_str(),
-				    "a, ccs=UTF-8");
-			if (m_f == NULL)
-				err = errno;
-#endif
-
-			if (err != 0 && err != EACCES)
-				m_f = NULL;
-
-			if (err == EACCES)
-				CThread::SleepMillisecs(20);
-
-			iLoop++;
-
-		} while (err == EACCES && iLoop < 100);
-
-#ifndef WIN32
-		// on Linux/Mac we set an advisory lock, i.e. it prevents
-		// other processes from using the file only if they are collaborative 
-		// and check for the lock, otherwise they can do whatever they like ..
-		if (m_f != NULL)
-		{
-			if (fcntl(fileno(m_f), F_SETLK, m_flock) == -1)	/* set the lock */
-			{
-				fclose(m_f);
-				m_f = NULL;
-			}
-		}
-#endif
-
-		if (!m_f)
-		{
-#ifdef WIN32
-			ReleaseMutex(LogMutex);
-#else
-			m_mutex.Unlock();
-#endif
-			incrementOpenFailed();
-			return false;
-		}
-
-		resetOpenFailed();
-		return true;
-	}
-
-//PRIVATE: Close the file
-	inline void CLog::close()
-	{
-		if (!m_f)
-			throw CMWEXCEPTION(EIDMW_ERR_UNKNOWN);
-
-#ifndef WIN32
-		m_flock->l_type = F_UNLCK;	/* tell it to unlock the region */
-
-		if (fcntl(fileno(m_f), F_SETLK, m_flock) == -1)	/* set the region to unlocked */
-			throw CMWEXCEPTION(EIDMW_ERR_UNKNOWN);
-
-		free(m_flock);
-#endif
-
-		fclose(m_f);
-
-		m_f = NULL;
-
-#ifdef WIN32
-		ReleaseMutex(LogMutex);
-#else
-		m_mutex.Unlock();
-#endif
+		m_sink = logq_sink_w(root_filename.c_str(), m_filesize,
+				     m_filenr);
+		return m_sink;
 	}
 
 //PRIVATE: Convert the enum into message
@@ -858,9 +593,100 @@ namespace eIDMW
 
 
 
+//Append a wide string to a line, encoded as UTF-8
+	static void appendUtf8(std::string & line, const wchar_t * in)
+	{
+		unsigned long c;
+
+		for (; *in != 0; in++)
+		{
+			c = (unsigned long) *in;
+			//UTF-16 surrogate pair (Windows)
+			if (c >= 0xD800 && c < 0xDC00
+			    && (unsigned long) in[1] >= 0xDC00
+			    && (unsigned long) in[1] < 0xE000)
+			{
+				c = 0x10000 + ((c - 0xD800) << 10) +
+					((unsigned long) in[1] - 0xDC00);
+				in++;
+			}
+
+			if (c < 0x80)
+			{
+				line += (char) c;
+			} else if (c < 0x800)
+			{
+				line += (char) (0xC0 | (c >> 6));
+				line += (char) (0x80 | (c & 0x3F));
+			} else if (c < 0x10000)
+			{
+				line += (char) (0xE0 | (c >> 12));
+				line += (char) (0x80 | ((c >> 6) & 0x3F));
+				line += (char) (0x80 | (c & 0x3F));
+			} else
+			{
+				line += (char) (0xF0 | ((c >> 18) & 0x07));
+				line += (char) (0x80 | ((c >> 12) & 0x3F));
+				line += (char) (0x80 | ((c >> 6) & 0x3F));
+				line += (char) (0x80 | (c & 0x3F));
+			}
+		}
+	}
+
+//Append formatted text to a line, long messages are truncated
+	static void appendFormatV(std::string & line, const wchar_t * format,
+				  va_list args)
+	{
+		wchar_t buffer[0x1000];
+		const size_t count = sizeof(buffer) / sizeof(buffer[0]);
+
+		buffer[0] = 0;
+#ifdef WIN32
+		_vsnwprintf_s(buffer, count, _TRUNCATE, format, args);
+#else
+		vswprintf(buffer, count, format, args);
+#endif
+		buffer[count - 1] = 0;
+		appendUtf8(line, buffer);
+	}
+
+	static void appendFormatV(std::string & line, const char *format,
+				  va_list args)
+	{
+		char buffer[0x4000];
+
+		buffer[0] = 0;
+#ifdef WIN32
+		_vsnprintf_s(buffer, sizeof(buffer), _TRUNCATE, format, args);
+#else
+		vsnprintf(buffer, sizeof(buffer), format, args);
+#endif
+		buffer[sizeof(buffer) - 1] = 0;
+		line += buffer;
+	}
+
+	static void appendFormat(std::string & line, const wchar_t * format,
+				 ...)
+	{
+		va_list args;
+
+		va_start(args, format);
+		appendFormatV(line, format, args);
+		va_end(args);
+	}
+
+	static void appendFormat(std::string & line, const char *format, ...)
+	{
+		va_list args;
+
+		va_start(args, format);
+		appendFormatV(line, format, args);
+		va_end(args);
+	}
+
 //ATTENTION : Design for use with macro
-//            Must be follow by writeLineMessage to close the file
-//Write to log the first part of the line
+//            Must be follow by writeLineMessage to write the line
+//Start a line with its header
 	bool CLog::writeLineHeaderW(tLOG_Level level, const int line,
 				    const wchar_t * file)
 	{
@@ -868,66 +694,51 @@ namespace eIDMW
 		if (level > m_maxlevel)
 			return false;
 
-		long lPreviousOpenFailed = getOpenFailed();
+		m_mutex.Lock();
 
-		if (!open(true))
+		if (getSink() < 0)
+		{
+			m_mutex.Unlock();
 			return false;
+		}
 
 		std::wstring timestamp;
 		getLocalTimeW(timestamp);
 
-		if (lPreviousOpenFailed > 0)
-		{
-			if (isFileMixingGroups())
-			{
-				fwprintf_s(m_f,
-					   L"%ls - %ld - %ls: ...ERROR: This file could not be opened. %ld logging line(s) are missing...\n",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   m_group.c_str(),
-					   lPreviousOpenFailed);
-			} else
-			{
-				fwprintf_s(m_f,
-					   L"%ls - %ld: ...ERROR: This file could not be opened. %ld logging line(s) are missing...\n",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   lPreviousOpenFailed);
-			}
-		}
+		m_line.clear();
 
 		if (isFileMixingGroups())
 		{
 			if (line > 0 && wcslen(file) > 0)
-				fwprintf_s(m_f,
-					   L"%ls - %ld|%ld - %ls - %ls -'%ls'-line=%d: ",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   CThread::getCurrentThreadId(),
-					   m_group.c_str(), getLevel(level),
-					   file, line);
+				appendFormat(m_line,
+					     L"%ls - %ld|%ld - %ls - %ls -'%ls'-line=%d: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     m_group.c_str(), getLevel(level),
+					     file, line);
 			else
-				fwprintf_s(m_f,
-					   L"%ls - %ld|%ld - %ls - %ls: ",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   CThread::getCurrentThreadId(),
-					   m_group.c_str(), getLevel(level));
+				appendFormat(m_line,
+					     L"%ls - %ld|%ld - %ls - %ls: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     m_group.c_str(), getLevel(level));
 		} else
 		{
 			if (line > 0 && wcslen(file) > 0)
-				fwprintf_s(m_f,
-					   L"%ls - %ld|%ld - %ls -'%ls'-line=%d: ",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   CThread::getCurrentThreadId(),
-					   getLevel(level), file, line);
+				appendFormat(m_line,
+					     L"%ls - %ld|%ld - %ls -'%ls'-line=%d: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     getLevel(level), file, line);
 			else
-				fwprintf_s(m_f, L"%ls - %ld|%ld - %ls: ",
-					   timestamp.c_str(),
-					   CThread::getCurrentPid(),
-					   CThread::getCurrentThreadId(),
-					   getLevel(level));
+				appendFormat(m_line, L"%ls - %ld|%ld - %ls: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     getLevel(level));
 		}
 
 		return true;
@@ -941,82 +752,64 @@ namespace eIDMW
 		if (level_in > m_maxlevel)
 			return false;
 
-		long lPreviousOpenFailed = getOpenFailed();
+		m_mutex.Lock();
 
-		if (!open(false))
+		if (getSink() < 0)
+		{
+			m_mutex.Unlock();
 			return false;
+		}
 
 		std::string timestamp;
 		getLocalTimeA(timestamp);
 
-		if (lPreviousOpenFailed > 0)
-		{
-			if (isFileMixingGroups())
-			{
-				fprintf_s(m_f,
-					  "%s - %ld - %ls: ...ERROR: This file could not be opened. %ld logging line(s) are missing...\n",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  m_group.c_str(),
-					  lPreviousOpenFailed);
-			} else
-			{
-				fprintf_s(m_f,
-					  "%s - %ld: ...ERROR: This file could not be opened. %ld logging line(s) are missing...\n",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  lPreviousOpenFailed);
-			}
-		}
-
 		std::string level = utilStringNarrow(getLevel(level_in));
 
+		m_line.clear();
+
 		if (isFileMixingGroups())
 		{
 			std::string group = utilStringNarrow(m_group);
 
 			if (line > 0 && strlen(file) > 0)
-				fprintf_s(m_f,
-					  "%s - %ld|%ld - %s - %s -'%s'-line=%d: ",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  CThread::getCurrentThreadId(),
-					  group.c_str(), level.c_str(), file,
-					  line);
+				appendFormat(m_line,
+					     "%s - %ld|%ld - %s - %s -'%s'-line=%d: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     group.c_str(), level.c_str(), file,
+					     line);
 			else
-				fprintf_s(m_f, "%s - %ld|%ld - %s - %s: ",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  CThread::getCurrentThreadId(),
-					  group.c_str(), level.c_str());
+				appendFormat(m_line, "%s - %ld|%ld - %s - %s: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     group.c_str(), level.c_str());
 		} else
 		{
 			if (line > 0 && strlen(file) > 0)
-				fprintf_s(m_f,
-					  "%s - %ld|%ld - %s -'%s'-line=%d: ",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  CThread::getCurrentThreadId(),
-					  level.c_str(), file, line);
+				appendFormat(m_line,
+					     "%s - %ld|%ld - %s -'%s'-line=%d: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     level.c_str(), file, line);
 			else
-				fprintf_s(m_f, "%s - %ld|%ld - %s: ",
-					  timestamp.c_str(),
-					  CThread::getCurrentPid(),
-					  CThread::getCurrentThreadId(),
-					  level.c_str());
+				appendFormat(m_line, "%s - %ld|%ld - %s: ",
+					     timestamp.c_str(),
+					     CThread::getCurrentPid(),
+					     CThread::getCurrentThreadId(),
+					     level.c_str());
 		}
 
 		return true;
 
 	}
 //ATTENTION : Design for use with macro
-//            Must be preceded by writeLineHeader to close the file
+//            Must be preceded by writeLineHeader
 //Write to log the second part of the line
 	bool CLog::writeLineMessageW(const wchar_t * format, ...)
 	{
-		if (!m_f)	//Should not happend, as this method must only be called if the writeLineHeader succeed
-			throw CMWEXCEPTION(EIDMW_FILE_NOT_OPENED);
-
 		va_list args;
 
 		va_start(args, format);
@@ -1028,9 +821,6 @@ namespace eIDMW
 
 	bool CLog::writeLineMessageA(const char *format, ...)
 	{
-		if (!m_f)	//Should not happend, as this method must only be called if the writeLineHeader succeed
-			throw CMWEXCEPTION(EIDMW_FILE_NOT_OPENED);
-
 		va_list args;
 
 		va_start(args, format);
@@ -1041,28 +831,22 @@ namespace eIDMW
 	}
 
 //PRIVATE
-//Write to log the second part of the line
+//Write to log the second part of the line, and queue the line for writing
 
 	void CLog::writeLineMessageW(const wchar_t * format, va_list argList)
 	{
-
-		if (!m_f)	//Should not happend, as this method must only be called if the writeLineHeader succeed
-			throw CMWEXCEPTION(EIDMW_FILE_NOT_OPENED);
-
-		vfwprintf_s(m_f, format, argList);
-		fwprintf_s(m_f, L"%c", '\n');
-		close();
+		appendFormatV(m_line, format, argList);
+		m_line += '\n';
+		logq_write(m_sink, m_line.data(), m_line.size());
+		m_mutex.Unlock();
 	}
 
 	void CLog::writeLineMessageA(const char *format, va_list argList)
 	{
-
-		if (!m_f)	//Should not happend, as this method must only be called if the writeLineHeader succeed
-			throw CMWEXCEPTION(EIDMW_FILE_NOT_OPENED);
-
-		vfprintf_s(m_f, format, argList);
-		fprintf_s(m_f, "%c", '\n');
-		close();
+		appendFormatV(m_line, format, argList);
+		m_line += '\n';
+		logq_write(m_sink, m_line.data(), m_line.size());
+		m_mutex.Unlock();
 	}
 
 //Write Critical level to log
@@ -1335,40 +1119,4 @@ namespace eIDMW
 		return (!m_groupinnewfile || m_group.size() == 0);
 	}
 
-	long CLog::getOpenFailed()
-	{
-		if (isFileMixingGroups())
-			return m_sopenfailed;
-		else
-			return m_openfailed;
-	}
-
-	bool CLog::canWeTryToOpen()
-	{
-		//To avoid delay if open failed 5 times consecutively,
-		//we retry only once every 100 times
-		if (isFileMixingGroups())
-			return (m_sopenfailed <= 5
-				|| (m_sopenfailed % 100) == 0);
-		else
-			return (m_openfailed <= 5
-				|| (m_openfailed % 100) == 0);
-	}
-
-	void CLog::incrementOpenFailed()
-	{
-		if (isFileMixingGroups())
-			m_sopenfailed++;
-		else
-			m_openfailed++;
-	}
-
-	void CLog::resetOpenFailed()
-	{
-		if (isFileMixingGroups())
-			m_sopenfailed = 0;
-		else
-			m_openfailed = 0;
-	}
-
 }
@@ -40,7 +40,8 @@ CLOG
 ----
 Each CLog represents a set of log file. (One set by group) 
 The constructor is not enabled but objects are created by the logger when you ask for a new group.
-The files are closed after each write.
+Lines are formatted here and handed to the asynchronous writer in logqueue.h,
+which keeps the file open and appends them in the background.
 
 PARAMETERS
 ----------
@@ -86,11 +87,6 @@ Example of usage through objects and macro are give at the end of this file
 #define __WFILE__ WIDEN(__FILE__)
 #endif
 
-#ifndef WIN32
-#include <sys/file.h>
-#include <fcntl.h>
-#endif
-
 #include <stdarg.h>
 
 namespace eIDMW
@@ -131,6 +127,9 @@ public:
 					const char *prefix, long filesize,
 					long filenr, tLOG_Level minlevel,
 					bool groupinnewfile);
+		/** The highest level that is written, without taking a lock or
+		    creating the logger; LOG_LEVEL_DEBUG until the logger is set up */
+		static long MaxLevel() { return m_lMaxLevel; };
 		CLog & getLogW(const wchar_t * group = L"");
 		CLog & getLogA(const char *group = "");
 		void writeToGroup(const wchar_t * group,
@@ -163,6 +162,7 @@ public:
 private:
 		static std::auto_ptr < CLogger > m_instance;
 		static bool m_bApplicationLeaving;
+		static volatile long m_lMaxLevel;	// m_maxlevel, for MaxLevel()
 
 		     std::wstring m_directory;
 		     std::wstring m_prefix;
@@ -265,10 +265,7 @@ public:
 		friend class CLogger;
 
 private:
-		void getFilename(std::wstring & filename);
-		void renameFiles(const wchar_t * root_filename);
-		bool open(bool bWchar);
-		void close();
+		int getSink();
 		void writeLineMessageW(const wchar_t * format,
 				       va_list argList);
 		void writeLineMessageA(const char *format, va_list argList);
@@ -280,10 +277,6 @@ private:
 				   const char *format = "%Y-%m-%d %H:%M:%S");
 
 		bool isFileMixingGroups();
-		long getOpenFailed();
-		bool canWeTryToOpen();
-		void incrementOpenFailed();
-		void resetOpenFailed();
 
 		     std::wstring m_directory;
 		     std::wstring m_prefix;
@@ -292,14 +285,10 @@ private:
 		long m_filenr;
 		tLOG_Level m_maxlevel;
 		bool m_groupinnewfile;
-		long m_openfailed;
-		static long m_sopenfailed;
+		int m_sink;
 
-		FILE *m_f;
-
-#ifndef WIN32
-		struct flock *m_flock;
-#endif
+		//The line being built, between writeLineHeader and writeLineMessage
+		     std::string m_line;
 	};
 
 //SHORTCUT MACRO
@@ -0,0 +1,730 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "logqueue.h"
+#include "thread.h"
+#include "mutex.h"
+#include "util.h"
+
+#include <string>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sys/time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define swprintf_s swprintf
+#endif
+
+//The writer wakes up on the first line queued after it went idle,
+//and at least this often otherwise
+#define LOGQ_IDLE_MS		500
+
+//A file that could not be opened is retried for the first few lines,
+//then only once every LOGQ_RETRY_EVERY lines
+#define LOGQ_RETRY_FIRST	5
+#define LOGQ_RETRY_EVERY	100
+
+//Other processes write the same files: a batch waits this long for
+//them to release the lock before its lines are counted as lost
+#define LOGQ_LOCK_WAIT_MS	2000
+#define LOGQ_LOCK_POLL_MS	20
+
+//How long logq_stop() waits for the writer to write its last batch
+#define LOGQ_STOP_WAIT_MS	2000
+#define LOGQ_STOP_POLL_MS	5
+
+namespace eIDMW
+{
+
+	typedef struct LOGQ_RECORD
+	{
+		struct LOGQ_RECORD *pNext;
+		int sink;
+		size_t len;
+		char data[1];
+	} LOGQ_RECORD;
+
+	typedef struct LOGQ_SINK
+	{
+		std::wstring name;
+		long maxsize;
+		long filenr;
+		FILE *f;	// only open, and locked, during a batch
+		long lost;	// lines dropped because the file could not be opened
+#ifndef WIN32
+		int lockfd;	// 'name'.lock, locked while the files are in use
+#endif
+	} LOGQ_SINK;
+
+	class CLogWriter:public CThread
+	{
+public:
+		void Run();
+	};
+
+	//The sinks and the writer are allocated once and never freed, lines
+	//may still be logged while static objects are destroyed
+	static LOGQ_SINK *gSinks[LOGQ_MAX_SINKS];
+	static volatile long gSinkCount = 0;
+	static CLogWriter *gWriter = NULL;
+	static volatile int gRunning = 0;
+
+	//Lines are pushed on a lock-free LIFO list; the writer takes the
+	//whole list at once and reverses it
+	static LOGQ_RECORD *volatile gHead = NULL;
+	static volatile long gPending = 0;
+
+	static CMutex gFileMutex;	// sinks, files and the draining of gHead
+	static CMutex gStateMutex;	// starting and stopping the writer
+
+#ifdef WIN32
+	static HANDLE gWakeEvent = NULL;
+	//The same systemwide mutex CLog always used for its files
+	static HANDLE gLogMutex = NULL;
+
+	static bool casptr(LOGQ_RECORD * volatile *pp, LOGQ_RECORD * o,
+			   LOGQ_RECORD * n)
+	{
+		return InterlockedCompareExchangePointer((PVOID volatile *) pp,
+							 n, o) == o;
+	}
+
+	static LOGQ_RECORD *xchgptr(LOGQ_RECORD * volatile *pp,
+				    LOGQ_RECORD * n)
+	{
+		return (LOGQ_RECORD *)
+			InterlockedExchangePointer((PVOID volatile *) pp, n);
+	}
+
+#define atomic_inc(p)		InterlockedIncrement(p)
+#define atomic_dec(p)		InterlockedDecrement(p)
+#else
+	static pthread_mutex_t gWakeLock = PTHREAD_MUTEX_INITIALIZER;
+	static pthread_cond_t gWakeCond = PTHREAD_COND_INITIALIZER;
+	static int gWakeSignaled = 0;
+	static int gForkHandler = 0;
+
+	static bool casptr(LOGQ_RECORD * volatile *pp, LOGQ_RECORD * o,
+			   LOGQ_RECORD * n)
+	{
+		return __sync_bool_compare_and_swap(pp, o, n);
+	}
+
+	static LOGQ_RECORD *xchgptr(LOGQ_RECORD * volatile *pp,
+				    LOGQ_RECORD * n)
+	{
+		__sync_synchronize();
+		return __sync_lock_test_and_set(pp, n);
+	}
+
+#define atomic_inc(p)		__sync_add_and_fetch(p, 1)
+#define atomic_dec(p)		__sync_sub_and_fetch(p, 1)
+#endif
+
+	static void logq_wake()
+	{
+#ifdef WIN32
+		SetEvent(gWakeEvent);
+#else
+		pthread_mutex_lock(&gWakeLock);
+		gWakeSignaled = 1;
+		pthread_cond_signal(&gWakeCond);
+		pthread_mutex_unlock(&gWakeLock);
+#endif
+	}
+
+	static void logq_sleep()
+	{
+#ifdef WIN32
+		WaitForSingleObject(gWakeEvent, LOGQ_IDLE_MS);
+#else
+		struct timeval now;
+		struct timespec until;
+
+		gettimeofday(&now, NULL);
+		until.tv_sec = now.tv_sec + LOGQ_IDLE_MS / 1000;
+		until.tv_nsec =
+			(now.tv_usec + (LOGQ_IDLE_MS % 1000) * 1000) * 1000;
+		if (until.tv_nsec >= 1000000000)
+		{
+			until.tv_sec++;
+			until.tv_nsec -= 1000000000;
+		}
+
+		pthread_mutex_lock(&gWakeLock);
+		if (!gWakeSignaled)
+			pthread_cond_timedwait(&gWakeCond, &gWakeLock, &until);
+		gWakeSignaled = 0;
+		pthread_mutex_unlock(&gWakeLock);
+#endif
+	}
+
+	static bool fileSize(const std::wstring & name, long *size)
+	{
+#ifdef WIN32
+		struct _stat results;
+
+		if (_wstat(name.c_str(), &results) != 0)
+			return false;
+#else
+		struct stat results;
+
+		if (stat(utilStringNarrow(name).c_str(), &results) != 0)
+			return false;
+#endif
+		*size = (long) results.st_size;
+		return true;
+	}
+
+	static void fileRemove(const std::wstring & name)
+	{
+#ifdef WIN32
+		_wremove(name.c_str());
+#else
+		remove(utilStringNarrow(name).c_str());
+#endif
+	}
+
+	static void fileRename(const std::wstring & src,
+			       const std::wstring & dest)
+	{
+#ifdef WIN32
+		_wrename(src.c_str(), dest.c_str());
+#else
+		rename(utilStringNarrow(src).c_str(),
+		       utilStringNarrow(dest).c_str());
+#endif
+	}
+
+	static FILE *fileOpen(const std::wstring & name, const wchar_t * mode)
+	{
+		FILE *f = NULL;
+
+#ifdef WIN32
+		if (_wfopen_s(&f, name.c_str(), mode) != 0)
+			f = NULL;
+#else
+		f = fopen(utilStringNarrow(name).c_str(),
+			  utilStringNarrow(mode).c_str());
+#endif
+		return f;
+	}
+
+	static std::wstring indexName(const std::wstring & root, long i)
+	{
+		wchar_t index[12];
+
+		swprintf_s(index, 12, L"%ld", i);
+		return root + index + L".log";
+	}
+
+	//Return the name of the file to append to, rotating the files
+	//when the current one is full
+	static std::wstring sinkFilename(LOGQ_SINK * s)
+	{
+		long size;
+		long i;
+
+		if (s->filenr <= 1)
+		{
+			if (s->maxsize > 0 && fileSize(s->name, &size)
+			    && size >= s->maxsize)
+			{
+				fileRemove(s->name + L".1");
+				fileRename(s->name, s->name + L".1");
+			}
+			return s->name;
+		}
+
+		if (s->maxsize <= 0)
+			return indexName(s->name, 0);
+
+		//The first file that doesn't exist or isn't full yet
+		for (i = 0; i < s->filenr; i++)
+		{
+			std::wstring file = indexName(s->name, i);
+
+			if (!fileSize(file, &size) || size < s->maxsize)
+				return file;
+		}
+
+		//All full: remove file 0, rename file i to i-1
+		fileRemove(indexName(s->name, 0));
+		for (i = 1; i < s->filenr; i++)
+		{
+			std::wstring src = indexName(s->name, i);
+
+			if (!fileSize(src, &size))
+				break;
+			fileRename(src, indexName(s->name, i - 1));
+		}
+		return indexName(s->name, s->filenr - 1);
+	}
+
+	//Take the lock that keeps other processes from writing or rotating
+	//the files of this sink at the same time
+	static bool sinkLock(LOGQ_SINK * s)
+	{
+		int i;
+
+#ifdef WIN32
+		DWORD dwRet;
+
+		if (gLogMutex == NULL)
+			gLogMutex = CreateMutex(0, FALSE, L"LogMutex");
+		if (gLogMutex == NULL)
+			return true;
+		for (i = 0; i < LOGQ_LOCK_WAIT_MS / LOGQ_LOCK_POLL_MS; i++)
+		{
+			dwRet = WaitForSingleObject(gLogMutex, LOGQ_LOCK_POLL_MS);
+			//An abandoned mutex is ours now as well
+			if (dwRet == WAIT_OBJECT_0 || dwRet == WAIT_ABANDONED)
+				return true;
+			if (dwRet != WAIT_TIMEOUT)
+				return false;
+		}
+		return false;
+#else
+		struct flock fl;
+
+		if (s->lockfd < 0)
+			s->lockfd = open(utilStringNarrow(s->name + L".lock").c_str(),
+					 O_RDWR | O_CREAT, 0666);
+		//Without a lock file (another user's, read-only), write
+		//unlocked the way everyone did before
+		if (s->lockfd < 0)
+			return true;
+
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_WRLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = 0;
+		fl.l_len = 0;
+		for (i = 0; fcntl(s->lockfd, F_SETLK, &fl) == -1; i++)
+		{
+			if ((errno != EACCES && errno != EAGAIN)
+			    || i >= LOGQ_LOCK_WAIT_MS / LOGQ_LOCK_POLL_MS)
+				return false;
+			CThread::SleepMillisecs(LOGQ_LOCK_POLL_MS);
+		}
+		return true;
+#endif
+	}
+
+	static void sinkUnlock(LOGQ_SINK * s)
+	{
+#ifdef WIN32
+		if (gLogMutex != NULL)
+			ReleaseMutex(gLogMutex);
+#else
+		struct flock fl;
+
+		if (s->lockfd < 0)
+			return;
+
+		memset(&fl, 0, sizeof(fl));
+		fl.l_type = F_UNLCK;
+		fl.l_whence = SEEK_SET;
+		fl.l_start = 0;
+		fl.l_len = 0;
+		fcntl(s->lockfd, F_SETLK, &fl);
+#endif
+	}
+
+	//Lock the sink and open the file to append to; the rotation is done
+	//under the lock, so two processes never rotate the same files
+	static bool sinkOpen(LOGQ_SINK * s)
+	{
+		char note[128];
+		int n;
+
+		if (s->f != NULL)
+			return true;
+
+		if (s->lost > LOGQ_RETRY_FIRST && (s->lost % LOGQ_RETRY_EVERY) != 0)
+			return false;
+
+		if (!sinkLock(s))
+			return false;
+
+		s->f = fileOpen(sinkFilename(s), L"a");
+		if (s->f == NULL)
+		{
+			sinkUnlock(s);
+			return false;
+		}
+
+		if (s->lost > 0)
+		{
+			n = snprintf(note, sizeof(note),
+				     "...ERROR: This file could not be opened. %ld logging line(s) are missing...\n",
+				     s->lost);
+			if (n > 0 && n < (int) sizeof(note))
+				fwrite(note, 1, n, s->f);
+			s->lost = 0;
+		}
+		return true;
+	}
+
+	//Caller holds gFileMutex
+	static void sinkPut(int sink, const char *data, size_t len)
+	{
+		LOGQ_SINK *s = gSinks[sink];
+
+		if (!sinkOpen(s))
+		{
+			s->lost++;
+			return;
+		}
+		fwrite(data, 1, len, s->f);
+	}
+
+	//Caller holds gFileMutex: close the files written to in this batch
+	//and let the other processes have them
+	static void logq_sync()
+	{
+		long i;
+
+		for (i = 0; i < gSinkCount; i++)
+		{
+			LOGQ_SINK *s = gSinks[i];
+
+			if (s->f == NULL)
+				continue;
+			fclose(s->f);
+			s->f = NULL;
+			sinkUnlock(s);
+		}
+	}
+
+	//Caller holds gFileMutex: write everything queued, oldest first
+	static void logq_drain()
+	{
+		LOGQ_RECORD *pList = xchgptr(&gHead, NULL);
+		LOGQ_RECORD *pFifo = NULL;
+		LOGQ_RECORD *pNext;
+
+		while (pList != NULL)
+		{
+			pNext = pList->pNext;
+			pList->pNext = pFifo;
+			pFifo = pList;
+			pList = pNext;
+		}
+
+		while (pFifo != NULL)
+		{
+			pNext = pFifo->pNext;
+			sinkPut(pFifo->sink, pFifo->data, pFifo->len);
+			free(pFifo);
+			atomic_dec(&gPending);
+			pFifo = pNext;
+		}
+	}
+
+	void CLogWriter::Run()
+	{
+#ifndef WIN32
+		//Nobody joins this thread
+		pthread_detach(pthread_self());
+#endif
+		while (!m_bStopRequest)
+		{
+			logq_sleep();
+
+			CAutoMutex lock(&gFileMutex);
+
+			logq_drain();
+			logq_sync();
+		}
+	}
+
+	static int logq_add_sink(const std::wstring & name, long maxsize,
+				 long filenr)
+	{
+		CAutoMutex lock(&gFileMutex);
+		LOGQ_SINK *s;
+		long i;
+
+		for (i = 0; i < gSinkCount; i++)
+		{
+			if (gSinks[i]->name == name)
+			{
+				gSinks[i]->maxsize = maxsize;
+				gSinks[i]->filenr = filenr;
+				return (int) i;
+			}
+		}
+		if (gSinkCount >= LOGQ_MAX_SINKS)
+			return -1;
+
+		s = new LOGQ_SINK;
+		s->name = name;
+		s->maxsize = maxsize;
+		s->filenr = filenr;
+		s->f = NULL;
+		s->lost = 0;
+#ifndef WIN32
+		s->lockfd = -1;
+#endif
+		gSinks[gSinkCount] = s;
+		gSinkCount++;
+
+		return (int) i;
+	}
+
+}
+
+using namespace eIDMW;
+
+extern "C" int logq_sink_w(const wchar_t * name, long maxsize, long filenr)
+{
+	try
+	{
+		return logq_add_sink(name, maxsize, filenr);
+	}
+	catch(...)
+	{
+		return -1;
+	}
+}
+
+extern "C" int logq_sink(const char *name, long maxsize, long filenr)
+{
+#ifdef WIN32
+	wchar_t wname[MAX_PATH];
+
+	if (MultiByteToWideChar(CP_ACP, 0, name, -1, wname, MAX_PATH) == 0)
+		return -1;
+	return logq_sink_w(wname, maxsize, filenr);
+#else
+	try
+	{
+		return logq_add_sink(utilStringWiden(name), maxsize, filenr);
+	}
+	catch(...)
+	{
+		return -1;
+	}
+#endif
+}
+
+extern "C" void logq_truncate(int sink)
+{
+	LOGQ_SINK *s;
+	FILE *f;
+
+	if (sink < 0 || sink >= gSinkCount)
+		return;
+
+	CAutoMutex lock(&gFileMutex);
+
+	logq_drain();
+	logq_sync();
+
+	s = gSinks[sink];
+	if (!sinkLock(s))
+		return;
+	f = fileOpen(s->filenr <= 1 ? s->name : indexName(s->name, 0), L"w");
+	if (f != NULL)
+		fclose(f);
+	sinkUnlock(s);
+}
+
+extern "C" void logq_write(int sink, const char *line, size_t len)
+{
+	LOGQ_RECORD *pRec = NULL;
+	LOGQ_RECORD *pHead;
+
+	if (sink < 0 || sink >= gSinkCount || len == 0)
+		return;
+
+	if (gRunning)
+	{
+		if (atomic_inc(&gPending) <= LOGQ_MAX_PENDING)
+			pRec = (LOGQ_RECORD *)
+				malloc(offsetof(LOGQ_RECORD, data) + len);
+		if (pRec != NULL)
+		{
+			pRec->sink = sink;
+			pRec->len = len;
+			memcpy(pRec->data, line, len);
+			do
+			{
+				pHead = gHead;
+				pRec->pNext = pHead;
+			} while (!casptr(&gHead, pHead, pRec));
+
+			//Only the first line after the writer emptied the list
+			//needs to wake it up
+			if (pHead == NULL)
+				logq_wake();
+			return;
+		}
+		atomic_dec(&gPending);
+	}
+
+	//No writer, or it can't keep up: write the backlog and our own
+	//line here
+	CAutoMutex lock(&gFileMutex);
+
+	logq_drain();
+	sinkPut(sink, line, len);
+	logq_sync();
+}
+
+extern "C" void logq_flush(void)
+{
+	CAutoMutex lock(&gFileMutex);
+
+	logq_drain();
+	logq_sync();
+}
+
+#ifndef WIN32
+//A fork() copies the queue and the locks, but not the writer thread: hold
+//the locks over the fork so nothing is half done, and let the child write
+//its own lines until it starts a writer of its own
+static void logq_fork_prepare(void)
+{
+	gStateMutex.Lock();
+	gFileMutex.Lock();
+	pthread_mutex_lock(&gWakeLock);
+}
+
+static void logq_fork_parent(void)
+{
+	pthread_mutex_unlock(&gWakeLock);
+	gFileMutex.Unlock();
+	gStateMutex.Unlock();
+}
+
+static void logq_fork_child(void)
+{
+	LOGQ_RECORD *pList;
+	LOGQ_RECORD *pNext;
+
+	//The locks are owned by the parent's thread id; the child can't
+	//unlock them, it needs new ones
+	pthread_mutex_init(&gWakeLock, NULL);
+	pthread_cond_init(&gWakeCond, NULL);
+	gWakeSignaled = 0;
+	new(&gFileMutex) CMutex();
+	new(&gStateMutex) CMutex();
+
+	//The parent's writer still writes these
+	pList = xchgptr(&gHead, NULL);
+	while (pList != NULL)
+	{
+		pNext = pList->pNext;
+		free(pList);
+		pList = pNext;
+	}
+	gPending = 0;
+
+	//The writer object belongs to a thread that doesn't exist here
+	gRunning = 0;
+	gWriter = NULL;
+}
+#endif
+
+extern "C" void logq_start(void)
+{
+	CAutoMutex state(&gStateMutex);
+
+	if (gRunning)
+		return;
+
+	try
+	{
+#ifdef WIN32
+		if (gWakeEvent == NULL)
+			gWakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		if (gWakeEvent == NULL)
+			return;
+#else
+		if (!gForkHandler
+		    && pthread_atfork(logq_fork_prepare, logq_fork_parent,
+				      logq_fork_child) != 0)
+			return;
+		gForkHandler = 1;
+#endif
+		if (gWriter == NULL)
+			gWriter = new CLogWriter();
+		gWriter->m_bStopRequest = false;
+		if (gWriter->Start() == 0)
+			gRunning = 1;
+	}
+	catch(...)
+	{
+	}
+}
+
+extern "C" void logq_stop(void)
+{
+	CAutoMutex state(&gStateMutex);
+	int i;
+
+	if (gRunning)
+	{
+		gRunning = 0;
+		gWriter->RequestStop();
+		logq_wake();
+		//The writer wakes up right away; if it doesn't stop, it was
+		//killed at process exit (maybe holding gFileMutex), so leave
+		//the files to the system
+		for (i = 0; gWriter->IsRunning(); i++)
+		{
+			if (i >= LOGQ_STOP_WAIT_MS / LOGQ_STOP_POLL_MS)
+				return;
+			CThread::SleepMillisecs(LOGQ_STOP_POLL_MS);
+		}
+	}
+
+	CAutoMutex lock(&gFileMutex);
+
+	logq_drain();
+	logq_sync();
+}
+
+namespace eIDMW
+{
+	// Stops the writer and writes what it had queued when the module is
+	// unloaded without C_Finalize(), so the thread doesn't outlive its code.
+	// Defined after the mutexes, so it's destroyed before them.
+	static class CLogQueueCleanup
+	{
+public:
+		~CLogQueueCleanup()
+		{
+			logq_stop();
+		}
+	} oLogQueueCleanup;
+}
@@ -0,0 +1,75 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#ifndef __LOGQUEUE_H__
+#define __LOGQUEUE_H__
+
+#include <stddef.h>
+#include <wchar.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Asynchronous log file writer, shared by log_trace() and CLog.
+ *
+ * Callers format complete lines and hand them to logq_write(), which only
+ * pushes them on a lock-free list. A background thread appends the lines to
+ * their files in batches. For each batch the files are locked against other
+ * processes ('name'.lock, or the LogMutex on Windows), rotated on size,
+ * written and closed again. While the thread is not running (before logq_start(),
+ * after logq_stop(), or when LOGQ_MAX_PENDING lines are waiting) the caller
+ * writes the pending lines and its own line itself, so nothing is lost and
+ * the order is kept. */
+
+#define LOGQ_MAX_SINKS		16
+#define LOGQ_MAX_PENDING	4096
+
+/* Register a log file and return its sink number, or -1 if the table is
+ * full. Registering the same name again returns the same sink.
+ *   filenr <= 1 : the file is 'name'; once it holds maxsize bytes it is
+ *                 moved to 'name'.1 and a new one is started
+ *   filenr >= 2 : the files are 'name'0.log .. 'name'<filenr-1>.log and are
+ *                 rotated the way CLog always did (see logbase.h)
+ *   maxsize 0   : no size limit */
+	int logq_sink(const char *name, long maxsize, long filenr);
+	int logq_sink_w(const wchar_t * name, long maxsize, long filenr);
+
+/* Empty the file of a sink */
+	void logq_truncate(int sink);
+
+/* Queue one or more complete lines (including the '\n') */
+	void logq_write(int sink, const char *line, size_t len);
+
+/* Write everything queued so far to disk */
+	void logq_flush(void);
+
+/* Start the background writer; does nothing if it is running already */
+	void logq_start(void);
+
+/* Flush, stop the background writer and close the files */
+	void logq_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
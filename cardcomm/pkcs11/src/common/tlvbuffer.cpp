@@ -38,28 +38,22 @@ namespace eIDMW
 
 	CTLVBuffer::CTLVBuffer()
 	{
-
+		Clear(NULL);
 	}
 
 
 	CTLVBuffer::~CTLVBuffer()
 	{
-		ITMap it;
-
-		//free complete m_oMapTLV
-		for (it = m_oMapTLV.begin(); it != m_oMapTLV.end(); ++it)
-		{
-			CTLV *pTemp = (*it).second;
+	}
 
-			if (pTemp != NULL)
-			{
-				delete pTemp;
-			}
-		}
-		m_oMapTLV.clear();
+	void CTLVBuffer::Clear(const unsigned char *pucData)
+	{
+		m_pucData = pucData;
+		memset(m_ulOffset, 0, sizeof(m_ulOffset));
+		memset(m_ulLength, 0, sizeof(m_ulLength));
 	}
 
-/** Unstream a multi-TLV-block into m_oMapTLV structure.
+/** Unstream a multi-TLV-block into the tag index.
   User standard TLV syntax; extra length bytes when the MSB of a length-byte is set to 1.
   Each block should start with a 0-Tag, 0-tag can only be used as first TLV of a block.
 
@@ -71,9 +65,10 @@ namespace eIDMW
 	{
 		bool bRet = false;
 
+		//an empty or missing file leaves no tags from the previous one
+		Clear(pucData);
 		if (pucData != NULL && ulLen > 0)
 		{
-			m_oMapTLV.clear();
 			bRet = true;
 			unsigned long ulIndex = 0;
 
@@ -108,16 +103,15 @@ namespace eIDMW
 				}
 
 				//--- add the decoded TLV 
-				m_oMapTLV[ucTag] =
-					new CTLV(ucTag, pucData + ulIndex,
-						 ulFieldLen);
+				m_ulOffset[ucTag] = ulIndex;
+				m_ulLength[ucTag] = ulFieldLen;
 				ulIndex += ulFieldLen;
 			}
 		}
 		return bRet;
 	}
 
-/** Unstream a multi-TLV-block into m_oMapTLV structure
+/** Unstream a multi-TLV-block into the tag index
  Use Fedict TLV syntax; extra length bytes when length-byte = FF
  0-tags can only be used as first TLV of a block
  returns: 0 = invalid data
@@ -129,9 +123,10 @@ namespace eIDMW
 	{
 		int iRet = 0;
 
+		//an empty or missing file leaves no tags from the previous one
+		Clear(pucData);
 		if (pucData != NULL && ulLen > 0)
 		{
-			m_oMapTLV.clear();
 			iRet = 1;
 			unsigned long ulIndex = 0;
 
@@ -167,40 +162,42 @@ namespace eIDMW
 					break;
 				}
 				//get data
-				m_oMapTLV[ucTag] =
-					new CTLV(ucTag, pucData + ulIndex,
-						 ulFieldLen);
+				m_ulOffset[ucTag] = ulIndex;
+				m_ulLength[ucTag] = ulFieldLen;
 				ulIndex += ulFieldLen;
 			}
 		}
 		return iRet;
 	}
 
-	CTLV *CTLVBuffer::GetTagData(unsigned char ucTag)
+	bool CTLVBuffer::GetTagData(unsigned char ucTag,
+				    const unsigned char **ppucData,
+				    unsigned long *pulLen)
 	{
-		ITMap it = m_oMapTLV.find(ucTag);
-
-		if (it != m_oMapTLV.end())
+		if (m_ulOffset[ucTag] == 0)
 		{
-			return (*it).second;
+			return false;
 		}
-		return NULL;
+		*ppucData = m_pucData + m_ulOffset[ucTag];
+		*pulLen = m_ulLength[ucTag];
+		return true;
 	}
 
 	void CTLVBuffer::FillASCIIData(unsigned char ucTag, char *pData,
 				       unsigned long *pulLen)
 	{
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 		unsigned long ulLength = 0;
 
 		assert(pulLen != NULL);
 
-		if ((NULL != (pTagData = GetTagData(ucTag)))
+		if (GetTagData(ucTag, &pucTagData, &ulTagLen)
 		    && (pData != NULL))
 		{
-			if ((*pulLen >= (ulLength = pTagData->GetLength())))
+			if ((*pulLen >= (ulLength = ulTagLen)))
 			{
-				memcpy(pData, pTagData->GetData(), ulLength);
+				memcpy(pData, pucTagData, ulLength);
 			}
 			//else: we don't chop off data, so either get it all, or nothing
 		}
@@ -212,19 +209,20 @@ namespace eIDMW
 	bool CTLVBuffer::FillUTF8Data(unsigned char ucTag, char *pData,
 				      unsigned long *pulLen)
 	{
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 		unsigned long ulLength = 0;
 
 		assert(pulLen != NULL);
 
-		if (NULL == (pTagData = GetTagData(ucTag))) {
+		if (!GetTagData(ucTag, &pucTagData, &ulTagLen)) {
 			return false;
 		}
 		if(pData != NULL)
 		{
-			if ((*pulLen >= (ulLength = pTagData->GetLength())))
+			if ((*pulLen >= (ulLength = ulTagLen)))
 			{
-				memcpy(pData, pTagData->GetData(), ulLength);
+				memcpy(pData, pucTagData, ulLength);
 			}
 			//else: we don't chop off data, so either get it all, or nothing
 		}
@@ -238,15 +236,16 @@ namespace eIDMW
 					      char *pData,
 					      unsigned long *pulLen)
 	{
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 		unsigned long ulLength;
 
-		if ((NULL != (pTagData = GetTagData(ucTag)))
+		if (GetTagData(ucTag, &pucTagData, &ulTagLen)
 		    && (pData != NULL) && (pulLen != NULL))
 		{
 			char *pszTemp =
-				Hexify(pTagData->GetData(),
-				       pTagData->GetLength());
+				Hexify(pucTagData,
+				       ulTagLen);
 			if (*pulLen >
 			    (ulLength = (unsigned long) strlen(pszTemp)))
 			{
@@ -260,15 +259,16 @@ namespace eIDMW
 
 	void CTLVBuffer::FillLongData(unsigned char ucTag, long *piData)
 	{
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 
-		if (NULL != (pTagData = GetTagData(ucTag)))
+		if (GetTagData(ucTag, &pucTagData, &ulTagLen))
 		{
-			char *pszTemp = new char[pTagData->GetLength() + 1];
+			char *pszTemp = new char[ulTagLen + 1];
 
-			memset(pszTemp, 0, pTagData->GetLength() + 1);
-			memcpy(pszTemp, pTagData->GetData(),
-			       pTagData->GetLength());
+			memset(pszTemp, 0, ulTagLen + 1);
+			memcpy(pszTemp, pucTagData,
+			       ulTagLen);
 			*piData = atol(pszTemp);
 			delete[]pszTemp;
 		}
@@ -278,14 +278,15 @@ namespace eIDMW
 							    /**< in/out: In=max.length, Out=current length */
 		)
 	{
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 
-		if (NULL != (pTagData = GetTagData(ucTag)))
+		if (GetTagData(ucTag, &pucTagData, &ulTagLen))
 		{
-			unsigned long ulLength = pTagData->GetLength();
+			unsigned long ulLength = ulTagLen;
 
 			if (*pulLen >= ulLength)	//length data
-				memcpy(pData, pTagData->GetData(), ulLength);
+				memcpy(pData, pucTagData, ulLength);
 			else
 				ulLength = 0;
 			*pulLen = ulLength;
@@ -297,23 +298,24 @@ namespace eIDMW
 					     unsigned long *pulLen)
 	{
 		bool bRet = false;
-		CTLV *pTagData = NULL;
+		const unsigned char *pucTagData = NULL;
+		unsigned long ulTagLen = 0;
 
-		if (NULL != (pTagData = GetTagData(ucTag)))
+		if (GetTagData(ucTag, &pucTagData, &ulTagLen))
 		{
-			if (*pulLen >= pTagData->GetLength())
+			if (*pulLen >= ulTagLen)
 			{
-				*pulLen = pTagData->GetLength();
+				*pulLen = ulTagLen;
 				bRet = true;
 			}
-			memcpy(pData, pTagData->GetData(), *pulLen);
+			memcpy(pData, pucTagData, *pulLen);
 		} else
 			*pulLen = 0;
 		return bRet;
 	}
 
 //binair to ascii-hex
-	char *CTLVBuffer::Hexify(unsigned char *pData, unsigned long ulLen)
+	char *CTLVBuffer::Hexify(const unsigned char *pData, unsigned long ulLen)
 	{
 		char *pszHex = new char[ulLen * 2 + 1];
 
@@ -332,98 +334,6 @@ namespace eIDMW
 		return pszHex;
 	}
 
-	unsigned long CTLVBuffer::GetLengthNeeded()
-	{
-		unsigned long lRet = 0;
-		ITMap it;
-		unsigned char ucLenBuffer[5];
-		int iBufLen;
-
-		for (it = m_oMapTLV.begin(); it != m_oMapTLV.end(); ++it)
-		{
-			CTLV *pTemp = (*it).second;
-
-			if (pTemp != NULL)
-			{
-				memset(ucLenBuffer, 0, sizeof(ucLenBuffer));
-				iBufLen = sizeof(ucLenBuffer);
-				if (TlvEncodeLen
-				    (pTemp->GetLength(), ucLenBuffer,
-				     &iBufLen))
-				{
-					lRet++;	//Tag
-					lRet += iBufLen;	//Length
-					lRet += pTemp->GetLength();	//Data
-				}
-			}
-		}
-		return lRet;
-	}
-
-/**********************************************************************************************************
-Encode the length in the TLV format    
-
-    Default one length byte.
-    The highest bit = 1 means one additional length-byte.
-    The lowest 7 bits of each byte are 7 bits of the length-number.
-
-    1 length byte  will encode max 7-bit  numbers, between     00 -       7F  
-    2 length bytes will encode max 14-bit numbers, between     80 -     3FFF
-    3 length bytes will encode max 21-bit numbers, between    400 -  1F FFFF
-    4 length bytes will encode max 28-bit numbers, between 20 000 - FFF FFFF
-    
-examples:
-  len=7B        -> encoding =          7B    
-  len=CD        -> encoding =       81 4D
-  len=2039      -> encoding =       C0 39 
-  len=43ABDA    -> encoding = 82 8E D7 5A
-    
- **********************************************************************************************************/
-	bool CTLVBuffer::TlvEncodeLen(unsigned long ulLenVal,	//In: length-value to encode in the TLV-format
-				      unsigned char *pucBufDest,	//In/Out: Destination buffer with the encoded length-stream
-				      int *piBufLen	//In/out: Max buffer length, Out:length of encoded stream
-		)
-	{
-		int iStreamLen = 1;	//length of the stream
-		unsigned long ulLenValLoc = 0;	//length
-		unsigned char ucExtraByte = 0x00;
-
-		//--- parameter check   
-		if (pucBufDest == NULL || piBufLen == NULL)
-		{
-			return false;
-		}
-		//--- determinate number of length-bytes
-		ulLenValLoc = ulLenVal >> 7;
-
-		while (ulLenValLoc)
-		{
-			iStreamLen++;
-			ulLenValLoc >>= 7;
-		}
-
-		if (*piBufLen < iStreamLen)
-		{
-			return false;
-		}
-		*piBufLen = iStreamLen;
-
-		//--- write encoded length
-		ulLenValLoc = ulLenVal;
-		pucBufDest[0] = 0;
-		ucExtraByte = 0;
-		while (iStreamLen--)
-		{
-			pucBufDest[iStreamLen] =
-				((unsigned char) ulLenValLoc & 0x7F) +
-				ucExtraByte;
-			ucExtraByte = 0x80;
-			ulLenValLoc >>= 7;
-		}
-
-		return true;
-	}
-
 /**********************************************************************************************************
 Decode the length from the TLV format    
    
@@ -458,65 +368,4 @@ Decode the length from the TLV format
 		return true;
 	}
 
-	void CTLVBuffer::SetTagData(unsigned char ucTag,
-				    const unsigned char *pucData,
-				    unsigned long ulLen)
-	{
-
-		if (pucData)
-		{
-			ITMap itr;
-
-			itr = m_oMapTLV.find(ucTag);
-			if (itr == m_oMapTLV.end())
-			{
-				m_oMapTLV[ucTag] =
-					new CTLV(ucTag, pucData, ulLen);
-			} else
-			{
-				itr->second->ReplaceData(pucData, ulLen);
-			}
-		}
-	}
-
-	unsigned long CTLVBuffer::Extract(unsigned char *pucData,
-					  unsigned long ulLen)
-	{
-
-		if (!pucData)
-			return 0;
-
-		CByteArray oTempArray;
-		unsigned char ucLenBuffer[4] = { 0 };
-		int iBufLen = sizeof(ucLenBuffer);
-		ITMap it;
-
-		for (it = m_oMapTLV.begin(); it != m_oMapTLV.end(); ++it)
-		{
-
-			iBufLen = sizeof(ucLenBuffer);
-			memset(ucLenBuffer, 0, sizeof(ucLenBuffer));
-
-			if (TlvEncodeLen
-			    (it->second->GetLength(), ucLenBuffer, &iBufLen))
-			{
-				oTempArray.Append(it->second->GetTag());
-				oTempArray.Append(ucLenBuffer, iBufLen);
-				oTempArray.Append(it->second->GetData(),
-						  it->second->GetLength());
-			}
-		}
-
-		unsigned long ulSize = oTempArray.Size();
-
-		if (ulLen >= ulSize)
-		{
-			memcpy(pucData, oTempArray.GetBytes(), ulSize);
-			return ulSize;
-		}
-
-		return 0;
-	}
-
-
 }				// namespace eIDMW
@@ -31,28 +31,26 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <map>
-#include "tlv.h"
 
 namespace eIDMW
 {
 
+	/* An index of the TLVs in a buffer, by tag. Nothing is copied: the
+	 * data of the tags stays where it is, so the buffer that was parsed
+	 * must be kept as long as the CTLVBuffer is used. */
 	class CTLVBuffer
 	{
 public:
 		CTLVBuffer();
 		virtual ~ CTLVBuffer();
 
-		void SetTagData(unsigned char ucTag,
-					      const unsigned char *pucData,
-					      unsigned long ulLen);
-		unsigned long Extract(unsigned char *pucData,
-						    unsigned long ulLen);
 		int ParseTLV(const unsigned char *pucData,
 					   unsigned long ulLen);
 		bool ParseFileTLV(const unsigned char *pucData,
 						unsigned long ulLen);
-		CTLV *GetTagData(unsigned char ucTag);
+		bool GetTagData(unsigned char ucTag,
+					      const unsigned char **ppucData,
+					      unsigned long *pulLen);
 		void FillASCIIData(unsigned char ucTag,
 						 char *pData,
 						 unsigned long *pulLen);
@@ -72,23 +70,22 @@ public:
 						       unsigned char *pData,
 						       unsigned long
 						       *pulMaxLen);
-		unsigned long GetLengthNeeded();
 
 private:
-		static char *Hexify(unsigned char *pData,
+		void Clear(const unsigned char *pucData);
+		static char *Hexify(const unsigned char *pData,
 				    unsigned long ulLen);
 
-		bool TlvEncodeLen(unsigned long ulLenVal,
-				  unsigned char *pucBufDest, int *piBufLen);
 		bool TlvDecodeLen(const unsigned char *pucBufSrc,
 				  int *piBufLen, unsigned long *pulLenVal);
 
 		static char hexChars[];
 
-		typedef std::map < unsigned char, CTLV * >MapTLV;
-		typedef MapTLV::iterator ITMap;
-
-		MapTLV m_oMapTLV;
+		//the data of tag t is m_ulLength[t] bytes at m_pucData + m_ulOffset[t];
+		//an offset of 0 means the tag isn't there, data comes after a tag and a length
+		const unsigned char *m_pucData;
+		unsigned long m_ulOffset[256];
+		unsigned long m_ulLength[256];
 	};
 
 }			     // namespace eIDMW
@@ -22,8 +22,10 @@
 #include <stdlib.h>
 #include <string.h>
 #include "beid_p11.h"
+#include "beidpkcs11ext.h"
 #include "util.h"
 #include "pkcs11log.h"
+#include "logqueue.h"
 #include "p11.h"
 #include "cal.h"
 
@@ -37,6 +39,7 @@
 #define LOG_MAX_REC  10
 
 extern CK_FUNCTION_LIST pkcs11_function_list;
+extern CK_BEID_FUNCTION_LIST beid_function_list;
 //extern void *logmutex;
 
 //static int g_final = 0; /* Belpic */
@@ -98,6 +101,7 @@ CK_RV C_Initialize(CK_VOID_PTR pReserved)
 			p11_init_lock(p_args);
 		}
 		cal_init();
+		p11_init_label_flags();
 		p11_set_init(BEIDP11_INITIALIZED);
 		log_trace(WHERE, "S: Initialize this PKCS11 Module");
 		log_trace(WHERE, "S: =============================");
@@ -135,13 +139,16 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 		return (CKR_ARGUMENTS_BAD);
 	}
 
-	p11_lock();
+	//wait until all slots are idle
+	p11_lock_all_slots();
 
 	//g_final = 0; /* Belpic */
 	p11_set_init(BEIDP11_DEINITIALIZING);
 
 	p11_close_sessions_finalize();
 
+	p11_lock();
+
 	cal_close();
 
 	/* Release and destroy the mutex */
@@ -153,6 +160,9 @@ CK_RV C_Finalize(CK_VOID_PTR pReserved)
 	// util_clean_lock(&logmutex);
 	log_trace(WHERE, "I: p11_free_lock()");
 	log_trace(WHERE, "I: leave, ret = %i",ret);
+
+	/* write out the queued log lines and stop the log writer thread */
+	logq_stop();
 	return ret;
 }
 #undef WHERE
@@ -211,6 +221,48 @@ CK_RV C_GetFunctionList(CK_FUNCTION_LIST_PTR_PTR ppFunctionList)
 
 
 
+#define WHERE "C_BEID_GetFunctionList()"
+CK_RV C_BEID_GetFunctionList(CK_BEID_FUNCTION_LIST_PTR_PTR ppFunctionList)
+{
+	log_trace(WHERE, "I: enter");
+
+	if (ppFunctionList == NULL_PTR)
+	{
+		log_trace(WHERE, "I: leave, CKR_ARGUMENTS_BAD");
+		return CKR_ARGUMENTS_BAD;
+	}
+
+	*ppFunctionList = &beid_function_list;
+
+	log_trace(WHERE, "I: leave, CKR_OK");
+	return CKR_OK;
+}
+#undef WHERE
+
+
+
+#define WHERE "C_BEID_GetApduStats()"
+CK_RV C_BEID_GetApduStats(CK_BEID_APDU_STATS_PTR pStats, CK_BBOOL bReset)
+{
+	CK_RV ret;
+	log_trace(WHERE, "I: enter");
+
+	if (pStats == NULL_PTR)
+	{
+		log_trace(WHERE, "I: leave, CKR_ARGUMENTS_BAD");
+		return CKR_ARGUMENTS_BAD;
+	}
+
+	//no p11_lock(): the counters are only read and written atomically
+	ret = cal_get_apdu_stats(pStats, bReset);
+
+	log_trace(WHERE, "I: leave, ret = %i", ret);
+	return ret;
+}
+#undef WHERE
+
+
+
 #define WHERE "C_GetSlotList()"
 CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token present */
 	CK_SLOT_ID_PTR pSlotList,     /* receives the array of slot IDs */
@@ -220,6 +272,7 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	P11_SLOT *pSlot;
 	CK_RV ret = CKR_OK;
 	int h;
+	int nreaders;
 	CK_ULONG c = 0; 
 	static int l=0;
 
@@ -231,9 +284,6 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}
 
-	p11_lock();
-	log_trace(WHERE, "I: p11_lock() acquired");
-
 	if (++l<LOG_MAX_REC)
 		log_trace(WHERE, "S: C_GetSlotList()");
 
@@ -244,7 +294,14 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	}
 
 	if(pSlotList == NULL){
+		//the slot list is rebuilt, so no slot may be in use
+		p11_lock_all_slots();
+		p11_lock();
+		log_trace(WHERE, "I: p11_lock() acquired");
 		ret = cal_refresh_readers();
+		log_trace(WHERE, "I: p11_unlock()");
+		p11_unlock();
+		p11_unlock_all_slots();
 	}
 	//init slots allready done
 	//update info on tokens in slot, could be removed if thread keeps track of these token states
@@ -253,20 +310,32 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	//Adobe just assumes that the first slot has ID=0 !!! and uses this ID=0 for all further actions.
 	//to overcome this problem, we start our SlotIDs from 0 and not 1 !!!
 
+	//the slot list may be rebuilt by another thread, so only look at it under p11_lock();
+	//cal_token_present() below is safe under the slot's own lock
+	p11_lock();
+	nreaders = p11_get_nreaders();
+	if (l < LOG_MAX_REC)
+	{
+		for (h=0; h < nreaders; h++)
+		{
+			pSlot = p11_get_slot(h);
+			log_trace(WHERE, "I: slot[%d]: %s", h, pSlot->name);
+		}
+	}
+	p11_unlock();
+
 	log_trace(WHERE, "I: h=0");
 
-	for (h=0; h < p11_get_nreaders(); h++)
+	for (h=0; h < nreaders; h++)
 	{
 		log_trace(WHERE, "I: h=%i",h);
-		pSlot = p11_get_slot(h);
-
-		if (l < LOG_MAX_REC) 
-			log_trace(WHERE, "I: slot[%d]: %s", h, pSlot->name);
 
 		if (tokenPresent == CK_TRUE)
 		{
 			int pPresent = 0;
+			p11_lock_slot(h);
 			ret = cal_token_present(h, &pPresent);
+			p11_unlock_slot(h);
 			if(ret != CKR_OK && ret != CKR_TOKEN_NOT_RECOGNIZED)
 			{
 				goto cleanup;
@@ -301,8 +370,6 @@ CK_RV C_GetSlotList(CK_BBOOL       tokenPresent,  /* only slots with token prese
 	*pulCount = c;
 
 cleanup:   
-	log_trace(WHERE, "I: p11_unlock()");
-	p11_unlock();
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -325,7 +392,7 @@ CK_RV C_GetSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	if (++l < LOG_MAX_REC)  
 		log_trace(WHERE, "S: C_GetSlotInfo(slot %d)", slotID);
@@ -370,7 +437,7 @@ CK_RV C_GetSlotInfo(CK_SLOT_ID slotID, CK_SLOT_INFO_PTR pInfo)
 	}
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -390,7 +457,7 @@ CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	log_trace(WHERE, "S: C_GetTokenInfo(slot %d)", slotID);
 	if (pInfo == NULL_PTR) 
@@ -407,7 +474,7 @@ CK_RV C_GetTokenInfo(CK_SLOT_ID slotID, CK_TOKEN_INFO_PTR pInfo)
 	}
 
 cleanup:        
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -429,7 +496,7 @@ CK_RV C_GetMechanismList(CK_SLOT_ID slotID,
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	log_trace(WHERE, "S: C_GetMechanismList(slot %d)", slotID);
 
@@ -442,7 +509,7 @@ CK_RV C_GetMechanismList(CK_SLOT_ID slotID,
 
 cleanup:
 
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -463,7 +530,7 @@ CK_RV C_GetMechanismInfo(CK_SLOT_ID slotID,
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	log_trace(WHERE, "S: C_GetMechanismInfo(slot %d)", slotID);
 
@@ -480,7 +547,7 @@ CK_RV C_GetMechanismInfo(CK_SLOT_ID slotID,
 	}
 
 cleanup:        
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -668,3 +735,9 @@ CK_FUNCTION_LIST pkcs11_function_list = {
 	C_CancelFunction,
 	C_WaitForSlotEvent
 };
+
+CK_BEID_FUNCTION_LIST beid_function_list = {
+	{ CK_BEID_EXT_VERSION_MAJOR, CK_BEID_EXT_VERSION_MINOR },
+	C_BEID_SignBatch,
+	C_BEID_GetApduStats
+};
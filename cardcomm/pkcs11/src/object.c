@@ -25,6 +25,7 @@
 #include "p11.h"
 #include "cal.h"
 #include "display.h"
+#include "objectindex.h"
 
 //global variable 
 //int eidmw_readpermission = 0;
@@ -92,6 +93,7 @@ CK_RV C_GetAttributeValue(CK_SESSION_HANDLE hSession,   /* the session's handle
 													CK_ATTRIBUTE_PTR  pTemplate,  /* specifies attributes, gets values */
 													CK_ULONG          ulCount)    /* attributes in template */
 {
+	CK_SLOT_ID hLockSlot;
 	/*
 	This function returns the values from the object.
 	Object is cached so objects are read only once and remain valid until new session is setup with token.
@@ -114,7 +116,7 @@ CK_RV C_GetAttributeValue(CK_SESSION_HANDLE hSession,   /* the session's handle
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_GetAttributeValue(hObject=%d)",hObject);
 
@@ -141,8 +143,9 @@ CK_RV C_GetAttributeValue(CK_SESSION_HANDLE hSession,   /* the session's handle
 		goto cleanup;
 	}
 
-	//read object from token if not cached allready
-	if (pObject->state != P11_CACHED)
+	//read object from token if not cached allready, and only if the template asks
+	//for something that comes from the token
+	if (cal_object_needs_read(pObject, pTemplate, ulCount))
 	{
 		ret = cal_read_object(pSession->hslot, pObject);
 		if (ret != 0)
@@ -204,7 +207,7 @@ CK_RV C_GetAttributeValue(CK_SESSION_HANDLE hSession,   /* the session's handle
 		log_template("I: Template out:", pTemplate, ulCount);
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	return ret;
 }
 #undef WHERE
@@ -229,6 +232,7 @@ CK_RV C_FindObjectsInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
 												CK_ATTRIBUTE_PTR  pTemplate,  /* attribute values to match */
 												CK_ULONG          ulCount)    /* attributes in search template */
 {
+	CK_SLOT_ID hLockSlot;
 	P11_SESSION *pSession = NULL;
 	P11_SLOT    *pSlot    = NULL;
 	P11_FIND_DATA *pData = NULL;
@@ -246,7 +250,7 @@ CK_RV C_FindObjectsInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_FindObjectsInit(session %d)", hSession);
 	if (ulCount == 0)
@@ -503,7 +507,7 @@ CK_RV C_FindObjectsInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
 	ret = CKR_OK;
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	return ret;
 }
 #undef WHERE
@@ -515,6 +519,7 @@ CK_RV C_FindObjects(CK_SESSION_HANDLE    hSession,          /* the session's han
 										CK_ULONG             ulMaxObjectCount,  /* max handles to be returned */
 										CK_ULONG_PTR         pulObjectCount)    /* actual number returned */
 {
+	CK_SLOT_ID hLockSlot;
 	/*
 
 	this function finds handles to objects but does not actually reads them.
@@ -545,7 +550,7 @@ CK_RV C_FindObjects(CK_SESSION_HANDLE    hSession,          /* the session's han
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: p11_get_session(session %d) enter", hSession);
 
@@ -615,9 +620,13 @@ CK_RV C_FindObjects(CK_SESSION_HANDLE    hSession,          /* the session's han
 
 	*pulObjectCount = 0;
 
-	//for all objects in token, match with search template as long as we need, keep handle to current token object
-	for (h = pData->hCurrent; h <= (pSlot->nobjects) && (*pulObjectCount < ulMaxObjectCount); h++, pData->hCurrent++)
+	//for all candidate objects in token, match with search template as long as we need, keep handle to current token object
+	//the slot's object index skips the objects that can't match the class, id, label or object id of the template
+	for (h = p11_index_next(pSlot, pData->pSearch, pData->size, pData->hCurrent);
+		(h != 0) && (*pulObjectCount < ulMaxObjectCount);
+		h = p11_index_next(pSlot, pData->pSearch, pData->size, h + 1))
 	{
+		pData->hCurrent = h + 1;
 		pObject = p11_get_slot_object(pSlot, h);
 		if (pObject == NULL)
 		{
@@ -682,12 +691,14 @@ CK_RV C_FindObjects(CK_SESSION_HANDLE    hSession,          /* the session's han
 		else
 			log_trace(WHERE, "I: Slot %d: Object %d no match with search template", pSession->hslot, h);
 	}
+	if (h == 0)
+		pData->hCurrent = pSlot->nobjects + 1;
 
 	ret = CKR_OK;
 
 cleanup: 
 	log_trace(WHERE, "I: leave");
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	return ret;
 }
 #undef WHERE
@@ -699,6 +710,7 @@ cleanup:
 #define WHERE "C_FindObjectsFinal()"
 CK_RV C_FindObjectsFinal(CK_SESSION_HANDLE hSession) /* the session's handle */
 {
+	CK_SLOT_ID hLockSlot;
 	P11_SESSION *pSession = NULL;
 	P11_FIND_DATA *pData = NULL;
 	CK_RV ret;
@@ -710,7 +722,7 @@ CK_RV C_FindObjectsFinal(CK_SESSION_HANDLE hSession) /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_FindObjectsFinal(session %d)", hSession);
 
@@ -752,98 +764,82 @@ CK_RV C_FindObjectsFinal(CK_SESSION_HANDLE hSession) /* the session's handle */
 	ret = CKR_OK;
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	return ret;
 }
 #undef WHERE
 
 
-void SetParseFlagByLabel(CK_ULONG* pFilesToParseFlag,CK_UTF8CHAR_PTR pLabel,CK_ULONG len)
+//hash table from the label of an ID data object to the file it is read from,
+//filled in once by C_Initialize(); 0 is never a valid flag so it marks an empty entry
+#define LABEL_FLAGS_SIZE 128
+
+typedef struct LABEL_FLAG
+{
+	const char* label;
+	CK_ULONG len;
+	CK_ULONG flag;
+} LABEL_FLAG;
+
+static LABEL_FLAG gLabelFlags[LABEL_FLAGS_SIZE];
+
+static void AddLabelFlag(const char* label, CK_ULONG flag)
+{
+	CK_ULONG len = (CK_ULONG)strlen(label);
+	unsigned int i = p11_index_hash(label, len) % LABEL_FLAGS_SIZE;
+
+	while (gLabelFlags[i].flag != 0)
+	{
+		//keep the first one, as the linear search used to do
+		if ((gLabelFlags[i].len == len) && (memcmp(gLabelFlags[i].label, label, len) == 0))
+			return;
+		i = (i + 1) % LABEL_FLAGS_SIZE;
+	}
+	gLabelFlags[i].label = label;
+	gLabelFlags[i].len = len;
+	gLabelFlags[i].flag = flag;
+}
+
+void p11_init_label_flags(void)
 {
-	CK_ULONG nrOfItems = 0;
 	CK_ULONG counter = 0;
 	BEID_DATA_LABELS_NAME ID_LABELS[]=BEID_ID_DATA_LABELS;
 	BEID_DATA_LABELS_NAME ADDRESS_LABELS[]=BEID_ADDRESS_DATA_LABELS;
-
-	CK_ULONG carddataLabelsListLen = 14;
-	const char* carddataLabelsList[14] = {BEID_LABEL_DATA_SerialNr,BEID_LABEL_DATA_CompCode,BEID_LABEL_DATA_OSNr,
+	const char* carddataLabelsList[] = {BEID_LABEL_DATA_SerialNr,BEID_LABEL_DATA_CompCode,BEID_LABEL_DATA_OSNr,
 		BEID_LABEL_DATA_OSVersion,BEID_LABEL_DATA_SoftMaskNumber,BEID_LABEL_DATA_SoftMaskVersion,
 		BEID_LABEL_DATA_ApplVersion,BEID_LABEL_DATA_GlobOSVersion,BEID_LABEL_DATA_ApplIntVersion,
 		BEID_LABEL_DATA_PKCS1Support,BEID_LABEL_DATA_ApplLifeCycle,BEID_LABEL_DATA_KeyExchangeVersion,
 		BEID_LABEL_DATA_Signature,BEID_LABEL_ATR};
 
+	memset(gLabelFlags, 0, sizeof(gLabelFlags));
+
 	//labels from identity data
-	nrOfItems = sizeof(ID_LABELS)/sizeof(BEID_DATA_LABELS_NAME);
-	while(counter < nrOfItems)
-	{
-		if(strlen(ID_LABELS[counter].name) == len)
-		{
-			if(memcmp(ID_LABELS[counter].name,pLabel,len)==0){
-				*pFilesToParseFlag=CACHED_DATA_TYPE_ID;
-				return;
-			}
-		}
-		counter++;
-	}
+	for (counter = 0; counter < sizeof(ID_LABELS)/sizeof(BEID_DATA_LABELS_NAME); counter++)
+		AddLabelFlag(ID_LABELS[counter].name, CACHED_DATA_TYPE_ID);
 	//labels from address data
-	counter = 0;
-	nrOfItems = sizeof(ADDRESS_LABELS)/sizeof(BEID_DATA_LABELS_NAME);
-	while(counter < nrOfItems)
-	{		
-		if(strlen(ADDRESS_LABELS[counter].name) == len)
-		{
-			if(memcmp(ADDRESS_LABELS[counter].name,pLabel,len)==0){
-				*pFilesToParseFlag=CACHED_DATA_TYPE_ADDRESS;
-				return;
-			}
-		}
-		counter++;
-	}
-
-	//label of the foto file
-	if(strlen(BEID_LABEL_PHOTO) == len)
-	{
-		if(memcmp(BEID_LABEL_PHOTO,pLabel,len)==0){
-			*pFilesToParseFlag=CACHED_DATA_TYPE_PHOTO;
-			return;
-		}
-	}
-	//label of the RN cert
-	if(strlen(BEID_LABEL_CERT_RN) == len)
-	{
-		if(memcmp(BEID_LABEL_CERT_RN,pLabel,len)==0){
-			*pFilesToParseFlag=CACHED_DATA_TYPE_RNCERT;
-			return;
-		}
-	}
-	//label of the data signature file
-	if(strlen(BEID_LABEL_SGN_RN) == len)
-	{
-		if(memcmp(BEID_LABEL_SGN_RN,pLabel,len)==0){
-			*pFilesToParseFlag=CACHED_DATA_TYPE_SIGN_DATA_FILE;
-			return;
-		}
-	}
-	//label of the address signature cert
-	if(strlen(BEID_LABEL_SGN_ADDRESS) == len)
-	{
-		if(memcmp(BEID_LABEL_SGN_ADDRESS,pLabel,len)==0){
-			*pFilesToParseFlag=CACHED_DATA_TYPE_SIGN_ADDRESS_FILE;
-			return;
-		}
-	}
+	for (counter = 0; counter < sizeof(ADDRESS_LABELS)/sizeof(BEID_DATA_LABELS_NAME); counter++)
+		AddLabelFlag(ADDRESS_LABELS[counter].name, CACHED_DATA_TYPE_ADDRESS);
+	AddLabelFlag(BEID_LABEL_PHOTO, CACHED_DATA_TYPE_PHOTO);
+	AddLabelFlag(BEID_LABEL_CERT_RN, CACHED_DATA_TYPE_RNCERT);
+	AddLabelFlag(BEID_LABEL_SGN_RN, CACHED_DATA_TYPE_SIGN_DATA_FILE);
+	AddLabelFlag(BEID_LABEL_SGN_ADDRESS, CACHED_DATA_TYPE_SIGN_ADDRESS_FILE);
 	//labels from card data
-	counter = 0;
-	while(counter < carddataLabelsListLen)
+	for (counter = 0; counter < sizeof(carddataLabelsList)/sizeof(const char*); counter++)
+		AddLabelFlag(carddataLabelsList[counter], CACHED_DATA_TYPE_CARDDATA);
+}
+
+void SetParseFlagByLabel(CK_ULONG* pFilesToParseFlag,CK_UTF8CHAR_PTR pLabel,CK_ULONG len)
+{
+	unsigned int i = p11_index_hash(pLabel, len) % LABEL_FLAGS_SIZE;
+
+	while (gLabelFlags[i].flag != 0)
 	{
-		if(strlen(carddataLabelsList[counter]) == len)
+		if ((gLabelFlags[i].len == len) && (memcmp(gLabelFlags[i].label, pLabel, len) == 0))
 		{
-			if(memcmp(carddataLabelsList[counter],pLabel,len)==0){
-				*pFilesToParseFlag=CACHED_DATA_TYPE_CARDDATA;
-				return;
-			}
+			*pFilesToParseFlag = gLabelFlags[i].flag;
+			return;
 		}
-		counter++;
+		i = (i + 1) % LABEL_FLAGS_SIZE;
 	}
 	//unknown label
 	return;
@@ -0,0 +1,122 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <string.h>
+#include "beid_p11.h"
+#include "p11.h"
+#include "objectindex.h"
+
+//the indexed attributes, most selective first
+static const CK_ATTRIBUTE_TYPE gIndexKeys[P11_INDEX_KEYS] = { CKA_OBJECT_ID, CKA_LABEL, CKA_ID, CKA_CLASS };
+
+unsigned int p11_index_hash(const void *pValue, CK_ULONG len)
+{
+	//FNV-1a
+	const unsigned char *p = (const unsigned char *) pValue;
+	unsigned int hash = 2166136261U;
+	CK_ULONG i;
+
+	for (i = 0; i < len; i++)
+	{
+		hash ^= p[i];
+		hash *= 16777619U;
+	}
+	return hash;
+}
+
+void p11_index_invalidate(P11_SLOT *pSlot)
+{
+	pSlot->index.valid = 0;
+}
+
+static void build_index(P11_SLOT *pSlot)
+{
+	P11_OBJECT *pObject;
+	CK_VOID_PTR p;
+	CK_ULONG len;
+	unsigned int h, k, b;
+
+	memset(pSlot->index.bucket, 0, sizeof(pSlot->index.bucket));
+
+	//walk backwards and insert at the head, so the chains are sorted by handle
+	for (h = pSlot->nobjects; h > 0; h--)
+	{
+		pObject = p11_get_slot_object(pSlot, h);
+		if ((pObject == NULL) || (pObject->inuse == 0))
+			continue;
+		for (k = 0; k < P11_INDEX_KEYS; k++)
+		{
+			pObject->hnext[k] = 0;
+			if (p11_get_attribute_value(pObject->pAttr, pObject->count, gIndexKeys[k], &p, &len) != CKR_OK)
+				continue;
+			b = p11_index_hash(p, len) % P11_INDEX_BUCKETS;
+			pObject->hnext[k] = pSlot->index.bucket[k][b];
+			pSlot->index.bucket[k][b] = h;
+		}
+	}
+	pSlot->index.valid = 1;
+}
+
+CK_OBJECT_HANDLE p11_index_next(P11_SLOT *pSlot, CK_ATTRIBUTE_PTR pSearch, CK_ULONG size, CK_OBJECT_HANDLE h)
+{
+	P11_OBJECT *pObject;
+	CK_ATTRIBUTE_PTR pKey = NULL;
+	CK_VOID_PTR p;
+	CK_ULONG len;
+	unsigned int k, i;
+	CK_OBJECT_HANDLE hNext;
+
+	if (h > pSlot->nobjects)
+		return 0;
+
+	//pick the most selective indexed attribute of the template
+	for (k = 0; (k < P11_INDEX_KEYS) && (pKey == NULL); k++)
+	{
+		for (i = 0; i < size; i++)
+		{
+			if (pSearch[i].type == gIndexKeys[k])
+			{
+				pKey = &pSearch[i];
+				break;
+			}
+		}
+	}
+	if (pKey == NULL)
+		return h;
+	k--;
+
+	if (!pSlot->index.valid)
+		build_index(pSlot);
+
+	for (hNext = pSlot->index.bucket[k][p11_index_hash(pKey->pValue, pKey->ulValueLen) % P11_INDEX_BUCKETS];
+		hNext != 0; hNext = pObject->hnext[k])
+	{
+		pObject = p11_get_slot_object(pSlot, hNext);
+		if (pObject == NULL)
+			return 0;
+		if (hNext < h)
+			continue;
+		//skip other values that ended up in the same bucket
+		if ((p11_get_attribute_value(pObject->pAttr, pObject->count, gIndexKeys[k], &p, &len) == CKR_OK) &&
+			(len == pKey->ulValueLen) && ((len == 0) || (memcmp(p, pKey->pValue, len) == 0)))
+			return hNext;
+	}
+	return 0;
+}
@@ -0,0 +1,60 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#ifndef __objectindex_h__
+#define __objectindex_h__
+
+/*
+ * Per-slot index over the slot objects, used by C_FindObjects().
+ *
+ * Every slot keeps a small hash table for each of CKA_CLASS, CKA_ID,
+ * CKA_LABEL and CKA_OBJECT_ID. The buckets are chains of object handles
+ * linked through P11_OBJECT.hnext and sorted by handle, so a search that
+ * was interrupted because the caller's buffer was full can resume at
+ * P11_FIND_DATA.hCurrent.
+ *
+ * The labels of certificates and keys are only set after the object was
+ * added, so the index is not maintained while objects are being added:
+ * adding or cleaning objects marks it stale and the next search rebuilds
+ * it. All of this runs with the slot lock held.
+ */
+
+#include "p11.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+	unsigned int p11_index_hash(const void *pValue, CK_ULONG len);
+	/* Forget the index of pSlot; it is rebuilt when it is needed again */
+	void p11_index_invalidate(P11_SLOT * pSlot);
+	/* Returns the first object handle >= h that may match the search
+	 * template, or 0 if there is none. If the template contains no indexed
+	 * attribute, this is simply h (as long as h is a valid handle). */
+	CK_OBJECT_HANDLE p11_index_next(P11_SLOT * pSlot,
+					CK_ATTRIBUTE_PTR pSearch, CK_ULONG size,
+					CK_OBJECT_HANDLE h);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
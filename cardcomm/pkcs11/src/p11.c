@@ -24,6 +24,9 @@
 #include "cal.h"
 #include "pkcs11log.h"
 #include "util.h"
+#include "sessiontable.h"
+#include "objectindex.h"
+#include "arena.h"
 
 #define MAX_SZ_READER 1024
 
@@ -48,9 +51,6 @@ P11_SLOT       gpSlot[MAX_SLOTS];
 //imagine different threads call init -> last close should clean the global data
 unsigned int   gRefCount = 0;
 
-P11_SESSION *gpSessions = NULL;
-unsigned int nSessions = 0;
-
 #ifdef __cplusplus
    } //extern "C"
 #endif
@@ -69,18 +69,48 @@ CK_RV p11_get_session(CK_SESSION_HANDLE h, P11_SESSION **ppSession)
 {
 	CK_RV ret = 0;
 
-	if ((h == 0) || (h > nSessions))
+	if ((*ppSession = p11_session_lookup(h)) == NULL)
 	{
 		return (CKR_SESSION_HANDLE_INVALID); //invalid handle
 	}		
 
-	*ppSession = &gpSessions[h - 1];
-
 	ret = cal_validate_session(*ppSession);
 
 	return (ret);
 }
 
+/*
+ * Take the lock of the slot that session h belongs to, and return that slot
+ * (to be passed to p11_unlock_slot() when done).
+ * If h isn't an open session, no slot is locked and P11_SLOT_NONE is returned;
+ * p11_get_session() will then report the invalid handle.
+ * Doesn't take the global lock.
+ */
+CK_SLOT_ID p11_lock_session(CK_SESSION_HANDLE h)
+{
+	P11_SESSION *pSession;
+	CK_SLOT_ID hSlot;
+
+	for (;;)
+	{
+		if ((pSession = p11_session_lookup(h)) == NULL)
+		{
+			return P11_SLOT_NONE;
+		}
+		hSlot = pSession->hslot;
+
+		p11_lock_slot(hSlot);
+
+		//the session may have been closed (and its entry reused) in the meantime;
+		//sessions are only closed with their slot locked, so after this check it stays
+		if ((p11_session_lookup(h) == NULL) || (pSession->hslot == hSlot))
+		{
+			return hSlot;
+		}
+		p11_unlock_slot(hSlot);
+	}
+}
+
 P11_OBJECT *p11_get_slot_object(P11_SLOT *pSlot, CK_SESSION_HANDLE h)
 {
    if ( (h < 1) || (h > pSlot->nobjects) )
@@ -98,49 +128,17 @@ int p11_get_nreaders()
 
 
 #define WHERE "p11_get_free_session()"
-CK_RV p11_get_free_session(CK_SESSION_HANDLE_PTR phSession, P11_SESSION **ppSession)
+CK_RV p11_get_free_session(CK_SLOT_ID hSlot, CK_SESSION_HANDLE_PTR phSession, P11_SESSION **ppSession)
 {
 CK_RV ret = 0;
-unsigned int index = 0;
-unsigned int size = 0;
-unsigned int diff = 0;
-P11_SESSION *gpSessions_realloc;
-
-*ppSession = NULL;
-// search for free entry in session table  
-for (index=0; index < nSessions; index++)
-   {            
-   if (gpSessions[index].inuse == 0)
-      break;
-   }
 
-//enlarge session table if no free entry was found
-if (index == nSessions)
+//reserve a free entry in the session table
+ret = p11_session_alloc(hSlot, phSession, ppSession);
+if (ret != CKR_OK)
    {
-   size = nSessions * sizeof(P11_SESSION);
-   diff = SESSION_TAB_STEP_SIZE * sizeof(P11_SESSION);
-
-   gpSessions_realloc = realloc(gpSessions, size + diff);
-   if (gpSessions_realloc == NULL)
-   {
-	   log_trace(WHERE, "E: unable to allocate memory for session table, %d bytes\n", size + diff);
-	   return(CKR_HOST_MEMORY);
-   }
-   else
-   {
-	   gpSessions = gpSessions_realloc;
+   log_trace(WHERE, "E: session table full (%d sessions)", MAX_SESSIONS);
    }
 
-   memset(&gpSessions[index], 0, diff);
-   nSessions += SESSION_TAB_STEP_SIZE;
-   }
-
-
-gpSessions[index].inuse = 1;
-
-*ppSession = &gpSessions[index];
-*phSession = index+1;
-
 return (ret);
 }
 #undef WHERE
@@ -154,8 +152,9 @@ CK_RV p11_close_sessions_finalize()
 	unsigned int i;
 
 	ret = CKR_OK;
-	for(i=0;i<nSessions; i++) {
-		if((pSession = &gpSessions[i])) {
+	//all slot locks are held, so no sessions can be opened or closed meanwhile
+	for(i=0;i<p11_session_count(); i++) {
+		if((pSession = p11_session_entry(i))) {
 			if(pSession->inuse) {
 				pSlot = p11_get_slot(pSession->hslot);
 				// don't overwrite previous errors
@@ -170,6 +169,9 @@ CK_RV p11_close_sessions_finalize()
 }
 #undef WHERE
 
+/*
+ * To be called with the lock of the session's slot held.
+ */
 #define WHERE "p11_close_session()"
 CK_RV p11_close_session(P11_SLOT* pSlot, P11_SESSION* pSession)
 {
@@ -202,16 +204,18 @@ CK_RV p11_close_session(P11_SLOT* pSlot, P11_SESSION* pSession)
 		pSession->Operation[P11_OPERATION_DIGEST].active = 0;
 	}
 	if(pSession->Operation[P11_OPERATION_SIGN].active) {
-		free(pSession->Operation[P11_OPERATION_SIGN].pData);
+		P11_SIGN_DATA *pSignData = (P11_SIGN_DATA *) pSession->Operation[P11_OPERATION_SIGN].pData;
+		if (pSignData != NULL && pSignData->pbuf != NULL)
+			free(pSignData->pbuf);
+		free(pSignData);
 		pSession->Operation[P11_OPERATION_SIGN].pData = NULL;
 		pSession->Operation[P11_OPERATION_SIGN].active = 0;
 	}
 	pSession->state = 0;
-	pSession->inuse = 0;
 	pSession->flags = 0;
-	pSession->hslot = 0;
 	pSession->pdNotify = NULL;
 	pSession->pfNotify = NULL;
+	p11_session_free(pSession);
 
 	return ret;
 }
@@ -240,8 +244,10 @@ if (pSlot->nsessions == 0)
    }
 
 //walk through all sessions and clean the ones related to this slot
-for (i=0; (i < nSessions) && (pSession = &gpSessions[i]) ;i++)
+//(the slot's lock is held, so none of them can be opened or closed meanwhile)
+for (i=0; i < p11_session_count(); i++)
    {
+   pSession = p11_session_entry(i);
    if ( (pSession->inuse) && (pSession->hslot == slotID) )
       {
       ret = p11_close_session(pSlot, pSession);
@@ -264,7 +270,7 @@ unsigned int i = 0;
 P11_SESSION *pSession = NULL;
 
 //walk through all sessions and invalidate the ones related to this slot
-for (i=0; (i < nSessions) && (pSession = &gpSessions[i]) ;i++)
+for (i=0; (i < p11_session_count()) && (pSession = p11_session_entry(i)) ;i++)
    {
    if ( (pSession->inuse) && (pSession->hslot == hSlot) )
       pSession->state = status;
@@ -318,6 +324,7 @@ if (index == pSlot->nobjects)
 
 //set flag inuse so nobody else will get this handle
 pSlot->pobjects[index].inuse = 1;
+p11_index_invalidate(pSlot);
 
 //handle is array el + 1 //handles start from 1
 *phObject = index + 1;
@@ -392,6 +399,58 @@ return (CKR_ATTRIBUTE_TYPE_INVALID);
 
 
 
+#define WHERE "p11_set_object_value()"
+CK_RV p11_set_object_value(P11_OBJECT *pObject, CK_ATTRIBUTE_TYPE type, CK_VOID_PTR pVoid, CK_ULONG len)
+{
+CK_ATTRIBUTE_PTR pAttr = NULL;
+unsigned int i = 0;
+
+if (pObject->pArena == NULL)
+   return (p11_set_attribute_value(pObject->pAttr, pObject->count, type, pVoid, len));
+
+if (len > MAX_ATTRIBUTE_SIZE)
+   return (CKR_ARGUMENTS_BAD);
+
+//search for attribute to set value
+for (i=0; (i < pObject->count) && (pAttr = &pObject->pAttr[i]); i++)
+   {
+   if (pAttr->type == type)
+      {
+      CK_VOID_PTR pOld = pAttr->pValue;
+      CK_ULONG oldLen = pAttr->ulValueLen;
+
+      //overwrite the old value if the new one fits in its space; if not,
+      //the old space is wiped and stays in the arena until the token goes away
+      if (pOld == NULL || !p11_arena_fits(oldLen, len))
+         {
+         pAttr->pValue = p11_arena_alloc(pObject->pArena, len);
+         if (pAttr->pValue == NULL)
+            {
+            pAttr->ulValueLen = 0;
+            log_trace(WHERE, "E: allocation error for attribute value (len=%d)", len);
+            return(CKR_HOST_MEMORY);
+            }
+         memcpy(pAttr->pValue, pVoid, len);
+         if (pOld != NULL)
+            memwash((char *) pOld, (unsigned int) oldLen);
+         }
+      else
+         {
+         memmove(pOld, pVoid, len);
+         if (oldLen > len)
+            memwash((char *) pOld + len, (unsigned int) (oldLen - len));
+         }
+      pAttr->ulValueLen = len;
+      return(CKR_OK);
+      }
+   }
+
+return (CKR_ATTRIBUTE_TYPE_INVALID);
+}
+#undef WHERE
+
+
+
 
 #define WHERE "p11_copy_object()"
 CK_RV p11_copy_object(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_ATTRIBUTE_PTR pObject)
@@ -436,6 +495,52 @@ return (ret);
 
 
 
+#define WHERE "p11_copy_slot_object()"
+static CK_RV p11_copy_slot_object(P11_SLOT *pSlot, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, P11_OBJECT *pObject)
+{
+unsigned int i;
+
+//check values are within limits
+if (ulCount > MAX_OBJECT_SIZE)
+   return (CKR_ARGUMENTS_BAD);
+
+//add room for attributes as in template
+pObject->pAttr = (CK_ATTRIBUTE_PTR) p11_arena_alloc(&pSlot->arena, ulCount * sizeof(CK_ATTRIBUTE));
+if (pObject->pAttr == NULL)
+   {
+   log_trace(WHERE, "E: alloc error for attribute");
+   return (CKR_HOST_MEMORY);
+   }
+memset(pObject->pAttr, 0, ulCount * sizeof(CK_ATTRIBUTE));
+pObject->pArena = &pSlot->arena;
+
+//set the size of the object attributes
+pObject->count = ulCount;
+
+for (i=0; i < ulCount; i++)
+   {
+   if ( pTemplate[i].ulValueLen > MAX_ATTRIBUTE_SIZE)
+      return (CKR_ARGUMENTS_BAD);
+
+   pObject->pAttr[i].type = pTemplate[i].type;
+   if (pTemplate[i].ulValueLen)
+      {
+      pObject->pAttr[i].pValue = p11_arena_alloc(&pSlot->arena, pTemplate[i].ulValueLen);
+      if (pObject->pAttr[i].pValue == NULL)
+         return (CKR_HOST_MEMORY);
+      memcpy(pObject->pAttr[i].pValue, pTemplate[i].pValue, pTemplate[i].ulValueLen);
+      pObject->pAttr[i].ulValueLen = pTemplate[i].ulValueLen;
+      }
+   }
+
+return (CKR_OK);
+}
+#undef WHERE
+
+
+
+
+
 #define WHERE "p11_add_slot_object()"
 CK_RV p11_add_slot_object(P11_SLOT *pSlot, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount, CK_BBOOL bToken, CK_ULONG type, CK_ULONG id,  CK_BBOOL bPrivate, CK_ULONG *phObject)
 {
@@ -454,55 +559,43 @@ if ((ret != 0) || (*phObject == 0))
 
 pObject = p11_get_slot_object(pSlot, *phObject);
 
-//add room for attributes as in template
-pObject->pAttr = (CK_ATTRIBUTE_PTR) malloc(ulCount * sizeof(CK_ATTRIBUTE));
-if (pObject->pAttr == NULL)
-   {
-   log_trace(WHERE, "E: alloc error for attribute");
-   return (CKR_HOST_MEMORY);
-   }
-memset(pObject->pAttr, 0, ulCount * sizeof(CK_ATTRIBUTE));
-
-//set the size of the object attributes
-pObject->count = ulCount;
-
-//copy the template to the new object
-ret = p11_copy_object(pTemplate, ulCount, pObject->pAttr);
+//copy the template to the new object, in the slot's arena
+ret = p11_copy_slot_object(pSlot, pTemplate, ulCount, pObject);
 if (ret)
    {
-   log_trace(WHERE, "E: p11_copy_object() returned %d", ret);
+   log_trace(WHERE, "E: p11_copy_slot_object() returned %d", ret);
    goto cleanup;
    }
 
 //CKA_TOKEN
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_TOKEN, (CK_VOID_PTR) &bToken, sizeof(CK_BBOOL));
+ret = p11_set_object_value(pObject, CKA_TOKEN, (CK_VOID_PTR) &bToken, sizeof(CK_BBOOL));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_TOKEN) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_TOKEN) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_CLASS
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_CLASS, (CK_VOID_PTR) &type, sizeof(CK_ULONG));
+ret = p11_set_object_value(pObject, CKA_CLASS, (CK_VOID_PTR) &type, sizeof(CK_ULONG));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_CLASS) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_CLASS) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_ID
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_ID, (CK_VOID_PTR) &id, sizeof(CK_ULONG));
+ret = p11_set_object_value(pObject, CKA_ID, (CK_VOID_PTR) &id, sizeof(CK_ULONG));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_ID) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_ID) returned %d", ret);
    goto cleanup;
    }
  
 //CKA_PRIVATE
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_PRIVATE, (CK_VOID_PTR) &bPrivate, sizeof(CK_BBOOL));
+ret = p11_set_object_value(pObject, CKA_PRIVATE, (CK_VOID_PTR) &bPrivate, sizeof(CK_BBOOL));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_PRIVATE) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_PRIVATE) returned %d", ret);
    goto cleanup;
    }
 
@@ -536,79 +629,67 @@ if ((ret != CKR_OK) || (*phObject == 0))
 
 pObject = p11_get_slot_object(pSlot, *phObject);
 
-//add room for attributes as in template
-pObject->pAttr = (CK_ATTRIBUTE_PTR) malloc(ulCount * sizeof(CK_ATTRIBUTE));
-if (pObject->pAttr == NULL)
-   {
-   log_trace(WHERE, "E: alloc error for attribute");
-   return (CKR_HOST_MEMORY);
-   }
-memset(pObject->pAttr, 0, ulCount * sizeof(CK_ATTRIBUTE));
-
-//set the size of the object attributes
-pObject->count = ulCount;
-
-//copy the template to the new object
-ret = p11_copy_object(pTemplate, ulCount, pObject->pAttr);
+//copy the template to the new object, in the slot's arena
+ret = p11_copy_slot_object(pSlot, pTemplate, ulCount, pObject);
 if (ret)
    {
-   log_trace(WHERE, "E: p11_copy_object() returned %d", ret);
+   log_trace(WHERE, "E: p11_copy_slot_object() returned %d", ret);
    goto cleanup;
    }
 
 //CKA_TOKEN
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_TOKEN, (CK_VOID_PTR) &bToken, sizeof(CK_BBOOL));
+ret = p11_set_object_value(pObject, CKA_TOKEN, (CK_VOID_PTR) &bToken, sizeof(CK_BBOOL));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_TOKEN) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_TOKEN) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_CLASS
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_CLASS, (CK_VOID_PTR) &type, sizeof(CK_ULONG));
+ret = p11_set_object_value(pObject, CKA_CLASS, (CK_VOID_PTR) &type, sizeof(CK_ULONG));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_CLASS) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_CLASS) returned %d", ret);
    goto cleanup;
    }
  
 //CKA_PRIVATE
-ret = p11_set_attribute_value(pObject->pAttr, ulCount, CKA_PRIVATE, (CK_VOID_PTR) &bPrivate, sizeof(CK_BBOOL));
+ret = p11_set_object_value(pObject, CKA_PRIVATE, (CK_VOID_PTR) &bPrivate, sizeof(CK_BBOOL));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_PRIVATE) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_PRIVATE) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_LABEL
-ret = p11_set_attribute_value(pObject->pAttr, pObject->count, CKA_LABEL, plabel, labelLen);
+ret = p11_set_object_value(pObject, CKA_LABEL, plabel, labelLen);
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_LABEL) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_LABEL) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_VALUE
-ret = p11_set_attribute_value(pObject->pAttr, pObject->count, CKA_VALUE, pvalue, valueLen);
+ret = p11_set_object_value(pObject, CKA_VALUE, pvalue, valueLen);
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_VALUE) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_VALUE) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_VALUE_LEN
-ret = p11_set_attribute_value(pObject->pAttr, pObject->count, CKA_VALUE_LEN, &valueLen, sizeof(CK_ULONG));
+ret = p11_set_object_value(pObject, CKA_VALUE_LEN, &valueLen, sizeof(CK_ULONG));
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_VALUE_LEN) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_VALUE_LEN) returned %d", ret);
    goto cleanup;
    }
 
 //CKA_OBJECT_ID
-ret = p11_set_attribute_value(pObject->pAttr, pObject->count, CKA_OBJECT_ID, pobjectID, objectIDLen);
+ret = p11_set_object_value(pObject, CKA_OBJECT_ID, pobjectID, objectIDLen);
 if (ret)
    {
-   log_trace(WHERE, "E: p11_set_attribute_value(CKA_OBJECT_ID) returned %d", ret);
+   log_trace(WHERE, "E: p11_set_object_value(CKA_OBJECT_ID) returned %d", ret);
    goto cleanup;
    }
 
@@ -627,6 +708,12 @@ void p11_clean_object(P11_OBJECT *pObject)
 		return;
 	if(pObject->count > MAX_OBJECT_SIZE)
 		return;
+	//attributes in the slot's arena are freed all at once by p11_arena_release()
+	if (pObject->pArena != NULL)
+	{
+		pObject->pAttr = NULL;
+		pObject->pArena = NULL;
+	}
 	//remove attributes from object
 	if (pObject->pAttr != NULL)
 	{
@@ -682,13 +769,16 @@ CK_RV p11_find_slot_object(P11_SLOT *pSlot, CK_ULONG type, CK_ULONG id,  P11_OBJ
 {
 CK_RV ret = CKR_OK;
 P11_OBJECT *pObject = NULL;
-unsigned int h = 0;
+CK_OBJECT_HANDLE h = 0;
 CK_VOID_PTR  p = NULL;
 CK_ULONG     l = 0;
+CK_ATTRIBUTE search = { CKA_ID, NULL, sizeof(CK_ULONG) };
 
 *ppObject = NULL;
+search.pValue = &id;
 
-for (h=1; h <= pSlot->nobjects; h++)
+//only visit the objects with this CKA_ID
+for (h = p11_index_next(pSlot, &search, 1, 1); h != 0; h = p11_index_next(pSlot, &search, 1, h + 1))
    {
    pObject = p11_get_slot_object(pSlot, h);
    if (pObject == NULL)
@@ -698,11 +788,6 @@ for (h=1; h <= pSlot->nobjects; h++)
       goto cleanup;
       }
 
-   ret = p11_get_attribute_value(pObject->pAttr, pObject->count, CKA_ID, &p, &l);
-   if ( (ret != 0) || ( l!= sizeof(CK_ULONG)) || (memcmp(p, &id, sizeof(CK_ULONG)) != 0) )
-      {
-      continue;
-      }
    ret = p11_get_attribute_value(pObject->pAttr, pObject->count, CKA_CLASS, &p, &l);
    if ( (ret != 0) || ( l!= sizeof(CK_ULONG)) || (memcmp(p, &type, sizeof(CK_ULONG)) != 0) )
       {
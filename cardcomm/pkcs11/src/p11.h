@@ -78,9 +78,10 @@ extern "C"
 #define SIGN_TYPE_NONREP		1
 #define SIGN_TYPE_DIGSIG		2
 
-#define SESSION_TAB_STEP_SIZE 10
 #define OBJECT_TAB_STEP_SIZE 3
 
+#define P11_SLOT_NONE         ((CK_SLOT_ID) -1)
+
 #define P11_SESSION_INVALID   -1000
 #define P11_SESSION_VALID      1
 #define P11_SLOT_OBJECT_ERROR -1001
@@ -134,14 +135,37 @@ extern "C"
 	} P11_TOKEN;
 #endif
 
+#define P11_INDEX_KEYS     4	//CKA_OBJECT_ID, CKA_LABEL, CKA_ID and CKA_CLASS, see objectindex.h
+#define P11_INDEX_BUCKETS  32
+
+	typedef struct P11_ARENA_BLOCK
+	{
+		struct P11_ARENA_BLOCK *pNext;
+		CK_ULONG size;
+		CK_ULONG used;
+	} P11_ARENA_BLOCK;
+
+	typedef struct P11_ARENA
+	{
+		P11_ARENA_BLOCK *pBlocks;	//the block that is being filled comes first, see arena.h
+	} P11_ARENA;
+
 	typedef struct P11_OBJECT
 	{
 		int inuse;
 		int state;
 		CK_ATTRIBUTE_PTR pAttr;
 		CK_ULONG count;
+		P11_ARENA *pArena;	//where pAttr and the values live, NULL if they were malloc'ed
+		unsigned int hnext[P11_INDEX_KEYS];	//next object in the same index bucket, 0 ends the chain
 	} P11_OBJECT;
 
+	typedef struct P11_OBJECT_INDEX
+	{
+		int valid;
+		unsigned int bucket[P11_INDEX_KEYS][P11_INDEX_BUCKETS];
+	} P11_OBJECT_INDEX;
+
 
 	typedef struct P11_SLOT
 	{
@@ -154,8 +178,11 @@ extern "C"
 //P11_TOKEN      token;
 		P11_OBJECT *pobjects;
 		unsigned int nobjects;
+		P11_OBJECT_INDEX index;
+		P11_ARENA arena;
 		void *pReader;	//CReader
 		CK_ULONG ulCardDataCached;
+		CK_ULONG ulGeneration;	//CReader generation the objects belong to, 0 = not known
 	} P11_SLOT;
 
 //pReader = &oReader;
@@ -181,6 +208,9 @@ extern "C"
 	typedef struct P11_SESSION
 	{
 		int inuse;
+		CK_SESSION_HANDLE handle;	//0 while the entry is free, see sessiontable.h
+		unsigned int generation;
+		unsigned int next_free;
 		CK_SLOT_ID hslot;
 		CK_FLAGS flags;
 		CK_VOID_PTR pdNotify;
@@ -228,6 +258,7 @@ extern "C"
 		unsigned int l_hash;
 		char *pbuf;
 		unsigned int lbuf;
+		unsigned int cbuf;	//allocated size of pbuf, grows geometrically up to l_sign
 	} P11_SIGN_DATA;
 
 
@@ -262,13 +293,15 @@ extern "C"
 
 	P11_SLOT *p11_get_slot(CK_SESSION_HANDLE h);
 	CK_RV p11_get_session(CK_SESSION_HANDLE h, P11_SESSION ** ppSession);
+	CK_SLOT_ID p11_lock_session(CK_SESSION_HANDLE h);
 	P11_OBJECT *p11_get_slot_object(P11_SLOT * pSlot, CK_SESSION_HANDLE h);
 	int p11_get_nreaders(void);
 
 	CK_RV p11_close_sessions_finalize(void);
 	CK_RV p11_close_session(P11_SLOT *, P11_SESSION *);
 	CK_RV p11_close_all_sessions(CK_SLOT_ID slotID);
-	CK_RV p11_get_free_session(CK_SESSION_HANDLE_PTR phSession,
+	CK_RV p11_get_free_session(CK_SLOT_ID hSlot,
+				   CK_SESSION_HANDLE_PTR phSession,
 				   P11_SESSION ** ppSession);
 	CK_RV p11_get_attribute_value(CK_ATTRIBUTE_PTR pTemplate,
 				      CK_ULONG ulCount,
@@ -278,6 +311,9 @@ extern "C"
 				      CK_ULONG ulCount,
 				      CK_ATTRIBUTE_TYPE type,
 				      CK_VOID_PTR pVoid, CK_ULONG len);
+	CK_RV p11_set_object_value(P11_OBJECT * pObject,
+				   CK_ATTRIBUTE_TYPE type,
+				   CK_VOID_PTR pVoid, CK_ULONG len);
 	CK_RV p11_copy_object(CK_ATTRIBUTE_PTR pTemplate, CK_ULONG ulCount,
 			      CK_ATTRIBUTE_PTR pObject);
 	CK_RV p11_add_slot_ID_object(P11_SLOT * pSlot,
@@ -299,6 +335,7 @@ extern "C"
 	void p11_clean_finddata(P11_FIND_DATA * pFindData);
 	CK_RV p11_find_slot_object(P11_SLOT * pSlot, CK_ULONG type,
 				   CK_ULONG id, P11_OBJECT ** pphObject);
+	void p11_init_label_flags(void);
 	int p11_attribute_present(CK_ATTRIBUTE_TYPE type,
 				  CK_ATTRIBUTE_PTR pTemplate,
 				  CK_ULONG ulCount);
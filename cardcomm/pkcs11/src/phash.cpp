@@ -50,19 +50,37 @@ int hash_init(CK_MECHANISM_PTR pMechanism, void **pphashinfo,
 		case CKM_SHA256:
 		case CKM_SHA256_RSA_PKCS_PSS:
 		case CKM_SHA256_RSA_PKCS:
+		case CKM_ECDSA_SHA256:
 			algo = ALGO_SHA256;
 			*size = 32;
 			break;
 		case CKM_SHA384:
 		case CKM_SHA384_RSA_PKCS:
+		case CKM_ECDSA_SHA384:
 			algo = ALGO_SHA384;
 			*size = 48;
 			break;
 		case CKM_SHA512:
 		case CKM_SHA512_RSA_PKCS:
+		case CKM_ECDSA_SHA512:
 			algo = ALGO_SHA512;
 			*size = 64;
 			break;
+		case CKM_SHA3_256:
+		case CKM_ECDSA_SHA3_256:
+			algo = ALGO_SHA3_256;
+			*size = 32;
+			break;
+		case CKM_SHA3_384:
+		case CKM_ECDSA_SHA3_384:
+			algo = ALGO_SHA3_384;
+			*size = 48;
+			break;
+		case CKM_SHA3_512:
+		case CKM_ECDSA_SHA3_512:
+			algo = ALGO_SHA3_512;
+			*size = 64;
+			break;
 		case CKM_RIPEMD160:
 		case CKM_RIPEMD160_RSA_PKCS:
 			algo = ALGO_RIPEMD160;
@@ -92,9 +110,9 @@ int hash_update(void *phashinfo, char *p, unsigned long l)
 {
 	int ret = CKR_OK;
 	CHash *oHash = (CHash *) phashinfo;
-	CByteArray data((unsigned char *) p, l);
 
-	oHash->Update(data);
+	//hash the caller's buffer as is, without copying it into a CByteArray first
+	oHash->Update((const unsigned char *) p, l);
 
 	return (ret);
 }
@@ -125,3 +143,11 @@ int hash_final(void *phashinfo, unsigned char *p, unsigned long *l)
 }
 
 #undef WHERE
+
+
+
+/* drop a hash that won't be finished */
+void hash_free(void *phashinfo)
+{
+	delete((CHash *) phashinfo);
+}
@@ -33,6 +33,7 @@ extern "C"
 		      unsigned int *size);
 	int hash_update(void *phashinfo, char *p, unsigned long l);
 	int hash_final(void *phashinfo, unsigned char *p, unsigned long *l);
+	void hash_free(void *phashinfo);
 
 
 #ifdef __cplusplus
@@ -33,6 +33,7 @@
 #include "pkcs11log.h"
 #include "util.h"
 #include "configbase.h"
+#include "logqueue.h"
 
 /******************************************************************************
  *
@@ -64,11 +65,63 @@ static inline void sprintf_s(char* dest,size_t size, char* format,...) {
  *
  ******************************************************************************/
 
-unsigned int g_uiLogLevel          = LOG_LEVEL_PKCS11_NONE;
+volatile unsigned int g_uiLogLevel = LOG_LEVEL_PKCS11_NONE;
 
 
 void *logmutex = NULL;
 char g_szLogFile[MAX_PATH];
+static int g_logSink = -1;
+
+/******************************************************************************
+ *
+ * log_append: append to a line that is handed to logq_write() as a whole
+ *
+ ******************************************************************************/
+static void log_vappend(char *buf, size_t size, size_t *used, const char *format, va_list args)
+{
+	int n;
+
+	if (*used + 1 >= size)
+		return;
+#ifdef WIN32
+	n = _vsnprintf_s(buf + *used, size - *used, _TRUNCATE, format, args);
+#else
+	n = vsnprintf(buf + *used, size - *used, format, args);
+#endif
+	if (n < 0 || (size_t)n >= size - *used)
+		*used = size - 1;	// truncated
+	else
+		*used += n;
+}
+
+static void log_append(char *buf, size_t size, size_t *used, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	log_vappend(buf, size, used, format, args);
+	va_end(args);
+}
+
+static void log_timestamp(char *asctime, size_t size)
+{
+	time_t        ltime;
+	struct tm     stime;
+
+	time(&ltime);
+#ifdef WIN32
+	localtime_s(&stime, &ltime );
+#else
+	localtime_r(&ltime, &stime);
+#endif
+	sprintf_s(asctime,size, "%02d.%02d.%04d %02d:%02d:%02d",
+		stime.tm_mday,
+		stime.tm_mon+1,
+		stime.tm_year+1900,
+		stime.tm_hour,
+		stime.tm_min,
+		stime.tm_sec);
+}
 
 /******************************************************************************
  *
@@ -77,8 +130,6 @@ char g_szLogFile[MAX_PATH];
  ******************************************************************************/
 void log_init(char *pszLogFile, unsigned int uiLogLevel)
 {
-	FILE          *fp = NULL;
-
 #ifdef WIN32
 	DWORD         dwRet;
 	DWORD       dwData = 0; 
@@ -161,13 +212,15 @@ void log_init(char *pszLogFile, unsigned int uiLogLevel)
 #endif
 
 
+  g_logSink = logq_sink(g_szLogFile, P11_LOG_MAX_SIZE, 1);
+#ifndef WIN32
   //this will empty the logfile automatically
-#ifdef WIN32
-  if ((fopen_s(&fp,g_szLogFile, "a")) == 0)
-#else
-  if ((fp = fopen(g_szLogFile, "w")) != NULL)
+  logq_truncate(g_logSink);
 #endif
-     fclose(fp);
+
+  //the lines are written by a background thread until C_Finalize
+  if ((g_uiLogLevel & 0x0F) != LOG_LEVEL_PKCS11_NONE)
+     logq_start();
 
   util_unlock(logmutex);
 }
@@ -175,120 +228,56 @@ void log_init(char *pszLogFile, unsigned int uiLogLevel)
 
 int log_level_approved(const char *string)
 {
-	unsigned int  level = g_uiLogLevel & 0x0F;
-
   if(string == NULL) {
     return 1;
   }
-	// evaluate debug level
-  if (string[1] == ':')
-  {
-    switch (string[0])
-    {
-      case 'I':
-        if (level  < LOG_LEVEL_PKCS11_INFO) 
-          return 0;
-        break;
-
-      case 'S':
-        if (level  < LOG_LEVEL_PKCS11_DEBUG) 
-          return 0;
-        break;
-
-      case 'W':
-        if (level < LOG_LEVEL_PKCS11_WARNING) 
-          return 0;
-        break;
-
-      case 'E':
-				if (level < LOG_LEVEL_PKCS11_ERROR)
-					return 0;
-        break;
-
-      default:
-        return 0;
-    }
-  }
-	return 1;
+  return LOG_STRING_LEVEL(string) <= (g_uiLogLevel & 0x0F);
 }
 /******************************************************************************
  *
- * log_trace
+ * log_trace_write
  *
  ******************************************************************************/
-#ifdef __GNUC__
-#define GCC_UNUSED __attribute__((unused))
-#else
-#define GCC_UNUSED
-#endif
-void log_trace(const char *where, const char *string,... )
+void log_trace_write(const char *where, const char *string,... )
 {
-  int           ret GCC_UNUSED;
-  static char   buf[0x4000];    
+  char          line[0x4000];
+  size_t        used = 0;
   va_list       args;
-  FILE          *fp = NULL;
-  time_t        ltime;  
-  struct tm     stime;
   char          asctime[21];
 
   // evaluate log level
   if (!log_level_approved(string))
 		return;
 
-  util_lock(logmutex);
-
+  log_timestamp(asctime, sizeof(asctime));
 #ifdef WIN32
-  if ((fopen_s(&fp, g_szLogFile, "a")) != 0)
+  log_append(line, sizeof(line), &used, "%d %d %19s %-26s | ", GetCurrentProcessId(), GetCurrentThreadId(), asctime, where);
 #else
-  if ((fp = fopen(g_szLogFile, "a")) == NULL)
+  log_append(line, sizeof(line), &used, "%19s %-26s | ", asctime, where);
 #endif
-    CLEANUP(0);
-  
+
    va_start(args, string);                                       // get args from param-string     
-#ifdef WIN32
-    _vsnprintf_s(buf, sizeof(buf), sizeof(buf), string, args);     // convert to string    
-#else
-  vsnprintf(buf, sizeof(buf), string, args);    // convert to string    
-#endif
+  log_vappend(line, sizeof(line), &used, string, args);         // convert to string    
    va_end(args);                                                               // free arguments
 
 #ifdef EIDMW_DEBUG
-  printf("%s %s\n", where, buf);
-#endif
-
-  time(&ltime);
-#ifdef WIN32
-	localtime_s(&stime, &ltime );
-#else
-	stime = *(localtime(&ltime ));
-#endif
-  
-	sprintf_s(asctime,sizeof(asctime), "%02d.%02d.%04d %02d:%02d:%02d",
-		stime.tm_mday,
-		stime.tm_mon+1,
-		stime.tm_year+1900,
-		stime.tm_hour,
-		stime.tm_min,
-		stime.tm_sec);
-#ifdef WIN32
-  fprintf(fp, "%d %d %19s %-26s | %s\n",GetCurrentProcessId(), GetCurrentThreadId(), asctime, where, buf);
-#else
-  fprintf(fp, "%19s %-26s | %s\n", asctime, where, buf);
+  printf("%s\n", line);
 #endif
-  fclose(fp);
 
-cleanup:
-  util_unlock(logmutex);
-  return;
+  if (used + 1 >= sizeof(line))
+     line[used - 1] = '\n';
+  else
+     line[used++] = '\n';
+  logq_write(g_logSink, line, used);
 }
 
 /******************************************************************************
  *
- * log_xtrace
+ * log_xtrace_write
  *
  ******************************************************************************/
 void _log_xtrace(char *text, void *data, int l_data);
-void log_xtrace(const char *where, char *string,void *data,int len)
+void log_xtrace_write(const char *where, char *string,void *data,int len)
 {
   static  char  hex[]="0123456789abcdef";
   int           a;
@@ -298,9 +287,9 @@ void log_xtrace(const char *where, char *string,void *data,int len)
   char          buff1[40];
   char          buff2[20];  
 
-  FILE          *fp = NULL;
-  time_t        ltime;  
-  struct tm     stime;
+  char          *line;
+  size_t        size;
+  size_t        used = 0;
   char          asctime[21];
   
 	// evaluate log level
@@ -310,44 +299,28 @@ void log_xtrace(const char *where, char *string,void *data,int len)
   if (string != NULL)
 	string += 2;
 
-  util_lock(logmutex);
 #ifdef EIDMW_DEBUG
   _log_xtrace(string, data, len);
 #endif
 
-#ifdef WIN32
-  if ((fopen_s(&fp,g_szLogFile, "a")) != 0)
-#else
-  if ((fp = fopen(g_szLogFile, "a")) == NULL)
-#endif
-    goto cleanup;
-        
-   time(&ltime);
-#ifdef WIN32
-	localtime_s(&stime, &ltime );
-#else
-	stime = *(localtime(&ltime ));
-#endif
-   
-  sprintf_s(asctime,sizeof(asctime), "%02d.%02d.%04d %02d:%02d:%02d", 
-		stime.tm_mday,
-		stime.tm_mon+1,
-		stime.tm_year+1900,
-		stime.tm_hour,
-		stime.tm_min,
-		stime.tm_sec);
+  // the whole dump is queued as one piece, so it isn't mixed with other lines
+  size = 128 + (where ? strlen(where) : 0) + (string ? strlen(string) : 0) + (len > 0 ? ((size_t)len + 15) / 16 * 80 : 0);
+  if ((line = (char *)malloc(size)) == NULL)
+    return;
+
+  log_timestamp(asctime, sizeof(asctime));
   
 if (where)
    {
    if(string != NULL) 
-      fprintf(fp, "%19s | %-26s | %s\n", asctime, where, string);
+      log_append(line, size, &used, "%19s | %-26s | %s\n", asctime, where, string);
    else
-      fprintf(fp, "%19s | %-26s | \n", asctime, where);    
+      log_append(line, size, &used, "%19s | %-26s | \n", asctime, where);    
    }
 else
    {
    if(string != NULL) 
-      fprintf(fp, "%s\n", string);
+      log_append(line, size, &used, "%s\n", string);
    }
 
   dt=(char *)data;
@@ -371,17 +344,14 @@ else
       }
       *x=0;
 
-      fprintf(fp, "%-6x | %-38s |%-16s\n", adr, buff1, buff2);
+      log_append(line, size, &used, "%-6x | %-38s |%-16s\n", adr, buff1, buff2);
       len-=16;
       dt+=16;
       adr+=16;
       }
 
-  fclose(fp);
-
-cleanup:
-  util_unlock(logmutex);
-  return;
+  logq_write(g_logSink, line, used);
+  free(line);
 }
 
 
@@ -431,7 +401,7 @@ void _log_xtrace(char *text, void *data, int l_data)
    }
 }
 
-void log_template(const char *string, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG count)
+void log_template_write(const char *string, CK_ATTRIBUTE_PTR pTemplate, CK_ULONG count)
 {
 	// evaluate log level
   if (!log_level_approved(string))
@@ -517,7 +487,8 @@ void log_attr(CK_ATTRIBUTE_PTR pAttr)
 {
   const char *ctype = NULL;
   int       logtype = 0;
-  FILE      *fp = NULL;
+  char      line[512];
+  size_t    used = 0;
   char      string[129];
   const char *s;
   unsigned long  len = 0;
@@ -527,27 +498,18 @@ void log_attr(CK_ATTRIBUTE_PTR pAttr)
   if (pAttr == NULL)
      return;
 
-  util_lock(logmutex);
-
-#ifdef WIN32
-  if ((fopen_s(&fp,g_szLogFile, "a")) != 0)
-#else
-  if ((fp = fopen(g_szLogFile, "a")) == NULL)
-#endif
-     goto cleanup;
-
   map_log_info(pAttr->type, &ctype, &logtype);
 
   //log attribute type
   if (ctype)
-     fprintf(fp, "\nAttribute type : %s\n", ctype); 
+     log_append(line, sizeof(line), &used, "\nAttribute type : %s\n", ctype); 
   else
-     fprintf(fp, "\nAttribute type : ??? (0x%0lx)\n", pAttr->type); 
+     log_append(line, sizeof(line), &used, "\nAttribute type : ??? (0x%0lx)\n", pAttr->type); 
 
   //log value
   if (pAttr->pValue == NULL)
      {
-     fprintf(fp, "Attribute Value: NULL\n");
+     log_append(line, sizeof(line), &used, "Attribute Value: NULL\n");
      goto cleanup;
      }
 
@@ -556,40 +518,40 @@ void log_attr(CK_ATTRIBUTE_PTR pAttr)
      case T_TYPE:
         if (pAttr->ulValueLen != sizeof(CK_ULONG))
            {
-           fprintf(fp, "Attribute Value: INVALID size for Value (CK_ULONG)\n)");
+           log_append(line, sizeof(line), &used, "Attribute Value: INVALID size for Value (CK_ULONG)\n)");
            break;
            }
         memcpy(&ul, (CK_ULONG*) pAttr->pValue, sizeof(CK_ULONG));
         s = get_type_string(pAttr->type, ul);
-        fprintf(fp, "Attribute Value: %s\n", s);
+        log_append(line, sizeof(line), &used, "Attribute Value: %s\n", s);
         break;
 
      case T_BOOL:
         if (pAttr->ulValueLen != sizeof(CK_BBOOL))
            {
-           fprintf(fp, "Attribute Value: INVALID size for Value (CK_BBOOL)\n)");
+           log_append(line, sizeof(line), &used, "Attribute Value: INVALID size for Value (CK_BBOOL)\n)");
            break;
            }
         memcpy(&b, pAttr->pValue, sizeof(CK_BBOOL));
-        fprintf(fp, b == CK_TRUE ? "Attribute Value: TRUE\n":"Value: FALSE\n"); 
+        log_append(line, sizeof(line), &used, b == CK_TRUE ? "Attribute Value: TRUE\n":"Value: FALSE\n"); 
         break;
 
      case T_STRING:
         len = pAttr->ulValueLen <= 128 ? pAttr->ulValueLen:128;
         memcpy(string, pAttr->pValue, len);
         string[len]=0;
-        fprintf(fp, "Attribute Value: %s\n", string); 
+        log_append(line, sizeof(line), &used, "Attribute Value: %s\n", string); 
         break;
 
      case T_UL:
         if (pAttr->ulValueLen != sizeof(CK_ULONG))
            {
-           fprintf(fp, "Attribute Value: INVALID size for CK_ULONG\n)");
+           log_append(line, sizeof(line), &used, "Attribute Value: INVALID size for CK_ULONG\n)");
            break;
            }
          
         memcpy(&ul, (CK_ULONG*) pAttr->pValue, sizeof(CK_ULONG));
-        fprintf(fp, "Attribute Value: 0x%lx\n",  ul); 
+        log_append(line, sizeof(line), &used, "Attribute Value: 0x%lx\n",  ul); 
         break;
 
      default: ;
@@ -597,20 +559,18 @@ void log_attr(CK_ATTRIBUTE_PTR pAttr)
         if (pAttr->ulValueLen <= sizeof(CK_ULONG))
            {
            memcpy(&ul, pAttr->pValue, pAttr->ulValueLen);
-           fprintf(fp, "Attribute Value: 0x%lx\n",  ul); 
+           log_append(line, sizeof(line), &used, "Attribute Value: 0x%lx\n",  ul); 
            }
         else
            {
-           fclose(fp);
-           fp = NULL;
+           logq_write(g_logSink, line, used);
+           used = 0;
            log_xtrace(0, "Attribute Value: ", pAttr->pValue, (int)(pAttr->ulValueLen));
            }
      }
  
 cleanup:
-  util_unlock(logmutex);
-  if (fp)
-     fclose(fp);
+  logq_write(g_logSink, line, used);
 }
 
 
@@ -44,6 +44,9 @@ extern "C"
 #endif
 #endif
 
+/* once p11.log reaches this size it is moved to p11.log.1 */
+#define P11_LOG_MAX_SIZE	(10 * 1024 * 1024)
+
 	typedef struct P11_MAP_TYPE
 	{
 		CK_ULONG ultype;
@@ -163,14 +166,55 @@ extern "C"
  *
  ******************************************************************************/
 	extern void log_init(char *pszLogFile, unsigned int uiLogLevel);
-	extern void log_trace(const char *where, const char *string, ...);
-	extern void log_xtrace(const char *where, char *string, void *data,
+	extern void log_trace_write(const char *where, const char *string, ...);
+	extern void log_xtrace_write(const char *where, char *string, void *data,
 			       int len);
 	void log_attr(CK_ATTRIBUTE_PTR pAttr);
-	void log_template(const char *string, CK_ATTRIBUTE_PTR pTemplate,
+	void log_template_write(const char *string, CK_ATTRIBUTE_PTR pTemplate,
 			  CK_ULONG count);
 	char *log_map_error(CK_RV err);
 
+	extern volatile unsigned int g_uiLogLevel;
+
+/******************************************************************************
+ *
+ * Level-gated entry points: the arguments are only evaluated if the string's
+ * "E:", "W:", "I:" or "S:" prefix passes the log level.
+ *
+ ******************************************************************************/
+
+/* Messages above this level are left out at compile time (see --disable-debug-log) */
+#ifdef BEID_NO_DEBUG_LOG
+#define LOG_LEVEL_PKCS11_MAX	LOG_LEVEL_PKCS11_INFO
+#else
+#define LOG_LEVEL_PKCS11_MAX	LOG_LEVEL_PKCS11_DEBUG
+#endif
+
+/* The level of a log string from its prefix: 0 (always logged) if there's
+ * none, 0xFF (never logged) if the prefix isn't known */
+#define LOG_STRING_LEVEL(s) \
+	((s)[0] == '\0' || (s)[1] != ':' ? 0 : \
+	 (s)[0] == 'E' ? LOG_LEVEL_PKCS11_ERROR : \
+	 (s)[0] == 'W' ? LOG_LEVEL_PKCS11_WARNING : \
+	 (s)[0] == 'I' ? LOG_LEVEL_PKCS11_INFO : \
+	 (s)[0] == 'S' ? LOG_LEVEL_PKCS11_DEBUG : 0xFF)
+
+#define LOG_ON(s) \
+	(LOG_STRING_LEVEL(s) <= LOG_LEVEL_PKCS11_MAX && LOG_STRING_LEVEL(s) <= (g_uiLogLevel & 0x0F))
+
+/* the first of the arguments; LOG_EXPAND() is for MSVC, which would pass
+ * __VA_ARGS__ on as a single argument */
+#define LOG_EXPAND(x)		x
+#define LOG_FIRST_(s, ...)	s
+#define LOG_FIRST(...)		LOG_EXPAND(LOG_FIRST_(__VA_ARGS__, 0))
+
+#define log_trace(where, ...) \
+	do { if (LOG_ON(LOG_FIRST(__VA_ARGS__))) log_trace_write(where, __VA_ARGS__); } while (0)
+#define log_xtrace(where, string, data, len) \
+	do { if (LOG_ON(string)) log_xtrace_write(where, string, data, len); } while (0)
+#define log_template(string, pTemplate, count) \
+	do { if (LOG_ON(string)) log_template_write(string, pTemplate, count); } while (0)
+
 #ifdef __cplusplus
 }
 #endif
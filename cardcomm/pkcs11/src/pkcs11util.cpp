@@ -22,6 +22,7 @@
 //#include <stdlib.h>
 //#include <string.h>
 #include "beid_p11.h"
+#include "p11.h"
 #include "mutex.h"
 #include "util.h"
 #include "thread.h"
@@ -37,6 +38,15 @@ static CK_C_INITIALIZE_ARGS_PTR _locking;
 static void *_lock = NULL;
 static unsigned char g_initialized = BEIDP11_NOT_INITIALIZED;
 
+//SLOT LOCKING
+//The global lock above only protects the slot and session tables; everything
+//that talks to a card is done while holding the lock of that card's slot, so
+//that different readers can be used at the same time.
+//Lock order: slot locks (in ascending slot order) before the global lock,
+//never wait for a slot lock while holding the global lock.
+static CMutex g_slot_mutex[MAX_SLOTS];
+static void *_slot_lock[MAX_SLOTS];
+
 
 void p11_set_init(unsigned char initialized)
 {
@@ -76,6 +86,7 @@ void strcpy_n(unsigned char *to, const char *from, size_t n, char padding)
 CK_RV p11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
 {
 	CK_RV ret = CKR_OK;
+	unsigned int i;
 
 	if (_lock)
 		return CKR_OK;
@@ -114,6 +125,8 @@ CK_RV p11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
                  return CKR_OK;
 #endif*/
 		_lock = (void *) &g_mutex;
+		for (i = 0; i < MAX_SLOTS; i++)
+			_slot_lock[i] = (void *) &g_slot_mutex[i];
 		//g_Mutex = new CMutex();
 		//if (g_Mutex == NULL)
 		//   ret = CKR_CANT_LOCK;
@@ -122,8 +135,31 @@ CK_RV p11_init_lock(CK_C_INITIALIZE_ARGS_PTR args)
 	else if (args->CreateMutex && args->DestroyMutex && args->LockMutex && args->UnlockMutex)
 	{
 		ret = args->CreateMutex(&_lock);
+		if (ret != CKR_OK)
+		{
+			_lock = NULL;
+			return ret;
+		}
+		for (i = 0; i < MAX_SLOTS; i++)
+		{
+			ret = args->CreateMutex(&_slot_lock[i]);
+			if (ret != CKR_OK)
+				break;
+		}
 		if (ret == CKR_OK)
 			_locking = args;
+		else
+		{
+			//don't leave the app with half of its mutexes created
+			_slot_lock[i] = NULL;
+			while (i-- > 0)
+			{
+				args->DestroyMutex(_slot_lock[i]);
+				_slot_lock[i] = NULL;
+			}
+			args->DestroyMutex(_lock);
+			_lock = NULL;
+		}
 	}
 #define CreateMutex CreateMutexW
 
@@ -175,9 +211,60 @@ void p11_unlock()
 	__p11_unlock(_lock);
 }
 
+void p11_lock_slot(CK_SLOT_ID slotID)
+{
+	void *lock;
+
+	if ((slotID >= MAX_SLOTS) || !(lock = _slot_lock[slotID]))
+		return;
+	if (_locking)
+	{
+		while (_locking->LockMutex(lock) != CKR_OK)
+			;
+	} else
+	{
+		((CMutex *) lock)->Lock();
+	}
+}
+
+void p11_unlock_slot(CK_SLOT_ID slotID)
+{
+	void *lock;
+
+	if ((slotID >= MAX_SLOTS) || !(lock = _slot_lock[slotID]))
+		return;
+	if (_locking)
+	{
+		while (_locking->UnlockMutex(lock) != CKR_OK) ;
+	} else
+	{
+		((CMutex *) lock)->Unlock();
+	}
+}
+
 /*
- * Free the lock - note the lock must be held when
- * you come here (and not nested)
+ * For the things that change the slot list itself
+ * (and for C_Finalize): wait until no slot is in use
+ */
+void p11_lock_all_slots()
+{
+	CK_SLOT_ID slotID;
+
+	for (slotID = 0; slotID < MAX_SLOTS; slotID++)
+		p11_lock_slot(slotID);
+}
+
+void p11_unlock_all_slots()
+{
+	CK_SLOT_ID slotID = MAX_SLOTS;
+
+	while (slotID-- > 0)
+		p11_unlock_slot(slotID);
+}
+
+/*
+ * Free the lock - note the lock and all slot locks must
+ * be held when you come here (and not nested)
  */
 void p11_free_lock()
 {
@@ -185,6 +272,7 @@ void p11_free_lock()
 	void *tempLock;
 
 	int counter = 0;
+	CK_SLOT_ID slotID;
 
 	if (!(tempLock = _lock))
 		return;
@@ -215,6 +303,15 @@ void p11_free_lock()
 		//g_mutex will always be there
 		//sc_mutex_free((sc_mutex_t *) tempLock);
 	}
+
+	for (slotID = 0; slotID < MAX_SLOTS; slotID++)
+	{
+		p11_unlock_slot(slotID);
+		if (_locking)
+			_locking->DestroyMutex(_slot_lock[slotID]);
+		//g_slot_mutex will always be there as well
+		_slot_lock[slotID] = NULL;
+	}
 	_locking = NULL;
 }
 
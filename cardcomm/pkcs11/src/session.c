@@ -26,6 +26,7 @@
 #include "pkcs11log.h"
 #include "util.h"
 #include "cal.h"
+#include "sessiontable.h"
 
 #define WHERE "C_OpenSession()"
 CK_RV C_OpenSession(CK_SLOT_ID            slotID,        /* the slot's ID */
@@ -48,7 +49,7 @@ CK_RV C_OpenSession(CK_SLOT_ID            slotID,        /* the slot's ID */
 	}		
 
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	log_trace(WHERE, "S: C_OpenSession (slot %d)", slotID);
 
@@ -83,7 +84,7 @@ CK_RV C_OpenSession(CK_SLOT_ID            slotID,        /* the slot's ID */
 	}
 
 	//get a free session object reserve it by setting inuse flag
-	ret = p11_get_free_session(phSession, &pSession);
+	ret = p11_get_free_session(slotID, phSession, &pSession);
 	if (ret != CKR_OK)
 	{
 		log_trace(WHERE, "E: p11_get_free_session() returns %d", ret);
@@ -96,11 +97,10 @@ CK_RV C_OpenSession(CK_SLOT_ID            slotID,        /* the slot's ID */
 	{
 		log_trace(WHERE, "E: cal_connect(slot %d) failed", slotID);
 		//release session so it can be reused
-		pSession->inuse = 0;
+		p11_session_free(pSession);
 		goto cleanup;
 	}
 
-	pSession->hslot = slotID;
 	pSession->flags = flags;
 	pSession->pdNotify = pApplication;
 	pSession->pfNotify = Notify;
@@ -114,7 +114,7 @@ CK_RV C_OpenSession(CK_SLOT_ID            slotID,        /* the slot's ID */
 	log_trace(WHERE, "S: Open session (slot %d: hsession = %d )", slotID, *phSession);
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -125,6 +125,7 @@ cleanup:
 #define WHERE "C_CloseSession()"
 CK_RV C_CloseSession(CK_SESSION_HANDLE hSession)
 {
+	CK_SLOT_ID hLockSlot;
 	P11_SESSION *pSession = NULL;
 	P11_SLOT *pSlot = NULL;
 	CK_RV ret;
@@ -136,7 +137,7 @@ CK_RV C_CloseSession(CK_SESSION_HANDLE hSession)
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}	
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_CloseSession (session %d)", hSession);
 
@@ -162,7 +163,7 @@ CK_RV C_CloseSession(CK_SESSION_HANDLE hSession)
 	}
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -183,13 +184,13 @@ CK_RV C_CloseAllSessions(CK_SLOT_ID slotID) /* the token's slot */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	p11_lock_slot(slotID);
 
 	log_trace(WHERE, "S: C_CloseAllSessions(slot %d)", slotID);
 
 	ret = p11_close_all_sessions(slotID);
 
-	p11_unlock();
+	p11_unlock_slot(slotID);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -201,6 +202,7 @@ CK_RV C_CloseAllSessions(CK_SLOT_ID slotID) /* the token's slot */
 CK_RV C_GetSessionInfo(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	CK_SESSION_INFO_PTR pInfo)   /* receives session information */
 {
+	CK_SLOT_ID hLockSlot;
 	CK_RV ret;
 	P11_SESSION *pSession = NULL;
 	P11_SLOT *pSlot = NULL;
@@ -213,7 +215,7 @@ CK_RV C_GetSessionInfo(CK_SESSION_HANDLE hSession,  /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_GetSessionInfo(session %d)", hSession);
 
@@ -266,7 +268,7 @@ CK_RV C_GetSessionInfo(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	}
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -304,6 +306,7 @@ CK_RV C_Login(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	CK_CHAR_PTR       pPin,      /* the user's PIN */
 	CK_ULONG          ulPinLen)  /* the length of the PIN */
 {
+	CK_SLOT_ID hLockSlot;
 	CK_RV ret;
 	P11_SESSION *pSession = NULL;
 	P11_SLOT *pSlot = NULL;
@@ -318,7 +321,7 @@ CK_RV C_Login(CK_SESSION_HANDLE hSession,  /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	memset(&tokeninfo, 0, sizeof(CK_TOKEN_INFO));
 
@@ -373,7 +376,7 @@ CK_RV C_Login(CK_SESSION_HANDLE hSession,  /* the session's handle */
 	}		
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -384,6 +387,7 @@ cleanup:
 #define WHERE "C_Logout()"
 CK_RV C_Logout(CK_SESSION_HANDLE hSession) /* the session's handle */
 {
+	CK_SLOT_ID hLockSlot;
 	CK_RV ret = CKR_OK;
 	P11_SESSION *pSession = NULL;
 	P11_SLOT *pSlot = NULL;
@@ -395,7 +399,7 @@ CK_RV C_Logout(CK_SESSION_HANDLE hSession) /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: Logout (session %d)", hSession);
 
@@ -427,7 +431,7 @@ CK_RV C_Logout(CK_SESSION_HANDLE hSession) /* the session's handle */
 	/* TODO: destroy all private session objects (we only have private token objects and they are unreadable anyway) */
 
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
@@ -454,6 +458,7 @@ CK_RV C_SetPIN(CK_SESSION_HANDLE hSession,
 	CK_CHAR_PTR pNewPin,
 	CK_ULONG ulNewLen)
 {
+	CK_SLOT_ID hLockSlot;
 	CK_RV ret;
 	P11_SESSION *pSession = NULL;
 	log_trace(WHERE, "I: enter");
@@ -464,7 +469,7 @@ CK_RV C_SetPIN(CK_SESSION_HANDLE hSession,
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-	p11_lock();
+	hLockSlot = p11_lock_session(hSession);
 
 	log_trace(WHERE, "S: C_SetPIN(session %d)", hSession);
 
@@ -477,7 +482,7 @@ CK_RV C_SetPIN(CK_SESSION_HANDLE hSession,
 
 	ret = cal_change_pin(pSession->hslot, ulOldLen, pOldPin, ulNewLen, pNewPin);
 cleanup:
-	p11_unlock();
+	p11_unlock_slot(hLockSlot);
 	log_trace(WHERE, "I: leave, ret = %i",ret);
 	return ret;
 }
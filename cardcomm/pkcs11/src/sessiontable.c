@@ -0,0 +1,152 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include "beid_p11.h"
+#include "p11.h"
+#include "sessiontable.h"
+
+#ifdef WIN32
+#include <windows.h>
+#define cas32(p, o, n) (InterlockedCompareExchange((volatile LONG *)(p), (LONG)(n), (LONG)(o)) == (LONG)(o))
+#define cas64(p, o, n) (InterlockedCompareExchange64((volatile LONGLONG *)(p), (LONGLONG)(n), (LONGLONG)(o)) == (LONGLONG)(o))
+#define barrier() MemoryBarrier()
+#else
+#define cas32(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define cas64(p, o, n) __sync_bool_compare_and_swap((p), (o), (n))
+#define barrier() __sync_synchronize()
+#endif
+
+static P11_SESSION gSessions[MAX_SESSIONS];
+//nr of entries that have been used at least once; entries above it are
+//handed out in order before the free list is used
+static volatile unsigned int gSessionCount = 0;
+//free list head: (tag << 32) | (index + 1), 0 = empty
+static volatile unsigned long long gFreeHead = 0;
+
+static P11_SESSION *pop_free(void)
+{
+	unsigned long long head, next;
+	unsigned int index;
+
+	do
+	{
+		head = gFreeHead;
+		index = (unsigned int) (head & 0xFFFFFFFF);
+		if (index == 0)
+			return NULL;
+		//the tag makes sure this fails if the entry was popped and pushed meanwhile
+		next = ((head >> 32) + 1) << 32 | gSessions[index - 1].next_free;
+	} while (!cas64(&gFreeHead, head, next));
+
+	return &gSessions[index - 1];
+}
+
+static void push_free(P11_SESSION *pSession)
+{
+	unsigned long long head, next;
+	unsigned int index = (unsigned int) (pSession - gSessions);
+
+	do
+	{
+		head = gFreeHead;
+		pSession->next_free = (unsigned int) (head & 0xFFFFFFFF);
+		next = ((head >> 32) + 1) << 32 | (index + 1);
+	} while (!cas64(&gFreeHead, head, next));
+}
+
+static P11_SESSION *take_unused(void)
+{
+	unsigned int count;
+
+	do
+	{
+		count = gSessionCount;
+		if (count >= MAX_SESSIONS)
+			return NULL;
+	} while (!cas32(&gSessionCount, count, count + 1));
+
+	return &gSessions[count];
+}
+
+CK_RV p11_session_alloc(CK_SLOT_ID hSlot, CK_SESSION_HANDLE_PTR phSession, P11_SESSION **ppSession)
+{
+	P11_SESSION *pSession;
+	unsigned int index;
+	unsigned int generation;
+
+	*ppSession = NULL;
+
+	pSession = take_unused();
+	if (pSession == NULL)
+		pSession = pop_free();
+	if (pSession == NULL)
+		return (CKR_SESSION_COUNT);
+
+	//nobody else can see the entry until its handle has been set
+	index = (unsigned int) (pSession - gSessions);
+	generation = pSession->generation;
+	memset(pSession, 0, sizeof(P11_SESSION));
+	pSession->generation = generation;
+	pSession->inuse = 1;
+	pSession->hslot = hSlot;
+	barrier();
+	pSession->handle = ((CK_SESSION_HANDLE) generation << P11_SESSION_INDEX_BITS) | (index + 1);
+
+	*ppSession = pSession;
+	*phSession = pSession->handle;
+
+	return (CKR_OK);
+}
+
+void p11_session_free(P11_SESSION *pSession)
+{
+	pSession->handle = 0;
+	pSession->inuse = 0;
+	//keep the handles within 32 bits (CK_ULONG on Windows)
+	pSession->generation = (pSession->generation + 1) & (0xFFFFFFFFUL >> P11_SESSION_INDEX_BITS);
+	barrier();
+	push_free(pSession);
+}
+
+P11_SESSION *p11_session_lookup(CK_SESSION_HANDLE h)
+{
+	unsigned long index = (unsigned long) (h & P11_SESSION_INDEX_MASK);
+	P11_SESSION *pSession;
+
+	if ((index == 0) || (index > MAX_SESSIONS))
+		return (NULL);
+
+	pSession = &gSessions[index - 1];
+	if (pSession->handle != h)
+		return (NULL);
+	barrier();
+
+	return (pSession);
+}
+
+unsigned int p11_session_count(void)
+{
+	return gSessionCount;
+}
+
+P11_SESSION *p11_session_entry(unsigned int index)
+{
+	return &gSessions[index];
+}
@@ -0,0 +1,67 @@
+
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#ifndef __sessiontable_h__
+#define __sessiontable_h__
+
+/*
+ * The session table.
+ *
+ * A fixed array of MAX_SESSIONS entries, so a P11_SESSION pointer stays
+ * valid for the lifetime of the library. Free entries are kept on a
+ * lock-free stack; looking up a handle is a single compare and never
+ * takes a lock.
+ *
+ * A session handle is (generation << P11_SESSION_INDEX_BITS) | (index + 1).
+ * The generation of an entry is bumped every time it is handed out again,
+ * so the handle of a closed session doesn't find the session that reuses
+ * its entry (nor does the free list suffer from ABA, its head is tagged).
+ * The first use of an entry has generation 0, so the first handles are
+ * still 1, 2, 3, ...
+ */
+
+#include "p11.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define P11_SESSION_INDEX_BITS 10
+#define P11_SESSION_INDEX_MASK ((1UL << P11_SESSION_INDEX_BITS) - 1)
+
+	/* Reserve an entry for a new session in slot hSlot;
+	 * returns CKR_SESSION_COUNT if all MAX_SESSIONS entries are in use */
+	CK_RV p11_session_alloc(CK_SLOT_ID hSlot, CK_SESSION_HANDLE_PTR phSession,
+				P11_SESSION ** ppSession);
+	/* Give the entry back; its handle becomes invalid immediately */
+	void p11_session_free(P11_SESSION * pSession);
+	/* Returns the session with handle h, or NULL if h isn't an open session */
+	P11_SESSION *p11_session_lookup(CK_SESSION_HANDLE h);
+	/* For walking through the table: entries 0 .. p11_session_count() - 1
+	 * have been used at least once (and may be in use or free) */
+	unsigned int p11_session_count(void);
+	P11_SESSION *p11_session_entry(unsigned int index);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -20,6 +20,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "beid_p11.h"
+#include "beidpkcs11ext.h"
 #include "util.h"
 #include "pkcs11log.h"
 #include "p11.h"
@@ -31,6 +32,7 @@
 CK_RV C_DigestInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
                    CK_MECHANISM_PTR  pMechanism) /* the digesting mechanism */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_DIGEST_DATA *pDigestData = NULL;
@@ -41,7 +43,7 @@ CK_RV C_DigestInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter, hSession = %i",hSession);
 
@@ -83,7 +85,7 @@ CK_RV C_DigestInit(CK_SESSION_HANDLE hSession,   /* the session's handle */
    pSession->Operation[P11_OPERATION_DIGEST].active = 1;
 
 cleanup:
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
    return ret;
 }
@@ -99,6 +101,7 @@ CK_RV C_Digest(CK_SESSION_HANDLE hSession,     /* the session's handle */
                CK_BYTE_PTR       pDigest,      /* receives the message digest */
                CK_ULONG_PTR      pulDigestLen) /* receives byte length of digest */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_DIGEST_DATA *pDigestData = NULL;
@@ -109,7 +112,7 @@ CK_RV C_Digest(CK_SESSION_HANDLE hSession,     /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter, hSession = %i",hSession);
 
@@ -174,7 +177,7 @@ CK_RV C_Digest(CK_SESSION_HANDLE hSession,     /* the session's handle */
    pSession->Operation[P11_OPERATION_DIGEST].active = 0;
 
 cleanup:
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 
 return ret;
@@ -188,6 +191,7 @@ CK_RV C_DigestUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
                      CK_BYTE_PTR       pPart,     /* data to be digested */
                      CK_ULONG          ulPartLen) /* bytes of data to be digested */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_DIGEST_DATA *pDigestData = NULL;
@@ -198,7 +202,7 @@ CK_RV C_DigestUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter");
 
@@ -234,7 +238,7 @@ CK_RV C_DigestUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
       }
 
 cleanup:
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 
 return ret;
@@ -258,6 +262,7 @@ CK_RV C_DigestFinal(CK_SESSION_HANDLE hSession,     /* the session's handle */
                     CK_BYTE_PTR       pDigest,      /* receives the message digest */
                     CK_ULONG_PTR      pulDigestLen) /* receives byte count of digest */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_DIGEST_DATA *pDigestData = NULL;
@@ -268,7 +273,7 @@ CK_RV C_DigestFinal(CK_SESSION_HANDLE hSession,     /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter, hSession = %i, pDigest=%p",hSession,pDigest);
 
@@ -324,7 +329,7 @@ CK_RV C_DigestFinal(CK_SESSION_HANDLE hSession,     /* the session's handle */
    pSession->Operation[P11_OPERATION_DIGEST].active = 0;
 
 cleanup:
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 
 return ret;
@@ -338,6 +343,7 @@ CK_RV C_SignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
                  CK_MECHANISM_PTR  pMechanism,  /* the signature mechanism */
                  CK_OBJECT_HANDLE  hKey)        /* handle of the signature key */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_SLOT    *pSlot = NULL;
@@ -361,7 +367,7 @@ CK_RV C_SignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter");
 
@@ -458,6 +464,9 @@ CK_RV C_SignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
       case CKM_ECDSA_SHA256:
       case CKM_ECDSA_SHA384:
       case CKM_ECDSA_SHA512:
+      case CKM_ECDSA_SHA3_256:
+      case CKM_ECDSA_SHA3_384:
+      case CKM_ECDSA_SHA3_512:
       	ihash = 1; break;
       case CKM_RSA_PKCS:
       case CKM_ECDSA:
@@ -552,7 +561,7 @@ CK_RV C_SignInit(CK_SESSION_HANDLE hSession,    /* the session's handle */
    pSession->Operation[P11_OPERATION_SIGN].active = 1;
 
 cleanup:       
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 
 return ret;
@@ -568,11 +577,13 @@ CK_RV C_Sign(CK_SESSION_HANDLE hSession,        /* the session's handle */
              CK_BYTE_PTR       pSignature,      /* receives the signature */
              CK_ULONG_PTR      pulSignatureLen) /* receives byte count of signature */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret                  = CKR_OK;
    P11_SESSION*   pSession    = NULL;
    P11_SIGN_DATA* pSignData   = NULL;
    unsigned char* pDigest     = NULL;
    unsigned long  ulDigestLen = 0;
+   unsigned char* pToSign     = pData;
 // unsigned int ulSignatureLen = *pulSignatureLen;
 
 	if (p11_get_init() != BEIDP11_INITIALIZED)
@@ -581,7 +592,7 @@ CK_RV C_Sign(CK_SESSION_HANDLE hSession,        /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter");
 
@@ -649,27 +660,23 @@ CK_RV C_Sign(CK_SESSION_HANDLE hSession,        /* the session's handle */
          ret = CKR_FUNCTION_FAILED;
          goto terminate;
          }
+      pToSign = pDigest;
       }
    else
       {
-      /* reserve space for data to sign */
-      pDigest = (unsigned char*) malloc(ulDataLen);
-      if (pDigest == NULL)
-         {
-         ret = CKR_HOST_MEMORY;
-         goto cleanup;
-         }
-      memcpy(pDigest, pData, ulDataLen);
+      /* no hash: sign the caller's data as is, no need to copy it */
       ulDigestLen = ulDataLen;
       }
 
    /* do the signing (and add pkcs headers first if needed) */
-   ret = cal_sign(pSession->hslot, pSignData, pDigest, ulDigestLen, pSignature, pulSignatureLen);
+   ret = cal_sign(pSession->hslot, pSignData, pToSign, ulDigestLen, pSignature, pulSignatureLen);
    if (ret != CKR_OK)
       log_trace(WHERE, "E: cal_sign() returned %s", log_map_error(ret));
 
 terminate:
    //terminate sign operation
+   if (pSignData->pbuf != NULL)
+      free(pSignData->pbuf);
    free(pSignData);
    pSession->Operation[P11_OPERATION_SIGN].pData = NULL;
    pSession->Operation[P11_OPERATION_SIGN].active = 0;
@@ -677,22 +684,132 @@ terminate:
 cleanup:        
    if (pDigest)
       free(pDigest);
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 return ret;
 }
 #undef WHERE
 
 
+#define WHERE "C_BEID_SignBatch()"
+CK_RV C_BEID_SignBatch(CK_SESSION_HANDLE hSession,         /* the session's handle */
+                       CK_BEID_SIGN_ITEM_PTR pItems,       /* the inputs and their signatures */
+                       CK_ULONG          ulCount)          /* number of items */
+{
+   CK_SLOT_ID hLockSlot;
+   CK_RV ret                  = CKR_OK;
+   P11_SESSION*   pSession    = NULL;
+   P11_SIGN_DATA* pSignData   = NULL;
+   CK_ULONG i;
+   CK_ULONG ulNoBuffer        = 0;
+
+	if (p11_get_init() != BEIDP11_INITIALIZED)
+	{
+		log_trace(WHERE, "I: leave, CKR_CRYPTOKI_NOT_INITIALIZED");
+		return (CKR_CRYPTOKI_NOT_INITIALIZED);
+	}		
+
+   hLockSlot = p11_lock_session(hSession);
+
+	 log_trace(WHERE, "I: enter");
+
+   ret = p11_get_session(hSession, &pSession);
+   if (ret)
+      {
+      log_trace(WHERE, "E: Invalid session handle (%d)", hSession);
+      goto cleanup;
+      }
+
+   if (pSession->Operation[P11_OPERATION_SIGN].active == 0)
+      {
+      log_trace(WHERE, "E: Session %d: no sign operation initialized", hSession);
+      ret = CKR_OPERATION_NOT_INITIALIZED;
+      goto cleanup;
+      }
+
+   if((pSignData = pSession->Operation[P11_OPERATION_SIGN].pData) == NULL)
+      {
+      log_trace( WHERE, "E: no sign operation initialized");
+      ret = CKR_OPERATION_NOT_INITIALIZED;
+      goto cleanup;
+      }
+
+   if(pSignData->update)
+      {
+      log_trace(WHERE, "E: C_BEID_SignBatch() cannot be used to finalize a C_SignUpdate() function");
+      ret = CKR_FUNCTION_FAILED;
+      goto cleanup;
+      }
+
+   if (pItems == NULL_PTR && ulCount > 0)
+      {
+      ret = CKR_ARGUMENTS_BAD;
+      goto cleanup;
+      }
+
+   log_trace(WHERE, "S: C_BEID_SignBatch(session %d, %lu items)", hSession, ulCount);
+
+   /* as with C_Sign(), a length query or a too small buffer keeps the
+    * operation going */
+   for (i = 0; i < ulCount; i++)
+      {
+      if (pItems[i].pSignature == NULL_PTR)
+         ulNoBuffer++;
+      else if (pItems[i].ulSignatureLen < pSignData->l_sign)
+         ret = CKR_BUFFER_TOO_SMALL;
+      }
+   if (ulNoBuffer > 0 || ret != CKR_OK)
+      {
+      for (i = 0; i < ulCount; i++)
+         pItems[i].ulSignatureLen = pSignData->l_sign;
+      goto cleanup;
+      }
+
+   /* the digests are passed in, so a hash mechanism only tells us
+    * their length */
+   for (i = 0; i < ulCount; i++)
+      {
+      pItems[i].rv = CKR_OK;
+      if (pSignData->phash && pItems[i].ulDigestLen != pSignData->l_hash)
+         {
+         log_trace(WHERE, "E: item %lu: digest length %lu, expected %u", i, pItems[i].ulDigestLen, pSignData->l_hash);
+         pItems[i].rv = CKR_DATA_LEN_RANGE;
+         }
+      }
+
+   ret = cal_sign_batch(pSession->hslot, pSignData, pItems, ulCount);
+   if (ret != CKR_OK)
+      log_trace(WHERE, "E: cal_sign_batch() returned %s", log_map_error(ret));
+
+   //terminate sign operation
+   if (pSignData->phash != NULL)
+      hash_free(pSignData->phash);
+   if (pSignData->pbuf != NULL)
+      free(pSignData->pbuf);
+   free(pSignData);
+   pSession->Operation[P11_OPERATION_SIGN].pData = NULL;
+   pSession->Operation[P11_OPERATION_SIGN].active = 0;
+
+cleanup:        
+   p11_unlock_slot(hLockSlot);
+	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
+return ret;
+}
+#undef WHERE
+
+
+
 #define WHERE "C_SignUpdate()"
 CK_RV C_SignUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
                    CK_BYTE_PTR       pPart,     /* the data (digest) to be signed */
                    CK_ULONG          ulPartLen) /* count of bytes to be signed */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_SIGN_DATA *pSignData = NULL;
-   char* oldBuf = NULL;
+   char* newBuf = NULL;
+   unsigned int newSize = 0;
 
 	if (p11_get_init() != BEIDP11_INITIALIZED)
 	{
@@ -700,7 +817,7 @@ CK_RV C_SignUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 	
    log_trace(WHERE, "I: enter");
 
@@ -735,17 +852,24 @@ CK_RV C_SignUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
          ret = CKR_DATA_LEN_RANGE;
          goto cleanup;
          }
-	  oldBuf = pSignData->pbuf;
-	  pSignData->pbuf = (char*)realloc(pSignData->pbuf, pSignData->lbuf + ulPartLen);
-
-      if (pSignData->pbuf == NULL)
+      if ( (ulPartLen + pSignData->lbuf) > pSignData->cbuf)
          {
-         log_trace(WHERE, "E: memory allocation problem for host");
-         ret = CKR_HOST_MEMORY;
-		 //old location has not been freed, so do that now
-		 if (oldBuf != NULL)
-			free(oldBuf);
-         goto cleanup;
+         //double the buffer, so feeding many small parts doesn't realloc (and copy) every time;
+         //there can never be more than l_sign bytes
+         newSize = pSignData->cbuf ? pSignData->cbuf * 2 : 64;
+         if (newSize < pSignData->lbuf + ulPartLen)
+            newSize = pSignData->lbuf + ulPartLen;
+         if (newSize > pSignData->l_sign)
+            newSize = pSignData->l_sign;
+         newBuf = (char*)realloc(pSignData->pbuf, newSize);
+         if (newBuf == NULL)
+            {
+            log_trace(WHERE, "E: memory allocation problem for host");
+            ret = CKR_HOST_MEMORY;
+            goto cleanup;
+            }
+         pSignData->pbuf = newBuf;
+         pSignData->cbuf = newSize;
          }
       //add data
       memcpy(pSignData->pbuf+pSignData->lbuf, pPart, ulPartLen);
@@ -764,7 +888,7 @@ CK_RV C_SignUpdate(CK_SESSION_HANDLE hSession,  /* the session's handle */
 
 cleanup:
 
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 return ret;
 }
@@ -777,6 +901,7 @@ CK_RV C_SignFinal(CK_SESSION_HANDLE hSession,        /* the session's handle */
                   CK_BYTE_PTR       pSignature,      /* receives the signature */
                   CK_ULONG_PTR      pulSignatureLen) /* receives byte count of signature */
 {
+   CK_SLOT_ID hLockSlot;
    CK_RV ret;
    P11_SESSION *pSession = NULL;
    P11_SIGN_DATA *pSignData = NULL;
@@ -789,7 +914,7 @@ CK_RV C_SignFinal(CK_SESSION_HANDLE hSession,        /* the session's handle */
 		return (CKR_CRYPTOKI_NOT_INITIALIZED);
 	}		
 
-   p11_lock();
+   hLockSlot = p11_lock_session(hSession);
 
 	 log_trace(WHERE, "I: enter");
  
@@ -850,15 +975,10 @@ CK_RV C_SignFinal(CK_SESSION_HANDLE hSession,        /* the session's handle */
       }
    else
       {
-      /* no hash: get buffer to sign directly */
-      pDigest = (unsigned char*) malloc(pSignData->lbuf);
-      if (pDigest == NULL)
-         {
-         ret = CKR_HOST_MEMORY;
-         goto cleanup;
-         }
-      memcpy(pDigest, pSignData->pbuf, pSignData->lbuf);
+      /* no hash: sign the collected buffer directly, it is freed with pDigest */
+      pDigest = (unsigned char*) pSignData->pbuf;
       ulDigestLen = pSignData->lbuf;
+      pSignData->pbuf = NULL;
       }
 
    ret = cal_sign(pSession->hslot, pSignData, pDigest, ulDigestLen, pSignature, pulSignatureLen);
@@ -874,7 +994,7 @@ cleanup:
    if (pDigest)
       free(pDigest);
 
-   p11_unlock();
+   p11_unlock_slot(hLockSlot);
 	 log_trace(WHERE, "I: leave, ret = 0x%08x",ret);
 
 return ret;
@@ -40,6 +40,10 @@ extern "C"
     void p11_lock(void);
     void p11_unlock(void);
     void p11_free_lock(void);
+    void p11_lock_slot(CK_SLOT_ID slotID);
+    void p11_unlock_slot(CK_SLOT_ID slotID);
+    void p11_lock_all_slots(void);
+    void p11_unlock_all_slots(void);
 	void util_init_lock(void **lock);
 	void util_clean_lock(void **lock);
 	void util_lock(void *lock);
@@ -0,0 +1,168 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/* Vendor extensions of the beid PKCS#11 module.
+ *
+ * Include this after pkcs11.h. An application that loads the module at run
+ * time should look up C_BEID_GetFunctionList the way it looks up
+ * C_GetFunctionList, and check the version of the list it returns before
+ * using a function that was added in a later version.
+ */
+
+#ifndef _BEIDPKCS11EXT_H_
+#define _BEIDPKCS11EXT_H_ 1
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/* Version of the extension function list */
+#define CK_BEID_EXT_VERSION_MAJOR	1
+#define CK_BEID_EXT_VERSION_MINOR	1
+
+/* One input and its signature for C_BEID_SignBatch() */
+typedef struct CK_BEID_SIGN_ITEM
+{
+	CK_BYTE_PTR pDigest;	/* the digest (or data) to be signed */
+	CK_ULONG ulDigestLen;	/* its length */
+	CK_BYTE_PTR pSignature;	/* receives the signature */
+	CK_ULONG ulSignatureLen;	/* in: size of pSignature, out: length of the signature */
+	CK_RV rv;		/* out: the result for this item */
+} CK_BEID_SIGN_ITEM;
+
+typedef CK_BEID_SIGN_ITEM CK_PTR CK_BEID_SIGN_ITEM_PTR;
+
+/* The card layer calls that C_BEID_GetApduStats() reports on. Some of them
+ * call others (e.g. connect calls update_token), which then count twice. */
+#define CK_BEID_CALL_CONNECT		0
+#define CK_BEID_CALL_DISCONNECT		1
+#define CK_BEID_CALL_UPDATE_TOKEN	2
+#define CK_BEID_CALL_INIT_OBJECTS	3
+#define CK_BEID_CALL_GET_CARD_DATA	4
+#define CK_BEID_CALL_READ_ID_FILES	5
+#define CK_BEID_CALL_READ_OBJECT	6
+#define CK_BEID_CALL_LOGON		7
+#define CK_BEID_CALL_LOGOUT		8
+#define CK_BEID_CALL_CHANGE_PIN		9
+#define CK_BEID_CALL_SIGN		10
+#define CK_BEID_CALL_SIGN_BATCH		11
+#define CK_BEID_CALL_COUNT		12
+
+/* Times are in microseconds. All counters wrap around. */
+typedef struct CK_BEID_INS_STATS
+{
+	CK_ULONG ulCount;	/* APDUs sent with this INS byte */
+	CK_ULONG ulBytesSent;	/* command bytes */
+	CK_ULONG ulBytesReceived;	/* response bytes, incl. SW1-SW2 */
+	unsigned long long ullTransmitUs;	/* time spent in SCardTransmit() */
+} CK_BEID_INS_STATS;
+
+typedef struct CK_BEID_CALL_STATS
+{
+	CK_ULONG ulCount;	/* number of calls */
+	CK_ULONG ulApdus;	/* APDUs sent during them */
+	unsigned long long ullTimeUs;	/* time spent in them */
+} CK_BEID_CALL_STATS;
+
+typedef struct CK_BEID_APDU_STATS
+{
+	CK_BBOOL bEnabled;	/* if CK_FALSE, nothing is counted */
+	CK_ULONG ulApdus;	/* the sum of all ins[].ulCount */
+	CK_ULONG ulBytesSent;
+	CK_ULONG ulBytesReceived;
+	unsigned long long ullTransmitUs;
+	unsigned long long ullSleepUs;	/* delays added around APDUs and connects */
+	unsigned long long ullSleepSavedUs;	/* not slept thanks to card_adaptive_delay */
+	CK_ULONG ulDelayBackoffs;	/* times card_adaptive_delay made a delay longer */
+	CK_ULONG ulTransactions;	/* card transactions (SCardBeginTransaction) */
+	unsigned long long ullTransactionUs;	/* time they were held */
+	CK_ULONG ulRetries;	/* APDUs resent after a transient error */
+	CK_ULONG ulRecoveries;	/* card resets after a lost connection */
+	CK_BEID_CALL_STATS calls[CK_BEID_CALL_COUNT];
+	CK_BEID_INS_STATS ins[256];	/* indexed by INS byte */
+} CK_BEID_APDU_STATS;
+
+typedef CK_BEID_APDU_STATS CK_PTR CK_BEID_APDU_STATS_PTR;
+
+typedef struct CK_BEID_FUNCTION_LIST CK_BEID_FUNCTION_LIST;
+
+typedef CK_BEID_FUNCTION_LIST CK_PTR CK_BEID_FUNCTION_LIST_PTR;
+
+typedef CK_BEID_FUNCTION_LIST_PTR CK_PTR CK_BEID_FUNCTION_LIST_PTR_PTR;
+
+/* C_BEID_GetFunctionList returns the extension function list. */
+extern CK_DECLARE_FUNCTION(CK_RV, C_BEID_GetFunctionList)
+	(CK_BEID_FUNCTION_LIST_PTR_PTR ppFunctionList);
+
+/* C_BEID_SignBatch signs several inputs with the key of the sign
+ * operation that was started with C_SignInit, all in one card
+ * transaction, and finishes that operation just like C_Sign does.
+ *
+ * For a mechanism that includes a hash (e.g. CKM_SHA256_RSA_PKCS) each
+ * pDigest must hold the precomputed hash; for CKM_RSA_PKCS and CKM_ECDSA
+ * it is signed as is.
+ *
+ * If pSignature is NULL_PTR or too small for any item, all the
+ * ulSignatureLen fields receive the signature length, CKR_BUFFER_TOO_SMALL
+ * (or CKR_OK if no item has a buffer) is returned and the sign operation
+ * stays active. Otherwise CKR_OK means that every item has been handled
+ * and that its rv field holds its own result. */
+extern CK_DECLARE_FUNCTION(CK_RV, C_BEID_SignBatch)
+	(CK_SESSION_HANDLE hSession,	/* the session's handle */
+	 CK_BEID_SIGN_ITEM_PTR pItems,	/* the inputs and their signatures */
+	 CK_ULONG ulCount);	/* number of items */
+
+/* C_BEID_GetApduStats copies the card communication counters of this
+ * process. They are only kept when enabled with the apdu_stats setting or
+ * the EID_APDU_STATS environment variable (1 to count; a file name, or -
+ * for stderr, to also write them there on C_Finalize). With bReset set to
+ * CK_TRUE, the counters start again from 0 afterwards.
+ *
+ * This may also be called while the module isn't initialized. */
+extern CK_DECLARE_FUNCTION(CK_RV, C_BEID_GetApduStats)
+	(CK_BEID_APDU_STATS_PTR pStats,	/* receives the counters */
+	 CK_BBOOL bReset);	/* reset them afterwards */
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_BEID_GetFunctionList)
+	(CK_BEID_FUNCTION_LIST_PTR_PTR ppFunctionList);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_BEID_SignBatch)
+	(CK_SESSION_HANDLE hSession,
+	 CK_BEID_SIGN_ITEM_PTR pItems,
+	 CK_ULONG ulCount);
+
+typedef CK_DECLARE_FUNCTION_POINTER(CK_RV, CK_C_BEID_GetApduStats)
+	(CK_BEID_APDU_STATS_PTR pStats,
+	 CK_BBOOL bReset);
+
+/* New functions are only ever added at the end */
+struct CK_BEID_FUNCTION_LIST
+{
+	CK_VERSION version;	/* extension version */
+	CK_C_BEID_SignBatch C_BEID_SignBatch;
+	CK_C_BEID_GetApduStats C_BEID_GetApduStats;	/* since version 1.1 */
+};
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,222 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+
+/*
+ * Getting the attributes of the four eID certificates (authentication,
+ * signature, citizen CA and root) out of their DER encoding, as
+ * cal_read_object() does. "before" looks up each field from the start of
+ * the certificate with asn1_get_item() and copies it into a buffer of its
+ * own, as cert_get_info() used to; "after" is the single pass of the
+ * current cert_get_info(), which copies nothing.
+ *
+ * The certificates come from the emulated card image.
+ *
+ * Usage: bench_certs [seconds per run] [card image]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "asn1.h"
+#include "cert.h"
+
+#define CERTS 4
+
+static const char *cert_files[CERTS] = { "3F00DF005038", "3F00DF005039", "3F00DF00503A", "3F00DF00503B" };
+
+static unsigned char *certs[CERTS];
+static unsigned int l_certs[CERTS];
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* "file <path> <hex>" lines of the card image, see cardemu.h */
+static int load_certs(const char *image) {
+	static char line[16384];
+	FILE *f = fopen(image, "r");
+	int found = 0;
+
+	if(f == NULL) {
+		perror(image);
+		return -1;
+	}
+	while(fgets(line, sizeof(line), f) != NULL) {
+		char path[32];
+		int offset = 0;
+		int i;
+
+		if(sscanf(line, "file %31s %n", path, &offset) != 1 || offset == 0)
+			continue;
+		for(i = 0; i < CERTS; i++) {
+			const char *hex = line + offset;
+			unsigned int len = 0;
+
+			if(strcmp(path, cert_files[i]) != 0)
+				continue;
+			certs[i] = (unsigned char *) malloc(strlen(hex) / 2);
+			while(sscanf(hex, "%2hhx", &certs[i][len]) == 1) {
+				len++;
+				hex += 2;
+			}
+			l_certs[i] = len;
+			found++;
+		}
+	}
+	fclose(f);
+	if(found != CERTS) {
+		fprintf(stderr, "%s: not all certificates found\n", image);
+		return -1;
+	}
+	return 0;
+}
+
+/* the old cert_get_info() */
+static int copy_item(const unsigned char *pcert, unsigned int lcert, const char *path, int raw, int unsign, unsigned char **p, unsigned int *l) {
+	ASN1_ITEM item;
+	int ret = asn1_get_item(pcert, lcert, path, &item);
+
+	if(ret)
+		return ret;
+	if(raw) {
+		item.p_data = item.p_raw;
+		item.l_data = item.l_raw;
+	} else if(unsign && *(item.p_data) == 0) {
+		item.p_data++;
+		item.l_data--;
+	}
+	*p = (unsigned char *) malloc(item.l_data);
+	if(*p == NULL)
+		return E_X509_ALLOC;
+	memcpy(*p, item.p_data, item.l_data);
+	*l = item.l_data;
+	return 0;
+}
+
+static int get_info_before(const unsigned char *pcert, unsigned int lcert) {
+	unsigned char *p[8] = { NULL };
+	unsigned int l[8];
+	ASN1_ITEM item;
+	int ret, i;
+
+	if((ret = asn1_get_item(pcert, lcert, "\1", &item)) != 0)
+		return ret;
+	if(item.l_raw > lcert)
+		return E_X509_INCOMPLETE;
+	lcert = item.l_raw;
+
+	if((ret = copy_item(pcert, lcert, X509_SUBJECT, 1, 0, &p[0], &l[0])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_ISSUER, 1, 0, &p[1], &l[1])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_SERIAL, 1, 0, &p[2], &l[2])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_VALID_FROM, 0, 0, &p[3], &l[3])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_VALID_UNTIL, 0, 0, &p[4], &l[4])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_RSA_MOD, 0, 1, &p[5], &l[5])) == 0 &&
+	   (ret = copy_item(pcert, lcert, X509_RSA_EXP, 0, 1, &p[6], &l[6])) == 0)
+		ret = copy_item(pcert, lcert, X509_PKINFO, 1, 0, &p[7], &l[7]);
+
+	for(i = 0; i < 8; i++)
+		free(p[i]);
+	return ret;
+}
+
+static double before(unsigned long n) {
+	double start = now();
+	unsigned long i;
+
+	for(i = 0; i < n; i++) {
+		if(get_info_before(certs[i % CERTS], l_certs[i % CERTS]) != 0)
+			exit(1);
+	}
+	return now() - start;
+}
+
+static double after(unsigned long n) {
+	T_CERT_INFO info;
+	double start = now();
+	unsigned long i;
+
+	for(i = 0; i < n; i++) {
+		if(cert_get_info(certs[i % CERTS], l_certs[i % CERTS], &info) != 0)
+			exit(1);
+	}
+	return now() - start;
+}
+
+/* both must find the same fields */
+static int check(void) {
+	int i;
+
+	for(i = 0; i < CERTS; i++) {
+		T_CERT_INFO info;
+		ASN1_ITEM item;
+
+		if(cert_get_info(certs[i], l_certs[i], &info) != 0)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_SUBJECT, &item) != 0 ||
+		   item.p_raw != info.subject || item.l_raw != info.l_subject)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_ISSUER, &item) != 0 ||
+		   item.p_raw != info.issuer || item.l_raw != info.l_issuer)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_SERIAL, &item) != 0 ||
+		   item.p_raw != info.serial || item.l_raw != info.l_serial)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_PKINFO, &item) != 0 ||
+		   item.p_raw != info.pkinfo || item.l_raw != info.l_pkinfo)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_RSA_MOD, &item) != 0 ||
+		   item.p_data + item.l_data != info.mod + info.l_mod || info.l_mod != 256)
+			return -1;
+		if(asn1_get_item(certs[i], l_certs[i], X509_RSA_EXP, &item) != 0 ||
+		   item.p_data + item.l_data != info.exp + info.l_exp)
+			return -1;
+	}
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	double secs = argc > 1 ? atof(argv[1]) : 1;
+	const char *image = argc > 2 ? argv[2] : CARD_IMAGE;
+	unsigned long n = 1000;
+	double tb, ta;
+
+	if(load_certs(image) != 0)
+		return 1;
+	if(check() != 0) {
+		fprintf(stderr, "cert_get_info() and asn1_get_item() disagree\n");
+		return 1;
+	}
+
+	/* grow n until a run takes long enough */
+	while((tb = before(n)) < secs / 4 && n < (1UL << 30))
+		n *= 2;
+	tb = before(n);
+	ta = after(n);
+
+	printf("certificate\tns before\tns after\tspeedup\n");
+	printf("cert_get_info\t%.1f\t%.1f\t%.1fx\n", tb * 1e9 / n, ta * 1e9 / n, ta > 0 ? tb / ta : 0);
+
+	return 0;
+}
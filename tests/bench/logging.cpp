@@ -0,0 +1,127 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+
+/*
+ * The cost of a log message that the log level filters out, as made for
+ * each APDU (the hex dump in CPCSC::Transmit()) and for each attribute in
+ * C_GetAttributeValue (log_template()). "before" calls the log function
+ * directly, as the modules did before MWLOG(), log_trace() and
+ * log_template() became level-gated macros; "after" uses the macros.
+ *
+ * Usage: bench_logging [seconds per run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "log.h"
+#include "bytearray.h"
+
+extern "C"
+{
+#include "beid_p11.h"
+#include "pkcs11log.h"
+
+/* pkcs11log.c needs these, log_init() isn't called here */
+void util_init_lock(void **lock) { (void)lock; }
+void util_lock(void *lock) { (void)lock; }
+void util_unlock(void *lock) { (void)lock; }
+}
+
+using namespace eIDMW;
+
+static const unsigned char APDU[] = { 0x00, 0xB0, 0x00, 0x00, 0xF8 };
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double apdu_before(unsigned long n) {
+	CByteArray oCmdAPDU(APDU, sizeof(APDU));
+	double start = now();
+
+	for(unsigned long i = 0; i < n; i++)
+		MWLOGWrite(LEV_DEBUG, MOD_CAL, L"      SCardTransmit(%ls)", oCmdAPDU.ToWString(true, true, 0, 5).c_str());
+	return now() - start;
+}
+
+static double apdu_after(unsigned long n) {
+	CByteArray oCmdAPDU(APDU, sizeof(APDU));
+	double start = now();
+
+	for(unsigned long i = 0; i < n; i++)
+		MWLOG(LEV_DEBUG, MOD_CAL, L"      SCardTransmit(%ls)", oCmdAPDU.ToWString(true, true, 0, 5).c_str());
+	return now() - start;
+}
+
+static double attribute_before(unsigned long n) {
+	CK_BBOOL btrue = CK_TRUE;
+	CK_ATTRIBUTE attr = { CKA_TOKEN, &btrue, sizeof(btrue) };
+	double start = now();
+
+	for(unsigned long i = 0; i < n; i++) {
+		log_template_write("I: Template out:", &attr, 1);
+		log_trace_write("C_GetAttributeValue()", "I: leave, ret = %s", log_map_error(CKR_OK));
+	}
+	return now() - start;
+}
+
+static double attribute_after(unsigned long n) {
+	CK_BBOOL btrue = CK_TRUE;
+	CK_ATTRIBUTE attr = { CKA_TOKEN, &btrue, sizeof(btrue) };
+	double start = now();
+
+	for(unsigned long i = 0; i < n; i++) {
+		log_template("I: Template out:", &attr, 1);
+		log_trace("C_GetAttributeValue()", "I: leave, ret = %s", log_map_error(CKR_OK));
+	}
+	return now() - start;
+}
+
+static void run(const char *name, double (*before)(unsigned long), double (*after)(unsigned long), double secs) {
+	unsigned long n = 1000;
+	double tb, ta;
+
+	/* grow n until a run takes long enough */
+	while((tb = before(n)) < secs / 4 && n < (1UL << 30))
+		n *= 2;
+	tb = before(n);
+	ta = after(n);
+	printf("%s\t%.1f\t%.1f\t%.0fx\n", name, tb * 1e9 / n, ta * 1e9 / n, ta > 0 ? tb / ta : 0);
+}
+
+int main(int argc, char **argv) {
+	double secs = argc > 1 ? atof(argv[1]) : 1;
+
+	/* errors only, as in a default installation */
+	CLogger::instance().init(L"/tmp", L"bench_logging", 100000, 2, LOG_LEVEL_ERROR, false);
+	g_uiLogLevel = LOG_LEVEL_PKCS11_ERROR;
+
+	printf("filtered message\tns before\tns after\tspeedup\n");
+	run("APDU (MWLOG)", apdu_before, apdu_after, secs);
+	run("attribute (log_template, log_trace)", attribute_before, attribute_after, secs);
+
+	return 0;
+}
@@ -0,0 +1,135 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+
+/*
+ * Card insert/remove cycles in the object store: add the objects of a
+ * typical card (certificates, keys and the identity, address and card
+ * data objects), fill in the certificates as C_GetAttributeValue would,
+ * then clean them up again as on card removal.
+ *
+ * Usage: bench_objects [seconds]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "beid_p11.h"
+#include "p11.h"
+#include "cal.h"
+#include "arena.h"
+
+#define CERTS       5
+#define DATA_FIELDS 60
+
+/* p11.c needs these, none of them is used on the paths measured here */
+volatile unsigned int g_uiLogLevel = 0;
+void log_trace_write(const char *where, const char *string, ...) { (void)where; (void)string; }
+CK_RV cal_disconnect(CK_SLOT_ID hSlot) { (void)hSlot; return CKR_OK; }
+CK_RV cal_logout(CK_SLOT_ID hSlot) { (void)hSlot; return CKR_OK; }
+CK_RV cal_validate_session(P11_SESSION *pSession) { (void)pSession; return CKR_OK; }
+void p11_lock_slot(CK_SLOT_ID slotID) { (void)slotID; }
+void p11_unlock_slot(CK_SLOT_ID slotID) { (void)slotID; }
+void memwash(char *p_in, unsigned int len) { memset(p_in, 0, len); }
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int insert_card(P11_SLOT *pSlot) {
+	CK_ATTRIBUTE CERTIFICATE[] = BEID_TEMPLATE_CERTIFICATE;
+	CK_ATTRIBUTE PRV_KEY[] = BEID_TEMPLATE_PRV_KEY;
+	CK_ATTRIBUTE PUB_KEY[] = BEID_TEMPLATE_PUB_KEY;
+	CK_ATTRIBUTE ID_DATA[] = BEID_TEMPLATE_ID_DATA;
+	static unsigned char cert[1500], photo[3000], field[48];
+	char label[32];
+	CK_ULONG hObject, i;
+	P11_OBJECT *pObject;
+
+	for(i = 0; i < CERTS; i++) {
+		sprintf(label, "Certificate %lu", i);
+		if(p11_add_slot_object(pSlot, CERTIFICATE, sizeof(CERTIFICATE) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_CERTIFICATE, i, CK_FALSE, &hObject) != CKR_OK)
+			return -1;
+		pObject = p11_get_slot_object(pSlot, hObject);
+		if(p11_set_object_value(pObject, CKA_LABEL, label, strlen(label)) != CKR_OK)
+			return -1;
+		if(i < 2) {
+			if(p11_add_slot_object(pSlot, PRV_KEY, sizeof(PRV_KEY) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_PRIVATE_KEY, i, CK_TRUE, &hObject) != CKR_OK)
+				return -1;
+			if(p11_add_slot_object(pSlot, PUB_KEY, sizeof(PUB_KEY) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_PUBLIC_KEY, i, CK_FALSE, &hObject) != CKR_OK)
+				return -1;
+		}
+	}
+	for(i = 0; i < DATA_FIELDS; i++) {
+		sprintf(label, "field_%lu", i);
+		if(p11_add_slot_ID_object(pSlot, ID_DATA, sizeof(ID_DATA) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_DATA, CK_FALSE, &hObject,
+					label, strlen(label), i == 0 ? photo : field, i == 0 ? sizeof(photo) : sizeof(field), "id", 2) != CKR_OK)
+			return -1;
+	}
+	/* read the certificates */
+	for(i = 0; i < CERTS; i++) {
+		if(p11_find_slot_object(pSlot, CKO_CERTIFICATE, i, &pObject) != CKR_OK || pObject == NULL)
+			return -1;
+		if(p11_set_object_value(pObject, CKA_VALUE, cert, sizeof(cert)) != CKR_OK)
+			return -1;
+	}
+	return 0;
+}
+
+static void remove_card(P11_SLOT *pSlot) {
+	unsigned int i;
+
+	for(i = 1; i <= pSlot->nobjects; i++) {
+		p11_clean_object(p11_get_slot_object(pSlot, i));
+	}
+	p11_arena_release(&pSlot->arena);
+}
+
+int main(int argc, char **argv) {
+	static P11_SLOT slot;
+	double secs = argc > 1 ? atof(argv[1]) : 2;
+	double start, end;
+	unsigned long cycles = 0;
+	unsigned int blocks = 0;
+	P11_ARENA_BLOCK *pBlock;
+
+	start = now();
+	do {
+		if(insert_card(&slot) != 0) {
+			printf("error adding objects\n");
+			return 1;
+		}
+		if(cycles == 0) {
+			for(pBlock = slot.arena.pBlocks; pBlock != NULL; pBlock = pBlock->pNext)
+				blocks++;
+		}
+		remove_card(&slot);
+		cycles++;
+		end = now();
+	} while(end - start < secs);
+
+	printf("objects/card\tarena blocks/card\tcycles/s\tus/cycle\n");
+	printf("%u\t%u\t%.0f\t%.2f\n", slot.nobjects, blocks, cycles / (end - start), (end - start) * 1e6 / cycles);
+	return 0;
+}
@@ -0,0 +1,470 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+
+/*
+ * End-to-end workloads through the PKCS#11 API of libbeidpkcs11, with a
+ * card in a reader: C_Initialize on a cold module, slot enumeration,
+ * reading the identity data and the certificates, finding a key by label,
+ * login + sign, and reading from several threads at once.
+ *
+ * For each workload the latencies (percentiles, in usec), the number of
+ * allocations and, if the module counts them (EID_APDU_STATS=1), the
+ * number of APDUs per operation are written to stdout as JSON; progress
+ * goes to stderr. To get numbers that can be compared between commits,
+ * run it against the card emulator (configure --enable-card-emulator,
+ * EID_CARD_EMULATOR_IMAGE=tests/emulator/beid-v17.img), which "make bench"
+ * does by default.
+ *
+ * The login and sign workloads need the PIN code in EID_BENCH_PIN
+ * (1234 for the emulated card) and are skipped without it.
+ *
+ * Usage: bench_pkcs11 [iterations [threads]]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <unix.h>
+#include <pkcs11.h>
+#include <beidpkcs11ext.h>
+
+#define MAX_THREADS 64
+
+/* Allocations are counted by taking over malloc() and friends, which
+ * only works (without dlsym() tricks) with the GNU C library */
+#ifdef __GLIBC__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static volatile unsigned long allocs;
+
+void *malloc(size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+	__sync_fetch_and_add(&allocs, 1);
+	return __libc_realloc(ptr, size);
+}
+
+#define HAVE_ALLOC_COUNT 1
+#else
+static volatile unsigned long allocs;
+#define HAVE_ALLOC_COUNT 0
+#endif
+
+struct workload {
+	const char *name;
+	/* re-initialize the module before each operation, untimed, so
+	 * that the operation finds nothing cached */
+	int cold;
+	/* run by "threads" threads at the same time */
+	int parallel;
+	int needs_pin;
+	CK_RV (*setup)(void);
+	CK_RV (*op)(void);
+	CK_RV (*teardown)(void);
+};
+
+static CK_C_INITIALIZE_ARGS init_args = { NULL_PTR, NULL_PTR, NULL_PTR, NULL_PTR, CKF_OS_LOCKING_OK, NULL_PTR };
+static CK_SLOT_ID slot;
+static CK_SESSION_HANDLE session;
+static const char *pin;
+static unsigned long iterations = 100;
+static unsigned long threads = 4;
+
+/* latencies of the current workload, in usec */
+static double *samples;
+static volatile unsigned long nsamples;
+static volatile unsigned long napdus;
+static int have_apdus;
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Like the slot_list workload; the first call also finds the readers */
+static CK_RV find_token(void) {
+	CK_SLOT_ID list[16];
+	CK_ULONG count = 0;
+	CK_RV rv;
+
+	if((rv = C_GetSlotList(CK_TRUE, NULL_PTR, &count)) != CKR_OK) {
+		return rv;
+	}
+	count = sizeof(list) / sizeof(list[0]);
+	if((rv = C_GetSlotList(CK_TRUE, list, &count)) != CKR_OK) {
+		return rv;
+	}
+	if(count == 0) {
+		return CKR_TOKEN_NOT_PRESENT;
+	}
+	slot = list[0];
+	return CKR_OK;
+}
+
+static CK_RV init(void) {
+	CK_RV rv;
+
+	if((rv = C_Initialize(&init_args)) != CKR_OK) {
+		return rv;
+	}
+	return find_token();
+}
+
+static CK_RV open_session(void) {
+	CK_RV rv;
+
+	if((rv = init()) != CKR_OK) {
+		return rv;
+	}
+	return C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session);
+}
+
+static CK_RV finalize(void) {
+	return C_Finalize(NULL_PTR);
+}
+
+/* Reads the attribute "type" of all objects that match the template */
+static CK_RV read_objects(CK_SESSION_HANDLE hSession, CK_ATTRIBUTE_PTR templ, CK_ULONG count, CK_ATTRIBUTE_TYPE type) {
+	CK_OBJECT_HANDLE objects[64];
+	CK_BYTE buf[16384];	/* not malloc()ed, to count the module's allocations only */
+	CK_ULONG found, i;
+	CK_RV rv;
+
+	if((rv = C_FindObjectsInit(hSession, templ, count)) != CKR_OK) {
+		return rv;
+	}
+	rv = C_FindObjects(hSession, objects, sizeof(objects) / sizeof(objects[0]), &found);
+	C_FindObjectsFinal(hSession);
+	for(i = 0; rv == CKR_OK && i < found; i++) {
+		CK_ATTRIBUTE value = { type, NULL_PTR, 0 };
+
+		if((rv = C_GetAttributeValue(hSession, objects[i], &value, 1)) != CKR_OK) {
+			break;
+		}
+		if(value.ulValueLen > sizeof(buf)) {
+			return CKR_BUFFER_TOO_SMALL;
+		}
+		value.pValue = buf;
+		rv = C_GetAttributeValue(hSession, objects[i], &value, 1);
+	}
+	return rv;
+}
+
+static CK_OBJECT_HANDLE find_by_label(CK_OBJECT_CLASS type, const char *label) {
+	CK_ATTRIBUTE templ[] = {
+		{ CKA_CLASS, &type, sizeof(type) },
+		{ CKA_LABEL, (CK_VOID_PTR)label, strlen(label) },
+	};
+	CK_OBJECT_HANDLE object = CK_INVALID_HANDLE;
+	CK_ULONG count = 0;
+
+	if(C_FindObjectsInit(session, templ, 2) != CKR_OK) {
+		return CK_INVALID_HANDLE;
+	}
+	if(C_FindObjects(session, &object, 1, &count) != CKR_OK || count == 0) {
+		object = CK_INVALID_HANDLE;
+	}
+	C_FindObjectsFinal(session);
+	return object;
+}
+
+/* ---- the operations ---- */
+
+static CK_RV op_initialize(void) {
+	return C_Initialize(&init_args);
+}
+
+static CK_RV op_slot_list(void) {
+	CK_SLOT_ID list[16];
+	CK_ULONG count = 0;
+	CK_RV rv;
+
+	if((rv = C_GetSlotList(CK_TRUE, NULL_PTR, &count)) != CKR_OK) {
+		return rv;
+	}
+	count = sizeof(list) / sizeof(list[0]);
+	return C_GetSlotList(CK_TRUE, list, &count);
+}
+
+static CK_RV op_read_identity(void) {
+	CK_OBJECT_CLASS type = CKO_DATA;
+	CK_ATTRIBUTE templ = { CKA_CLASS, &type, sizeof(type) };
+
+	return read_objects(session, &templ, 1, CKA_VALUE);
+}
+
+static CK_RV op_read_certificates(void) {
+	CK_OBJECT_CLASS type = CKO_CERTIFICATE;
+	CK_ATTRIBUTE templ = { CKA_CLASS, &type, sizeof(type) };
+
+	return read_objects(session, &templ, 1, CKA_VALUE);
+}
+
+static CK_RV op_find_label(void) {
+	return find_by_label(CKO_PRIVATE_KEY, "Authentication") == CK_INVALID_HANDLE ? CKR_GENERAL_ERROR : CKR_OK;
+}
+
+static CK_RV op_login(void) {
+	CK_RV rv;
+
+	if((rv = C_Login(session, CKU_USER, (CK_UTF8CHAR_PTR)pin, strlen(pin))) != CKR_OK) {
+		return rv;
+	}
+	return C_Logout(session);
+}
+
+static CK_OBJECT_HANDLE sign_key;
+
+static CK_RV setup_sign(void) {
+	CK_RV rv;
+
+	if((rv = open_session()) != CKR_OK) {
+		return rv;
+	}
+	if((rv = C_Login(session, CKU_USER, (CK_UTF8CHAR_PTR)pin, strlen(pin))) != CKR_OK) {
+		return rv;
+	}
+	sign_key = find_by_label(CKO_PRIVATE_KEY, "Authentication");
+	return sign_key == CK_INVALID_HANDLE ? CKR_KEY_HANDLE_INVALID : CKR_OK;
+}
+
+static CK_RV op_sign(void) {
+	CK_MECHANISM mech = { CKM_SHA256_RSA_PKCS, NULL_PTR, 0 };
+	CK_BYTE data[] = "The eID middleware signature benchmark";
+	CK_BYTE sig[512];
+	CK_ULONG sig_len = sizeof(sig);
+	CK_RV rv;
+
+	if((rv = C_SignInit(session, &mech, sign_key)) != CKR_OK) {
+		return rv;
+	}
+	return C_Sign(session, data, sizeof(data) - 1, sig, &sig_len);
+}
+
+/* Each thread has a session of its own */
+static CK_RV op_concurrent(void) {
+	CK_OBJECT_CLASS type = CKO_CERTIFICATE;
+	CK_ATTRIBUTE templ = { CKA_CLASS, &type, sizeof(type) };
+	CK_SESSION_HANDLE hSession;
+	CK_RV rv;
+
+	if((rv = C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &hSession)) != CKR_OK) {
+		return rv;
+	}
+	rv = read_objects(hSession, &templ, 1, CKA_VALUE);
+	C_CloseSession(hSession);
+	return rv;
+}
+
+static const struct workload workloads[] = {
+	{ "initialize", 0, 0, 0, NULL, op_initialize, NULL },
+	{ "slot_list", 0, 0, 0, init, op_slot_list, finalize },
+	{ "read_identity", 1, 0, 0, open_session, op_read_identity, finalize },
+	{ "read_identity_cached", 0, 0, 0, open_session, op_read_identity, finalize },
+	{ "read_certificates", 1, 0, 0, open_session, op_read_certificates, finalize },
+	{ "find_label", 0, 0, 0, open_session, op_find_label, finalize },
+	{ "login", 0, 0, 1, open_session, op_login, finalize },
+	{ "sign", 0, 0, 1, setup_sign, op_sign, finalize },
+	{ "concurrent_sessions", 0, 1, 0, init, op_concurrent, finalize },
+};
+
+/* ---- running and reporting ---- */
+
+/* The number of APDUs the module sent so far, if it counts them */
+static unsigned long apdus(void) {
+	static CK_BEID_APDU_STATS stats;
+
+	if(C_BEID_GetApduStats(&stats, CK_FALSE) != CKR_OK || !stats.bEnabled) {
+		return 0;
+	}
+	have_apdus = 1;
+	return stats.ulApdus;
+}
+
+static int run_ops(const struct workload *w, unsigned long n) {
+	unsigned long i, before = 0;
+	double start;
+	CK_RV rv;
+
+	for(i = 0; i < n; i++) {
+		if(w->cold && (rv = w->setup()) != CKR_OK) {
+			fprintf(stderr, "%s: setup failed: 0x%lx\n", w->name, (unsigned long)rv);
+			return -1;
+		}
+		/* with several threads, the APDUs are counted for all of them */
+		if(!w->parallel) {
+			before = apdus();
+		}
+		start = now();
+		rv = w->op();
+		samples[__sync_fetch_and_add(&nsamples, 1)] = (now() - start) * 1e6;
+		if(!w->parallel) {
+			napdus += apdus() - before;
+		}
+		if(rv != CKR_OK) {
+			fprintf(stderr, "%s: failed: 0x%lx\n", w->name, (unsigned long)rv);
+			return -1;
+		}
+		/* also undoes C_Initialize, untimed, before the next one */
+		if(w->cold || w->op == op_initialize) {
+			finalize();
+		}
+	}
+	return 0;
+}
+
+static const struct workload *current;
+
+static void *thread_func(void *arg) {
+	(void)arg;
+	return (void *)(long)run_ops(current, iterations);
+}
+
+static int compare(const void *a, const void *b) {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static double percentile(double p) {
+	unsigned long i = (unsigned long)(p / 100 * nsamples + 0.5);
+
+	return samples[i > 0 ? i - 1 : 0];
+}
+
+static void report(const struct workload *w, unsigned long ops, unsigned long nallocs, int first) {
+	double sum = 0;
+	unsigned long i;
+
+	qsort(samples, nsamples, sizeof(double), compare);
+	for(i = 0; i < nsamples; i++) {
+		sum += samples[i];
+	}
+	printf("%s\n\t\t{ \"name\": \"%s\", \"ops\": %lu, \"threads\": %lu,", first ? "" : ",", w->name, ops, w->parallel ? threads : 1);
+	printf(" \"mean_us\": %.1f, \"min_us\": %.1f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, \"max_us\": %.1f,",
+		sum / nsamples, samples[0], percentile(50), percentile(90), percentile(99), samples[nsamples - 1]);
+	if(HAVE_ALLOC_COUNT) {
+		printf(" \"allocs_per_op\": %.1f,", (double)nallocs / ops);
+	} else {
+		printf(" \"allocs_per_op\": null,");
+	}
+	if(have_apdus) {
+		printf(" \"apdus_per_op\": %.1f }", (double)napdus / ops);
+	} else {
+		printf(" \"apdus_per_op\": null }");
+	}
+}
+
+int main(int argc, char **argv) {
+	pthread_t tids[MAX_THREADS];
+	unsigned long i, t, before, apdus_before;
+	const struct workload *w;
+	int first = 1, failed;
+	void *ret;
+	CK_RV rv;
+
+	if(argc > 1) {
+		iterations = strtoul(argv[1], NULL, 10);
+	}
+	if(argc > 2) {
+		threads = strtoul(argv[2], NULL, 10);
+	}
+	if(iterations == 0 || threads == 0 || threads > MAX_THREADS) {
+		fprintf(stderr, "Usage: bench_pkcs11 [iterations [threads (1-%d)]]\n", MAX_THREADS);
+		return 1;
+	}
+	pin = getenv("EID_BENCH_PIN");
+
+	/* Without a card, there's nothing to measure (this isn't a failure,
+	 * so that "make bench" works everywhere) */
+	if((rv = init()) != CKR_OK) {
+		fprintf(stderr, "bench_pkcs11: no card found (0x%lx), skipping\n", (unsigned long)rv);
+		C_Finalize(NULL_PTR);
+		return 0;
+	}
+	C_Finalize(NULL_PTR);
+
+	samples = malloc(iterations * MAX_THREADS * sizeof(double));
+	printf("{\n\t\"iterations\": %lu,\n\t\"results\": [", iterations);
+	for(i = 0; i < sizeof(workloads) / sizeof(workloads[0]); i++) {
+		w = &workloads[i];
+		if(w->needs_pin && pin == NULL) {
+			fprintf(stderr, "%s: skipped, EID_BENCH_PIN is not set\n", w->name);
+			continue;
+		}
+		fprintf(stderr, "%s...\n", w->name);
+		if(w->setup != NULL && !w->cold && (rv = w->setup()) != CKR_OK) {
+			fprintf(stderr, "%s: setup failed: 0x%lx\n", w->name, (unsigned long)rv);
+			C_Finalize(NULL_PTR);
+			continue;
+		}
+		/* one untimed run, so that cached workloads start warm */
+		nsamples = 0;
+		if(!w->cold && w->op != op_initialize && w->op() != CKR_OK) {
+			fprintf(stderr, "%s: failed\n", w->name);
+			C_Finalize(NULL_PTR);
+			continue;
+		}
+
+		nsamples = 0;
+		napdus = 0;
+		before = allocs;
+		failed = 0;
+		if(w->parallel) {
+			current = w;
+			apdus_before = apdus();
+			for(t = 0; t < threads; t++) {
+				pthread_create(&tids[t], NULL, thread_func, NULL);
+			}
+			for(t = 0; t < threads; t++) {
+				pthread_join(tids[t], &ret);
+				failed |= ret != NULL;
+			}
+			napdus = apdus() - apdus_before;
+		} else {
+			failed = run_ops(w, iterations);
+		}
+		if(!failed) {
+			report(w, nsamples, allocs - before, first);
+			first = 0;
+		}
+		if(!w->cold && w->teardown != NULL) {
+			w->teardown();
+		}
+	}
+	printf("\n\t]\n}\n");
+	free(samples);
+	return 0;
+}
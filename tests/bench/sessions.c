@@ -0,0 +1,115 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+/*
+ * Open/close/lookup rates of the session table, with 1 up to N threads.
+ * Every thread opens a session, looks it up LOOKUPS times (as every
+ * session based C_* call does) and closes it again.
+ *
+ * Usage: bench_sessions [max threads] [seconds per run]
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "beid_p11.h"
+#include "p11.h"
+#include "sessiontable.h"
+
+#define LOOKUPS 16
+
+static volatile int stop;
+
+struct result {
+	unsigned long opens;
+	unsigned long lookups;
+	unsigned long errors;
+};
+
+static void *bench_thread(void *arg) {
+	struct result *res = arg;
+	CK_SESSION_HANDLE h;
+	P11_SESSION *pSession;
+	int i;
+
+	while(!stop) {
+		if(p11_session_alloc(0, &h, &pSession) != CKR_OK) {
+			res->errors++;
+			continue;
+		}
+		for(i = 0; i < LOOKUPS; i++) {
+			if(p11_session_lookup(h) != pSession) {
+				res->errors++;
+			}
+		}
+		res->lookups += LOOKUPS;
+		p11_session_free(pSession);
+		/* a closed handle must never be found again */
+		if(p11_session_lookup(h) != NULL) {
+			res->errors++;
+		}
+		res->opens++;
+	}
+
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int max_threads = argc > 1 ? atoi(argv[1]) : 8;
+	int seconds = argc > 2 ? atoi(argv[2]) : 2;
+	int nthreads, i;
+	int rv = 0;
+
+	printf("%8s %16s %16s %8s\n", "threads", "open+close/s", "lookups/s", "errors");
+	for(nthreads = 1; nthreads <= max_threads; nthreads *= 2) {
+		pthread_t *threads = calloc(nthreads, sizeof(pthread_t));
+		struct result *res = calloc(nthreads, sizeof(struct result));
+		struct result total = { 0, 0, 0 };
+		struct timespec start, end;
+		double elapsed;
+
+		stop = 0;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(i = 0; i < nthreads; i++) {
+			pthread_create(&threads[i], NULL, bench_thread, &res[i]);
+		}
+		sleep(seconds);
+		stop = 1;
+		for(i = 0; i < nthreads; i++) {
+			pthread_join(threads[i], NULL);
+			total.opens += res[i].opens;
+			total.lookups += res[i].lookups;
+			total.errors += res[i].errors;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+		printf("%8d %16.0f %16.0f %8lu\n", nthreads, total.opens / elapsed, total.lookups / elapsed, total.errors);
+		if(total.errors) {
+			rv = 1;
+		}
+		free(threads);
+		free(res);
+	}
+
+	return rv;
+}
@@ -0,0 +1,161 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2008-2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+
+
+/*
+ * Multi-part signing through C_SignInit/C_SignUpdate/C_SignFinal, with a
+ * hashing (CKM_SHA256_RSA_PKCS) and a raw (CKM_RSA_PKCS) mechanism, fed
+ * in parts of different sizes. The card is replaced by the stubs below,
+ * so this measures the time spent in the module itself.
+ *
+ * Usage: bench_sign [seconds per run]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "beid_p11.h"
+#include "p11.h"
+#include "cal.h"
+#include "sessiontable.h"
+
+#define MODULUS_BITS 2048
+
+extern unsigned int nReaders;
+extern P11_SLOT gpSlot[MAX_SLOTS];
+
+/* the rest of the module, as far as signing needs it */
+unsigned char p11_get_init(void) { return BEIDP11_INITIALIZED; }
+void p11_lock_slot(CK_SLOT_ID slotID) { (void)slotID; }
+void p11_unlock_slot(CK_SLOT_ID slotID) { (void)slotID; }
+void memwash(char *p_in, unsigned int len) { memset(p_in, 0, len); }
+volatile unsigned int g_uiLogLevel = 0;
+void log_trace_write(const char *where, const char *string, ...) { (void)where; (void)string; }
+char *log_map_error(CK_RV err) { (void)err; return (char *)""; }
+CK_RV cal_init_objects(P11_SLOT *pSlot) { (void)pSlot; return CKR_OK; }
+CK_RV cal_disconnect(CK_SLOT_ID hSlot) { (void)hSlot; return CKR_OK; }
+CK_RV cal_logout(CK_SLOT_ID hSlot) { (void)hSlot; return CKR_OK; }
+CK_RV cal_validate_session(P11_SESSION *pSession) { (void)pSession; return CKR_OK; }
+
+CK_RV cal_get_mechanism_list(CK_SLOT_ID hSlot, CK_MECHANISM_TYPE_PTR pMechanismList, CK_ULONG_PTR pulCount) {
+	(void)hSlot;
+	if(pMechanismList != NULL) {
+		pMechanismList[0] = CKM_RSA_PKCS;
+		pMechanismList[1] = CKM_SHA256_RSA_PKCS;
+	}
+	*pulCount = 2;
+	return CKR_OK;
+}
+
+CK_RV cal_sign(CK_SLOT_ID hSlot, P11_SIGN_DATA *pSignData, unsigned char *in, unsigned long l_in, unsigned char *out, unsigned long *l_out) {
+	(void)hSlot;
+	memset(out, 0, pSignData->l_sign);
+	memcpy(out, in, l_in < pSignData->l_sign ? l_in : pSignData->l_sign);
+	*l_out = pSignData->l_sign;
+	return CKR_OK;
+}
+
+CK_RV cal_sign_batch(CK_SLOT_ID hSlot, P11_SIGN_DATA *pSignData, CK_BEID_SIGN_ITEM_PTR pItems, CK_ULONG ulCount) {
+	CK_ULONG i;
+
+	for(i = 0; i < ulCount; i++) {
+		if(pItems[i].rv != CKR_OK)
+			continue;
+		pItems[i].ulSignatureLen = pSignData->l_sign;
+		cal_sign(hSlot, pSignData, pItems[i].pDigest, pItems[i].ulDigestLen, pItems[i].pSignature, &pItems[i].ulSignatureLen);
+	}
+	return CKR_OK;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void run(CK_SESSION_HANDLE hSession, CK_OBJECT_HANDLE hKey, CK_MECHANISM_TYPE mech, const char *name, CK_ULONG total, CK_ULONG part, double secs) {
+	CK_MECHANISM mechanism = { mech, NULL, 0 };
+	static unsigned char data[1 << 20];
+	unsigned char sig[MODULUS_BITS / 8];
+	CK_ULONG sig_len, off;
+	unsigned long n = 0;
+	double start, end;
+
+	start = now();
+	do {
+		if(C_SignInit(hSession, &mechanism, hKey) != CKR_OK) {
+			printf("C_SignInit failed\n");
+			exit(1);
+		}
+		for(off = 0; off < total; off += part) {
+			if(C_SignUpdate(hSession, data + off, part) != CKR_OK) {
+				printf("C_SignUpdate failed\n");
+				exit(1);
+			}
+		}
+		sig_len = sizeof(sig);
+		if(C_SignFinal(hSession, sig, &sig_len) != CKR_OK) {
+			printf("C_SignFinal failed\n");
+			exit(1);
+		}
+		n++;
+		end = now();
+	} while(end - start < secs);
+
+	printf("%s\t%lu\t%lu\t%.1f\t%.2f\n", name, part, total / part, (end - start) * 1e6 / n, n * (double)total / (end - start) / 1e6);
+}
+
+int main(int argc, char **argv) {
+	CK_ATTRIBUTE PRV_KEY[] = BEID_TEMPLATE_PRV_KEY;
+	double secs = argc > 1 ? atof(argv[1]) : 1;
+	CK_KEY_TYPE keytype = CKK_RSA;
+	CK_BBOOL btrue = CK_TRUE;
+	CK_ULONG modsize = MODULUS_BITS;
+	CK_ULONG hKey, part;
+	CK_SESSION_HANDLE hSession;
+	P11_SESSION *pSession;
+	P11_OBJECT *pObject;
+
+	nReaders = 1;
+	gpSlot[0].ulCardDataCached = CACHED_DATA_TYPE_CDF;
+	if(p11_add_slot_object(&gpSlot[0], PRV_KEY, sizeof(PRV_KEY) / sizeof(CK_ATTRIBUTE), CK_TRUE, CKO_PRIVATE_KEY, 0, CK_TRUE, &hKey) != CKR_OK) {
+		printf("could not add the key\n");
+		return 1;
+	}
+	pObject = p11_get_slot_object(&gpSlot[0], hKey);
+	p11_set_object_value(pObject, CKA_KEY_TYPE, &keytype, sizeof(keytype));
+	p11_set_object_value(pObject, CKA_SIGN, &btrue, sizeof(btrue));
+	p11_set_object_value(pObject, CKA_MODULUS_BITS, &modsize, sizeof(modsize));
+	if(p11_session_alloc(0, &hSession, &pSession) != CKR_OK) {
+		printf("could not open a session\n");
+		return 1;
+	}
+
+	printf("mechanism\tpart size\tparts\tus/signature\tMB/s\n");
+	for(part = 1; part <= 4096; part *= 16) {
+		run(hSession, hKey, CKM_SHA256_RSA_PKCS, "CKM_SHA256_RSA_PKCS", 1 << 20, part, secs);
+	}
+	for(part = 1; part <= 256; part *= 4) {
+		run(hSession, hKey, CKM_RSA_PKCS, "CKM_RSA_PKCS", MODULUS_BITS / 8, part, secs);
+	}
+	return 0;
+}
@@ -0,0 +1,274 @@
+#!/usr/bin/env python3
+#
+# Generates a card image for the card emulator (configure
+# --enable-card-emulator): a BEID applet 1.7 card with the usual EF tree,
+# PKCS#15 files, identity files and two 2048-bit RSA keys whose
+# certificates match them.
+#
+# The keys are generated from a fixed seed, so running this again gives
+# the same image. They are test keys: never trust anything signed by them.
+#
+# Usage: mkimage.py [-l <msec per APDU>] [-b <usec per byte>] [-s <msec per signature>] > beid-v17.img
+
+import argparse
+import hashlib
+import random
+import sys
+
+rng = random.Random(20081402)
+
+PIN = "1234"
+
+
+# ---- RSA ----
+
+def is_probable_prime(n, rounds=40):
+	if n < 2:
+		return False
+	for p in (2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37):
+		if n % p == 0:
+			return n == p
+	d, s = n - 1, 0
+	while d % 2 == 0:
+		d //= 2
+		s += 1
+	for _ in range(rounds):
+		x = pow(rng.randrange(2, n - 1), d, n)
+		if x in (1, n - 1):
+			continue
+		for _ in range(s - 1):
+			x = pow(x, 2, n)
+			if x == n - 1:
+				break
+		else:
+			return False
+	return True
+
+
+def gen_prime(bits, e):
+	while True:
+		p = rng.getrandbits(bits) | (3 << (bits - 2)) | 1
+		if p % e != 1 and is_probable_prime(p):
+			return p
+
+
+def gen_rsa(bits=2048, e=65537):
+	while True:
+		p = gen_prime(bits // 2, e)
+		q = gen_prime(bits // 2, e)
+		n = p * q
+		if p != q and n.bit_length() == bits:
+			return {"n": n, "e": e, "d": pow(e, -1, (p - 1) * (q - 1)), "bits": bits}
+
+
+def i2b(x, length=None):
+	if length is None:
+		length = max(1, (x.bit_length() + 7) // 8)
+	return x.to_bytes(length, "big")
+
+
+SHA256_PREFIX = bytes.fromhex("3031300d060960864801650304020105000420")
+
+
+def rsa_sign_sha256(key, data):
+	k = key["bits"] // 8
+	t = SHA256_PREFIX + hashlib.sha256(data).digest()
+	em = b"\x00\x01" + b"\xff" * (k - len(t) - 3) + b"\x00" + t
+	return i2b(pow(int.from_bytes(em, "big"), key["d"], key["n"]), k)
+
+
+# ---- DER ----
+
+def der(tag, content):
+	n = len(content)
+	if n < 0x80:
+		length = bytes([n])
+	else:
+		lb = i2b(n)
+		length = bytes([0x80 | len(lb)]) + lb
+	return bytes([tag]) + length + content
+
+
+def seq(*items):
+	return der(0x30, b"".join(items))
+
+
+def integer(x):
+	b = i2b(x)
+	if b[0] & 0x80:
+		b = b"\x00" + b
+	return der(0x02, b)
+
+
+def octets(b):
+	return der(0x04, b)
+
+
+def utf8(s):
+	return der(0x0C, s.encode("utf-8"))
+
+
+def bits(b, unused=0):
+	return der(0x03, bytes([unused]) + b)
+
+
+def oid(s):
+	parts = [int(x) for x in s.split(".")]
+	out = bytes([40 * parts[0] + parts[1]])
+	for p in parts[2:]:
+		chunk = [p & 0x7F]
+		p >>= 7
+		while p:
+			chunk.insert(0, 0x80 | (p & 0x7F))
+			p >>= 7
+		out += bytes(chunk)
+	return der(0x06, out)
+
+
+def name(cn):
+	def rdn(o, tag, v):
+		return der(0x31, seq(oid(o), der(tag, v.encode())))
+	return seq(rdn("2.5.4.6", 0x13, "BE"), rdn("2.5.4.3", 0x0C, cn))
+
+
+SHA256_RSA = seq(oid("1.2.840.113549.1.1.11"), der(0x05, b""))
+
+
+def spki(key):
+	rsapub = seq(integer(key["n"]), integer(key["e"]))
+	return seq(seq(oid("1.2.840.113549.1.1.1"), der(0x05, b"")), bits(rsapub))
+
+
+def certificate(serial, subject, key, issuer, issuer_key, ca):
+	basic = seq(der(0x01, b"\xff")) if ca else seq()
+	ext = der(0xA3, seq(seq(oid("2.5.29.19"), der(0x01, b"\xff"), octets(basic))))
+	tbs = seq(der(0xA0, integer(2)), integer(serial), SHA256_RSA, name(issuer),
+		  seq(der(0x17, b"200101000000Z"), der(0x17, b"300101000000Z")),
+		  name(subject), spki(key), ext)
+	return seq(tbs, SHA256_RSA, bits(rsa_sign_sha256(issuer_key, tbs)))
+
+
+# ---- BEID TLV (identity and address files) ----
+
+def tlv(fields):
+	out = b""
+	for tag, value in fields:
+		if isinstance(value, str):
+			value = value.encode("utf-8")
+		n = len(value)
+		length = b""
+		while n >= 0xFF:
+			length += b"\xff"
+			n -= 0xFF
+		out += bytes([tag]) + length + bytes([n]) + value
+	return out
+
+
+# ---- a uniformly grey baseline JPEG ----
+
+def jpeg(width, height):
+	out = b"\xff\xd8"
+	out += b"\xff\xe0" + i2b(16, 2) + b"JFIF\x00\x01\x01\x00\x00\x01\x00\x01\x00\x00"
+	out += b"\xff\xdb" + i2b(67, 2) + b"\x00" + b"\x01" * 64
+	out += b"\xff\xc0" + i2b(11, 2) + b"\x08" + i2b(height, 2) + i2b(width, 2) + b"\x01\x01\x11\x00"
+	# one-symbol Huffman tables: DC difference category 0 and AC end-of-block
+	table = b"\x01" + b"\x00" * 15 + b"\x00"
+	out += b"\xff\xc4" + i2b(20, 2) + b"\x00" + table
+	out += b"\xff\xc4" + i2b(20, 2) + b"\x10" + table
+	out += b"\xff\xda" + i2b(8, 2) + b"\x01\x01\x00\x00\x3f\x00"
+	blocks = ((width + 7) // 8) * ((height + 7) // 8)
+	nbits = 2 * blocks
+	data = bytearray(b"\x00" * ((nbits + 7) // 8))
+	if nbits % 8:
+		data[-1] = (1 << (8 - nbits % 8)) - 1
+	return out + bytes(data) + b"\xff\xd9"
+
+
+def national_number(birth):
+	return birth + "%02d" % (97 - int("2" + birth) % 97)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Generate a BEID card image for the card emulator")
+	parser.add_argument("-l", "--latency", type=int, default=0, help="msec per APDU")
+	parser.add_argument("-b", "--byte-latency", type=int, default=0, help="usec per APDU byte")
+	parser.add_argument("-s", "--sign-latency", type=int, default=0, help="extra msec per signature")
+	args = parser.parse_args()
+
+	serial = bytes(range(0x10, 0x20))
+	root = gen_rsa()
+	ca = gen_rsa()
+	rrn = gen_rsa()
+	auth = gen_rsa()
+	sign = gen_rsa()
+
+	certs = {
+		"3F00DF005038": certificate(1, "Alice Specimen (Authentication)", auth, "Emulated Citizen CA", ca, False),
+		"3F00DF005039": certificate(2, "Alice Specimen (Signature)", sign, "Emulated Citizen CA", ca, False),
+		"3F00DF00503A": certificate(3, "Emulated Citizen CA", ca, "Emulated Root CA", root, True),
+		"3F00DF00503B": certificate(4, "Emulated Root CA", root, "Emulated Root CA", root, True),
+		"3F00DF00503C": certificate(5, "Emulated RRN", rrn, "Emulated Root CA", root, False),
+	}
+
+	photo = jpeg(140, 200)
+	idfile = tlv([(0, b"\x01"), (1, "591000000123"), (2, serial), (3, "01.01.2020"), (4, "01.01.2030"),
+		      (5, "Brussel"), (6, national_number("000101001")), (7, "Specimen"), (8, "Alice"),
+		      (9, "B"), (10, "Belg"), (11, "Brussel"), (12, "01 JAN 2000"), (13, "V"),
+		      (15, "1"), (16, "0"), (17, hashlib.sha1(photo).digest())])
+	idsig = rsa_sign_sha256(rrn, idfile)
+	address = tlv([(0, b"\x01"), (1, "Wetstraat 16"), (2, "1000"), (3, "Brussel")])
+	addrsig = rsa_sign_sha256(rrn, address + idsig)
+
+	belpic = "3F00DF00"
+	files = {
+		"3F002F00": der(0x61, der(0x4F, bytes.fromhex("A000000177504B43532D3135")) +
+				der(0x50, b"BELPIC") + der(0x51, bytes.fromhex(belpic))),
+		belpic + "5032": seq(integer(0), octets(serial), utf8("eID middleware"),
+				     der(0x80, b"BELPIC"), bits(b"\x01", 7)),
+		belpic + "5031": der(0xA0, seq(octets(bytes.fromhex(belpic + "5035")))) +
+				 der(0xA4, seq(octets(bytes.fromhex(belpic + "5037")))) +
+				 der(0xA8, seq(octets(bytes.fromhex(belpic + "5034")))),
+		belpic + "5034": seq(seq(utf8("Basic PIN"), bits(b"\xc0", 6)),
+				     seq(octets(b"\x01")),
+				     der(0xA1, seq(bits(b"\x30", 3), der(0x0A, b"\x00"), integer(4), integer(8),
+						   integer(12), der(0x80, b"\x01"), octets(b"\xff"),
+						   seq(octets(bytes.fromhex("3F00")))))),
+		belpic + "5035": b"".join(
+			seq(seq(utf8(label), bits(b"\x80", 7), octets(b"\x01"), *([integer(1)] if consent else [])),
+			    seq(octets(bytes([keyid])), bits(b"\x20", 5), bits(b"\xb8", 3), integer(keyref)),
+			    der(0xA1, seq(seq(octets(bytes.fromhex(belpic))), integer(2048))))
+			for label, keyid, keyref, consent in (("Authentication", 2, 0x82, False),
+							      ("Signature", 3, 0x83, True))),
+		belpic + "5037": b"".join(
+			seq(seq(utf8(label), bits(b"\x00", 7)),
+			    seq(octets(bytes([certid])), *([der(0x01, b"\xff")] if authority else [])),
+			    der(0xA1, seq(seq(octets(bytes.fromhex(path))))))
+			for label, certid, authority, path in (("Authentication", 2, False, belpic + "5038"),
+							       ("Signature", 3, False, belpic + "5039"),
+							       ("CA", 4, True, belpic + "503A"),
+							       ("Root", 6, True, belpic + "503B"))),
+		"3F00DF014031": idfile,
+		"3F00DF014032": idsig,
+		"3F00DF014033": address,
+		"3F00DF014034": addrsig,
+		"3F00DF014035": photo,
+	}
+	files.update(certs)
+
+	out = sys.stdout
+	out.write("# BEID applet 1.7 test card, generated by tests/emulator/mkimage.py\n")
+	out.write("# PIN: %s\n" % PIN)
+	out.write("reader Emulated BEID Reader 00 00\n")
+	out.write("atr 3B 98 13 40 0A A5 03 01 01 01 AD 13 11\n")
+	out.write("carddata %s A5 03 01 01 01 17 00 0A 01 01 01 0F\n" % serial.hex().upper())
+	out.write("latency %d\nbyte_latency %d\nsign_latency %d\n" % (args.latency, args.byte_latency, args.sign_latency))
+	out.write("pin 01 %s 3\n" % PIN)
+	for keyref, consent, key in ((0x82, 0, auth), (0x83, 1, sign)):
+		out.write("key %02X 01 %d %s %s\n" % (keyref, consent, i2b(key["n"]).hex().upper(),
+						       i2b(key["d"], key["bits"] // 8).hex().upper()))
+	for path in sorted(files):
+		out.write("file %s %s\n" % (path, files[path].hex().upper()))
+
+
+if __name__ == "__main__":
+	main()
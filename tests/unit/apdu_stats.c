@@ -0,0 +1,93 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <unix.h>
+#include <pkcs11.h>
+#include <beidpkcs11ext.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "testlib.h"
+
+static CK_BEID_APDU_STATS stats;
+
+/* Reads a certificate and checks that C_BEID_GetApduStats() saw the
+ * APDUs that took, and that resetting the counters works. */
+TEST_FUNC(apdu_stats) {
+	int ret;
+	CK_SESSION_HANDLE session;
+	CK_SLOT_ID slot;
+	CK_OBJECT_HANDLE object;
+	CK_OBJECT_CLASS type = CKO_CERTIFICATE;
+	CK_ATTRIBUTE attr = { CKA_CLASS, &type, sizeof(type) };
+	CK_BEID_FUNCTION_LIST_PTR ext;
+	CK_ULONG count, apdus, i;
+
+	check_rv(C_BEID_GetFunctionList(&ext));
+	verbose_assert(ext->version.minor >= 1);
+	verbose_assert(ext->C_BEID_GetApduStats == C_BEID_GetApduStats);
+
+	check_rv(C_Initialize(NULL_PTR));
+
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	if(!stats.bEnabled) {
+		fprintf(stderr, "APDU counters not enabled, set EID_APDU_STATS=1\n");
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_SKIP;
+	}
+
+	if((ret = find_slot(CK_TRUE, &slot)) != TEST_RV_OK) {
+		check_rv(C_Finalize(NULL_PTR));
+		return ret;
+	}
+
+	check_rv(C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session));
+	check_rv(C_FindObjectsInit(session, &attr, 1));
+	check_rv(C_FindObjects(session, &object, 1, &count));
+	verbose_assert(count == 1);
+	check_rv(C_FindObjectsFinal(session));
+
+	attr.type = CKA_VALUE;
+	attr.pValue = NULL_PTR;
+	attr.ulValueLen = 0;
+	check_rv(C_GetAttributeValue(session, object, &attr, 1));
+	verbose_assert(attr.ulValueLen > 0);
+
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	verbose_assert(stats.bEnabled == CK_TRUE);
+	verbose_assert(stats.ulApdus > 0);
+	verbose_assert(stats.ulBytesReceived >= attr.ulValueLen);
+	for(i = 0, apdus = 0; i < 256; i++) {
+		apdus += stats.ins[i].ulCount;
+	}
+	verbose_assert(apdus == stats.ulApdus);
+	/* READ BINARY */
+	verbose_assert(stats.ins[0xB0].ulCount > 0);
+	printf("%lu APDUs, %lu bytes received, %lu transactions\n", stats.ulApdus, stats.ulBytesReceived, stats.ulTransactions);
+
+	check_rv(C_BEID_GetApduStats(&stats, CK_FALSE));
+	verbose_assert(stats.ulApdus == 0);
+	verbose_assert(stats.ins[0xB0].ulCount == 0);
+
+	check_rv(C_CloseSession(session));
+	check_rv(C_Finalize(NULL_PTR));
+
+	return TEST_RV_OK;
+}
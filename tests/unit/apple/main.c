@@ -74,6 +74,10 @@ int main(int argc, char** argv) {
 	run_test(threads());
 	run_test(sign());
 	run_test(sign_state());
+	run_test(sign_batch());
+	run_test(apdu_stats());
+	run_test(pkcs15_cache());
+	run_test(lazy_objects());
 	run_test(decode_photo());
 	run_test(ordering());
 
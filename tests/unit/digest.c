@@ -29,7 +29,7 @@
 
 #include "testlib.h"
 
-CK_BYTE digest_results[4][512] = {
+CK_BYTE digest_results[7][512] = {
 	{
 		0x2c, 0x26, 0xb4, 0x6b,
 		0x68, 0xff, 0xc6, 0x8f,
@@ -79,13 +79,58 @@ CK_BYTE digest_results[4][512] = {
 		0x63, 0x7b, 0x79, 0x72,
 		0xa0, 0xad, 0x68, 0x73
 	},
+	{
+		0x76, 0xd3, 0xbc, 0x41,
+		0xc9, 0xf5, 0x88, 0xf7,
+		0xfc, 0xd0, 0xd5, 0xbf,
+		0x47, 0x18, 0xf8, 0xf8,
+		0x4b, 0x1c, 0x41, 0xb2,
+		0x08, 0x82, 0x70, 0x31,
+		0x00, 0xb9, 0xeb, 0x94,
+		0x13, 0x80, 0x7c, 0x01
+	},
+	{
+		0x66, 0x55, 0x51, 0x92,
+		0x8d, 0x13, 0xb7, 0xd8,
+		0x4e, 0xe0, 0x27, 0x34,
+		0x50, 0x2b, 0x01, 0x8d,
+		0x89, 0x6a, 0x0f, 0xb8,
+		0x7e, 0xed, 0x5a, 0xdb,
+		0x4c, 0x87, 0xba, 0x91,
+		0xbb, 0xd6, 0x48, 0x94,
+		0x10, 0xe1, 0x1b, 0x0f,
+		0xbc, 0xc0, 0x6e, 0xd7,
+		0xd0, 0xeb, 0xad, 0x55,
+		0x9e, 0x5d, 0x3b, 0xb5
+	},
+	{
+		0x4b, 0xca, 0x2b, 0x13,
+		0x7e, 0xdc, 0x58, 0x0f,
+		0xe5, 0x0a, 0x88, 0x98,
+		0x3e, 0xf8, 0x60, 0xeb,
+		0xac, 0xa3, 0x6c, 0x85,
+		0x7b, 0x1f, 0x49, 0x28,
+		0x39, 0xd6, 0xd7, 0x39,
+		0x24, 0x52, 0xa6, 0x3c,
+		0x82, 0xcb, 0xeb, 0xc6,
+		0x8e, 0x3b, 0x70, 0xa2,
+		0xa1, 0x48, 0x0b, 0x4b,
+		0xb5, 0xd4, 0x37, 0xa7,
+		0xcb, 0xa6, 0xec, 0xf9,
+		0xd8, 0x9f, 0x9f, 0xf3,
+		0xcc, 0xd1, 0x4c, 0xd6,
+		0x14, 0x6e, 0xa7, 0xe7
+	}
 };
 
-CK_MECHANISM_TYPE digest_mechs[4] = {
+CK_MECHANISM_TYPE digest_mechs[7] = {
 	CKM_SHA256,
 	CKM_SHA384,
 	CKM_SHA512,
 	CKM_RIPEMD160,
+	CKM_SHA3_256,
+	CKM_SHA3_384,
+	CKM_SHA3_512,
 };
 
 TEST_FUNC(digest) {
@@ -107,7 +152,7 @@ TEST_FUNC(digest) {
 
 	check_rv(C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session));
 
-	for(i=0; i<4; i++) {
+	for(i=0; i<7; i++) {
 		memset(&mech, 0, sizeof(mech));
 		mech.mechanism = digest_mechs[i];
 
@@ -0,0 +1,97 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <unix.h>
+#include <pkcs11.h>
+#include <beidpkcs11ext.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "testlib.h"
+
+/* Asks for the label, ID and class of the certificates and keys, which
+ * should not read anything from the card, and then for the value of a
+ * certificate, which should. */
+TEST_FUNC(lazy_objects) {
+	int ret;
+	CK_SESSION_HANDLE session;
+	CK_SLOT_ID slot;
+	CK_OBJECT_HANDLE objects[16];
+	CK_ULONG count, i;
+	CK_OBJECT_CLASS classes[] = { CKO_CERTIFICATE, CKO_PRIVATE_KEY, CKO_PUBLIC_KEY };
+	CK_OBJECT_CLASS type;
+	CK_ATTRIBUTE search = { CKA_CLASS, &type, sizeof(type) };
+	CK_BEID_APDU_STATS stats;
+	unsigned int c;
+
+	check_rv(C_Initialize(NULL_PTR));
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	if(!stats.bEnabled) {
+		fprintf(stderr, "APDU counters not enabled, set EID_APDU_STATS=1\n");
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_SKIP;
+	}
+	if((ret = find_slot(CK_TRUE, &slot)) != TEST_RV_OK) {
+		check_rv(C_Finalize(NULL_PTR));
+		return ret;
+	}
+	check_rv(C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session));
+
+	for(c = 0; c < sizeof(classes) / sizeof(classes[0]); c++) {
+		type = classes[c];
+		check_rv(C_FindObjectsInit(session, &search, 1));
+		check_rv(C_FindObjects(session, objects, 16, &count));
+		check_rv(C_FindObjectsFinal(session));
+		verbose_assert(count > 0);
+
+		check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+		for(i = 0; i < count; i++) {
+			CK_ATTRIBUTE attr[] = {
+				{ CKA_LABEL, NULL_PTR, 0 },
+				{ CKA_ID, NULL_PTR, 0 },
+				{ CKA_CLASS, NULL_PTR, 0 },
+			};
+			check_rv(C_GetAttributeValue(session, objects[i], attr, 3));
+			verbose_assert(attr[0].ulValueLen > 0);
+		}
+		check_rv(C_BEID_GetApduStats(&stats, CK_FALSE));
+		verbose_assert(stats.calls[CK_BEID_CALL_READ_OBJECT].ulCount == 0);
+		verbose_assert(stats.ulApdus == 0);
+	}
+
+	type = CKO_CERTIFICATE;
+	check_rv(C_FindObjectsInit(session, &search, 1));
+	check_rv(C_FindObjects(session, objects, 16, &count));
+	check_rv(C_FindObjectsFinal(session));
+
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	{
+		CK_ATTRIBUTE attr = { CKA_VALUE, NULL_PTR, 0 };
+		check_rv(C_GetAttributeValue(session, objects[0], &attr, 1));
+		verbose_assert(attr.ulValueLen > 0);
+	}
+	check_rv(C_BEID_GetApduStats(&stats, CK_FALSE));
+	verbose_assert(stats.calls[CK_BEID_CALL_READ_OBJECT].ulCount == 1);
+
+	check_rv(C_CloseSession(session));
+	check_rv(C_Finalize(NULL_PTR));
+
+	return TEST_RV_OK;
+}
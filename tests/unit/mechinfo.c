@@ -63,12 +63,12 @@ TEST_FUNC(mechinfo) {
 	check_rv_long(C_GetMechanismInfo(slot, 0xdeadbeef, &info), m_mech_inv);
 
 	switch(count) {
-		case 8:
-		case 13:
+		case 11:
+		case 16:
 			printf("Found 1K card\n");
 			break;
-		case 10:
-		case 15:
+		case 13:
+		case 18:
 			printf("Found 2K card\n");
 			card_2k = 1;
 			break;
@@ -94,7 +94,7 @@ TEST_FUNC(mechinfo) {
 		verbose_assert(info.ulMaxKeySize != 0xdeadbeef);
 		verbose_assert(info.flags != 0xdeadbeef);
 
-		if(mechlist[i] != CKM_SHA1_RSA_PKCS_PSS && mechlist[i] != CKM_SHA256_RSA_PKCS_PSS && mechlist[i] != CKM_ECDSA_SHA256 && mechlist[i] != CKM_ECDSA_SHA384 && mechlist[i] != CKM_ECDSA_SHA512 && mechlist[i] != CKM_ECDSA) {
+		if(mechlist[i] != CKM_SHA1_RSA_PKCS_PSS && mechlist[i] != CKM_SHA256_RSA_PKCS_PSS && mechlist[i] != CKM_ECDSA_SHA256 && mechlist[i] != CKM_ECDSA_SHA384 && mechlist[i] != CKM_ECDSA_SHA512 && mechlist[i] != CKM_ECDSA_SHA3_256 && mechlist[i] != CKM_ECDSA_SHA3_384 && mechlist[i] != CKM_ECDSA_SHA3_512 && mechlist[i] != CKM_ECDSA) {
 			verbose_assert(info.ulMinKeySize == info.ulMaxKeySize);
 		}
 		if(mechlist[i] == CKM_RSA_PKCS) {
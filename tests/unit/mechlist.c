@@ -85,6 +85,9 @@ TEST_FUNC(mechlist) {
 		HAS_CKM(CKM_SHA256, 0, 0);
 		HAS_CKM(CKM_SHA384, 0, 0);
 		HAS_CKM(CKM_SHA512, 0, 0);
+		HAS_CKM(CKM_SHA3_256, 0, 0);
+		HAS_CKM(CKM_SHA3_384, 0, 0);
+		HAS_CKM(CKM_SHA3_512, 0, 0);
 		HAS_CKM(CKM_RIPEMD160_RSA_PKCS, 1, 0);
 		HAS_CKM(CKM_MD5_RSA_PKCS, 1, 0);
 		HAS_CKM(CKM_SHA1_RSA_PKCS, 1, 0);
@@ -98,6 +101,9 @@ TEST_FUNC(mechlist) {
 		HAS_CKM(CKM_ECDSA_SHA256, 0, 1);
 		HAS_CKM(CKM_ECDSA_SHA384, 0, 1);
 		HAS_CKM(CKM_ECDSA_SHA512, 0, 1);
+		HAS_CKM(CKM_ECDSA_SHA3_256, 0, 1);
+		HAS_CKM(CKM_ECDSA_SHA3_384, 0, 1);
+		HAS_CKM(CKM_ECDSA_SHA3_512, 0, 1);
 		case 0xdeadbeef:
 			printf("E: found uninitialized data\n");
 			retval = TEST_RV_FAIL;
@@ -126,7 +132,7 @@ TEST_FUNC(mechlist) {
 	}
 
 	verbose_assert(count == known_mechs);
-	verbose_assert(rsa_mechs == 8 || ecdsa_mechs == 4);
+	verbose_assert(rsa_mechs == 8 || ecdsa_mechs == 7);
 
 	check_rv_long(C_GetMechanismList(slot+30, mechlist, &count), m_p11_badslot);
 
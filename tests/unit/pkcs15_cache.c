@@ -0,0 +1,88 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <unix.h>
+#include <pkcs11.h>
+#include <beidpkcs11ext.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "testlib.h"
+
+static CK_BEID_APDU_STATS stats;
+
+static int count_keys(CK_ULONG_PTR count) {
+	int ret;
+	CK_SESSION_HANDLE session;
+	CK_SLOT_ID slot;
+	CK_OBJECT_HANDLE objects[8];
+	CK_OBJECT_CLASS type = CKO_PRIVATE_KEY;
+	CK_ATTRIBUTE attr = { CKA_CLASS, &type, sizeof(type) };
+
+	if((ret = find_slot(CK_TRUE, &slot)) != TEST_RV_OK) {
+		return ret;
+	}
+
+	check_rv(C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session));
+	check_rv(C_FindObjectsInit(session, &attr, 1));
+	check_rv(C_FindObjects(session, objects, 8, count));
+	check_rv(C_FindObjectsFinal(session));
+	check_rv(C_CloseSession(session));
+
+	return TEST_RV_OK;
+}
+
+/* Finds the keys on the card twice, with a C_Finalize() in between. The
+ * second time, the PKCS#15 structure of the card should come from the
+ * cache, so that the keys are found without reading the card's PKCS#15
+ * files again. */
+TEST_FUNC(pkcs15_cache) {
+	int ret;
+	CK_ULONG first, second;
+
+	check_rv(C_Initialize(NULL_PTR));
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	if(!stats.bEnabled) {
+		fprintf(stderr, "APDU counters not enabled, set EID_APDU_STATS=1\n");
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_SKIP;
+	}
+	if((ret = count_keys(&first)) != TEST_RV_OK) {
+		check_rv(C_Finalize(NULL_PTR));
+		return ret;
+	}
+	check_rv(C_Finalize(NULL_PTR));
+
+	check_rv(C_Initialize(NULL_PTR));
+	check_rv(C_BEID_GetApduStats(&stats, CK_TRUE));
+	if((ret = count_keys(&second)) != TEST_RV_OK) {
+		check_rv(C_Finalize(NULL_PTR));
+		return ret;
+	}
+	check_rv(C_BEID_GetApduStats(&stats, CK_FALSE));
+	check_rv(C_Finalize(NULL_PTR));
+
+	verbose_assert(first > 0);
+	verbose_assert(second == first);
+	verbose_assert(stats.calls[CK_BEID_CALL_INIT_OBJECTS].ulCount > 0);
+	verbose_assert(stats.calls[CK_BEID_CALL_INIT_OBJECTS].ulApdus == 0);
+
+	return TEST_RV_OK;
+}
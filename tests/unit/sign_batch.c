@@ -0,0 +1,179 @@
+/* ****************************************************************************
+
+ * eID Middleware Project.
+ * Copyright (C) 2014 FedICT.
+ *
+ * This is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License version
+ * 3.0 as published by the Free Software Foundation.
+ *
+ * This software is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this software; if not, see
+ * http://www.gnu.org/licenses/.
+
+**************************************************************************** */
+#include <unix.h>
+#include <pkcs11.h>
+#include <beidpkcs11ext.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "testlib.h"
+
+#define BATCH_SIZE 16
+
+/* DER prefix of a SHA-256 DigestInfo, to sign the same thing with
+ * CKM_RSA_PKCS as CKM_SHA256_RSA_PKCS signs for a digest */
+static const CK_BYTE sha256_prefix[] = {
+	0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+	0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20
+};
+
+static long elapsed_ms(struct timespec* start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Signs BATCH_SIZE digests with C_BEID_SignBatch() and then one by one
+ * with C_SignInit()/C_Sign(), checks that both give the same signatures
+ * and reports how many signatures per second each managed. */
+TEST_FUNC(sign_batch) {
+	int ret;
+	CK_SESSION_HANDLE session;
+	CK_SLOT_ID slot;
+	CK_ATTRIBUTE attr[2];
+	CK_MECHANISM mech = { CKM_SHA256_RSA_PKCS, NULL_PTR, 0 };
+	CK_MECHANISM rawmech = { CKM_RSA_PKCS, NULL_PTR, 0 };
+	CK_BEID_FUNCTION_LIST_PTR ext;
+	CK_BEID_SIGN_ITEM items[BATCH_SIZE];
+	CK_BYTE digests[BATCH_SIZE][32];
+	CK_BYTE tosign[sizeof(sha256_prefix) + 32];
+	CK_BYTE_PTR sig;
+	CK_ULONG type, keytype, count, sig_len, i;
+	CK_OBJECT_HANDLE privatekey;
+	char* label = "Authentication";
+	struct timespec start;
+	long batch_ms, loop_ms;
+	ckrv_mod m_finished[] = {
+		{ CKR_OK, TEST_RV_FAIL },
+		{ CKR_OPERATION_NOT_INITIALIZED, TEST_RV_OK },
+	};
+
+	if(!have_pin()) {
+		fprintf(stderr, "Cannot test signature without a pin code\n");
+		return TEST_RV_SKIP;
+	}
+
+	check_rv(C_Initialize(NULL_PTR));
+
+	check_rv(C_BEID_GetFunctionList(&ext));
+	verbose_assert(ext->version.major == CK_BEID_EXT_VERSION_MAJOR);
+	verbose_assert(ext->C_BEID_SignBatch == C_BEID_SignBatch);
+
+	if((ret = find_slot(CK_TRUE, &slot)) != TEST_RV_OK) {
+		check_rv(C_Finalize(NULL_PTR));
+		return ret;
+	}
+
+	check_rv(C_OpenSession(slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session));
+
+	if(!can_enter_pin(slot)) {
+		return TEST_RV_SKIP;
+	}
+
+	attr[0].type = CKA_CLASS;
+	attr[0].pValue = &type;
+	type = CKO_PRIVATE_KEY;
+	attr[0].ulValueLen = sizeof(CK_ULONG);
+
+	attr[1].type = CKA_LABEL;
+	attr[1].pValue = label;
+	attr[1].ulValueLen = strlen(label);
+
+	check_rv(C_FindObjectsInit(session, attr, 2));
+	check_rv(C_FindObjects(session, &privatekey, 1, &count));
+	verbose_assert(count == 1 || count == 0);
+	check_rv(C_FindObjectsFinal(session));
+
+	if(count == 0) {
+		fprintf(stderr, "Cannot test batch signatures on a card without an \"%s\" key\n", label);
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_SKIP;
+	}
+
+	attr[0].type = CKA_KEY_TYPE;
+	attr[0].pValue = &keytype;
+	attr[0].ulValueLen = sizeof(CK_ULONG);
+	check_rv(C_GetAttributeValue(session, privatekey, attr, 1));
+	if(keytype != CKK_RSA) {
+		fprintf(stderr, "Cannot compare batch signatures with CKM_RSA_PKCS ones on a card without RSA keys\n");
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_SKIP;
+	}
+
+	for(i = 0; i < BATCH_SIZE; i++) {
+		memset(digests[i], (int) i, sizeof(digests[i]));
+		items[i].pDigest = digests[i];
+		items[i].ulDigestLen = sizeof(digests[i]);
+		items[i].pSignature = NULL_PTR;
+		items[i].ulSignatureLen = 0;
+		items[i].rv = CKR_GENERAL_ERROR;
+	}
+
+	/* The length query leaves the operation active */
+	check_rv(C_SignInit(session, &mech, privatekey));
+	check_rv(C_BEID_SignBatch(session, items, BATCH_SIZE));
+	sig_len = items[0].ulSignatureLen;
+	verbose_assert(sig_len > 0);
+	for(i = 0; i < BATCH_SIZE; i++) {
+		items[i].pSignature = malloc(sig_len);
+		items[i].ulSignatureLen = sig_len;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	check_rv(C_BEID_SignBatch(session, items, BATCH_SIZE));
+	batch_ms = elapsed_ms(&start);
+
+	/* ... and the signing finishes it */
+	check_rv_long(C_BEID_SignBatch(session, items, BATCH_SIZE), m_finished);
+
+	for(i = 0; i < BATCH_SIZE; i++) {
+		verbose_assert(items[i].rv == CKR_OK);
+		verbose_assert(items[i].ulSignatureLen == sig_len);
+	}
+
+	sig = malloc(sig_len);
+	memcpy(tosign, sha256_prefix, sizeof(sha256_prefix));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < BATCH_SIZE; i++) {
+		memcpy(tosign + sizeof(sha256_prefix), digests[i], sizeof(digests[i]));
+		count = sig_len;
+		check_rv(C_SignInit(session, &rawmech, privatekey));
+		check_rv(C_Sign(session, tosign, sizeof(tosign), sig, &count));
+		verbose_assert(count == sig_len);
+		verbose_assert(memcmp(sig, items[i].pSignature, sig_len) == 0);
+	}
+	loop_ms = elapsed_ms(&start);
+
+	printf("%d signatures: C_BEID_SignBatch %ld ms (%.1f/s), C_SignInit/C_Sign %ld ms (%.1f/s)\n",
+		BATCH_SIZE, batch_ms, batch_ms ? BATCH_SIZE * 1000.0 / batch_ms : 0.0,
+		loop_ms, loop_ms ? BATCH_SIZE * 1000.0 / loop_ms : 0.0);
+
+	for(i = 0; i < BATCH_SIZE; i++) {
+		free(items[i].pSignature);
+	}
+	free(sig);
+
+	check_rv(C_Finalize(NULL_PTR));
+
+	return TEST_RV_OK;
+}
@@ -332,6 +332,9 @@ char* ckm_to_charp(CK_MECHANISM_TYPE mech) {
 		CKM_PRINT(CKM_SHA256);
 		CKM_PRINT(CKM_SHA384);
 		CKM_PRINT(CKM_SHA512);
+		CKM_PRINT(CKM_SHA3_256);
+		CKM_PRINT(CKM_SHA3_384);
+		CKM_PRINT(CKM_SHA3_512);
 		CKM_PRINT(CKM_RIPEMD160_RSA_PKCS);
 		CKM_PRINT(CKM_MD5_RSA_PKCS);
 		CKM_PRINT(CKM_SHA1_RSA_PKCS);
@@ -343,6 +346,9 @@ char* ckm_to_charp(CK_MECHANISM_TYPE mech) {
 		CKM_PRINT(CKM_ECDSA_SHA256);
 		CKM_PRINT(CKM_ECDSA_SHA384);
 		CKM_PRINT(CKM_ECDSA_SHA512);
+		CKM_PRINT(CKM_ECDSA_SHA3_256);
+		CKM_PRINT(CKM_ECDSA_SHA3_384);
+		CKM_PRINT(CKM_ECDSA_SHA3_512);
 		CKM_PRINT(CKM_ECDSA);
 		default:
 			return "Unknown mechanism";
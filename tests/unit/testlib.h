@@ -4,6 +4,18 @@
 #include <assert.h>
 #include <stdio.h>
 
+/* PKCS#11 v3.0 mechanisms, not in the v2.40 headers we build against */
+#ifndef CKM_SHA3_256
+#define CKM_SHA3_256 0x000002B0UL
+#define CKM_SHA3_384 0x000002C0UL
+#define CKM_SHA3_512 0x000002D0UL
+#endif
+#ifndef CKM_ECDSA_SHA3_256
+#define CKM_ECDSA_SHA3_256 0x00001048UL
+#define CKM_ECDSA_SHA3_384 0x00001049UL
+#define CKM_ECDSA_SHA3_512 0x0000104AUL
+#endif
+
 #define TEST_RV_SKIP 77		// defined by automake
 #define TEST_RV_FAIL 1
 #define TEST_RV_OK 0
@@ -118,6 +130,10 @@ int digest();
 int threads();
 int sign();
 int sign_state();
+int sign_batch();
+int apdu_stats();
+int pkcs15_cache();
+int lazy_objects();
 int decode_photo();
 int ordering();
 int wrong_init();
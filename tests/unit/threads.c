@@ -4,6 +4,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <time.h>
 
 #include "testlib.h"
 
@@ -123,6 +124,131 @@ void* thread_func(void* v EIDT_UNUSED) {
 	return NULL;
 }
 
+/* What read_certificates() found on one card */
+struct cert_summary {
+	CK_SLOT_ID slot;
+	CK_ULONG count;
+	CK_ULONG length;
+	CK_ULONG checksum;
+	CK_RV rv;
+};
+
+/* Read the value of all certificates on the card in the given slot */
+static CK_RV read_certificates(struct cert_summary* sum) {
+	CK_SESSION_HANDLE session;
+	CK_OBJECT_HANDLE object;
+	CK_ULONG count = 0;
+	CK_ULONG type = CKO_CERTIFICATE;
+	CK_ATTRIBUTE attr = { CKA_CLASS, &type, sizeof(CK_ULONG) };
+	CK_RV rv;
+
+	sum->count = sum->length = sum->checksum = 0;
+	if((rv = C_OpenSession(sum->slot, CKF_SERIAL_SESSION, NULL_PTR, NULL_PTR, &session)) != CKR_OK) {
+		return rv;
+	}
+	if((rv = C_FindObjectsInit(session, &attr, 1)) != CKR_OK) {
+		C_CloseSession(session);
+		return rv;
+	}
+	do {
+		CK_ATTRIBUTE value = { CKA_VALUE, NULL_PTR, 0 };
+		CK_ULONG i;
+
+		if((rv = C_FindObjects(session, &object, 1, &count)) != CKR_OK || !count) {
+			break;
+		}
+		if((rv = C_GetAttributeValue(session, object, &value, 1)) != CKR_OK) {
+			break;
+		}
+		value.pValue = malloc(value.ulValueLen);
+		if((rv = C_GetAttributeValue(session, object, &value, 1)) == CKR_OK) {
+			sum->count++;
+			sum->length += value.ulValueLen;
+			for(i = 0; i < value.ulValueLen; i++) {
+				sum->checksum = sum->checksum * 31 + ((CK_BYTE_PTR) value.pValue)[i];
+			}
+		}
+		free(value.pValue);
+	} while(rv == CKR_OK);
+	C_FindObjectsFinal(session);
+	C_CloseSession(session);
+
+	return rv;
+}
+
+static void* read_thread_func(void* v) {
+	struct cert_summary* sum = v;
+
+	sum->rv = read_certificates(sum);
+	return NULL;
+}
+
+static long elapsed_ms(struct timespec* start) {
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000 + (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Read N cards from N threads at once: every slot has its own lock and
+ * every reader its own PC/SC context, so this should take about as long as
+ * reading one card. Every thread must read the same as a sequential run,
+ * and clearly faster; the bound is loose, as the times depend a lot on the
+ * machine and the readers. */
+static int scaling_test(CK_C_INITIALIZE_ARGS_PTR args) {
+	CK_SLOT_ID list[16];
+	CK_ULONG count = sizeof(list) / sizeof(list[0]);
+	struct cert_summary seq[16], par[16];
+	pthread_t threads[16];
+	struct timespec start;
+	long seq_ms, par_ms;
+	CK_ULONG i;
+
+	/* Sequential: one slot after the other */
+	check_rv(C_Initialize(args));
+	check_rv(C_GetSlotList(CK_TRUE, list, &count));
+	if(count < 2) {
+		printf("INFO: need at least two cards to read them in parallel, skipping that part\n");
+		check_rv(C_Finalize(NULL_PTR));
+		return TEST_RV_OK;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++) {
+		seq[i].slot = list[i];
+		check_rv(read_certificates(&seq[i]));
+	}
+	seq_ms = elapsed_ms(&start);
+	check_rv(C_Finalize(NULL_PTR));
+
+	/* Parallel: one thread per slot (start again, so nothing is cached) */
+	check_rv(C_Initialize(args));
+	check_rv(C_GetSlotList(CK_TRUE, list, &count));
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(i = 0; i < count; i++) {
+		par[i].slot = list[i];
+		pthread_create(&threads[i], NULL, read_thread_func, &par[i]);
+	}
+	for(i = 0; i < count; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	par_ms = elapsed_ms(&start);
+	check_rv(C_Finalize(NULL_PTR));
+
+	printf("INFO: %lu readers: sequential %ld ms, parallel %ld ms\n", count, seq_ms, par_ms);
+	for(i = 0; i < count; i++) {
+		check_rv(par[i].rv);
+		verbose_assert(par[i].slot == seq[i].slot);
+		verbose_assert(par[i].count > 0);
+		verbose_assert(par[i].count == seq[i].count);
+		verbose_assert(par[i].length == seq[i].length);
+		verbose_assert(par[i].checksum == seq[i].checksum);
+	}
+	/* Serialized, both runs take the same time */
+	verbose_assert(par_ms * 10 < seq_ms * 9);
+
+	return TEST_RV_OK;
+}
+
 TEST_FUNC(threads) {
 	CK_C_INITIALIZE_ARGS args_os = {
 		.flags = CKF_OS_LOCKING_OK,
@@ -182,5 +308,15 @@ TEST_FUNC(threads) {
 	verbose_assert(create_count != 0 && destroy_count != 0 && lock_count != 0 && unlock_count != 0);
 	verbose_assert(create_count == destroy_count);
 	verbose_assert(lock_count == unlock_count);
+
+	if((ret = scaling_test(&args_os)) != TEST_RV_OK) {
+		return (int)ret;
+	}
+	if((ret = scaling_test(&args_man)) != TEST_RV_OK) {
+		return (int)ret;
+	}
+	verbose_assert(create_count == destroy_count);
+	verbose_assert(lock_count == unlock_count);
+
 	return TEST_RV_OK;
 }